@@ -21,11 +21,16 @@ extern int afpAppReturnValue;
 afpConfigApplication::afpConfigApplication()
 :
 	BApplication(ApplicationSignature),
-	iMainWindow(NULL)
+	iMainWindow(NULL),
+	iLastSnapshot(0)
 {
 	int result;
 	
-	SetPulseRate(1000000);
+	//
+	//Stats are pushed to us by the server, the pulse only watches
+	//for them to stop.
+	//
+	SetPulseRate(STATS_STALE_TIME);
 	
 	//
 	//Check to see if the server is running. If not, ask the user if
@@ -113,6 +118,8 @@ afpConfigApplication::afpConfigApplication()
 
 afpConfigApplication::~afpConfigApplication()
 {
+	AFPSubscribeStats(be_app_messenger, 0);
+	
 	if (iMainWindow != NULL)
 	{
 		//
@@ -138,19 +145,30 @@ afpConfigApplication::~afpConfigApplication()
 
 void afpConfigApplication::ReadyToRun()
 {
+	iLastSnapshot = system_time();
+	
+	AFPSubscribeStats(be_app_messenger, STATS_PUSH_INTERVAL);
 }
 
 /*
  * Pulse()
  *
  * Description:
+ *		If the snapshots have stopped coming, the server is down or
+ *		was restarted and has forgotten us, so try subscribing again.
  *
  * Returns:
  */
 
 void afpConfigApplication::Pulse()
 {
-	iMainWindow->UpdateThroughput();
+	if ((iMainWindow == NULL) || (system_time() - iLastSnapshot < STATS_STALE_TIME)) {
+		return;
+	}
+	
+	iMainWindow->UpdateThroughput(NULL);
+	
+	AFPSubscribeStats(be_app_messenger, STATS_PUSH_INTERVAL);
 }
 
 
@@ -170,6 +188,14 @@ void afpConfigApplication::MessageReceived(BMessage * Message)
 			iMainWindow->PopulateUserList();
 			break;
 			
+		case CMD_AFP_STATSSNAPSHOT:
+			iLastSnapshot = system_time();
+			
+			if (iMainWindow != NULL) {
+				iMainWindow->UpdateThroughput(Message);
+			}
+			break;
+			
 		default:
 			BApplication::MessageReceived(Message);
 			break;
@@ -6,6 +6,13 @@
 #include <Application.h>
 #include "afpMainWindow.h"
 
+//
+//How often the server pushes us stats, and how long we go without
+//one before calling the server down and subscribing again.
+//
+#define STATS_PUSH_INTERVAL		1000		//msecs
+#define STATS_STALE_TIME		3000000		//usecs
+
 class afpConfigApplication : public BApplication
 {
 public:
@@ -19,6 +26,7 @@ public:
 	
 private:
 	afpMainWindow 	*iMainWindow;
+	bigtime_t		iLastSnapshot;
 };
 	
 #endif //__afpServerApplication__
@@ -1031,6 +1031,34 @@ int AFPGetUsersLoggedOn(
 }
 
 
+/*
+ * AFPSubscribeStats()
+ *
+ * Description:
+ *		Asks the server to push a CMD_AFP_STATSSNAPSHOT to target every
+ *		interval msecs, or to stop if interval is 0.
+ *
+ * Returns:
+ *		B_OK if successfull, otherwise error code
+ */
+
+int AFPSubscribeStats(
+	BMessenger	target,
+	int32		interval
+)
+{
+	BMessenger	messenger(AFPServerSignature);
+	BMessage 	message(CMD_AFP_SUBSCRIBESTATS);
+	
+	message.AddMessenger(AFP_PARAM_MESSENGER, target);
+	message.AddInt32(AFP_PARAM_INT32, interval);
+	
+	messenger.SendMessage(&message, &message);
+	
+	return((message.what == be_afp_success) ? B_OK : message.what);
+}
+
+
 /*
  * AFPServerIsRunning()
  *
@@ -122,6 +122,11 @@ int AFPGetUsersLoggedOn(
 	int32* usersLoggedOn
 );
 
+int AFPSubscribeStats(
+	BMessenger	target,
+	int32		interval
+);
+
 uint32 AFPGetServerVersion();
 bool AFPGetServerVersionString(char* vers, int16 cbString);
 
@@ -222,6 +222,26 @@ void afpMainWindow::BuildWindow(void)
 	mReadOnlyBox->SetFontSize(general_font_size);
 	bbox->AddChild(mReadOnlyBox);
 	
+	//
+	//Coalescing small writes helps older clients copying to the
+	//volume, at the cost of data sitting in memory for up to a second.
+	//
+	rect.Set(105, 180, 188, 180+15);
+	mWriteBehindBox = new BCheckBox(rect, "wb", "Write Behind", new BMessage(CMD_APP_WBCHECKBOX));
+	mWriteBehindBox->SetViewColor(ui_color(B_PANEL_BACKGROUND_COLOR));
+	mWriteBehindBox->SetFontSize(general_font_size);
+	bbox->AddChild(mWriteBehindBox);
+	
+	//
+	//Files on volumes that are written locally all the time gain
+	//nothing from the server's block cache.
+	//
+	rect.Set(190, 180, 290, 180+15);
+	mNoCacheBox = new BCheckBox(rect, "nocache", "No Block Cache", new BMessage(CMD_APP_NOCACHECHECKBOX));
+	mNoCacheBox->SetViewColor(ui_color(B_PANEL_BACKGROUND_COLOR));
+	mNoCacheBox->SetFontSize(general_font_size);
+	bbox->AddChild(mNoCacheBox);
+	
 	//
 	//Populate the volume list so the user sees what's currently shared.
 	//
@@ -528,7 +548,15 @@ void afpMainWindow::MessageReceived(BMessage * Message)
 			break;
 			
 		case CMD_APP_ROCHECKBOX:
-			SaveReadOnlyState();
+			SaveVolumeFlag(0x02, mReadOnlyBox->Value() != 0);
+			break;
+			
+		case CMD_APP_WBCHECKBOX:
+			SaveVolumeFlag(0x04, mWriteBehindBox->Value() != 0);
+			break;
+			
+		case CMD_APP_NOCACHECHECKBOX:
+			SaveVolumeFlag(0x08, mNoCacheBox->Value() != 0);
 			break;
 			
 		case CMD_AFP_USERLISTCHANGED:
@@ -614,15 +642,17 @@ void afpMainWindow::PopulateVolumeList()
 
 
 /*
- * SaveReadOnlyState()
+ * SaveVolumeFlag()
  *
  * Description:
- *	Save the read only state for the selected volume to the pref file.
+ *	Set or clear one of the flags of the selected volume (0x02 read
+ *	only, 0x04 write behind, 0x08 no block cache) and save it to the
+ *	pref file.
  *
  * Returns:
  */
 
-void afpMainWindow::SaveReadOnlyState()
+void afpMainWindow::SaveVolumeFlag(uint32 flag, bool set)
 {
 	uint32		volFlags	= 0;
 	int32		index		= 0;
@@ -636,13 +666,13 @@ void afpMainWindow::SaveReadOnlyState()
 		
 	if (AFPGetVolumeFlagsFromIndex(index, &volFlags) == B_OK)
 	{
-		if (mReadOnlyBox->Value() == 0)
+		if (set)
 		{
-			volFlags &= ~0x02;
+			volFlags |= flag;
 		}
 		else
 		{
-			volFlags |= 0x02;
+			volFlags &= ~flag;
 		}
 		
 		if (AFPSaveVolumeFlags(index, volFlags) != B_OK)
@@ -677,11 +707,17 @@ void afpMainWindow::SetControlsState()
 	{
 		mReadOnlyBox->SetValue(0);
 		mReadOnlyBox->SetEnabled(false);
+		mWriteBehindBox->SetValue(0);
+		mWriteBehindBox->SetEnabled(false);
+		mNoCacheBox->SetValue(0);
+		mNoCacheBox->SetEnabled(false);
 		mRemoveButton->SetEnabled(false);
 	}
 	else
 	{
 		mReadOnlyBox->SetEnabled(true);
+		mWriteBehindBox->SetEnabled(true);
+		mNoCacheBox->SetEnabled(true);
 		mRemoveButton->SetEnabled(true);
 		
 		if (AFPGetVolumeFlagsFromIndex(index, &volFlags) == B_OK)
@@ -694,6 +730,9 @@ void afpMainWindow::SetControlsState()
 			{
 				mReadOnlyBox->SetValue(0);
 			}
+			
+			mWriteBehindBox->SetValue((volFlags & 0x04) ? 1 : 0);
+			mNoCacheBox->SetValue((volFlags & 0x08) ? 1 : 0);
 		}
 	}
 	
@@ -866,18 +905,20 @@ void afpMainWindow::GetComment()
  * UpdateThroughput()
  *
  * Description:
+ *		Shows a stats snapshot pushed by the server. A NULL snapshot
+ *		means we stopped hearing from the server.
  *
  * Returns:
  */
 
-void afpMainWindow::UpdateThroughput()
+void afpMainWindow::UpdateThroughput(const BMessage* snapshot)
 {
 	int			status 	= 0;
 	int64		bytes64	= 0;
 	int32		bytes32	= 0;
 	char		text[64];
 	
-	if (AFPGetBytesPerSecond(&bytes32) == B_OK)
+	if ((snapshot != NULL) && (snapshot->FindInt32(AFP_STAT_INT32_BPS, &bytes32) == B_OK))
 	{
 		if (bytes32 < 0) {
 			bytes32 = 0;
@@ -904,7 +945,7 @@ void afpMainWindow::UpdateThroughput()
 		status++;
 	}
 	
-	if (AFPGetBytesSent(&bytes64) == B_OK)
+	if ((snapshot != NULL) && (snapshot->FindInt64(AFP_STAT_INT64_SENT, &bytes64) == B_OK))
 	{
 		sprintf(text, "%u", (int)LO_LONG(bytes64));
 		
@@ -919,13 +960,13 @@ void afpMainWindow::UpdateThroughput()
 		status++;
 	}
 
-	if (AFPGetBytesRecieved(&bytes64) == B_OK)
+	if ((snapshot != NULL) && (snapshot->FindInt64(AFP_STAT_INT64_RECV, &bytes64) == B_OK))
 	{
 		sprintf(text, "%u", (int)LO_LONG(bytes64));
 		
 		mBytesRecv->LockLooper();
 		
-		if (strcmp(text, mBytesSent->Text())) {
+		if (strcmp(text, mBytesRecv->Text())) {
 			mBytesRecv->SetText(text);
 		}
 		
@@ -934,7 +975,7 @@ void afpMainWindow::UpdateThroughput()
 		status++;
 	}
 	
-	if (AFPGetPacketsProcessed(&bytes32) == B_OK)
+	if ((snapshot != NULL) && (snapshot->FindInt32(AFP_STAT_INT32_DSIPACKETS, &bytes32) == B_OK))
 	{
 		sprintf(text, "%d", (int)bytes32);
 		
@@ -949,7 +990,7 @@ void afpMainWindow::UpdateThroughput()
 		status++;
 	}
 	
-	if (AFPGetUsersLoggedOn(&bytes32) == B_OK)
+	if ((snapshot != NULL) && (snapshot->FindInt32(AFP_STAT_INT32_USERS, &bytes32) == B_OK))
 	{
 		sprintf(text, "%d", (int)bytes32);
 		
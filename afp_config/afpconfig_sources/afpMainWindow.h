@@ -24,6 +24,8 @@
 #define CMD_APP_MNGUSERS			'musr'
 #define CMD_APP_SENDMSG				'sndm'
 #define CMD_APP_ROCHECKBOX			'mkro'
+#define CMD_APP_NOCACHECHECKBOX		'mknc'
+#define CMD_APP_WBCHECKBOX			'mkwb'
 #define CMD_APP_VOLLISTCHANGED		'vchg'
 #define CMD_AFP_USERLISTCHANGED		'uchg'
 
@@ -109,13 +111,13 @@ public:
 
 	virtual void	PopulateUserList();
 	virtual void	PopulateVolumeList();
-	virtual void	SaveReadOnlyState();
+	virtual void	SaveVolumeFlag(uint32 flag, bool set);
 	virtual void	SetControlsState();
 	virtual void	RemoveShare();
 	virtual void	AddNewShare(entry_ref newRef);
 	virtual void	SaveComment();
 	virtual void	GetComment();
-	virtual void	UpdateThroughput();
+	virtual void	UpdateThroughput(const BMessage* snapshot);
 	
 	virtual bool 	QuitRequested();
 
@@ -125,6 +127,8 @@ private:
 		BBox*			mBox;
 		afpListView*	mVolumeListView;
 		BCheckBox*		mReadOnlyBox;
+		BCheckBox*		mNoCacheBox;
+		BCheckBox*		mWriteBehindBox;
 		BButton*		mRemoveButton;
 		afpListView*	mUserListView;
 		BStringView*	mServerStatus;
@@ -0,0 +1,1257 @@
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "afp_client.h"
+#include "afpdhxlogin.h"
+#include "dsi_connection.h"
+
+//
+//Text encoding hint sent with UTF-8 pathnames, kCFStringEncodingUTF8.
+//
+#define AFP_CLIENT_UTF8_HINT		0x08000103
+
+//
+//Enumerate replies are asked to fit in this much.
+//
+#define AFP_CLIENT_MAX_ENUM_REPLY	0x8000
+
+static const char*	kVersionStrings[] =
+{
+	AFP_22_VERSION_STR,
+	AFP_30_VERSION_STR,
+	AFP_31_VERSION_STR,
+	AFP_32_VERSION_STR,
+	AFP_33_VERSION_STR
+};
+
+/*
+ * Put8(), Put16(), Put32(), Put64()
+ *
+ * Description:
+ *		Store a value in network order.
+ *
+ * Returns: the position after it
+ */
+
+static inline uint8* Put8(uint8* pos, uint8 value)
+{
+	*pos = value;
+	return( pos + sizeof(uint8) );
+}
+
+static inline uint8* Put16(uint8* pos, uint16 value)
+{
+	value = htons(value);
+	memcpy(pos, &value, sizeof(value));
+	return( pos + sizeof(value) );
+}
+
+static inline uint8* Put32(uint8* pos, uint32 value)
+{
+	value = htonl(value);
+	memcpy(pos, &value, sizeof(value));
+	return( pos + sizeof(value) );
+}
+
+static inline uint8* Put64(uint8* pos, uint64 value)
+{
+	pos = Put32(pos, (uint32)(value >> 32));
+	return( Put32(pos, (uint32)value) );
+}
+
+
+/*
+ * Get16(), Get32()
+ *
+ * Description:
+ *		Fetch a value stored in network order.
+ *
+ * Returns: the value
+ */
+
+static inline uint16 Get16(const uint8* pos)
+{
+	uint16	value;
+
+	memcpy(&value, pos, sizeof(value));
+	return( ntohs(value) );
+}
+
+static inline uint32 Get32(const uint8* pos)
+{
+	uint32	value;
+
+	memcpy(&value, pos, sizeof(value));
+	return( ntohl(value) );
+}
+
+
+/*
+ * PutPascal()
+ *
+ * Description:
+ *
+ * Returns: the position after it
+ */
+
+static uint8* PutPascal(uint8* pos, const char* string)
+{
+	size_t	length = std::min(strlen(string), (size_t)UINT8_MAX);
+
+	*pos++ = (uint8)length;
+	memcpy(pos, string, length);
+
+	return( pos + length );
+}
+
+
+/*
+ * IsExpectedError()
+ *
+ * Description:
+ *		Errors that are how a call says it's done rather than that it
+ *		failed, reading past the end of a fork or the end of a
+ *		directory, or a desktop database with nothing for a file.
+ *
+ * Returns: bool
+ */
+
+static bool IsExpectedError(uint8 afpCommand, AFPERROR afpError)
+{
+	switch(afpCommand)
+	{
+		case afpRead:
+		case afpReadExt:
+			return( afpError == afpEofError );
+
+		case afpEnumerate:
+		case afpEnumerateExt:
+		case afpEnumerateExt2:
+			return( afpError == afpObjectNotFound );
+
+		case afpGetIcon:
+		case afpGetCmt:
+			return( afpError == afpItemNotFound );
+
+		case afpLogin:
+		case afpLoginExt:
+			return( afpError == afpAuthContinue );
+
+		default:
+			break;
+	}
+
+	return( false );
+}
+
+
+/*
+ * afp_client()
+ *
+ * Description:
+ *		One AFP over TCP connection, the client side. Requests are sent
+ *		one at a time and the reply waited for, like a single Finder
+ *		window would. maxTransfer is the most one FPRead or FPWrite
+ *		will move.
+ *
+ * Returns:
+ */
+
+afp_client::afp_client(size_t maxTransfer)
+{
+	mSocket			= -1;
+	mRequestID		= 0;
+	mAFPVersion		= afpVersion33;
+	mWriteQuantum	= maxTransfer;
+	mRecording		= false;
+
+	mRequest.resize(DSI_HEADER_SIZE + AFP_MAX_CMD_SIZE + maxTransfer);
+	mReply.resize(std::max(maxTransfer, (size_t)AFP_CLIENT_MAX_ENUM_REPLY) + AFP_MAX_CMD_SIZE);
+
+	for (int32 i = 0; i < AFP_CLIENT_COMMANDS; i++)
+	{
+		mStats[i].bytes		= 0;
+		mStats[i].errors	= 0;
+	}
+}
+
+
+/*
+ * ~afp_client()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+afp_client::~afp_client()
+{
+	Disconnect();
+}
+
+
+/*
+ * Connect()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t afp_client::Connect(const char* host, uint16 port)
+{
+	struct addrinfo		hints;
+	struct addrinfo*	addresses	= NULL;
+	char				service[16];
+	int					on			= 1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family		= AF_INET;
+	hints.ai_socktype	= SOCK_STREAM;
+
+	sprintf(service, "%u", (unsigned)port);
+
+	if (getaddrinfo(host, service, &hints, &addresses) != 0) {
+		return( B_NAME_NOT_FOUND );
+	}
+
+	mSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+	if (mSocket < 0)
+	{
+		freeaddrinfo(addresses);
+		return( B_ERROR );
+	}
+
+	setsockopt(mSocket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+	if (connect(mSocket, addresses->ai_addr, addresses->ai_addrlen) < 0)
+	{
+		freeaddrinfo(addresses);
+		Disconnect();
+		return( B_ERROR );
+	}
+
+	freeaddrinfo(addresses);
+
+	mRequestID = 0;
+
+	return( B_OK );
+}
+
+
+/*
+ * Disconnect()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+void afp_client::Disconnect()
+{
+	if (mSocket >= 0)
+	{
+		close(mSocket);
+		mSocket = -1;
+	}
+}
+
+
+/*
+ * OpenSession()
+ *
+ * Description:
+ *		DSIOpenSession, which also tells us how big a write the server
+ *		will take.
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_client::OpenSession()
+{
+	uint8*		start		= &mRequest[DSI_HEADER_SIZE];
+	uint8*		pos			= start;
+	size_t		replySize	= 0;
+	AFPERROR	afpError	= AFP_OK;
+
+	pos = Put8(pos, kClientAttentionQuantum);
+	pos = Put8(pos, sizeof(int32));
+	pos = Put32(pos, 1024);
+
+	afpError = Transact(DSI_CMD_OpenSession, 0, pos - start, 0, &replySize);
+
+	if (AFP_FAILURE(afpError)) {
+		return( afpError );
+	}
+
+	for (size_t i = 0; i + 2 <= replySize; i += 2 + mReply[i + 1])
+	{
+		if ((mReply[i] == kServerRequestQuanta) && (mReply[i + 1] == sizeof(int32)) && (i + 6 <= replySize))
+		{
+			size_t	quantum = Get32(&mReply[i + 2]);
+
+			//
+			//The quantum covers the whole AFP request, FPWriteExt's
+			//parameters included.
+			//
+			if (quantum > 32) {
+				mWriteQuantum = std::min(mWriteQuantum, quantum - 32);
+			}
+		}
+	}
+
+	return( AFP_OK );
+}
+
+
+/*
+ * CloseSession()
+ *
+ * Description:
+ *		DSICloseSession, the server doesn't reply to it.
+ *
+ * Returns: none
+ */
+
+void afp_client::CloseSession()
+{
+	uint8*	header = &mRequest[0];
+
+	if (mSocket < 0) {
+		return;
+	}
+
+	memset(header, 0, DSI_HEADER_SIZE);
+
+	header[DSI_OFFSET_FLAGS]	= DSI_REQUEST_FLAG;
+	header[DSI_OFFSET_COMMAND]	= DSI_CMD_CloseSession;
+
+	Put16(&header[DSI_OFFSET_REQUESTID], mRequestID++);
+
+	SendAll(header, DSI_HEADER_SIZE);
+	Disconnect();
+}
+
+
+/*
+ * GetStatus()
+ *
+ * Description:
+ *		What the Chooser sends to show a server in its list.
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_client::GetStatus()
+{
+	size_t		replySize	= 0;
+	AFPERROR	afpError	= AFP_OK;
+
+	afpError = Transact(DSI_CMD_GetStatus, afpGetSInfo, 0, 0, &replySize);
+
+	Disconnect();
+
+	return( afpError );
+}
+
+
+/*
+ * Login()
+ *
+ * Description:
+ *		FPLogin for AFP2.2 and FPLoginExt after, with the guest,
+ *		cleartext or DHCAST128 UAM.
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_client::Login(int8 afpVersion, int8 uam, const char* user, const char* password)
+{
+	uint8*		start		= &mRequest[DSI_HEADER_SIZE];
+	uint8*		pos			= start;
+	uint8		command		= (afpVersion >= afpVersion30) ? afpLoginExt : afpLogin;
+	size_t		replySize	= 0;
+
+	if ((afpVersion < afpVersion22) || (afpVersion > afpVersion33)) {
+		return( afpBadVersNum );
+	}
+
+	mAFPVersion = afpVersion;
+
+	pos = Put8(pos, command);
+
+	if (command == afpLoginExt)
+	{
+		pos = Put8(pos, 0);
+		pos = Put16(pos, 0);
+	}
+
+	pos = PutPascal(pos, kVersionStrings[afpVersion - 1]);
+
+	switch(uam)
+	{
+		case afpUAMGuest:		pos = PutPascal(pos, UAM_NONE_STR);		break;
+		case afpUAMClearText:	pos = PutPascal(pos, UAM_CLEAR_TEXT);	break;
+		case afpUAMDHCAST128:	pos = PutPascal(pos, UAM_DHCAST128);	break;
+
+		default:
+			return( afpBadUAM );
+	}
+
+	if (uam != afpUAMGuest)
+	{
+		if (command == afpLoginExt)
+		{
+			size_t	length = std::min(strlen(user), (size_t)UAM_USERNAMELEN);
+
+			//
+			//The user name in UTF-8 and an empty pathname.
+			//
+			pos = Put8(pos, kUnicodeNames);
+			pos = Put16(pos, (uint16)length);
+			memcpy(pos, user, length);
+			pos += length;
+
+			pos = Put8(pos, kUnicodeNames);
+			pos = Put16(pos, 0);
+		}
+		else
+		{
+			pos = PutPascal(pos, user);
+		}
+
+		if ((pos - start) % 2) {
+			pos = Put8(pos, 0);
+		}
+	}
+
+	switch(uam)
+	{
+		case afpUAMClearText:
+		{
+			char	clearText[UAM_CLRTXTPWDLEN] = {};
+
+			strncpy(clearText, password, sizeof(clearText));
+
+			memcpy(pos, clearText, sizeof(clearText));
+			pos += sizeof(clearText);
+			break;
+		}
+
+		case afpUAMDHCAST128:
+			return( LoginDHX(start, pos, password) );
+
+		default:
+			break;
+	}
+
+	return( Transact(DSI_CMD_Command, command, pos - start, 0, &replySize) );
+}
+
+
+/*
+ * LoginDHX()
+ *
+ * Description:
+ *		The client half of DHCAST128. Our public key goes with the
+ *		login, the server answers with its own and a nonce encrypted
+ *		with the shared key, and we continue the login with the nonce
+ *		plus one and the password encrypted the same way.
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_client::LoginDHX(uint8* start, uint8* pos, const char* password)
+{
+	uint8			p[]			= {	0xBA, 0x28, 0x73, 0xDF, 0xB0, 0x60, 0x57, 0xD4,
+									0x3F, 0x20, 0x24, 0x74, 0x4C, 0xEE, 0xE7, 0x5B	};
+	uint8			g			= 0x07;
+	uint8			shared[DHX_KEYSIZE * 2];
+	uint8			clear[DHX_CRYPT2BUFLEN]	= {};
+	uint8			iv[9];
+	uint8			sessionID[sizeof(int16)];
+	const BIGNUM*	publicKey	= NULL;
+	BIGNUM*			serverKey	= NULL;
+	BIGNUM*			nonce		= NULL;
+	DH*				dh			= DH_new();
+	CAST_KEY		castKey;
+	size_t			replySize	= 0;
+	int				keyLength	= 0;
+	AFPERROR		afpError	= afpMiscErr;
+
+	if (dh == NULL) {
+		return( afpMiscErr );
+	}
+
+	if (!DH_set0_pqg(dh, BN_bin2bn(p, sizeof(p), NULL), NULL, BN_bin2bn(&g, sizeof(g), NULL)))
+	{
+		DH_free(dh);
+		return( afpMiscErr );
+	}
+
+	if (!DH_generate_key(dh))
+	{
+		DH_free(dh);
+		return( afpMiscErr );
+	}
+
+	DH_get0_key(dh, &publicKey, NULL);
+
+	BN_bn2binpad(publicKey, pos, DHX_KEYSIZE);
+	pos += DHX_KEYSIZE;
+
+	afpError = Transact(DSI_CMD_Command, start[0], pos - start, 0, &replySize);
+
+	if (afpError != afpAuthContinue)
+	{
+		DH_free(dh);
+		return( AFP_SUCCESS(afpError) ? afpMiscErr : afpError );
+	}
+
+	if (replySize < sizeof(sessionID) + DHX_KEYSIZE + DHX_CRYPTBUFLEN)
+	{
+		DH_free(dh);
+		return( afpMiscErr );
+	}
+
+	//
+	//Reply is the session ID we echo back, the server's public key
+	//and the encrypted nonce.
+	//
+	memcpy(sessionID, &mReply[0], sizeof(sessionID));
+
+	serverKey	= BN_bin2bn(&mReply[sizeof(sessionID)], DHX_KEYSIZE, NULL);
+	keyLength	= DH_compute_key(shared, serverKey, dh);
+
+	BN_free(serverKey);
+	DH_free(dh);
+
+	if (keyLength <= 0) {
+		return( afpMiscErr );
+	}
+
+	CAST_set_key(&castKey, keyLength, shared);
+
+	memcpy(iv, "CJalbert", sizeof(iv));
+	CAST_cbc_encrypt(
+		&mReply[sizeof(sessionID) + DHX_KEYSIZE],
+		clear,
+		DHX_CRYPTBUFLEN,
+		&castKey,
+		iv,
+		CAST_DECRYPT
+		);
+
+	nonce = BN_bin2bn(clear, DHX_RANDBUFSIZE, NULL);
+
+	BN_add_word(nonce, 1);
+	BN_mask_bits(nonce, DHX_RANDBUFSIZE * 8);
+	BN_bn2binpad(nonce, clear, DHX_RANDBUFSIZE);
+	BN_free(nonce);
+
+	memset(clear + DHX_RANDBUFSIZE, 0, DHX_PASSWDLEN);
+	strncpy((char*)clear + DHX_RANDBUFSIZE, password, DHX_PASSWDLEN);
+
+	pos = start;
+	pos = Put8(pos, afpContLogin);
+	pos = Put8(pos, 0);
+
+	memcpy(pos, sessionID, sizeof(sessionID));
+	pos += sizeof(sessionID);
+
+	memcpy(iv, "LWallace", sizeof(iv));
+	CAST_cbc_encrypt(clear, pos, DHX_CRYPT2BUFLEN, &castKey, iv, CAST_ENCRYPT);
+	pos += DHX_CRYPT2BUFLEN;
+
+	memset(clear, 0, sizeof(clear));
+	memset(&castKey, 0, sizeof(castKey));
+
+	return( Transact(DSI_CMD_Command, afpContLogin, pos - start, 0, &replySize) );
+}
+
+
+/*
+ * Logout()
+ *
+ * Description:
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_client::Logout()
+{
+	uint8*	start		= &mRequest[DSI_HEADER_SIZE];
+	uint8*	pos			= start;
+	size_t	replySize	= 0;
+
+	pos = Put8(pos, afpLogout);
+	pos = Put8(pos, 0);
+
+	return( Transact(DSI_CMD_Command, afpLogout, pos - start, 0, &replySize) );
+}
+
+
+/*
+ * OpenVol()
+ *
+ * Description:
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_client::OpenVol(const char* name, uint16* volID)
+{
+	uint8*		start		= &mRequest[DSI_HEADER_SIZE];
+	uint8*		pos			= start;
+	size_t		replySize	= 0;
+	AFPERROR	afpError	= AFP_OK;
+
+	pos = Put8(pos, afpOpenVol);
+	pos = Put8(pos, 0);
+	pos = Put16(pos, kFPVolIDBit);
+	pos = PutPascal(pos, name);
+
+	afpError = Transact(DSI_CMD_Command, afpOpenVol, pos - start, 0, &replySize);
+
+	if (AFP_SUCCESS(afpError))
+	{
+		//
+		//Bitmap, then the one parameter we asked for.
+		//
+		*volID = (replySize >= 4) ? Get16(&mReply[2]) : 0;
+	}
+
+	return( afpError );
+}
+
+
+/*
+ * CloseVol()
+ *
+ * Description:
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_client::CloseVol(uint16 volID)
+{
+	uint8*	start		= &mRequest[DSI_HEADER_SIZE];
+	uint8*	pos			= start;
+	size_t	replySize	= 0;
+
+	pos = Put8(pos, afpVolClose);
+	pos = Put8(pos, 0);
+	pos = Put16(pos, volID);
+
+	return( Transact(DSI_CMD_Command, afpVolClose, pos - start, 0, &replySize) );
+}
+
+
+/*
+ * GetFileDirParms()
+ *
+ * Description:
+ *		Ask for the usual Finder parameters. For a directory nodeID is
+ *		set to its directory ID, which is always the first parameter
+ *		after the names when only kFPDirID is asked for, so we ask for
+ *		that alone when the caller wants it.
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_client::GetFileDirParms(uint16 volID, uint32 dirID, const char* name, uint32* nodeID)
+{
+	uint8*		start		= &mRequest[DSI_HEADER_SIZE];
+	uint8*		pos			= start;
+	size_t		replySize	= 0;
+	AFPERROR	afpError	= AFP_OK;
+
+	pos = Put8(pos, afpGetFlDrParms);
+	pos = Put8(pos, 0);
+	pos = Put16(pos, volID);
+	pos = Put32(pos, dirID);
+	pos = Put16(pos, (nodeID != NULL) ? kFPFileNum : AFP_CLIENT_FILE_BITMAP);
+	pos = Put16(pos, (nodeID != NULL) ? kFPDirID : AFP_CLIENT_DIR_BITMAP);
+	pos = AddName(pos, name);
+
+	afpError = Transact(DSI_CMD_Command, afpGetFlDrParms, pos - start, 0, &replySize);
+
+	if ((AFP_SUCCESS(afpError)) && (nodeID != NULL))
+	{
+		//
+		//File bitmap, directory bitmap, the directory flag and a pad
+		//byte come before the parameters.
+		//
+		*nodeID = (replySize >= 10) ? Get32(&mReply[6]) : 0;
+	}
+
+	return( afpError );
+}
+
+
+/*
+ * Enumerate()
+ *
+ * Description:
+ *		One page of a directory listing, FPEnumerateExt2 on AFP3.1 and
+ *		later, FPEnumerateExt on AFP3.0 and FPEnumerate before that.
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_client::Enumerate(uint16 volID, uint32 dirID, int32 startIndex, int16 reqCount, int16* actCount)
+{
+	uint8*		start		= &mRequest[DSI_HEADER_SIZE];
+	uint8*		pos			= start;
+	uint8		command		= afpEnumerate;
+	size_t		replySize	= 0;
+	AFPERROR	afpError	= AFP_OK;
+
+	if (mAFPVersion >= afpVersion31) {
+		command = afpEnumerateExt2;
+	}
+	else if (mAFPVersion >= afpVersion30) {
+		command = afpEnumerateExt;
+	}
+
+	pos = Put8(pos, command);
+	pos = Put8(pos, 0);
+	pos = Put16(pos, volID);
+	pos = Put32(pos, dirID);
+	pos = Put16(pos, AFP_CLIENT_FILE_BITMAP);
+	pos = Put16(pos, AFP_CLIENT_DIR_BITMAP);
+	pos = Put16(pos, reqCount);
+
+	if (command == afpEnumerateExt2)
+	{
+		pos = Put32(pos, startIndex);
+		pos = Put32(pos, AFP_CLIENT_MAX_ENUM_REPLY);
+	}
+	else
+	{
+		pos = Put16(pos, startIndex);
+		pos = Put16(pos, AFP_CLIENT_MAX_ENUM_REPLY - 1);
+	}
+
+	pos = AddName(pos, "");
+
+	afpError = Transact(DSI_CMD_Command, command, pos - start, 0, &replySize);
+
+	*actCount = ((AFP_SUCCESS(afpError)) && (replySize >= 6)) ? (int16)Get16(&mReply[4]) : 0;
+
+	return( afpError );
+}
+
+
+/*
+ * CreateFile()
+ *
+ * Description:
+ *		Soft create, an existing file is an error.
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_client::CreateFile(uint16 volID, uint32 dirID, const char* name)
+{
+	uint8*	start		= &mRequest[DSI_HEADER_SIZE];
+	uint8*	pos			= start;
+	size_t	replySize	= 0;
+
+	pos = Put8(pos, afpFileCreate);
+	pos = Put8(pos, 0);
+	pos = Put16(pos, volID);
+	pos = Put32(pos, dirID);
+	pos = AddName(pos, name);
+
+	return( Transact(DSI_CMD_Command, afpFileCreate, pos - start, 0, &replySize) );
+}
+
+
+/*
+ * Delete()
+ *
+ * Description:
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_client::Delete(uint16 volID, uint32 dirID, const char* name)
+{
+	uint8*	start		= &mRequest[DSI_HEADER_SIZE];
+	uint8*	pos			= start;
+	size_t	replySize	= 0;
+
+	pos = Put8(pos, afpDelete);
+	pos = Put8(pos, 0);
+	pos = Put16(pos, volID);
+	pos = Put32(pos, dirID);
+	pos = AddName(pos, name);
+
+	return( Transact(DSI_CMD_Command, afpDelete, pos - start, 0, &replySize) );
+}
+
+
+/*
+ * OpenFork()
+ *
+ * Description:
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_client::OpenFork(uint16 volID, uint32 dirID, const char* name, bool rsrc, int16 mode, uint16* forkRef)
+{
+	uint8*		start		= &mRequest[DSI_HEADER_SIZE];
+	uint8*		pos			= start;
+	size_t		replySize	= 0;
+	AFPERROR	afpError	= AFP_OK;
+
+	pos = Put8(pos, afpOpenFork);
+	pos = Put8(pos, rsrc ? kResourceForkBit : 0);
+	pos = Put16(pos, volID);
+	pos = Put32(pos, dirID);
+	pos = Put16(pos, 0);
+	pos = Put16(pos, mode);
+	pos = AddName(pos, name);
+
+	afpError = Transact(DSI_CMD_Command, afpOpenFork, pos - start, 0, &replySize);
+
+	if (AFP_SUCCESS(afpError)) {
+		*forkRef = (replySize >= 4) ? Get16(&mReply[2]) : 0;
+	}
+
+	return( afpError );
+}
+
+
+/*
+ * CloseFork()
+ *
+ * Description:
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_client::CloseFork(uint16 forkRef)
+{
+	uint8*	start		= &mRequest[DSI_HEADER_SIZE];
+	uint8*	pos			= start;
+	size_t	replySize	= 0;
+
+	pos = Put8(pos, afpForkClose);
+	pos = Put8(pos, 0);
+	pos = Put16(pos, forkRef);
+
+	return( Transact(DSI_CMD_Command, afpForkClose, pos - start, 0, &replySize) );
+}
+
+
+/*
+ * Read()
+ *
+ * Description:
+ *		FPReadExt, or FPRead before AFP3.0. afpEofError with actCount
+ *		set is a short read at the end of the fork.
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_client::Read(uint16 forkRef, off_t offset, size_t count, size_t* actCount)
+{
+	uint8*		start		= &mRequest[DSI_HEADER_SIZE];
+	uint8*		pos			= start;
+	uint8		command		= (mAFPVersion >= afpVersion30) ? afpReadExt : afpRead;
+	size_t		replySize	= 0;
+	AFPERROR	afpError	= AFP_OK;
+
+	count = std::min(count, mReply.size());
+
+	pos = Put8(pos, command);
+	pos = Put8(pos, 0);
+	pos = Put16(pos, forkRef);
+
+	if (command == afpReadExt)
+	{
+		pos = Put64(pos, (uint64)offset);
+		pos = Put64(pos, (uint64)count);
+	}
+	else
+	{
+		pos = Put32(pos, (uint32)offset);
+		pos = Put32(pos, (uint32)count);
+		pos = Put8(pos, 0);
+		pos = Put8(pos, 0);
+	}
+
+	afpError	= Transact(DSI_CMD_Command, command, pos - start, 0, &replySize);
+	*actCount	= replySize;
+
+	return( afpError );
+}
+
+
+/*
+ * Write()
+ *
+ * Description:
+ *		FPWriteExt, or FPWrite before AFP3.0, sent as a DSIWrite. count
+ *		must not be more than WriteQuantum().
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_client::Write(uint16 forkRef, off_t offset, const void* data, size_t count)
+{
+	uint8*	start		= &mRequest[DSI_HEADER_SIZE];
+	uint8*	pos			= start;
+	uint8	command		= (mAFPVersion >= afpVersion30) ? afpWriteExt : afpWrite;
+	size_t	replySize	= 0;
+
+	if (count > mWriteQuantum) {
+		return( afpParmErr );
+	}
+
+	pos = Put8(pos, command);
+	pos = Put8(pos, 0);
+	pos = Put16(pos, forkRef);
+
+	if (command == afpWriteExt)
+	{
+		pos = Put64(pos, (uint64)offset);
+		pos = Put64(pos, (uint64)count);
+	}
+	else
+	{
+		pos = Put32(pos, (uint32)offset);
+		pos = Put32(pos, (uint32)count);
+	}
+
+	memcpy(pos, data, count);
+
+	return( Transact(DSI_CMD_Write, command, (pos - start) + count, pos - start, &replySize) );
+}
+
+
+/*
+ * OpenDT()
+ *
+ * Description:
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_client::OpenDT(uint16 volID, uint16* dtRef)
+{
+	uint8*		start		= &mRequest[DSI_HEADER_SIZE];
+	uint8*		pos			= start;
+	size_t		replySize	= 0;
+	AFPERROR	afpError	= AFP_OK;
+
+	pos = Put8(pos, afpDTOpen);
+	pos = Put8(pos, 0);
+	pos = Put16(pos, volID);
+
+	afpError = Transact(DSI_CMD_Command, afpDTOpen, pos - start, 0, &replySize);
+
+	if (AFP_SUCCESS(afpError)) {
+		*dtRef = (replySize >= 2) ? Get16(&mReply[0]) : 0;
+	}
+
+	return( afpError );
+}
+
+
+/*
+ * CloseDT()
+ *
+ * Description:
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_client::CloseDT(uint16 dtRef)
+{
+	uint8*	start		= &mRequest[DSI_HEADER_SIZE];
+	uint8*	pos			= start;
+	size_t	replySize	= 0;
+
+	pos = Put8(pos, afpDTClose);
+	pos = Put8(pos, 0);
+	pos = Put16(pos, dtRef);
+
+	return( Transact(DSI_CMD_Command, afpDTClose, pos - start, 0, &replySize) );
+}
+
+
+/*
+ * GetIcon()
+ *
+ * Description:
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_client::GetIcon(uint16 dtRef, uint32 creator, uint32 type, int8 iconType, uint16 size)
+{
+	uint8*	start		= &mRequest[DSI_HEADER_SIZE];
+	uint8*	pos			= start;
+	size_t	replySize	= 0;
+
+	pos = Put8(pos, afpGetIcon);
+	pos = Put8(pos, 0);
+	pos = Put16(pos, dtRef);
+	pos = Put32(pos, creator);
+	pos = Put32(pos, type);
+	pos = Put8(pos, iconType);
+	pos = Put8(pos, 0);
+	pos = Put16(pos, size);
+
+	return( Transact(DSI_CMD_Command, afpGetIcon, pos - start, 0, &replySize) );
+}
+
+
+/*
+ * GetComment()
+ *
+ * Description:
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_client::GetComment(uint16 dtRef, uint32 dirID, const char* name)
+{
+	uint8*	start		= &mRequest[DSI_HEADER_SIZE];
+	uint8*	pos			= start;
+	size_t	replySize	= 0;
+
+	pos = Put8(pos, afpGetCmt);
+	pos = Put8(pos, 0);
+	pos = Put16(pos, dtRef);
+	pos = Put32(pos, dirID);
+	pos = AddName(pos, name);
+
+	return( Transact(DSI_CMD_Command, afpGetCmt, pos - start, 0, &replySize) );
+}
+
+
+/*
+ * AddName()
+ *
+ * Description:
+ *		A pathname and its type, long names before AFP3.0 and UTF-8
+ *		after. '/' in name separates directories.
+ *
+ * Returns: the position after it
+ */
+
+uint8* afp_client::AddName(uint8* pos, const char* name)
+{
+	size_t	length = strlen(name);
+	uint8*	string = NULL;
+
+	if (mAFPVersion >= afpVersion30)
+	{
+		pos = Put8(pos, kUnicodeNames);
+		pos = Put32(pos, AFP_CLIENT_UTF8_HINT);
+		pos = Put16(pos, (uint16)length);
+	}
+	else
+	{
+		length = std::min(length, (size_t)UINT8_MAX);
+
+		pos = Put8(pos, kLongNames);
+		pos = Put8(pos, (uint8)length);
+	}
+
+	string = pos;
+	memcpy(string, name, length);
+
+	//
+	//AFP separates the parts of a pathname with a null byte.
+	//
+	for (size_t i = 0; i < length; i++)
+	{
+		if (string[i] == '/') {
+			string[i] = '\0';
+		}
+	}
+
+	return( pos + length );
+}
+
+
+/*
+ * Transact()
+ *
+ * Description:
+ *		Send the request built after the DSI header in mRequest and wait
+ *		for its reply, which is left in mReply. Tickles and attentions
+ *		from the server that arrive in the meantime are dropped. The
+ *		round trip is counted under afpCommand while recording.
+ *
+ * Returns: the AFP error from the reply, afpMiscErr if the connection
+ *			failed
+ */
+
+AFPERROR afp_client::Transact(
+	int8		dsiCommand,
+	uint8		afpCommand,
+	size_t		requestSize,
+	size_t		writeOffset,
+	size_t*		replySize
+	)
+{
+	uint8*		header		= &mRequest[0];
+	uint8		reply[DSI_HEADER_SIZE];
+	uint16		requestID	= mRequestID++;
+	bigtime_t	started		= system_time();
+	AFPERROR	afpError	= AFP_OK;
+
+	*replySize = 0;
+
+	if (mSocket < 0) {
+		return( afpMiscErr );
+	}
+
+	header[DSI_OFFSET_FLAGS]	= DSI_REQUEST_FLAG;
+	header[DSI_OFFSET_COMMAND]	= dsiCommand;
+
+	Put16(&header[DSI_OFFSET_REQUESTID], requestID);
+	Put32(&header[DSI_OFFSET_DATAOFFSET], (uint32)writeOffset);
+	Put32(&header[DSI_OFFSET_DATALEN], (uint32)requestSize);
+	Put32(&header[DSI_OFFSET_RESERVED], 0);
+
+	if (!SendAll(header, DSI_HEADER_SIZE + requestSize))
+	{
+		Disconnect();
+		return( afpMiscErr );
+	}
+
+	for (;;)
+	{
+		if (!ReceiveAll(reply, sizeof(reply)))
+		{
+			Disconnect();
+			return( afpMiscErr );
+		}
+
+		size_t	length	= Get32(&reply[DSI_OFFSET_DATALEN]);
+		size_t	kept	= std::min(length, mReply.size());
+
+		if (!ReceiveAll(&mReply[0], kept))
+		{
+			Disconnect();
+			return( afpMiscErr );
+		}
+
+		//
+		//Whatever doesn't fit is read and thrown away to stay in step
+		//with the stream.
+		//
+		for (size_t left = length - kept; left > 0; )
+		{
+			uint8	discard[1024];
+			size_t	chunk = std::min(left, sizeof(discard));
+
+			if (!ReceiveAll(discard, chunk))
+			{
+				Disconnect();
+				return( afpMiscErr );
+			}
+
+			left -= chunk;
+		}
+
+		if (	(reply[DSI_OFFSET_FLAGS] == DSI_REPLY_FLAG)		&&
+				(Get16(&reply[DSI_OFFSET_REQUESTID]) == requestID)	)
+		{
+			afpError	= (AFPERROR)(int32)Get32(&reply[DSI_OFFSET_ERRORCODE]);
+			*replySize	= kept;
+
+			if (length > kept) {
+				afpError = afpMiscErr;
+			}
+
+			break;
+		}
+	}
+
+	if ((mRecording) && (afpCommand != 0))
+	{
+		AFP_CLIENT_STATS&	stats = mStats[afpCommand];
+
+		stats.times.push_back((uint32)(system_time() - started));
+		stats.bytes += requestSize + *replySize;
+
+		if ((AFP_FAILURE(afpError)) && (!IsExpectedError(afpCommand, afpError))) {
+			stats.errors++;
+		}
+	}
+
+	return( afpError );
+}
+
+
+/*
+ * SendAll()
+ *
+ * Description:
+ *
+ * Returns: false if the connection failed
+ */
+
+bool afp_client::SendAll(const void* data, size_t size)
+{
+	const uint8*	pos = (const uint8*)data;
+
+	while(size > 0)
+	{
+		ssize_t	sent = send(mSocket, pos, size, 0);
+
+		if (sent <= 0) {
+			return( false );
+		}
+
+		pos		+= sent;
+		size	-= sent;
+	}
+
+	return( true );
+}
+
+
+/*
+ * ReceiveAll()
+ *
+ * Description:
+ *
+ * Returns: false if the connection failed
+ */
+
+bool afp_client::ReceiveAll(void* data, size_t size)
+{
+	uint8*	pos = (uint8*)data;
+
+	while(size > 0)
+	{
+		ssize_t	received = recv(mSocket, pos, size, 0);
+
+		if (received <= 0) {
+			return( false );
+		}
+
+		pos		+= received;
+		size	-= received;
+	}
+
+	return( true );
+}
@@ -0,0 +1,113 @@
+#ifndef __afp_client__
+#define __afp_client__
+
+#include <OS.h>
+#include <SupportDefs.h>
+
+#include <vector>
+
+#include "afp.h"
+
+//
+//Every AFP command the client sends is timed and counted under its
+//command code, DSI requests that carry no AFP command are not.
+//
+#define AFP_CLIENT_COMMANDS			256
+
+//
+//Parameters asked for when enumerating, close to what the Finder asks
+//for when it opens a window.
+//
+#define AFP_CLIENT_FILE_BITMAP		(kFPFileAttributes | kFPParentID | kFPCreateDate | kFPModDate |	\
+									 kFPFinderInfo | kFPLongName | kFPFileNum | kFPDFLen | kFPRFLen)
+#define AFP_CLIENT_DIR_BITMAP		(kFPDirAttribute | kFPDirParentID | kFPDirCreateDate |				\
+									 kFPDirModDate | kFPDirFinderInfo | kFPDirLongName | kFPDirID |		\
+									 kFPDirOffCount | kFPDirOwnerID | kFPDirGroupID | kFPDirAccess)
+
+typedef struct
+{
+	std::vector<uint32>	times;
+	uint64				bytes;
+	int32				errors;
+}AFP_CLIENT_STATS;
+
+
+class afp_client
+{
+public:
+							afp_client(size_t maxTransfer);
+	virtual					~afp_client();
+
+	virtual status_t		Connect(const char* host, uint16 port);
+	virtual void			Disconnect();
+	virtual bool			IsConnected()		{ return( mSocket >= 0 ); }
+
+	//
+	//DSI
+	//
+	virtual AFPERROR		OpenSession();
+	virtual void			CloseSession();
+
+	//
+	//DSIGetStatus, counted as FPGetSrvrInfo. The server hangs up
+	//after replying.
+	//
+	virtual AFPERROR		GetStatus();
+
+	//
+	//AFP, names are relative to dirID and may contain '/'
+	//
+	virtual AFPERROR		Login(int8 afpVersion, int8 uam, const char* user, const char* password);
+	virtual AFPERROR		Logout();
+	virtual AFPERROR		OpenVol(const char* name, uint16* volID);
+	virtual AFPERROR		CloseVol(uint16 volID);
+	virtual AFPERROR		GetFileDirParms(uint16 volID, uint32 dirID, const char* name, uint32* nodeID);
+	virtual AFPERROR		Enumerate(uint16 volID, uint32 dirID, int32 startIndex, int16 reqCount, int16* actCount);
+	virtual AFPERROR		CreateFile(uint16 volID, uint32 dirID, const char* name);
+	virtual AFPERROR		Delete(uint16 volID, uint32 dirID, const char* name);
+	virtual AFPERROR		OpenFork(uint16 volID, uint32 dirID, const char* name, bool rsrc, int16 mode, uint16* forkRef);
+	virtual AFPERROR		CloseFork(uint16 forkRef);
+	virtual AFPERROR		Read(uint16 forkRef, off_t offset, size_t count, size_t* actCount);
+	virtual AFPERROR		Write(uint16 forkRef, off_t offset, const void* data, size_t count);
+	virtual AFPERROR		OpenDT(uint16 volID, uint16* dtRef);
+	virtual AFPERROR		CloseDT(uint16 dtRef);
+	virtual AFPERROR		GetIcon(uint16 dtRef, uint32 creator, uint32 type, int8 iconType, uint16 size);
+	virtual AFPERROR		GetComment(uint16 dtRef, uint32 dirID, const char* name);
+
+	//
+	//Largest FPWrite the server said it will take.
+	//
+	virtual size_t			WriteQuantum()		{ return( mWriteQuantum ); }
+
+	virtual void			SetRecording(bool record)	{ mRecording = record; }
+	virtual const AFP_CLIENT_STATS*	Stats()		{ return( mStats ); }
+
+private:
+
+	AFPERROR				Transact(
+								int8		dsiCommand,
+								uint8		afpCommand,
+								size_t		requestSize,
+								size_t		writeOffset,
+								size_t*		replySize
+								);
+
+	AFPERROR				LoginDHX(uint8* start, uint8* pos, const char* password);
+	uint8*					AddName(uint8* pos, const char* name);
+
+	bool					SendAll(const void* data, size_t size);
+	bool					ReceiveAll(void* data, size_t size);
+
+	int						mSocket;
+	uint16					mRequestID;
+	int8					mAFPVersion;
+	size_t					mWriteQuantum;
+	bool					mRecording;
+
+	std::vector<uint8>		mRequest;
+	std::vector<uint8>		mReply;
+
+	AFP_CLIENT_STATS		mStats[AFP_CLIENT_COMMANDS];
+};
+
+#endif //__afp_client__
@@ -0,0 +1,1031 @@
+/*
+ *	afpload.cpp
+ *
+ *	Drives afp_server with any number of simulated clients and reports
+ *	how fast it went: operations and megabytes a second overall, and
+ *	latency for each kind of work and each AFP command. Each client is
+ *	its own AFP session doing a mix of Finder style browsing, opening
+ *	files the way an application launch does, and copying files.
+ *
+ *	usage: afp_load [options] -V volume
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <vector>
+
+#include "afp_client.h"
+
+#define DEFAULT_HOST			"127.0.0.1"
+#define DEFAULT_PORT			548
+#define DEFAULT_CLIENTS			4
+#define DEFAULT_SECONDS			30
+#define DEFAULT_MIX				"browse:50,launch:30,copy:20"
+#define DEFAULT_FILE_SIZE		(1024 * 1024)
+#define DEFAULT_TRANSFER_SIZE	(128 * 1024)
+
+//
+//How many entries each enumerate asks for, the Finder's usual.
+//
+#define ENUMERATE_COUNT			64
+
+//
+//What we look for in the desktop database, a TextEdit document's icon.
+//
+#define DT_CREATOR				'ttxt'
+#define DT_TYPE					'TEXT'
+#define DT_ICON_TYPE			1
+#define DT_ICON_SIZE			256
+
+enum
+{
+	WORK_BROWSE = 0,
+	WORK_LAUNCH,
+	WORK_COPY,
+	WORK_LOGIN,
+	WORK_STATUS,
+	WORK_COUNT
+};
+
+static const char*	kWorkNames[WORK_COUNT] = { "browse", "launch", "copy", "login", "status" };
+
+typedef struct
+{
+	uint8		command;
+	const char*	name;
+}AFP_COMMAND_NAME;
+
+static const AFP_COMMAND_NAME	kCommandNames[] =
+{
+	{ afpVolClose,				"FPCloseVol" },
+	{ afpForkClose,				"FPCloseFork" },
+	{ afpFileCreate,			"FPCreateFile" },
+	{ afpDelete,				"FPDelete" },
+	{ afpEnumerate,				"FPEnumerate" },
+	{ afpGetSInfo,				"FPGetSrvrInfo" },
+	{ afpLogin,					"FPLogin" },
+	{ afpContLogin,				"FPLoginCont" },
+	{ afpLogout,				"FPLogout" },
+	{ afpOpenVol,				"FPOpenVol" },
+	{ afpOpenFork,				"FPOpenFork" },
+	{ afpRead,					"FPRead" },
+	{ afpWrite,					"FPWrite" },
+	{ afpGetFlDrParms,			"FPGetFileDirParms" },
+	{ afpDTOpen,				"FPOpenDT" },
+	{ afpDTClose,				"FPCloseDT" },
+	{ afpGetIcon,				"FPGetIcon" },
+	{ afpGetCmt,				"FPGetComment" },
+	{ afpReadExt,				"FPReadExt" },
+	{ afpWriteExt,				"FPWriteExt" },
+	{ afpLoginExt,				"FPLoginExt" },
+	{ afpEnumerateExt,			"FPEnumerateExt" },
+	{ afpEnumerateExt2,			"FPEnumerateExt2" }
+};
+
+//
+//What the whole run was asked to do.
+//
+typedef struct
+{
+	const char*		host;
+	uint16			port;
+	int32			clients;
+	int32			seconds;
+	int8			afpVersion;
+	int8			uam;
+	const char*		user;
+	const char*		password;
+	const char*		volume;
+	const char*		directory;
+	int32			weights[WORK_COUNT];
+	size_t			fileSize;
+	size_t			transferSize;
+}LOAD_CONFIG;
+
+//
+//One simulated client.
+//
+typedef struct
+{
+	int32					index;
+	const LOAD_CONFIG*		config;
+	afp_client*				client;
+	afp_client*				loginClient;	//Its own connection for the login and status work
+	thread_id				thread;
+	uint16					volID;
+	uint32					dirID;
+	uint16					dtRef;
+	char					fileName[32];
+	char					copyName[32];
+	std::vector<uint32>		workTimes[WORK_COUNT];
+	uint64					bytesRead;
+	uint64					bytesWritten;
+	bigtime_t				finished;
+	bool					failed;
+}LOAD_CLIENT;
+
+static std::atomic<int32>	sReady(0);
+static std::atomic<bool>	sGo(false);
+static std::atomic<bool>	sStop(false);
+
+
+/*
+ * CommandName()
+ *
+ * Description:
+ *
+ * Returns: const char*
+ */
+
+static const char* CommandName(uint8 command)
+{
+	for (size_t i = 0; i < sizeof(kCommandNames) / sizeof(kCommandNames[0]); i++)
+	{
+		if (kCommandNames[i].command == command) {
+			return( kCommandNames[i].name );
+		}
+	}
+
+	return( "?" );
+}
+
+
+/*
+ * Percentile()
+ *
+ * Description:
+ *		times must be sorted.
+ *
+ * Returns: usecs
+ */
+
+static uint32 Percentile(const std::vector<uint32>& times, int32 percent)
+{
+	if (times.empty()) {
+		return( 0 );
+	}
+
+	size_t	index = (times.size() * percent) / 100;
+
+	return( times[std::min(index, times.size() - 1)] );
+}
+
+
+/*
+ * Fail()
+ *
+ * Description:
+ *		Report why a client gave up.
+ *
+ * Returns: false
+ */
+
+static bool Fail(LOAD_CLIENT* load, const char* what, AFPERROR afpError)
+{
+	fprintf(stderr, "afp_load: client %d: %s failed (%d)\n", (int)load->index, what, (int)afpError);
+
+	load->failed = true;
+
+	return( false );
+}
+
+
+/*
+ * WriteFile()
+ *
+ * Description:
+ *		Write size bytes to a fork at position, in chunks the server
+ *		will take.
+ *
+ * Returns: AFPERROR
+ */
+
+static AFPERROR WriteFile(LOAD_CLIENT* load, uint16 forkRef, off_t position, const uint8* data, size_t size)
+{
+	afp_client*	client		= load->client;
+	size_t		quantum		= client->WriteQuantum();
+	AFPERROR	afpError	= AFP_OK;
+
+	for (size_t offset = 0; (offset < size) && (AFP_SUCCESS(afpError)); )
+	{
+		size_t	chunk = std::min(quantum, size - offset);
+
+		afpError = client->Write(forkRef, position + offset, data + offset, chunk);
+
+		if (AFP_SUCCESS(afpError))
+		{
+			load->bytesWritten	+= chunk;
+			offset				+= chunk;
+		}
+	}
+
+	return( afpError );
+}
+
+
+/*
+ * Setup()
+ *
+ * Description:
+ *		Connect, log in, open the volume and directory, and write the
+ *		file this client will read and copy. None of it is measured.
+ *
+ * Returns: true if the client is ready to run
+ */
+
+static bool Setup(LOAD_CLIENT* load)
+{
+	const LOAD_CONFIG*	config		= load->config;
+	afp_client*			client		= load->client;
+	uint16				forkRef		= 0;
+	AFPERROR			afpError	= AFP_OK;
+
+	if (client->Connect(config->host, config->port) != B_OK) {
+		return( Fail(load, "connect", afpNoServer) );
+	}
+
+	afpError = client->OpenSession();
+
+	if (AFP_FAILURE(afpError)) {
+		return( Fail(load, "DSIOpenSession", afpError) );
+	}
+
+	afpError = client->Login(config->afpVersion, config->uam, config->user, config->password);
+
+	if (AFP_FAILURE(afpError)) {
+		return( Fail(load, "login", afpError) );
+	}
+
+	afpError = client->OpenVol(config->volume, &load->volID);
+
+	if (AFP_FAILURE(afpError)) {
+		return( Fail(load, "FPOpenVol", afpError) );
+	}
+
+	load->dirID = kRootDirID;
+
+	if (config->directory[0] != '\0')
+	{
+		afpError = client->GetFileDirParms(load->volID, kRootDirID, config->directory, &load->dirID);
+
+		if (AFP_FAILURE(afpError)) {
+			return( Fail(load, "finding the directory", afpError) );
+		}
+	}
+
+	afpError = client->OpenDT(load->volID, &load->dtRef);
+
+	if (AFP_FAILURE(afpError)) {
+		return( Fail(load, "FPOpenDT", afpError) );
+	}
+
+	sprintf(load->fileName, "afp_load.%d", (int)load->index);
+	sprintf(load->copyName, "afp_load.%d.copy", (int)load->index);
+
+	//
+	//Whatever a run that was stopped short left behind.
+	//
+	client->Delete(load->volID, load->dirID, load->fileName);
+	client->Delete(load->volID, load->dirID, load->copyName);
+
+	afpError = client->CreateFile(load->volID, load->dirID, load->fileName);
+
+	if (AFP_SUCCESS(afpError)) {
+		afpError = client->OpenFork(load->volID, load->dirID, load->fileName, false, kReadWriteMode, &forkRef);
+	}
+
+	if (AFP_SUCCESS(afpError))
+	{
+		std::vector<uint8>	data(config->transferSize, 'x');
+
+		for (size_t offset = 0; (offset < config->fileSize) && (AFP_SUCCESS(afpError)); offset += data.size())
+		{
+			size_t	chunk = std::min(data.size(), config->fileSize - offset);
+
+			afpError = WriteFile(load, forkRef, offset, &data[0], chunk);
+		}
+
+		client->CloseFork(forkRef);
+	}
+
+	if (AFP_FAILURE(afpError)) {
+		return( Fail(load, "writing the test file", afpError) );
+	}
+
+	load->bytesWritten = 0;
+
+	return( true );
+}
+
+
+/*
+ * Cleanup()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+static void Cleanup(LOAD_CLIENT* load)
+{
+	afp_client*	client = load->client;
+
+	if (!client->IsConnected()) {
+		return;
+	}
+
+	client->Delete(load->volID, load->dirID, load->copyName);
+	client->Delete(load->volID, load->dirID, load->fileName);
+	client->CloseDT(load->dtRef);
+	client->CloseVol(load->volID);
+	client->Logout();
+	client->CloseSession();
+}
+
+
+/*
+ * Browse()
+ *
+ * Description:
+ *		A Finder window opening on the directory, the folder's
+ *		parameters, its whole listing and a look in the desktop
+ *		database for an icon and comment.
+ *
+ * Returns: AFPERROR
+ */
+
+static AFPERROR Browse(LOAD_CLIENT* load)
+{
+	afp_client*	client		= load->client;
+	int16		actCount	= 0;
+	AFPERROR	afpError	= AFP_OK;
+
+	afpError = client->GetFileDirParms(load->volID, load->dirID, "", NULL);
+
+	for (int32 index = 1; AFP_SUCCESS(afpError); index += actCount)
+	{
+		afpError = client->Enumerate(load->volID, load->dirID, index, ENUMERATE_COUNT, &actCount);
+
+		if (actCount <= 0) {
+			break;
+		}
+	}
+
+	if (afpError == afpObjectNotFound) {
+		afpError = AFP_OK;
+	}
+
+	client->GetIcon(load->dtRef, DT_CREATOR, DT_TYPE, DT_ICON_TYPE, DT_ICON_SIZE);
+	client->GetComment(load->dtRef, load->dirID, load->fileName);
+
+	return( afpError );
+}
+
+
+/*
+ * ReadFork()
+ *
+ * Description:
+ *		Read a whole fork from the start. The server may send back
+ *		less than we asked for without being at the end of the fork
+ *		(it caps a reply at its quantum), so only afpEofError or an
+ *		empty reply ends it.
+ *
+ * Returns: AFPERROR
+ */
+
+static AFPERROR ReadFork(LOAD_CLIENT* load, uint16 forkRef)
+{
+	afp_client*	client		= load->client;
+	size_t		transfer	= load->config->transferSize;
+	size_t		actCount	= 0;
+	off_t		offset		= 0;
+	AFPERROR	afpError	= AFP_OK;
+
+	do
+	{
+		afpError = client->Read(forkRef, offset, transfer, &actCount);
+
+		load->bytesRead	+= actCount;
+		offset			+= actCount;
+	}
+	while((AFP_SUCCESS(afpError)) && (actCount > 0));
+
+	return( (afpError == afpEofError) ? AFP_OK : afpError );
+}
+
+
+/*
+ * Launch()
+ *
+ * Description:
+ *		Opening an application, its parameters and icon, then both
+ *		forks read through.
+ *
+ * Returns: AFPERROR
+ */
+
+static AFPERROR Launch(LOAD_CLIENT* load)
+{
+	afp_client*	client		= load->client;
+	uint16		forkRef		= 0;
+	AFPERROR	afpError	= AFP_OK;
+
+	afpError = client->GetFileDirParms(load->volID, load->dirID, load->fileName, NULL);
+
+	if (AFP_SUCCESS(afpError)) {
+		client->GetIcon(load->dtRef, DT_CREATOR, DT_TYPE, DT_ICON_TYPE, DT_ICON_SIZE);
+	}
+
+	for (int32 fork = 0; (fork < 2) && (AFP_SUCCESS(afpError)); fork++)
+	{
+		afpError = client->OpenFork(load->volID, load->dirID, load->fileName, fork == 1, kReadMode, &forkRef);
+
+		if (AFP_SUCCESS(afpError))
+		{
+			afpError = ReadFork(load, forkRef);
+			client->CloseFork(forkRef);
+		}
+	}
+
+	return( afpError );
+}
+
+
+/*
+ * Copy()
+ *
+ * Description:
+ *		A Finder copy of the client's file next to itself, which is
+ *		then deleted.
+ *
+ * Returns: AFPERROR
+ */
+
+static AFPERROR Copy(LOAD_CLIENT* load)
+{
+	afp_client*			client		= load->client;
+	size_t				transfer	= load->config->transferSize;
+	std::vector<uint8>	data(transfer);
+	uint16				fromRef		= 0;
+	uint16				toRef		= 0;
+	size_t				actCount	= 0;
+	off_t				offset		= 0;
+	AFPERROR			afpError	= AFP_OK;
+
+	afpError = client->CreateFile(load->volID, load->dirID, load->copyName);
+
+	if (AFP_FAILURE(afpError)) {
+		return( afpError );
+	}
+
+	afpError = client->OpenFork(load->volID, load->dirID, load->fileName, false, kReadMode, &fromRef);
+
+	if (AFP_SUCCESS(afpError))
+	{
+		afpError = client->OpenFork(load->volID, load->dirID, load->copyName, false, kReadWriteMode, &toRef);
+
+		if (AFP_SUCCESS(afpError))
+		{
+			for (;;)
+			{
+				afpError = client->Read(fromRef, offset, transfer, &actCount);
+
+				load->bytesRead += actCount;
+
+				if ((AFP_FAILURE(afpError)) && (afpError != afpEofError)) {
+					break;
+				}
+
+				bool	last = ((afpError == afpEofError) || (actCount == 0));
+
+				//
+				//The reply data is gone with the next request, but all
+				//we care about is how much of it there was.
+				//
+				afpError	= WriteFile(load, toRef, offset, &data[0], actCount);
+				offset		+= actCount;
+
+				if ((last) || (AFP_FAILURE(afpError))) {
+					break;
+				}
+			}
+
+			client->CloseFork(toRef);
+		}
+
+		client->CloseFork(fromRef);
+	}
+
+	client->Delete(load->volID, load->dirID, load->copyName);
+
+	return( afpError );
+}
+
+
+/*
+ * Login()
+ *
+ * Description:
+ *		A Mac mounting a share from scratch, a new session logged
+ *		in with the configured UAM, then logged out and closed.
+ *
+ * Returns: AFPERROR
+ */
+
+static AFPERROR Login(LOAD_CLIENT* load)
+{
+	const LOAD_CONFIG*	config		= load->config;
+	afp_client*			client		= load->loginClient;
+	AFPERROR			afpError	= AFP_OK;
+
+	if (client->Connect(config->host, config->port) != B_OK) {
+		return( afpNoServer );
+	}
+
+	afpError = client->OpenSession();
+
+	if (AFP_SUCCESS(afpError))
+	{
+		afpError = client->Login(config->afpVersion, config->uam, config->user, config->password);
+
+		if (AFP_SUCCESS(afpError)) {
+			client->Logout();
+		}
+	}
+
+	client->CloseSession();
+
+	return( afpError );
+}
+
+
+/*
+ * Status()
+ *
+ * Description:
+ *		A status probe on a new connection, the way the Chooser and
+ *		Network Browser poll a server.
+ *
+ * Returns: AFPERROR
+ */
+
+static AFPERROR Status(LOAD_CLIENT* load)
+{
+	const LOAD_CONFIG*	config = load->config;
+
+	if (load->loginClient->Connect(config->host, config->port) != B_OK) {
+		return( afpNoServer );
+	}
+
+	return( load->loginClient->GetStatus() );
+}
+
+
+/*
+ * ClientThread()
+ *
+ * Description:
+ *		Set up, wait for everybody else, then run work picked by the
+ *		configured weights until told to stop.
+ *
+ * Returns: 0
+ */
+
+static int32 ClientThread(void* data)
+{
+	LOAD_CLIENT*		load		= (LOAD_CLIENT*)data;
+	const LOAD_CONFIG*	config		= load->config;
+	int32				total		= 0;
+	std::mt19937		random((uint32)(system_time() + load->index));
+
+	for (int32 i = 0; i < WORK_COUNT; i++) {
+		total += config->weights[i];
+	}
+
+	bool	ready = Setup(load);
+
+	sReady++;
+
+	while(!sGo) {
+		snooze(1000);
+	}
+
+	load->client->SetRecording(true);
+	load->loginClient->SetRecording(true);
+
+	while((ready) && (!sStop))
+	{
+		int32		pick		= (int32)(random() % total);
+		int32		work		= 0;
+		bigtime_t	started		= system_time();
+		AFPERROR	afpError	= AFP_OK;
+
+		while(pick >= config->weights[work])
+		{
+			pick -= config->weights[work];
+			work++;
+		}
+
+		switch(work)
+		{
+			case WORK_BROWSE:	afpError = Browse(load);	break;
+			case WORK_LAUNCH:	afpError = Launch(load);	break;
+			case WORK_COPY:		afpError = Copy(load);		break;
+			case WORK_LOGIN:	afpError = Login(load);		break;
+			case WORK_STATUS:	afpError = Status(load);	break;
+		}
+
+		if (((work == WORK_LOGIN) || (work == WORK_STATUS)) && (AFP_FAILURE(afpError)))
+		{
+			Fail(load, kWorkNames[work], afpError);
+			break;
+		}
+
+		if (!load->client->IsConnected())
+		{
+			Fail(load, kWorkNames[work], afpError);
+			break;
+		}
+
+		load->workTimes[work].push_back((uint32)(system_time() - started));
+	}
+
+	load->finished = system_time();
+	load->client->SetRecording(false);
+	load->loginClient->SetRecording(false);
+
+	Cleanup(load);
+
+	return( 0 );
+}
+
+
+/*
+ * ParseMix()
+ *
+ * Description:
+ *		"browse:50,launch:30,copy:20", work not named is not done.
+ *
+ * Returns: true if it made sense
+ */
+
+static bool ParseMix(const char* mix, int32* weights)
+{
+	char	buffer[256];
+	char*	state	= NULL;
+	int32	total	= 0;
+
+	strlcpy(buffer, mix, sizeof(buffer));
+
+	for (int32 i = 0; i < WORK_COUNT; i++) {
+		weights[i] = 0;
+	}
+
+	for (char* item = strtok_r(buffer, ",", &state); item != NULL; item = strtok_r(NULL, ",", &state))
+	{
+		char*	colon	= strchr(item, ':');
+		int32	work	= 0;
+
+		if (colon == NULL) {
+			return( false );
+		}
+
+		*colon = '\0';
+
+		while((work < WORK_COUNT) && (strcmp(item, kWorkNames[work]) != 0)) {
+			work++;
+		}
+
+		if (work == WORK_COUNT) {
+			return( false );
+		}
+
+		weights[work]	= std::max(atoi(colon + 1), 0);
+		total			+= weights[work];
+	}
+
+	return( total > 0 );
+}
+
+
+/*
+ * ParseVersion()
+ *
+ * Description:
+ *
+ * Returns: an afpVersion, 0 if unknown
+ */
+
+static int8 ParseVersion(const char* version)
+{
+	static const char*	versions[] = { "2.2", "3.0", "3.1", "3.2", "3.3" };
+
+	for (int32 i = 0; i < (int32)(sizeof(versions) / sizeof(versions[0])); i++)
+	{
+		if (strcmp(version, versions[i]) == 0) {
+			return( (int8)(afpVersion22 + i) );
+		}
+	}
+
+	return( 0 );
+}
+
+
+/*
+ * ParseUAM()
+ *
+ * Description:
+ *
+ * Returns: an afpUAM, 0 if unknown
+ */
+
+static int8 ParseUAM(const char* uam)
+{
+	if (strcmp(uam, "guest") == 0)		return( afpUAMGuest );
+	if (strcmp(uam, "cleartext") == 0)	return( afpUAMClearText );
+	if (strcmp(uam, "dhx") == 0)		return( afpUAMDHCAST128 );
+
+	return( 0 );
+}
+
+
+/*
+ * Report()
+ *
+ * Description:
+ *		Totals, then latency for each kind of work and each command.
+ *
+ * Returns: none
+ */
+
+static void Report(const LOAD_CONFIG* config, std::vector<LOAD_CLIENT>& clients, bigtime_t elapsed)
+{
+	std::vector<uint32>		workTimes[WORK_COUNT];
+	std::vector<uint32>		commandTimes[AFP_CLIENT_COMMANDS];
+	int32					commandErrors[AFP_CLIENT_COMMANDS] = {};
+	uint64					bytesRead		= 0;
+	uint64					bytesWritten	= 0;
+	uint64					operations		= 0;
+	int32					failed			= 0;
+	double					seconds			= elapsed / 1000000.0;
+
+	for (LOAD_CLIENT& load : clients)
+	{
+		const AFP_CLIENT_STATS*	stats		= load.client->Stats();
+		const AFP_CLIENT_STATS*	loginStats	= load.loginClient->Stats();
+
+		for (int32 i = 0; i < WORK_COUNT; i++) {
+			workTimes[i].insert(workTimes[i].end(), load.workTimes[i].begin(), load.workTimes[i].end());
+		}
+
+		for (int32 i = 0; i < AFP_CLIENT_COMMANDS; i++)
+		{
+			commandTimes[i].insert(commandTimes[i].end(), stats[i].times.begin(), stats[i].times.end());
+			commandErrors[i] += stats[i].errors;
+			operations += stats[i].times.size();
+
+			commandTimes[i].insert(commandTimes[i].end(), loginStats[i].times.begin(), loginStats[i].times.end());
+			commandErrors[i] += loginStats[i].errors;
+			operations += loginStats[i].times.size();
+		}
+
+		bytesRead		+= load.bytesRead;
+		bytesWritten	+= load.bytesWritten;
+
+		if (load.failed) {
+			failed++;
+		}
+	}
+
+	printf("%d clients, %.1f seconds", (int)config->clients, seconds);
+
+	if (failed > 0) {
+		printf(", %d failed", (int)failed);
+	}
+
+	printf("\n\n");
+	printf("%12llu operations  %10.1f ops/s\n", (unsigned long long)operations, operations / seconds);
+	printf("%12.1f MB read     %10.2f MB/s\n", bytesRead / 1048576.0, bytesRead / 1048576.0 / seconds);
+	printf("%12.1f MB written  %10.2f MB/s\n", bytesWritten / 1048576.0, bytesWritten / 1048576.0 / seconds);
+	printf("%12s             %10.2f MB/s total\n\n", "", (bytesRead + bytesWritten) / 1048576.0 / seconds);
+
+	printf("Latency by work (msecs)\n\n");
+	printf("%-24s %8s %9s %9s %9s %9s %9s\n", "work", "count", "per sec", "p50", "p95", "p99", "max");
+
+	for (int32 i = 0; i < WORK_COUNT; i++)
+	{
+		std::vector<uint32>&	times = workTimes[i];
+
+		if (times.empty()) {
+			continue;
+		}
+
+		std::sort(times.begin(), times.end());
+
+		printf("%-24s %8lu %9.1f %9.2f %9.2f %9.2f %9.2f\n",
+				kWorkNames[i],
+				(unsigned long)times.size(),
+				times.size() / seconds,
+				Percentile(times, 50) / 1000.0,
+				Percentile(times, 95) / 1000.0,
+				Percentile(times, 99) / 1000.0,
+				times.back() / 1000.0);
+	}
+
+	printf("\n");
+	printf("Latency by command (msecs)\n\n");
+	printf("%-24s %8s %7s %9s %9s %9s %9s %9s\n", "command", "count", "errors", "per sec", "p50", "p95", "p99", "max");
+
+	for (int32 i = 0; i < AFP_CLIENT_COMMANDS; i++)
+	{
+		std::vector<uint32>&	times = commandTimes[i];
+
+		if (times.empty()) {
+			continue;
+		}
+
+		std::sort(times.begin(), times.end());
+
+		printf("%-24s %8lu %7d %9.1f %9.2f %9.2f %9.2f %9.2f\n",
+				CommandName((uint8)i),
+				(unsigned long)times.size(),
+				(int)commandErrors[i],
+				times.size() / seconds,
+				Percentile(times, 50) / 1000.0,
+				Percentile(times, 95) / 1000.0,
+				Percentile(times, 99) / 1000.0,
+				times.back() / 1000.0);
+	}
+
+	printf("\n");
+}
+
+
+/*
+ * Usage()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+static void Usage()
+{
+	fprintf(stderr, "usage: afp_load [options] -V volume\n\n");
+	fprintf(stderr, "\t-h host\t\tserver address (default %s)\n", DEFAULT_HOST);
+	fprintf(stderr, "\t-p port\t\tserver port (default %d)\n", DEFAULT_PORT);
+	fprintf(stderr, "\t-c clients\tnumber of simultaneous clients (default %d)\n", DEFAULT_CLIENTS);
+	fprintf(stderr, "\t-t seconds\thow long to run (default %d)\n", DEFAULT_SECONDS);
+	fprintf(stderr, "\t-v version\tAFP version, 2.2, 3.0, 3.1, 3.2 or 3.3 (default 3.3)\n");
+	fprintf(stderr, "\t-a uam\t\tguest, cleartext or dhx (default guest)\n");
+	fprintf(stderr, "\t-u user\t\tuser name to log in as\n");
+	fprintf(stderr, "\t-w password\tpassword for the user\n");
+	fprintf(stderr, "\t-d directory\twhere to work, relative to the volume (default its root)\n");
+	fprintf(stderr, "\t-m mix\t\tweights of the work to do (default %s)\n", DEFAULT_MIX);
+	fprintf(stderr, "\t-s bytes\tsize of each client's test file (default %d)\n", DEFAULT_FILE_SIZE);
+	fprintf(stderr, "\t-r bytes\tlargest single read (default %d)\n\n", DEFAULT_TRANSFER_SIZE);
+	fprintf(stderr, "Each client writes a file named afp_load.<n> to the directory before\n");
+	fprintf(stderr, "the run and deletes it after, the volume must be writable.\n\n");
+	fprintf(stderr, "The login work opens a new session, logs in and out, and closes it.\n");
+	fprintf(stderr, "-m login:100 -a dhx measures encrypted logins per second.\n");
+	fprintf(stderr, "The status work is a DSIGetStatus on a new connection, -m status:100\n");
+	fprintf(stderr, "floods the server with them.\n");
+}
+
+
+/*
+ * main()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+int main(int argc, char** argv)
+{
+	LOAD_CONFIG		config;
+	int				option;
+
+	config.host			= DEFAULT_HOST;
+	config.port			= DEFAULT_PORT;
+	config.clients		= DEFAULT_CLIENTS;
+	config.seconds		= DEFAULT_SECONDS;
+	config.afpVersion	= afpVersion33;
+	config.uam			= afpUAMGuest;
+	config.user			= "";
+	config.password		= "";
+	config.volume		= NULL;
+	config.directory	= "";
+	config.fileSize		= DEFAULT_FILE_SIZE;
+	config.transferSize	= DEFAULT_TRANSFER_SIZE;
+
+	ParseMix(DEFAULT_MIX, config.weights);
+
+	while((option = getopt(argc, argv, "h:p:c:t:v:a:u:w:V:d:m:s:r:")) != -1)
+	{
+		switch(option)
+		{
+			case 'h':	config.host			= optarg;						break;
+			case 'p':	config.port			= (uint16)atoi(optarg);			break;
+			case 'c':	config.clients		= atoi(optarg);					break;
+			case 't':	config.seconds		= atoi(optarg);					break;
+			case 'v':	config.afpVersion	= ParseVersion(optarg);			break;
+			case 'a':	config.uam			= ParseUAM(optarg);				break;
+			case 'u':	config.user			= optarg;						break;
+			case 'w':	config.password		= optarg;						break;
+			case 'V':	config.volume		= optarg;						break;
+			case 'd':	config.directory	= optarg;						break;
+			case 's':	config.fileSize		= (size_t)atol(optarg);			break;
+			case 'r':	config.transferSize	= (size_t)atol(optarg);			break;
+
+			case 'm':
+				if (!ParseMix(optarg, config.weights))
+				{
+					fprintf(stderr, "afp_load: can't make sense of the mix %s\n", optarg);
+					return( 1 );
+				}
+				break;
+
+			default:
+				Usage();
+				return( 1 );
+		}
+	}
+
+	if (	(config.volume == NULL)		||
+			(config.clients <= 0)		||
+			(config.seconds <= 0)		||
+			(config.afpVersion == 0)	||
+			(config.uam == 0)			||
+			(config.transferSize == 0)		)
+	{
+		Usage();
+		return( 1 );
+	}
+
+	std::vector<LOAD_CLIENT>	clients(config.clients);
+	char						name[B_OS_NAME_LENGTH];
+
+	for (int32 i = 0; i < config.clients; i++)
+	{
+		LOAD_CLIENT&	load = clients[i];
+
+		load.index			= i;
+		load.config			= &config;
+		load.client			= new afp_client(config.transferSize);
+		load.loginClient	= new afp_client(config.transferSize);
+		load.volID			= 0;
+		load.dirID			= kRootDirID;
+		load.dtRef			= 0;
+		load.bytesRead		= 0;
+		load.bytesWritten	= 0;
+		load.finished		= 0;
+		load.failed			= false;
+
+		sprintf(name, "afp_load_%d", (int)i);
+
+		load.thread = spawn_thread(ClientThread, name, B_NORMAL_PRIORITY, &load);
+		resume_thread(load.thread);
+	}
+
+	while(sReady < config.clients) {
+		snooze(10000);
+	}
+
+	//
+	//Everybody is connected with their file written, start the clock.
+	//
+	bigtime_t	started		= system_time();
+	bigtime_t	finished	= started;
+
+	sGo = true;
+
+	snooze((bigtime_t)config.seconds * 1000000);
+
+	sStop = true;
+
+	for (LOAD_CLIENT& load : clients)
+	{
+		status_t	result;
+
+		wait_for_thread(load.thread, &result);
+
+		finished = std::max(finished, load.finished);
+	}
+
+	Report(&config, clients, finished - started);
+
+	for (LOAD_CLIENT& load : clients) {
+		delete load.client;
+		delete load.loginClient;
+	}
+
+	return( 0 );
+}
@@ -0,0 +1,565 @@
+/*
+ *	afptrace.cpp
+ *
+ *	Reads the request traces written by afp_server and reports where the
+ *	time went: latency by command, what each session did and when, and
+ *	the slowest requests.
+ *
+ *	usage: afp_trace [-n count] [-s session] tracefile ...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "afp.h"
+#include "dsi_connection.h"
+#include "dsi_trace.h"
+
+#define DEFAULT_TOP_COUNT		20
+
+typedef struct
+{
+	uint8		command;
+	const char*	name;
+}AFP_COMMAND_NAME;
+
+static const AFP_COMMAND_NAME	kCommandNames[] =
+{
+	{ afpByteRangeLock,			"FPByteRangeLock" },
+	{ afpVolClose,				"FPCloseVol" },
+	{ afpDirClose,				"FPCloseDir" },
+	{ afpForkClose,				"FPCloseFork" },
+	{ afpCopyFile,				"FPCopyFile" },
+	{ afpDirCreate,				"FPCreateDir" },
+	{ afpFileCreate,			"FPCreateFile" },
+	{ afpDelete,				"FPDelete" },
+	{ afpEnumerate,				"FPEnumerate" },
+	{ afpFlush,					"FPFlush" },
+	{ afpForkFlush,				"FPFlushFork" },
+	{ afpGetDirParms,			"FPGetDirParms" },
+	{ afpGetFileParms,			"FPGetFileParms" },
+	{ afpGetForkParms,			"FPGetForkParms" },
+	{ afpGetSInfo,				"FPGetSrvrInfo" },
+	{ afpGetSParms,				"FPGetSrvrParms" },
+	{ afpGetVolParms,			"FPGetVolParms" },
+	{ afpLogin,					"FPLogin" },
+	{ afpContLogin,				"FPLoginCont" },
+	{ afpLogout,				"FPLogout" },
+	{ afpMapID,					"FPMapID" },
+	{ afpMapName,				"FPMapName" },
+	{ afpMove,					"FPMoveAndRename" },
+	{ afpOpenVol,				"FPOpenVol" },
+	{ afpOpenDir,				"FPOpenDir" },
+	{ afpOpenFork,				"FPOpenFork" },
+	{ afpRead,					"FPRead" },
+	{ afpRename,				"FPRename" },
+	{ afpSetDirParms,			"FPSetDirParms" },
+	{ afpSetFileParms,			"FPSetFileParms" },
+	{ afpSetForkParms,			"FPSetForkParms" },
+	{ afpSetVolParms,			"FPSetVolParms" },
+	{ afpWrite,					"FPWrite" },
+	{ afpGetFlDrParms,			"FPGetFileDirParms" },
+	{ afpSetFlDrParms,			"FPSetFileDirParms" },
+	{ afpChangePwd,				"FPChangePassword" },
+	{ afpGetUserInfo,			"FPGetUserInfo" },
+	{ afpGetSrvrMsg,			"FPGetSrvrMsg" },
+	{ afpCreateID,				"FPCreateID" },
+	{ afpDeleteID,				"FPDeleteID" },
+	{ afpResolveID,				"FPResolveID" },
+	{ afpExchangeFiles,			"FPExchangeFiles" },
+	{ afpCatSearch,				"FPCatSearch" },
+	{ afpDTOpen,				"FPOpenDT" },
+	{ afpDTClose,				"FPCloseDT" },
+	{ afpGetIcon,				"FPGetIcon" },
+	{ afpGtIcnInfo,				"FPGetIconInfo" },
+	{ afpAddAPPL,				"FPAddAPPL" },
+	{ afpRmvAPPL,				"FPRemoveAPPL" },
+	{ afpGetAPPL,				"FPGetAPPL" },
+	{ afpAddCmt,				"FPAddComment" },
+	{ afpRmvCmt,				"FPRemoveComment" },
+	{ afpGetCmt,				"FPGetComment" },
+	{ afpAddIcon,				"FPAddIcon" },
+	{ afpByteRangeLockExt,		"FPByteRangeLockExt" },
+	{ afpReadExt,				"FPReadExt" },
+	{ afpWriteExt,				"FPWriteExt" },
+	{ afpGetAuthMethods,		"FPGetAuthMethods" },
+	{ afpLoginExt,				"FPLoginExt" },
+	{ afpGetSessionToken,		"FPGetSessionToken" },
+	{ afpDisconnectOldSession,	"FPDisconnectOldSession" },
+	{ afpEnumerateExt,			"FPEnumerateExt" },
+	{ afpCatSearchExt,			"FPCatSearchExt" },
+	{ afpEnumerateExt2,			"FPEnumerateExt2" },
+	{ afpGetExtAttr,			"FPGetExtAttr" },
+	{ afpSetExtAttr,			"FPSetExtAttr" },
+	{ afpRemoveExtAttr,			"FPRemoveExtAttr" },
+	{ afpListExtAttr,			"FPListExtAttrs" },
+	{ afpSyncDir,				"FPSyncDir" },
+	{ afpSyncFork,				"FPSyncFork" },
+	{ afpZzzzz,					"FPZzzzz" }
+};
+
+//
+//Latencies for one command, in usecs.
+//
+typedef struct
+{
+	std::vector<uint32>	times;
+	uint64				total;
+	uint64				bytes;
+	int32				errors;
+}COMMAND_STATS;
+
+
+/*
+ * CommandName()
+ *
+ * Description:
+ *		A readable name for what a record was. Only DSI commands and
+ *		writes carry an AFP command.
+ *
+ * Returns: const char*
+ */
+
+static const char* CommandName(const AFP_TRACE_RECORD& record)
+{
+	static char	unknown[32];
+
+	switch(record.dsiCommand)
+	{
+		case DSI_CMD_CloseSession:	return( "DSICloseSession" );
+		case DSI_CMD_GetStatus:		return( "DSIGetStatus" );
+		case DSI_CMD_OpenSession:	return( "DSIOpenSession" );
+		case DSI_CMD_Tickle:		return( "DSITickle" );
+		case DSI_CMD_Attention:		return( "DSIAttention" );
+
+		default:
+			break;
+	}
+
+	for (size_t i = 0; i < sizeof(kCommandNames) / sizeof(kCommandNames[0]); i++)
+	{
+		if (kCommandNames[i].command == record.afpCommand) {
+			return( kCommandNames[i].name );
+		}
+	}
+
+	sprintf(unknown, "AFP(%u)", (unsigned)record.afpCommand);
+
+	return( unknown );
+}
+
+
+/*
+ * FormatTime()
+ *
+ * Description:
+ *		Local time of day of a trace timestamp, to the millisecond.
+ *
+ * Returns: buffer
+ */
+
+static const char* FormatTime(int64 timestamp, char* buffer, size_t bufferSize)
+{
+	time_t		seconds = (time_t)(timestamp / 1000000);
+	struct tm	tstruct;
+	char		clock[32];
+
+	localtime_r(&seconds, &tstruct);
+	strftime(clock, sizeof(clock), "%m-%d %H:%M:%S", &tstruct);
+
+	snprintf(buffer, bufferSize, "%s.%03d", clock, (int)((timestamp % 1000000) / 1000));
+
+	return( buffer );
+}
+
+
+/*
+ * Percentile()
+ *
+ * Description:
+ *		times must be sorted.
+ *
+ * Returns: usecs
+ */
+
+static uint32 Percentile(const std::vector<uint32>& times, int32 percent)
+{
+	if (times.empty()) {
+		return( 0 );
+	}
+
+	size_t	index = (times.size() * percent) / 100;
+
+	return( times[std::min(index, times.size() - 1)] );
+}
+
+
+/*
+ * ReadTraceFile()
+ *
+ * Description:
+ *		Add the records in a trace file to records.
+ *
+ * Returns: true if the file was a trace
+ */
+
+static bool ReadTraceFile(const char* path, std::vector<AFP_TRACE_RECORD>& records)
+{
+	FILE*				file	= fopen(path, "rb");
+	AFP_TRACE_HEADER	header;
+
+	if (file == NULL)
+	{
+		fprintf(stderr, "afp_trace: can't open %s\n", path);
+		return( false );
+	}
+
+	if (	(fread(&header, sizeof(header), 1, file) != 1)		||
+			(header.magic != AFP_TRACE_MAGIC)					||
+			(header.version != AFP_TRACE_VERSION)				||
+			(header.recordSize != sizeof(AFP_TRACE_RECORD))			)
+	{
+		fprintf(stderr, "afp_trace: %s is not a trace this version can read\n", path);
+		fclose(file);
+		return( false );
+	}
+
+	//
+	//A file the server was still writing, or died writing, is its
+	//full size with count telling us how much of it is real.
+	//
+	uint32	count = std::min(header.count, header.capacity);
+	size_t	first = records.size();
+
+	records.resize(first + count);
+
+	size_t	got = fread(&records[first], sizeof(AFP_TRACE_RECORD), count, file);
+
+	records.resize(first + got);
+
+	//
+	//Records are finished out of order, so one the server died while
+	//writing is still zero.
+	//
+	records.erase(
+		std::remove_if(records.begin() + first, records.end(),
+			[](const AFP_TRACE_RECORD& record) { return( record.timestamp == 0 ); }),
+		records.end());
+
+	fclose(file);
+
+	return( true );
+}
+
+
+/*
+ * ReportCommands()
+ *
+ * Description:
+ *		Latency for each command, the ones the server spent the most
+ *		time on first.
+ *
+ * Returns: none
+ */
+
+static void ReportCommands(const std::vector<AFP_TRACE_RECORD>& records)
+{
+	std::map<std::string, COMMAND_STATS>	commands;
+
+	for (const AFP_TRACE_RECORD& record : records)
+	{
+		COMMAND_STATS&	stats = commands[CommandName(record)];
+
+		stats.times.push_back(record.serviceTime);
+		stats.total += record.serviceTime;
+		stats.bytes += (uint64)record.requestBytes + record.replyBytes;
+
+		if (record.afpError != AFP_OK) {
+			stats.errors++;
+		}
+	}
+
+	std::vector<std::pair<std::string, COMMAND_STATS*>>	order;
+
+	for (auto& command : commands)
+	{
+		std::sort(command.second.times.begin(), command.second.times.end());
+		order.push_back(std::make_pair(command.first, &command.second));
+	}
+
+	std::sort(order.begin(), order.end(),
+				[](const std::pair<std::string, COMMAND_STATS*>& a, const std::pair<std::string, COMMAND_STATS*>& b)
+				{ return( a.second->total > b.second->total ); });
+
+	printf("Latency by command (msecs)\n\n");
+	printf("%-24s %8s %7s %9s %9s %9s %9s %9s %11s %12s\n",
+			"command", "count", "errors", "avg", "p50", "p95", "p99", "max", "total", "bytes");
+
+	for (auto& entry : order)
+	{
+		COMMAND_STATS*	stats = entry.second;
+
+		printf("%-24s %8lu %7d %9.2f %9.2f %9.2f %9.2f %9.2f %11.1f %12llu\n",
+				entry.first.c_str(),
+				(unsigned long)stats->times.size(),
+				(int)stats->errors,
+				(double)stats->total / stats->times.size() / 1000.0,
+				Percentile(stats->times, 50) / 1000.0,
+				Percentile(stats->times, 95) / 1000.0,
+				Percentile(stats->times, 99) / 1000.0,
+				stats->times.back() / 1000.0,
+				stats->total / 1000.0,
+				(unsigned long long)stats->bytes);
+	}
+
+	printf("\n");
+}
+
+
+/*
+ * ReportSessions()
+ *
+ * Description:
+ *		When each session was active, how busy it kept the server and
+ *		its slowest request.
+ *
+ * Returns: none
+ */
+
+static void ReportSessions(const std::vector<AFP_TRACE_RECORD>& records)
+{
+	std::map<uint32, std::vector<const AFP_TRACE_RECORD*>>	sessions;
+	char	first[32];
+	char	last[32];
+
+	for (const AFP_TRACE_RECORD& record : records) {
+
+		sessions[record.session].push_back(&record);
+	}
+
+	printf("Sessions\n\n");
+	printf("%-10s %-18s %-18s %8s %7s %11s  %s\n",
+			"session", "first", "last", "requests", "errors", "busy msecs", "slowest");
+
+	for (auto& session : sessions)
+	{
+		const AFP_TRACE_RECORD*	slowest	= session.second.front();
+		uint64					busy	= 0;
+		int32					errors	= 0;
+
+		for (const AFP_TRACE_RECORD* record : session.second)
+		{
+			busy += record->serviceTime;
+
+			if (record->afpError != AFP_OK) {
+				errors++;
+			}
+
+			if (record->serviceTime > slowest->serviceTime) {
+				slowest = record;
+			}
+		}
+
+		printf("%-10u %-18s %-18s %8lu %7d %11.1f  %s %.2f msecs\n",
+				(unsigned)session.first,
+				FormatTime(session.second.front()->timestamp, first, sizeof(first)),
+				FormatTime(session.second.back()->timestamp, last, sizeof(last)),
+				(unsigned long)session.second.size(),
+				(int)errors,
+				busy / 1000.0,
+				CommandName(*slowest),
+				slowest->serviceTime / 1000.0);
+	}
+
+	printf("\n");
+}
+
+
+/*
+ * ReportTimeline()
+ *
+ * Description:
+ *		Every request one session made, in order, with the time since
+ *		the one before it. Long gaps are the client thinking or the
+ *		network, long service times are us.
+ *
+ * Returns: none
+ */
+
+static void ReportTimeline(const std::vector<AFP_TRACE_RECORD>& records, uint32 session)
+{
+	int64	previous = 0;
+	char	when[32];
+
+	printf("Timeline for session %u\n\n", (unsigned)session);
+	printf("%-18s %10s %-24s %6s %9s %9s %7s %10s\n",
+			"time", "gap msecs", "command", "req", "in", "out", "error", "msecs");
+
+	for (const AFP_TRACE_RECORD& record : records)
+	{
+		if (record.session != session) {
+			continue;
+		}
+
+		printf("%-18s %10.2f %-24s %6u %9u %9u %7d %10.2f\n",
+				FormatTime(record.timestamp, when, sizeof(when)),
+				(previous == 0) ? 0.0 : (record.timestamp - previous) / 1000.0,
+				CommandName(record),
+				(unsigned)record.requestID,
+				(unsigned)record.requestBytes,
+				(unsigned)record.replyBytes,
+				(int)record.afpError,
+				record.serviceTime / 1000.0);
+
+		previous = record.timestamp;
+	}
+
+	printf("\n");
+}
+
+
+/*
+ * ReportSlowest()
+ *
+ * Description:
+ *		The count slowest requests in the trace.
+ *
+ * Returns: none
+ */
+
+static void ReportSlowest(const std::vector<AFP_TRACE_RECORD>& records, size_t count)
+{
+	std::vector<const AFP_TRACE_RECORD*>	slowest;
+	char	when[32];
+
+	for (const AFP_TRACE_RECORD& record : records) {
+
+		slowest.push_back(&record);
+	}
+
+	count = std::min(count, slowest.size());
+
+	std::partial_sort(slowest.begin(), slowest.begin() + count, slowest.end(),
+				[](const AFP_TRACE_RECORD* a, const AFP_TRACE_RECORD* b)
+				{ return( a->serviceTime > b->serviceTime ); });
+
+	printf("%lu slowest requests\n\n", (unsigned long)count);
+	printf("%-18s %-10s %-24s %6s %9s %9s %7s %10s\n",
+			"time", "session", "command", "req", "in", "out", "error", "msecs");
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const AFP_TRACE_RECORD*	record = slowest[i];
+
+		printf("%-18s %-10u %-24s %6u %9u %9u %7d %10.2f\n",
+				FormatTime(record->timestamp, when, sizeof(when)),
+				(unsigned)record->session,
+				CommandName(*record),
+				(unsigned)record->requestID,
+				(unsigned)record->requestBytes,
+				(unsigned)record->replyBytes,
+				(int)record->afpError,
+				record->serviceTime / 1000.0);
+	}
+
+	printf("\n");
+}
+
+
+/*
+ * Usage()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+static void Usage()
+{
+	fprintf(stderr, "usage: afp_trace [-n count] [-s session] tracefile ...\n\n");
+	fprintf(stderr, "\t-n count\tnumber of slowest requests to list (default %d)\n", DEFAULT_TOP_COUNT);
+	fprintf(stderr, "\t-s session\talso list every request made by one session\n\n");
+	fprintf(stderr, "Trace files are written to ~/config/settings/%s.0 through .%d\n", AFP_TRACE_FILE_NAME, AFP_TRACE_FILES - 1);
+	fprintf(stderr, "while tracing is turned on in the server.\n");
+}
+
+
+/*
+ * main()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+int main(int argc, char** argv)
+{
+	std::vector<AFP_TRACE_RECORD>	records;
+	size_t							topCount	= DEFAULT_TOP_COUNT;
+	uint32							session		= 0;
+	bool							timeline	= false;
+	int								option;
+
+	while((option = getopt(argc, argv, "n:s:")) != -1)
+	{
+		switch(option)
+		{
+			case 'n':
+				topCount = (size_t)atol(optarg);
+				break;
+
+			case 's':
+				session		= (uint32)strtoul(optarg, NULL, 10);
+				timeline	= true;
+				break;
+
+			default:
+				Usage();
+				return( 1 );
+		}
+	}
+
+	if (optind >= argc)
+	{
+		Usage();
+		return( 1 );
+	}
+
+	for (int i = optind; i < argc; i++) {
+
+		ReadTraceFile(argv[i], records);
+	}
+
+	if (records.empty())
+	{
+		fprintf(stderr, "afp_trace: no requests found\n");
+		return( 1 );
+	}
+
+	//
+	//Files may be given in any order, and requests from different
+	//connections finish out of order.
+	//
+	std::stable_sort(records.begin(), records.end(),
+				[](const AFP_TRACE_RECORD& a, const AFP_TRACE_RECORD& b)
+				{ return( a.timestamp < b.timestamp ); });
+
+	ReportCommands(records);
+	ReportSessions(records);
+
+	if (timeline) {
+		ReportTimeline(records, session);
+	}
+
+	ReportSlowest(records, topCount);
+
+	return( 0 );
+}
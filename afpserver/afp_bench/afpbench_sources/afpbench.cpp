@@ -0,0 +1,1385 @@
+/*
+ *	afpbench.cpp
+ *
+ *	Microbenchmarks for the CPU bound paths of afp_server: the request
+ *	and reply codec, the parameter packers and the lookups done on
+ *	every request. Each benchmark runs long enough to be timed
+ *	reliably and the median of several runs is reported, either as a
+ *	table or as JSON so results can be compared between releases.
+ *
+ *	usage: afp_bench [-j] [-r runs] [-t msecs] [name ...]
+ *	       afp_bench -S [-j] [-a] [-n sizes] [-d depths] [-k samples]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "afpGlobals.h"
+#include "afp_os.h"
+#include "afp.h"
+#include "afp_buffer.h"
+#include "afp_session.h"
+#include "afpdesk.h"
+#include "afpread.h"
+#include "afpreplay.h"
+#include "afpsrvrinfo.h"
+#include "afpvolume.h"
+#include "dsi_connection.h"
+#include "finder_info.h"
+#include "fp_objects.h"
+#include "fp_rangelock.h"
+#include "fp_readahead.h"
+#include "fp_volume.h"
+#include "mac_roman.h"
+#include "afpbench.h"
+
+//
+//The server's main() lives in BeAFP.cpp, which isn't linked in.
+//
+int afpAppReturnValue(0);
+
+#define DEFAULT_RUNS			5
+#define DEFAULT_RUN_TIME		200		//msecs
+#define DEFAULT_SCALE_SIZES		"100,1000,10000,30000"
+#define DEFAULT_SCALE_DEPTHS	"1,5,10,20"
+#define DEFAULT_SCALE_SAMPLES	200
+#define BENCH_FOLDER_FILES		32
+#define BENCH_RANGE_LOCKS		64
+#define BENCH_DESKTOP_ICONS		128
+#define BENCH_BUFFER_SIZE		SRVR_REQUEST_QUANTUM_SIZE
+#define BENCH_NAME_LENGTH		255		//Longest name an AFP 3.x client may send
+#define BENCH_UTF8_NAME_SIZE	(BENCH_NAME_LENGTH * 3)
+#define BENCH_READ_FILE_SIZE	(8 * 1024 * 1024)
+
+#define BENCH_FILE_BITMAP		(kFPFileAttributes | kFPParentID | kFPCreateDate | kFPModDate |	\
+								 kFPFinderInfo | kFPLongName | kFPFileNum | kFPDFLen | kFPRFLen)
+#define BENCH_DIR_BITMAP		(kFPDirAttribute | kFPDirParentID | kFPDirCreateDate |				\
+								 kFPDirModDate | kFPDirFinderInfo | kFPDirLongName | kFPDirID |		\
+								 kFPDirOffCount | kFPDirOwnerID | kFPDirGroupID | kFPDirAccess)
+
+//
+//Everything the benchmarks share. The volume is a scratch folder in
+//the temp directory holding a few files and a desktop database, and
+//the session is a guest that has the volume open, which is as much
+//as the packers look at.
+//
+typedef struct
+{
+	char					folder[B_PATH_NAME_LENGTH];
+	fp_volume*				volume;
+	afp_session*			session;
+	uint16					dtRefnum;
+	fp_storage_entry*		fileEntry;
+	fp_storage_entry*		dirEntry;
+	std::unique_ptr<int8[]>	buffer;
+	afp_replay_cache*		replay;
+	OPEN_FORK_ITEM			forks[BENCH_FOLDER_FILES];
+	std::vector<fp_rangelock*>	locks;
+	std::vector<std::string>	macNames;	//kMacNames plus the 255 byte ones
+	std::vector<std::string>	utf8Names;	//The same as AFP 3.x clients send them
+
+	//
+	//The same large file open twice for reading, with read ahead and
+	//without, and where the next sequential read of each starts.
+	//
+	uint16					readRefs[2];
+	off_t					readOffsets[2];
+	std::unique_ptr<int8[]>	readBuffer;
+}BENCH_CONTEXT;
+
+typedef void (*BENCH_FUNC)(BENCH_CONTEXT* context, int64 iterations);
+
+typedef struct
+{
+	const char*		name;
+	BENCH_FUNC		func;
+}BENCHMARK;
+
+typedef struct
+{
+	const char*		name;
+	int64			iterations;
+	double			nsPerOp;
+	double			minNsPerOp;
+}BENCH_RESULT;
+
+//
+//Keeps the compiler from throwing away work whose result is unused.
+//
+static volatile int64	gSink = 0;
+
+static const char*	kFileNames[] =
+{
+	"Read Me.txt",
+	"Archive.sit",
+	"Backup.zip",
+	"Installer.image",
+	"Photo.jpeg",
+	"Makefile",
+	"notes.hqx",
+	"disk.img"
+};
+
+#define FILE_NAME_COUNT		(sizeof(kFileNames) / sizeof(kFileNames[0]))
+
+//
+//Names as we keep them on disk, in Mac Roman: accented letters, the
+//ligatures and typographic characters from the high half, a '/' kept
+//as REPLACE_SLASH_CHAR and a ':' that goes back to '/'. Setup() adds
+//two names of BENCH_NAME_LENGTH bytes, one ASCII and one not.
+//
+static const char*	kMacNames[] =
+{
+	"Read Me.txt",
+	"Caf\x8E Men\x9F.txt",
+	"\xCEuvres Compl\x8F" "tes \xAEsop",
+	"Of\xDE" "ce \xDFow \xA7 \xA4 \xA5",
+	"Q1\xB6Q2 Report \xD0 Final",
+	"Copy of Notes:Old",
+	"Lib\x8Er\x8E \xC7 \xC9 \xC8 Sp\x8E" "cial\xAA",
+	"\xA9 1998 \xA8 \xAA \xB5\xB9\xB8"
+};
+
+#define MAC_NAME_COUNT		(sizeof(kMacNames) / sizeof(kMacNames[0]))
+
+
+/*
+ * BenchPushNum()
+ *
+ * Description:
+ *		A reply's worth of mixed width integers.
+ *
+ * Returns: none
+ */
+
+static void BenchPushNum(BENCH_CONTEXT* context, int64 iterations)
+{
+	afp_buffer	reply(context->buffer.get(), BENCH_BUFFER_SIZE);
+
+	for (int64 i = 0; i < iterations; i++)
+	{
+		reply.Rewind();
+
+		for (int32 j = 0; j < 16; j++)
+		{
+			reply.push_num<int8>((int8)j);
+			reply.push_num<int16>((int16)i);
+			reply.push_num<int32>((int32)i);
+			reply.push_num<int64>(i);
+		}
+
+		gSink += reply.GetDataLength();
+	}
+}
+
+
+/*
+ * BenchPullNum()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+static void BenchPullNum(BENCH_CONTEXT* context, int64 iterations)
+{
+	afp_buffer	request(context->buffer.get(), BENCH_BUFFER_SIZE);
+	int64		sum = 0;
+
+	for (int64 i = 0; i < iterations; i++)
+	{
+		request.Rewind();
+
+		for (int32 j = 0; j < 16; j++)
+		{
+			sum += request.pull_num<int8>();
+			sum += request.pull_num<int16>();
+			sum += request.pull_num<int32>();
+			sum += request.pull_num<int64>();
+		}
+	}
+
+	gSink += sum;
+}
+
+
+/*
+ * BenchGetLongName()
+ *
+ * Description:
+ *		A kLongNames path as sent by AFP 2.x clients.
+ *
+ * Returns: none
+ */
+
+static void BenchGetLongName(BENCH_CONTEXT* context, int64 iterations)
+{
+	static const char	kPath[] = "Projects\0Source\0afp_session.cpp";
+	afp_buffer			request(context->buffer.get(), BENCH_BUFFER_SIZE);
+	char				name[MAX_AFP_PATH];
+
+	request.push_num<uint8>(sizeof(kPath) - 1);
+	request.AddRawData((void*)kPath, sizeof(kPath) - 1);
+
+	for (int64 i = 0; i < iterations; i++)
+	{
+		request.Rewind();
+		request.GetString(name, sizeof(name), true, kLongNames);
+
+		gSink += name[0];
+	}
+}
+
+
+/*
+ * BenchGetUnicodeName()
+ *
+ * Description:
+ *		A kUnicodeNames path as sent by AFP 3.x clients.
+ *
+ * Returns: none
+ */
+
+static void BenchGetUnicodeName(BENCH_CONTEXT* context, int64 iterations)
+{
+	static const char	kPath[] = "Projects\0Source\0Caf\xC3\xA9 Men\xC3\xBC.txt";
+	afp_buffer			request(context->buffer.get(), BENCH_BUFFER_SIZE);
+	char				name[MAX_AFP_PATH];
+
+	request.push_num<uint32>(0);
+	request.push_num<uint16>(sizeof(kPath) - 1);
+	request.AddRawData((void*)kPath, sizeof(kPath) - 1);
+
+	for (int64 i = 0; i < iterations; i++)
+	{
+		request.Rewind();
+		request.GetString(name, sizeof(name), true, kUnicodeNames);
+
+		gSink += name[0];
+	}
+}
+
+
+/*
+ * BenchAddUniString()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+static void BenchAddUniString(BENCH_CONTEXT* context, int64 iterations)
+{
+	char		name[] = "Caf\xC3\xA9 Men\xC3\xBC.txt";
+	afp_buffer	reply(context->buffer.get(), BENCH_BUFFER_SIZE);
+
+	for (int64 i = 0; i < iterations; i++)
+	{
+		reply.Rewind();
+		reply.AddUniString(name, true);
+
+		gSink += reply.GetDataLength();
+	}
+}
+
+
+/*
+ * BenchNameEncode()
+ *
+ * Description:
+ *		Mac Roman to UTF-8 with the path substitutions, as every name
+ *		in an AFP 3.x reply is.
+ *
+ * Returns: none
+ */
+
+static void BenchNameEncode(BENCH_CONTEXT* context, int64 iterations)
+{
+	char	name[BENCH_UTF8_NAME_SIZE];
+	size_t	count = context->macNames.size();
+
+	for (int64 i = 0; i < iterations; i++)
+	{
+		const std::string&	src = context->macNames[i % count];
+		int32				len = sizeof(name);
+
+		MacRomanToUTF8(src.data(), (int32)src.size(), name, &len, true);
+
+		gSink += len;
+	}
+}
+
+
+/*
+ * BenchNameDecode()
+ *
+ * Description:
+ *		The other way, as every name in an AFP 3.x request is.
+ *
+ * Returns: none
+ */
+
+static void BenchNameDecode(BENCH_CONTEXT* context, int64 iterations)
+{
+	char	name[BENCH_NAME_LENGTH];
+	size_t	count = context->utf8Names.size();
+
+	for (int64 i = 0; i < iterations; i++)
+	{
+		const std::string&	src = context->utf8Names[i % count];
+		int32				len = sizeof(name);
+
+		UTF8ToMacRoman(src.data(), (int32)src.size(), name, &len, true);
+
+		gSink += len;
+	}
+}
+
+
+/*
+ * BenchGetSrvrInfo()
+ *
+ * Description:
+ *		What a DSIGetStatus costs, a copy of the packed reply.
+ *
+ * Returns: none
+ */
+
+static void BenchGetSrvrInfo(BENCH_CONTEXT* context, int64 iterations)
+{
+	int8	request[2] = { afpGetSInfo, 0 };
+	int32	size = 0;
+
+	for (int64 i = 0; i < iterations; i++)
+	{
+		FPGetSrvrInfo(NULL, request, context->buffer.get(), &size);
+
+		gSink += size;
+	}
+}
+
+
+/*
+ * BenchSrvrInfoUpdate()
+ *
+ * Description:
+ *		Repacking the server info, which every status probe used to
+ *		do and now only a hostname or guest account change does.
+ *
+ * Returns: none
+ */
+
+static void BenchSrvrInfoUpdate(BENCH_CONTEXT* context, int64 iterations)
+{
+	#pragma unused(context)
+
+	for (int64 i = 0; i < iterations; i++) {
+		gAFPSrvrInfo.Update();
+	}
+}
+
+
+/*
+ * BenchGetFileParms()
+ *
+ * Description:
+ *		The bitmap the Finder asks for when it lists a window.
+ *
+ * Returns: none
+ */
+
+static void BenchGetFileParms(BENCH_CONTEXT* context, int64 iterations)
+{
+	afp_buffer	reply(context->buffer.get(), BENCH_BUFFER_SIZE);
+
+	for (int64 i = 0; i < iterations; i++)
+	{
+		reply.Rewind();
+
+		fp_objects::fp_GetFileParms(
+						context->session,
+						context->volume,
+						context->fileEntry,
+						BENCH_FILE_BITMAP,
+						&reply
+						);
+
+		gSink += reply.GetDataLength();
+	}
+}
+
+
+/*
+ * BenchGetDirParms()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+static void BenchGetDirParms(BENCH_CONTEXT* context, int64 iterations)
+{
+	afp_buffer	reply(context->buffer.get(), BENCH_BUFFER_SIZE);
+
+	for (int64 i = 0; i < iterations; i++)
+	{
+		reply.Rewind();
+
+		fp_objects::fp_GetDirParms(
+						context->session,
+						context->volume,
+						context->dirEntry,
+						BENCH_DIR_BITMAP,
+						&reply
+						);
+
+		gSink += reply.GetDataLength();
+	}
+}
+
+
+/*
+ * BenchReadExt()
+ *
+ * Description:
+ *		Sequential FPReadExt calls of BLOCK bytes through the file,
+ *		handled the way dsi_StreamRead() does: replies that fit in
+ *		one send buffer are built by FPReadReply(), larger ones are
+ *		read a segment at a time. Only the socket is missing.
+ *
+ * Returns: none
+ */
+
+template <size_t BLOCK, bool READAHEAD>
+static void BenchReadExt(BENCH_CONTEXT* context, int64 iterations)
+{
+	const int32		which		= READAHEAD ? 0 : 1;
+	const size_t	segmentSize	= SEND_BUFFER_SIZE - DSI_HEADER_SIZE;
+	int8			requestData[32];
+
+	for (int64 i = 0; i < iterations; i++)
+	{
+		afp_buffer		request(requestData, sizeof(requestData));
+		off_t			afpOffset	= 0;
+		off_t			afpForkLen	= 0;
+		size_t			afpReqCount	= 0;
+		int32			afpDataSize	= 0;
+		OPEN_FORK_ITEM*	forkItem	= NULL;
+
+		if (context->readOffsets[which] + (off_t)BLOCK > BENCH_READ_FILE_SIZE) {
+			context->readOffsets[which] = 0;
+		}
+
+		request.push_num<uint8>(afpReadExt);
+		request.push_num<uint8>(0);
+		request.push_num<uint16>(context->readRefs[which]);
+		request.push_num<int64>(context->readOffsets[which]);
+		request.push_num<int64>(BLOCK);
+
+		if (AFP_FAILURE(FPReadCheck(
+							context->session,
+							requestData,
+							DSI_MAX_STREAMED_READ,
+							&afpForkLen,
+							&forkItem,
+							&afpOffset,
+							&afpReqCount
+							)))
+		{
+			continue;
+		}
+
+		if (afpReqCount <= segmentSize)
+		{
+			FPReadReply(context->session, forkItem, afpOffset, afpReqCount, context->readBuffer.get(), &afpDataSize);
+
+			gSink += afpDataSize;
+		}
+		else
+		{
+			for (size_t done = 0; done < afpReqCount; done += segmentSize)
+			{
+				gSink += FPReadFork(
+							context->session,
+							forkItem,
+							afpOffset + done,
+							context->readBuffer.get(),
+							std::min(segmentSize, afpReqCount - done)
+							);
+			}
+		}
+
+		context->readOffsets[which] += BLOCK;
+	}
+}
+
+
+/*
+ * BenchFinderInfo()
+ *
+ * Description:
+ *		Known and unknown extensions, the unknown ones walk the
+ *		whole map.
+ *
+ * Returns: none
+ */
+
+static void BenchFinderInfo(BENCH_CONTEXT* context, int64 iterations)
+{
+	#pragma unused(context)
+
+	FINDER_INFO	finfo;
+
+	for (int64 i = 0; i < iterations; i++)
+	{
+		FinderInfoBasedOnExtension(kFileNames[i % FILE_NAME_COUNT], &finfo);
+
+		gSink += finfo.fdType[0];
+	}
+}
+
+
+/*
+ * BenchReplayAdd()
+ *
+ * Description:
+ *		A small reply cached for every request, as happens on a
+ *		session that supports reconnect.
+ *
+ * Returns: none
+ */
+
+static void BenchReplayAdd(BENCH_CONTEXT* context, int64 iterations)
+{
+	for (int64 i = 0; i < iterations; i++)
+	{
+		context->replay->AddReply(
+						(uint16)i,
+						DSI_CMD_Command,
+						afpGetFlDrParms,
+						AFP_OK,
+						context->buffer.get(),
+						128
+						);
+	}
+
+	gSink += context->replay->GetBytesCached();
+}
+
+
+/*
+ * BenchReplayFind()
+ *
+ * Description:
+ *		Half the lookups hit, half are for requests that have
+ *		already been pushed out.
+ *
+ * Returns: none
+ */
+
+static void BenchReplayFind(BENCH_CONTEXT* context, int64 iterations)
+{
+	int64	found = 0;
+
+	context->replay->Empty();
+
+	for (uint16 id = 0; id < AFP_REPLAY_CACHE_SIZE; id++)
+	{
+		context->replay->AddReply(
+						id,
+						DSI_CMD_Command,
+						afpGetFlDrParms,
+						AFP_OK,
+						context->buffer.get(),
+						128
+						);
+	}
+
+	for (int64 i = 0; i < iterations; i++)
+	{
+		uint16	id = (uint16)(i % (AFP_REPLAY_CACHE_SIZE * 2));
+
+		if (context->replay->Find(id, afpGetFlDrParms) != NULL) {
+			found++;
+		}
+	}
+
+	gSink += found;
+}
+
+
+/*
+ * BenchRangeLocked()
+ *
+ * Description:
+ *		Checks a range against every lock held on the volume, as
+ *		FPRead and FPWrite do.
+ *
+ * Returns: none
+ */
+
+static void BenchRangeLocked(BENCH_CONTEXT* context, int64 iterations)
+{
+	int64	locked = 0;
+
+	for (int64 i = 0; i < iterations; i++)
+	{
+		OPEN_FORK_ITEM*	fork	= &context->forks[i % BENCH_FOLDER_FILES];
+		off_t			start	= (i % 8) * 4096;
+
+		if (fp_rangelock::RangeLocked(start, start + 4095, fork->entry)) {
+			locked++;
+		}
+	}
+
+	gSink += locked;
+}
+
+
+/*
+ * BenchDesktopFind()
+ *
+ * Description:
+ *		Icon lookups by creator and type, as FPGetIcon does.
+ *
+ * Returns: none
+ */
+
+static void BenchDesktopFind(BENCH_CONTEXT* context, int64 iterations)
+{
+	DESKTOP_ENTRY	criteria;
+	DESKTOP_ENTRY	found;
+	int64			hits = 0;
+
+	criteria.entryType	= ENTRY_TYPE_ICON;
+	criteria.iconType	= 1;
+
+	for (int64 i = 0; i < iterations; i++)
+	{
+		int32	icon = (int32)(i % BENCH_DESKTOP_ICONS);
+
+		criteria.fileCreator	= 'BNC0' + icon;
+		criteria.fileType		= 'APPL';
+
+		if (AFP_SUCCESS(afp_FindDTEntry(context->session, context->dtRefnum, &criteria, 0, &found))) {
+			hits++;
+		}
+	}
+
+	gSink += hits;
+}
+
+
+static const BENCHMARK	kBenchmarks[] =
+{
+	{ "buffer_push_num",		BenchPushNum },
+	{ "buffer_pull_num",		BenchPullNum },
+	{ "buffer_get_long_name",	BenchGetLongName },
+	{ "buffer_get_unicode_name",BenchGetUnicodeName },
+	{ "buffer_add_uni_string",	BenchAddUniString },
+	{ "name_encode_utf8",		BenchNameEncode },
+	{ "name_decode_utf8",		BenchNameDecode },
+	{ "get_srvr_info",			BenchGetSrvrInfo },
+	{ "srvr_info_update",		BenchSrvrInfoUpdate },
+	{ "get_file_parms",			BenchGetFileParms },
+	{ "get_dir_parms",			BenchGetDirParms },
+
+	{ "read_ext_4k_readahead",	BenchReadExt<4 * 1024, true> },
+	{ "read_ext_4k_direct",		BenchReadExt<4 * 1024, false> },
+	{ "read_ext_32k_readahead",	BenchReadExt<32 * 1024, true> },
+	{ "read_ext_32k_direct",	BenchReadExt<32 * 1024, false> },
+	{ "read_ext_64k_readahead",	BenchReadExt<64 * 1024, true> },
+	{ "read_ext_64k_direct",	BenchReadExt<64 * 1024, false> },
+	{ "finder_info_extension",	BenchFinderInfo },
+	{ "replay_add",				BenchReplayAdd },
+	{ "replay_find",			BenchReplayFind },
+	{ "range_locked",			BenchRangeLocked },
+	{ "desktop_find_icon",		BenchDesktopFind }
+};
+
+#define BENCHMARK_COUNT		(sizeof(kBenchmarks) / sizeof(kBenchmarks[0]))
+
+
+/*
+ * CreateFile()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+static status_t CreateFile(fp_storage_dir* dir, const char* name, size_t size)
+{
+	fp_storage_node	file;
+	status_t		status = dir->CreateFile(name, &file, false);
+
+	if (status == B_OK)
+	{
+		std::vector<char>	data(size, 'x');
+
+		file.WriteAt(0, data.data(), data.size());
+	}
+
+	return( status );
+}
+
+
+/*
+ * RemoveFolder()
+ *
+ * Description:
+ *		Deletes a folder and everything in it.
+ *
+ * Returns: none
+ */
+
+void RemoveFolder(fp_storage_entry* folder)
+{
+	fp_storage_dir		dir(folder);
+	fp_storage_entry	entry;
+
+	while(dir.GetNextEntry(&entry) == B_OK)
+	{
+		if (entry.IsDirectory()) {
+			RemoveFolder(&entry);
+		}
+		else {
+			entry.Remove();
+		}
+	}
+
+	folder->Remove();
+}
+
+
+/*
+ * Setup()
+ *
+ * Description:
+ *		Builds the scratch volume and the state hung off it.
+ *
+ * Returns: B_OK or an error
+ */
+
+static status_t Setup(BENCH_CONTEXT* context)
+{
+	fp_storage_dir	temp;
+	fp_storage_dir	root;
+	fp_storage_dir	folder;
+	char			path[B_PATH_NAME_LENGTH];
+	char			name[B_FILE_NAME_LENGTH];
+	status_t		status;
+
+	status = fp_storage_temp_dir(path, sizeof(path));
+
+	if (status != B_OK) {
+		return( status );
+	}
+
+	snprintf(name, sizeof(name), "afp_bench.%d", (int)getpid());
+	snprintf(context->folder, sizeof(context->folder), "%s/%s", path, name);
+
+	status = temp.SetTo(path);
+
+	if (status == B_OK) {
+		status = temp.CreateDirectory(name, &root);
+	}
+
+	if (status == B_OK) {
+		status = root.CreateDirectory("Folder", &folder);
+	}
+
+	if (status != B_OK) {
+		return( status );
+	}
+
+	for (int32 i = 0; i < BENCH_FOLDER_FILES; i++)
+	{
+		snprintf(name, sizeof(name), "%02d %s", (int)i, kFileNames[i % FILE_NAME_COUNT]);
+		CreateFile(&folder, name, 4096 * (i + 1));
+	}
+
+	CreateFile(&root, "Document.txt", 65536);
+	CreateFile(&root, "Movie.mov", BENCH_READ_FILE_SIZE);
+
+	context->fileEntry	= new fp_storage_entry(&root, "Document.txt");
+	context->dirEntry	= new fp_storage_entry(&root, "Folder");
+	context->buffer.reset(new int8[BENCH_BUFFER_SIZE]);
+	context->replay		= new afp_replay_cache();
+
+	memset(context->buffer.get(), 0, BENCH_BUFFER_SIZE);
+
+	//
+	//The name corpus, and its UTF-8 form made by the code that's
+	//being timed.
+	//
+	std::string		longName;
+
+	context->macNames.assign(kMacNames, kMacNames + MAC_NAME_COUNT);
+
+	while(longName.size() < BENCH_NAME_LENGTH) {
+		longName += "Long File Name ";
+	}
+
+	context->macNames.push_back(longName.substr(0, BENCH_NAME_LENGTH));
+	longName.clear();
+
+	while(longName.size() < BENCH_NAME_LENGTH) {
+		longName += "\x8A\x9A\xDE\xDF\xCF\xBE\xB6 ";
+	}
+
+	context->macNames.push_back(longName.substr(0, BENCH_NAME_LENGTH));
+
+	for (const std::string& macName : context->macNames)
+	{
+		char	utf8[BENCH_UTF8_NAME_SIZE];
+		int32	len = sizeof(utf8);
+
+		if (MacRomanToUTF8(macName.data(), (int32)macName.size(), utf8, &len, true) != B_OK) {
+			return( B_ERROR );
+		}
+
+		context->utf8Names.push_back(std::string(utf8, len));
+	}
+
+	//
+	//Shared the way StartSharingVolume() shares any other, so the
+	//calls that look volumes up by ID find it.
+	//
+	VolumeStorageData	volData;
+
+	memset(&volData, 0, sizeof(volData));
+
+	volData.version	= VOLUME_DATA_V1;
+	volData.flags	= 0;
+	strlcpy(volData.path, context->folder, sizeof(volData.path));
+
+	if (StartSharingVolume(&volData) != B_OK) {
+		return( B_ERROR );
+	}
+
+	context->volume		= FindVolume(strrchr(context->folder, '/') + 1);
+	context->session	= new afp_session(NULL);
+
+	if (context->volume == NULL) {
+		return( B_ERROR );
+	}
+
+	context->session->SetAFPVersion(afpVersion33);
+	context->session->SetUAMLoginType(afpUAMGuest);
+	context->session->SetIsAuthenticated(true);
+	context->session->VolumeOpened(context->volume);
+
+	//
+	//Forks are opened the way FPOpenFork does it, then the second
+	//one has its read ahead taken away.
+	//
+	fp_storage_entry	movieEntry(&root, "Movie.mov");
+
+	context->readBuffer.reset(new int8[SEND_BUFFER_SIZE]);
+
+	for (int32 i = 0; i < 2; i++)
+	{
+		if (AFP_FAILURE(context->session->OpenFile(
+								context->volume,
+								&movieEntry,
+								kReadMode,
+								kDataFork,
+								&context->readRefs[i]
+								)))
+		{
+			return( B_ERROR );
+		}
+	}
+
+	OPEN_FORK_ITEM*	directFork = context->session->GetForkItem(context->readRefs[1]);
+
+	delete directFork->readAhead;
+	directFork->readAhead = NULL;
+
+	//
+	//Locks on every file in the folder, none of which overlap the
+	//ranges that are asked about, so each query looks at them all.
+	//
+	folder.Rewind();
+
+	for (int32 i = 0; i < BENCH_FOLDER_FILES; i++)
+	{
+		OPEN_FORK_ITEM*	fork = &context->forks[i];
+
+		fork->refnum	= (uint16)(i + 1);
+		fork->entry		= new fp_storage_entry();
+		fork->brlList	= new BList();
+		fork->volume	= context->volume;
+
+		folder.GetNextEntry(fork->entry);
+	}
+
+	for (int32 i = 0; i < BENCH_RANGE_LOCKS; i++)
+	{
+		fp_rangelock*	lock = new fp_rangelock(&context->forks[i % BENCH_FOLDER_FILES]);
+
+		lock->Lock(1024 * 1024 + i * 4096, 4096);
+		context->locks.push_back(lock);
+	}
+
+	//
+	//A desktop database holding an icon for each of a set of
+	//made up applications.
+	//
+	snprintf(path, sizeof(path), "%s/%s", context->folder, DESKTOP_FILE_NAME);
+
+	fp_storage_node*	dtFile	= new fp_storage_node();
+
+	dtFile->SetTo(path, FP_STORAGE_READ | FP_STORAGE_WRITE | FP_STORAGE_CREATE | FP_STORAGE_TRUNCATE);
+
+	fp_storage_entry*	dtEntry	= new fp_storage_entry(path);
+
+	status = context->session->OpenDesktop(
+							dtEntry,
+							dtFile,
+							context->volume->GetVolumeID(),
+							&context->dtRefnum
+							);
+
+	if (status != AFP_OK)
+	{
+		delete dtEntry;
+		delete dtFile;
+
+		return( B_ERROR );
+	}
+
+	for (int32 i = 0; i < BENCH_DESKTOP_ICONS; i++)
+	{
+		DESKTOP_ENTRY	icon;
+
+		icon.entryType		= ENTRY_TYPE_ICON;
+		icon.fileCreator	= 'BNC0' + i;
+		icon.fileType		= 'APPL';
+		icon.iconType		= 1;
+		icon.dataSize		= 256;
+
+		memset(icon.data, i, icon.dataSize);
+
+		afp_AddEntry(context->session, context->dtRefnum, &icon);
+	}
+
+	return( B_OK );
+}
+
+
+/*
+ * Cleanup()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+static void Cleanup(BENCH_CONTEXT* context)
+{
+	fp_storage_entry	folder(context->folder);
+
+	for (fp_rangelock* lock : context->locks) {
+
+		delete lock;
+	}
+
+	for (int32 i = 0; i < BENCH_FOLDER_FILES; i++)
+	{
+		delete context->forks[i].entry;
+		delete context->forks[i].brlList;
+	}
+
+	if (context->session != NULL)
+	{
+		for (int32 i = 0; i < 2; i++)
+		{
+			if (context->readRefs[i] != 0) {
+				context->session->CloseFile(context->readRefs[i]);
+			}
+		}
+
+		context->session->CloseDesktop(context->dtRefnum);
+		context->session->VolumeClosed(context->volume);
+
+		delete context->session;
+	}
+
+	if (context->volume != NULL) {
+		StopSharingVolume(context->folder);
+	}
+
+	delete context->replay;
+	delete context->fileEntry;
+	delete context->dirEntry;
+
+	RemoveFolder(&folder);
+}
+
+
+/*
+ * TimeRun()
+ *
+ * Description:
+ *
+ * Returns: elapsed time in microseconds
+ */
+
+static bigtime_t TimeRun(const BENCHMARK* bench, BENCH_CONTEXT* context, int64 iterations)
+{
+	bigtime_t	start = system_time();
+
+	bench->func(context, iterations);
+
+	return( system_time() - start );
+}
+
+
+/*
+ * RunBenchmark()
+ *
+ * Description:
+ *		Doubles the iteration count until a run takes at least
+ *		runTime, then times that many iterations runs times.
+ *
+ * Returns: none
+ */
+
+static void RunBenchmark(
+	const BENCHMARK*	bench,
+	BENCH_CONTEXT*		context,
+	int32				runs,
+	bigtime_t			runTime,
+	BENCH_RESULT*		result
+	)
+{
+	std::vector<double>	samples;
+	int64				iterations	= 1;
+	bigtime_t			elapsed		= TimeRun(bench, context, iterations);
+
+	while(elapsed < runTime)
+	{
+		//
+		//Jump close to the target once the timing means something,
+		//otherwise keep doubling.
+		//
+		if (elapsed > 1000) {
+			iterations = std::max(iterations * 2, (int64)(iterations * runTime * 1.2 / elapsed));
+		}
+		else {
+			iterations *= 2;
+		}
+
+		elapsed = TimeRun(bench, context, iterations);
+	}
+
+	for (int32 i = 0; i < runs; i++)
+	{
+		elapsed = TimeRun(bench, context, iterations);
+		samples.push_back((elapsed * 1000.0) / iterations);
+	}
+
+	std::sort(samples.begin(), samples.end());
+
+	result->name		= bench->name;
+	result->iterations	= iterations;
+	result->nsPerOp		= samples[samples.size() / 2];
+	result->minNsPerOp	= samples[0];
+}
+
+
+/*
+ * PrintTable()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+static void PrintTable(const std::vector<BENCH_RESULT>& results)
+{
+	printf("%-26s %12s %12s %12s %14s\n", "benchmark", "iterations", "ns/op", "min ns/op", "ops/s");
+
+	for (const BENCH_RESULT& result : results)
+	{
+		printf("%-26s %12lld %12.1f %12.1f %14.0f\n",
+				result.name,
+				(long long)result.iterations,
+				result.nsPerOp,
+				result.minNsPerOp,
+				1e9 / result.nsPerOp);
+	}
+}
+
+
+/*
+ * PrintJSON()
+ *
+ * Description:
+ *		One object per benchmark. Names never change meaning between
+ *		releases, a benchmark that measures something different gets
+ *		a new name.
+ *
+ * Returns: none
+ */
+
+static void PrintJSON(const std::vector<BENCH_RESULT>& results, int32 runs)
+{
+	system_info		info;
+
+	get_system_info(&info);
+
+	printf("{\n");
+	printf("\t\"tool\": \"afp_bench\",\n");
+	printf("\t\"format\": 1,\n");
+	printf("\t\"cpus\": %u,\n", (unsigned)info.cpu_count);
+	printf("\t\"runs\": %d,\n", (int)runs);
+	printf("\t\"results\": [\n");
+
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BENCH_RESULT&	result = results[i];
+
+		printf("\t\t{ \"name\": \"%s\", \"iterations\": %lld, \"ns_per_op\": %.2f, \"min_ns_per_op\": %.2f, \"ops_per_sec\": %.0f }%s\n",
+				result.name,
+				(long long)result.iterations,
+				result.nsPerOp,
+				result.minNsPerOp,
+				1e9 / result.nsPerOp,
+				(i + 1 < results.size()) ? "," : "");
+	}
+
+	printf("\t]\n");
+	printf("}\n");
+}
+
+
+/*
+ * Usage()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+static void Usage()
+{
+	fprintf(stderr, "usage: afp_bench [-j] [-l] [-r runs] [-t msecs] [name ...]\n");
+	fprintf(stderr, "       afp_bench -S [-j] [-a] [-n sizes] [-d depths] [-k samples]\n\n");
+	fprintf(stderr, "\t-j\t\twrite the results as JSON\n");
+	fprintf(stderr, "\t-l\t\tlist the benchmarks and exit\n");
+	fprintf(stderr, "\t-r runs\t\ttimed runs per benchmark, the median is reported (default %d)\n", DEFAULT_RUNS);
+	fprintf(stderr, "\t-t msecs\tminimum length of a run (default %d)\n\n", DEFAULT_RUN_TIME);
+	fprintf(stderr, "Names select the benchmarks whose name starts with them, all are run\n");
+	fprintf(stderr, "by default.\n\n");
+	fprintf(stderr, "\t-S\t\tmeasure how AFP calls scale with folder size and tree depth\n");
+	fprintf(stderr, "\t-a\t\tgive generated files AFP attributes up front\n");
+	fprintf(stderr, "\t-n sizes\tfiles in the large folder (default %s)\n", DEFAULT_SCALE_SIZES);
+	fprintf(stderr, "\t-d depths\tlevels in the deep tree (default %s)\n", DEFAULT_SCALE_DEPTHS);
+	fprintf(stderr, "\t-k samples\ttimed calls per operation (default %d)\n", DEFAULT_SCALE_SAMPLES);
+}
+
+
+/*
+ * Selected()
+ *
+ * Description:
+ *
+ * Returns: true if the benchmark was asked for
+ */
+
+static bool Selected(const BENCHMARK* bench, int argc, char** argv)
+{
+	if (optind >= argc) {
+		return( true );
+	}
+
+	for (int i = optind; i < argc; i++)
+	{
+		if (strncmp(bench->name, argv[i], strlen(argv[i])) == 0) {
+			return( true );
+		}
+	}
+
+	return( false );
+}
+
+
+/*
+ * ParseList()
+ *
+ * Description:
+ *		A comma separated list of positive numbers.
+ *
+ * Returns: none
+ */
+
+static void ParseList(const char* list, std::vector<int32>& values)
+{
+	values.clear();
+
+	while(*list != '\0')
+	{
+		char*	end		= NULL;
+		long	value	= strtol(list, &end, 10);
+
+		if (end == list) {
+			break;
+		}
+
+		if (value > 0) {
+			values.push_back((int32)value);
+		}
+
+		list = (*end == ',') ? end + 1 : end;
+	}
+}
+
+
+/*
+ * main()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+int main(int argc, char** argv)
+{
+	BENCH_CONTEXT				context;
+	std::vector<BENCH_RESULT>	results;
+	int32						runs		= DEFAULT_RUNS;
+	bigtime_t					runTime		= DEFAULT_RUN_TIME * 1000;
+	bool						json		= false;
+	bool						scaling		= false;
+	SCALE_OPTIONS				scale;
+	int							option;
+
+	ParseList(DEFAULT_SCALE_SIZES, scale.sizes);
+	ParseList(DEFAULT_SCALE_DEPTHS, scale.depths);
+
+	scale.samples	= DEFAULT_SCALE_SAMPLES;
+	scale.withAttrs	= false;
+
+	while((option = getopt(argc, argv, "ad:jk:ln:r:St:")) != -1)
+	{
+		switch(option)
+		{
+			case 'a':
+				scale.withAttrs = true;
+				break;
+
+			case 'd':
+				ParseList(optarg, scale.depths);
+				break;
+
+			case 'j':
+				json = true;
+				break;
+
+			case 'k':
+				scale.samples = std::max(1, atoi(optarg));
+				break;
+
+			case 'n':
+				ParseList(optarg, scale.sizes);
+				break;
+
+			case 'S':
+				scaling = true;
+				break;
+
+			case 'l':
+				for (size_t i = 0; i < BENCHMARK_COUNT; i++) {
+
+					printf("%s\n", kBenchmarks[i].name);
+				}
+				return( 0 );
+
+			case 'r':
+				runs = std::max(1, atoi(optarg));
+				break;
+
+			case 't':
+				runTime = std::max(1, atoi(optarg)) * 1000;
+				break;
+
+			default:
+				Usage();
+				return( 1 );
+		}
+	}
+
+	if (scaling)
+	{
+		scale.json = json;
+
+		return( RunScaling(&scale) );
+	}
+
+	context.folder[0]	= '\0';
+	context.volume		= NULL;
+	context.session		= NULL;
+	context.dtRefnum	= 0;
+	context.fileEntry	= NULL;
+	context.dirEntry	= NULL;
+	context.replay		= NULL;
+
+	memset(context.forks, 0, sizeof(context.forks));
+	memset(context.readRefs, 0, sizeof(context.readRefs));
+	memset(context.readOffsets, 0, sizeof(context.readOffsets));
+
+	if (Setup(&context) != B_OK)
+	{
+		fprintf(stderr, "afp_bench: couldn't set up the scratch volume in %s\n", context.folder);
+		Cleanup(&context);
+
+		return( 1 );
+	}
+
+	for (size_t i = 0; i < BENCHMARK_COUNT; i++)
+	{
+		BENCH_RESULT	result;
+
+		if (!Selected(&kBenchmarks[i], argc, argv)) {
+			continue;
+		}
+
+		RunBenchmark(&kBenchmarks[i], &context, runs, runTime, &result);
+		results.push_back(result);
+
+		if (!json) {
+			fprintf(stderr, ".");
+		}
+	}
+
+	if (!json) {
+		fprintf(stderr, "\n");
+	}
+
+	Cleanup(&context);
+
+	if (results.empty())
+	{
+		fprintf(stderr, "afp_bench: no benchmark matches\n");
+		return( 1 );
+	}
+
+	if (json) {
+		PrintJSON(results, runs);
+	}
+	else {
+		PrintTable(results);
+	}
+
+	return( 0 );
+}
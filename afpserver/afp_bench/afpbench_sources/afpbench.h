@@ -0,0 +1,24 @@
+#ifndef __afpbench__
+#define __afpbench__
+
+#include "fp_storage.h"
+
+#include <vector>
+
+//
+//Shape of the synthetic volumes the scaling run generates, one volume
+//per folder size and one per tree depth.
+//
+typedef struct
+{
+	std::vector<int32>	sizes;		//Files in the large folder
+	std::vector<int32>	depths;		//Levels in the deep tree
+	int32				samples;	//Timed calls per operation and shape
+	bool				withAttrs;	//Give generated files AFP attributes up front
+	bool				json;
+}SCALE_OPTIONS;
+
+int		RunScaling(const SCALE_OPTIONS* options);
+void	RemoveFolder(fp_storage_entry* folder);
+
+#endif //__afpbench__
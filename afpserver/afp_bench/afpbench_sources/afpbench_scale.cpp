@@ -0,0 +1,914 @@
+/*
+ *	afpbench_scale.cpp
+ *
+ *	Scaling run for afp_bench. Generates volumes with one very large
+ *	folder or one very deep tree and times the AFP calls that walk
+ *	them, as the request handlers see them, for each folder size and
+ *	depth asked for. Alongside the cost per call, the growth exponent
+ *	between neighbouring shapes is reported: about 0 when a call
+ *	doesn't care how big the folder is, about 1 when it is linear in
+ *	it, which makes walking the whole folder quadratic.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "afpGlobals.h"
+#include "afp_os.h"
+#include "afp.h"
+#include "afp_buffer.h"
+#include "afp_session.h"
+#include "afpvolume.h"
+#include "dsi_connection.h"
+#include "finder_info.h"
+#include "fp_catalog.h"
+#include "fp_objects.h"
+#include "fp_volume.h"
+#include "afpbench.h"
+
+#define SCALE_ENUM_COUNT		256		//Entries asked for per FPEnumerateExt2
+#define SCALE_DEPTH_FILES		8		//Files at each level of the deep tree
+#define SCALE_LONG_NAME_LENGTH	200
+#define SCALE_CATALOG_TIMEOUT	(120 * 1000000LL)
+
+#define SCALE_FILE_BITMAP		(kFPFileAttributes | kFPParentID | kFPCreateDate | kFPModDate |	\
+								 kFPFinderInfo | kFPLongName | kFPFileNum | kFPDFLen | kFPRFLen)
+#define SCALE_DIR_BITMAP		(kFPDirAttribute | kFPDirParentID | kFPDirCreateDate |				\
+								 kFPDirModDate | kFPDirFinderInfo | kFPDirLongName | kFPDirID |		\
+								 kFPDirOffCount | kFPDirOwnerID | kFPDirGroupID | kFPDirAccess)
+
+//
+//A generated volume shared the way StartSharingVolume() shares any
+//other, with a guest session that has it open.
+//
+typedef struct
+{
+	char					path[B_PATH_NAME_LENGTH];
+	const char*				leaf;
+	fp_volume*				volume;
+	afp_session*			session;
+	int16					volID;
+	std::unique_ptr<int8[]>	request;
+	std::unique_ptr<int8[]>	reply;
+}SCALE_VOLUME;
+
+typedef struct
+{
+	const char*		op;
+	const char*		shape;
+	int32			size;
+	int32			calls;
+	double			usPerOp;
+	double			exponent;		//NAN for the first size of a shape
+}SCALE_RESULT;
+
+
+/*
+ * AddPath()
+ *
+ * Description:
+ *		A kUnicodeNames path as an AFP3 client sends it, '/' in path
+ *		becomes the AFP separator.
+ *
+ * Returns: none
+ */
+
+static void AddPath(afp_buffer* request, const char* path)
+{
+	int16	length = (int16)strlen(path);
+
+	request->push_num<int8>(kUnicodeNames);
+	request->push_num<uint32>(0);
+	request->push_num<uint16>(length);
+
+	for (int16 i = 0; i < length; i++) {
+
+		request->push_num<int8>((path[i] == '/') ? '\0' : path[i]);
+	}
+}
+
+
+/*
+ * Call()
+ *
+ * Description:
+ *		Hands the request built in volume->request to an FP handler.
+ *
+ * Returns: AFPERROR
+ */
+
+static AFPERROR Call(
+	SCALE_VOLUME*	volume,
+	AFPERROR		(*handler)(afp_session*, int8*, int8*, int32*),
+	int32*			replySize
+	)
+{
+	int32	size = 0;
+
+	AFPERROR afpError = handler(volume->session, volume->request.get(), volume->reply.get(), &size);
+
+	if (replySize != NULL) {
+		*replySize = size;
+	}
+
+	return( afpError );
+}
+
+
+/*
+ * GetFileDirParms()
+ *
+ * Description:
+ *		FPGetFileDirParms on a path from the volume root.
+ *
+ * Returns: AFPERROR
+ */
+
+static AFPERROR GetFileDirParms(SCALE_VOLUME* volume, const char* path, int16 fileBitmap, int16 dirBitmap)
+{
+	afp_buffer	request(volume->request.get(), SRVR_REQUEST_QUANTUM_SIZE);
+
+	request.push_num<int8>(afpGetFlDrParms);
+	request.push_num<int8>(0);
+	request.push_num<int16>(volume->volID);
+	request.push_num<int32>(kRootDirID);
+	request.push_num<int16>(fileBitmap);
+	request.push_num<int16>(dirBitmap);
+	AddPath(&request, path);
+
+	return( Call(volume, FPGetFileDirParms, NULL) );
+}
+
+
+/*
+ * GetFileID()
+ *
+ * Description:
+ *
+ * Returns: the file's ID or 0
+ */
+
+static uint32 GetFileID(SCALE_VOLUME* volume, const char* path)
+{
+	if (!AFP_SUCCESS(GetFileDirParms(volume, path, kFPFileNum, 0))) {
+		return( 0 );
+	}
+
+	//
+	//File bitmap, directory bitmap, the directory flag and a pad byte
+	//come before the parameters.
+	//
+	afp_buffer	reply(volume->reply.get(), SRVR_REQUEST_QUANTUM_SIZE);
+
+	reply.Advance(6);
+
+	return( reply.pull_num<uint32>() );
+}
+
+
+/*
+ * EnumerateExt2()
+ *
+ * Description:
+ *
+ * Returns: AFPERROR
+ */
+
+static AFPERROR EnumerateExt2(SCALE_VOLUME* volume, const char* path, int32 startIndex, int16* actCount)
+{
+	afp_buffer	request(volume->request.get(), SRVR_REQUEST_QUANTUM_SIZE);
+	int32		replySize	= 0;
+	AFPERROR	afpError	= AFP_OK;
+
+	request.push_num<int8>(afpEnumerateExt2);
+	request.push_num<int8>(0);
+	request.push_num<int16>(volume->volID);
+	request.push_num<int32>(kRootDirID);
+	request.push_num<int16>(SCALE_FILE_BITMAP);
+	request.push_num<int16>(SCALE_DIR_BITMAP);
+	request.push_num<int16>(SCALE_ENUM_COUNT);
+	request.push_num<int32>(startIndex);
+	request.push_num<int32>(SRVR_REQUEST_QUANTUM_SIZE);
+	AddPath(&request, path);
+
+	afpError	= Call(volume, FPEnumerate, &replySize);
+	*actCount	= 0;
+
+	if ((AFP_SUCCESS(afpError)) && (replySize >= 6))
+	{
+		afp_buffer	reply(volume->reply.get(), SRVR_REQUEST_QUANTUM_SIZE);
+
+		reply.Advance(4);
+		*actCount = reply.pull_num<int16>();
+	}
+
+	return( afpError );
+}
+
+
+/*
+ * ResolveID()
+ *
+ * Description:
+ *
+ * Returns: AFPERROR
+ */
+
+static AFPERROR ResolveID(SCALE_VOLUME* volume, uint32 fileID)
+{
+	afp_buffer	request(volume->request.get(), SRVR_REQUEST_QUANTUM_SIZE);
+
+	request.push_num<int8>(afpResolveID);
+	request.push_num<int8>(0);
+	request.push_num<int16>(volume->volID);
+	request.push_num<uint32>(fileID);
+	request.push_num<int16>(SCALE_FILE_BITMAP);
+
+	return( Call(volume, FPResolveID, NULL) );
+}
+
+
+/*
+ * CreateFile()
+ *
+ * Description:
+ *
+ * Returns: AFPERROR
+ */
+
+static AFPERROR CreateFile(SCALE_VOLUME* volume, const char* path)
+{
+	afp_buffer	request(volume->request.get(), SRVR_REQUEST_QUANTUM_SIZE);
+
+	request.push_num<int8>(afpFileCreate);
+	request.push_num<int8>(kHardCreate);
+	request.push_num<int16>(volume->volID);
+	request.push_num<int32>(kRootDirID);
+	AddPath(&request, path);
+
+	return( Call(volume, FPCreateFile, NULL) );
+}
+
+
+/*
+ * MoveAndRename()
+ *
+ * Description:
+ *
+ * Returns: AFPERROR
+ */
+
+static AFPERROR MoveAndRename(SCALE_VOLUME* volume, const char* path, const char* toFolder, const char* newName)
+{
+	afp_buffer	request(volume->request.get(), SRVR_REQUEST_QUANTUM_SIZE);
+
+	request.push_num<int8>(afpMove);
+	request.push_num<int8>(0);
+	request.push_num<int16>(volume->volID);
+	request.push_num<int32>(kRootDirID);
+	request.push_num<int32>(kRootDirID);
+	AddPath(&request, path);
+	AddPath(&request, toFolder);
+	AddPath(&request, newName);
+
+	return( Call(volume, FPMoveAndRename, NULL) );
+}
+
+
+/*
+ * MakeFolder()
+ *
+ * Description:
+ *		Guests get write access through the "other" permission
+ *		bits, so generated folders are open to everyone.
+ *
+ * Returns: B_OK or an error
+ */
+
+static status_t MakeFolder(fp_storage_dir* parent, const char* name, fp_storage_dir* folder)
+{
+	fp_storage_entry	entry;
+	status_t			status = parent->CreateDirectory(name, folder);
+
+	if (status == B_OK)
+	{
+		folder->GetEntry(&entry);
+		entry.SetPermissions(0777);
+	}
+
+	return( status );
+}
+
+
+/*
+ * FileName()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+static void FileName(int32 index, char* name, size_t cbname)
+{
+	static const char*	kExtensions[] = { ".txt", ".sit", ".jpeg", ".img", "" };
+
+	snprintf(name, cbname, "File %06d%s", (int)index, kExtensions[index % 5]);
+}
+
+
+/*
+ * MakeFiles()
+ *
+ * Description:
+ *		Empty files, optionally with the Finder info and attributes
+ *		the server would otherwise add the first time it sees them.
+ *
+ * Returns: none
+ */
+
+static void MakeFiles(fp_storage_dir* folder, int32 count, bool withAttrs)
+{
+	char	name[B_FILE_NAME_LENGTH];
+
+	for (int32 i = 0; i < count; i++)
+	{
+		fp_storage_node	file;
+
+		FileName(i, name, sizeof(name));
+
+		if (folder->CreateFile(name, &file, true) != B_OK) {
+			continue;
+		}
+
+		if (withAttrs)
+		{
+			fp_storage_entry	entry(folder, name);
+			FINDER_INFO			finfo;
+			int16				attributes = 0;
+
+			FinderInfoBasedOnExtension(name, &finfo);
+
+			fp_objects::SetAFPFinderInfo(&entry, &finfo);
+			fp_objects::SetAFPAttributes(&entry, &attributes);
+		}
+	}
+}
+
+
+/*
+ * OpenVolume()
+ *
+ * Description:
+ *		Shares the generated folder and opens it from a guest
+ *		session. Waits for the catalog build so it doesn't run
+ *		underneath the timings.
+ *
+ * Returns: B_OK or an error
+ */
+
+static status_t OpenVolume(SCALE_VOLUME* volume)
+{
+	VolumeStorageData	volData;
+
+	memset(&volData, 0, sizeof(volData));
+
+	volData.version	= VOLUME_DATA_V1;
+	volData.flags	= 0;
+	strlcpy(volData.path, volume->path, sizeof(volData.path));
+
+	if (StartSharingVolume(&volData) != B_OK) {
+		return( B_ERROR );
+	}
+
+	volume->volume = FindVolume(volume->leaf);
+
+	if (volume->volume == NULL) {
+		return( B_ERROR );
+	}
+
+	if (!volume->volume->GetCatalog()->WaitForReady(SCALE_CATALOG_TIMEOUT)) {
+		fprintf(stderr, "afp_bench: catalog of %s still building\n", volume->leaf);
+	}
+
+	volume->volID	= volume->volume->GetVolumeID();
+	volume->session	= new afp_session(NULL);
+	volume->request.reset(new int8[SRVR_REQUEST_QUANTUM_SIZE]);
+	volume->reply.reset(new int8[SRVR_REQUEST_QUANTUM_SIZE]);
+
+	volume->session->SetAFPVersion(afpVersion33);
+	volume->session->SetUAMLoginType(afpUAMGuest);
+	volume->session->SetIsAuthenticated(true);
+	volume->session->VolumeOpened(volume->volume);
+
+	return( B_OK );
+}
+
+
+/*
+ * CloseVolume()
+ *
+ * Description:
+ *		Stops sharing the volume and deletes the folder behind it.
+ *
+ * Returns: none
+ */
+
+static void CloseVolume(SCALE_VOLUME* volume)
+{
+	fp_storage_entry	folder(volume->path);
+
+	if (volume->session != NULL)
+	{
+		volume->session->VolumeClosed(volume->volume);
+
+		delete volume->session;
+		volume->session = NULL;
+	}
+
+	if (volume->volume != NULL)
+	{
+		StopSharingVolume(volume->path);
+		volume->volume = NULL;
+	}
+
+	RemoveFolder(&folder);
+}
+
+
+/*
+ * AddResult()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+static void AddResult(
+	std::vector<SCALE_RESULT>&	results,
+	const char*					op,
+	const char*					shape,
+	int32						size,
+	int32						calls,
+	bigtime_t					elapsed
+	)
+{
+	SCALE_RESULT	result;
+
+	result.op		= op;
+	result.shape	= shape;
+	result.size		= size;
+	result.calls	= calls;
+	result.usPerOp	= (calls > 0) ? ((double)elapsed / calls) : 0.0;
+	result.exponent	= NAN;
+
+	results.push_back(result);
+}
+
+
+/*
+ * MeasureFolder()
+ *
+ * Description:
+ *		Times each operation against folder, which holds fileCount
+ *		generated files, and adds a result for it under shape/size.
+ *		Files are picked with a fixed seed so runs are comparable.
+ *
+ * Returns: none
+ */
+
+static void MeasureFolder(
+	SCALE_VOLUME*				volume,
+	const char*					shape,
+	int32						size,
+	const std::string&			folder,
+	int32						fileCount,
+	int32						samples,
+	std::vector<SCALE_RESULT>&	results
+	)
+{
+	std::vector<std::string>	paths;
+	std::vector<uint32>			fileIDs;
+	char						name[B_FILE_NAME_LENGTH];
+	bigtime_t					start;
+	int32						calls;
+
+	srand(1);
+
+	for (int32 i = 0; i < samples; i++)
+	{
+		FileName(rand() % fileCount, name, sizeof(name));
+		paths.push_back(folder + "/" + name);
+	}
+
+	//
+	//Whole listings, a page at a time, until at least samples pages
+	//have been asked for.
+	//
+	calls	= 0;
+	start	= system_time();
+
+	do
+	{
+		int32	index		= 1;
+		int16	actCount	= 0;
+
+		do
+		{
+			if (!AFP_SUCCESS(EnumerateExt2(volume, folder.c_str(), index, &actCount))) {
+				actCount = 0;
+			}
+
+			index += actCount;
+			calls++;
+
+		}while(actCount > 0);
+
+	}while(calls < samples);
+
+	AddResult(results, "enumerate_ext2", shape, size, calls, system_time() - start);
+
+	start = system_time();
+
+	for (const std::string& path : paths) {
+
+		GetFileDirParms(volume, path.c_str(), SCALE_FILE_BITMAP, SCALE_DIR_BITMAP);
+	}
+
+	AddResult(results, "get_file_dir_parms", shape, size, samples, system_time() - start);
+
+	for (const std::string& path : paths) {
+
+		fileIDs.push_back(GetFileID(volume, path.c_str()));
+	}
+
+	start = system_time();
+
+	for (uint32 fileID : fileIDs) {
+
+		ResolveID(volume, fileID);
+	}
+
+	AddResult(results, "resolve_id", shape, size, samples, system_time() - start);
+
+	//
+	//Files with names too long for AFP2, which the server keeps an
+	//extra attribute for, then moved out of the folder and renamed.
+	//
+	start = system_time();
+
+	for (int32 i = 0; i < samples; i++)
+	{
+		std::string	path = folder + "/";
+
+		snprintf(name, sizeof(name), "Long name %06d ", (int)i);
+		path += name;
+		path.append(SCALE_LONG_NAME_LENGTH - strlen(name), 'x');
+
+		CreateFile(volume, path.c_str());
+		paths[i] = path;
+	}
+
+	AddResult(results, "create_file_long", shape, size, samples, system_time() - start);
+
+	start = system_time();
+
+	for (int32 i = 0; i < samples; i++)
+	{
+		snprintf(name, sizeof(name), "%s moved %06d", shape, (int)i);
+
+		MoveAndRename(volume, paths[i].c_str(), "Moved", name);
+	}
+
+	AddResult(results, "move_and_rename", shape, size, samples, system_time() - start);
+}
+
+
+/*
+ * ScaleFolderSize()
+ *
+ * Description:
+ *		A volume with one folder of size files.
+ *
+ * Returns: B_OK or an error
+ */
+
+static status_t ScaleFolderSize(
+	const char*					temp,
+	const char*					prefix,
+	int32						size,
+	const SCALE_OPTIONS*		options,
+	std::vector<SCALE_RESULT>&	results
+	)
+{
+	SCALE_VOLUME	volume;
+	fp_storage_dir	tempDir;
+	fp_storage_dir	root;
+	fp_storage_dir	folder;
+	fp_storage_dir	moved;
+	char			leaf[B_FILE_NAME_LENGTH];
+	status_t		status;
+
+	snprintf(leaf, sizeof(leaf), "%s.files.%d", prefix, (int)size);
+	snprintf(volume.path, sizeof(volume.path), "%s/%s", temp, leaf);
+
+	volume.leaf		= volume.path + strlen(temp) + 1;
+	volume.volume	= NULL;
+	volume.session	= NULL;
+
+	status = tempDir.SetTo(temp);
+
+	if (status == B_OK) {
+		status = MakeFolder(&tempDir, leaf, &root);
+	}
+
+	if (status == B_OK) {
+		status = MakeFolder(&root, "Folder", &folder);
+	}
+
+	if (status == B_OK) {
+		status = MakeFolder(&root, "Moved", &moved);
+	}
+
+	if (status == B_OK)
+	{
+		MakeFiles(&folder, size, options->withAttrs);
+		status = OpenVolume(&volume);
+	}
+
+	if (status == B_OK) {
+		MeasureFolder(&volume, "files", size, "Folder", size, options->samples, results);
+	}
+
+	CloseVolume(&volume);
+
+	return( status );
+}
+
+
+/*
+ * ScaleTreeDepth()
+ *
+ * Description:
+ *		A volume with a tree depth folders deep, a few files at each
+ *		level. The deepest folder is measured by its path from the
+ *		volume root.
+ *
+ * Returns: B_OK or an error
+ */
+
+static status_t ScaleTreeDepth(
+	const char*					temp,
+	const char*					prefix,
+	int32						depth,
+	const SCALE_OPTIONS*		options,
+	std::vector<SCALE_RESULT>&	results
+	)
+{
+	SCALE_VOLUME	volume;
+	fp_storage_dir	tempDir;
+	fp_storage_dir	parent;
+	fp_storage_dir	moved;
+	std::string		folderPath;
+	char			leaf[B_FILE_NAME_LENGTH];
+	status_t		status;
+
+	snprintf(leaf, sizeof(leaf), "%s.depth.%d", prefix, (int)depth);
+	snprintf(volume.path, sizeof(volume.path), "%s/%s", temp, leaf);
+
+	volume.leaf		= volume.path + strlen(temp) + 1;
+	volume.volume	= NULL;
+	volume.session	= NULL;
+
+	status = tempDir.SetTo(temp);
+
+	if (status == B_OK) {
+		status = MakeFolder(&tempDir, leaf, &parent);
+	}
+
+	if (status == B_OK) {
+		status = MakeFolder(&parent, "Moved", &moved);
+	}
+
+	for (int32 level = 1; (status == B_OK) && (level <= depth); level++)
+	{
+		fp_storage_dir		folder;
+		fp_storage_entry	folderEntry;
+
+		snprintf(leaf, sizeof(leaf), "Level %02d", (int)level);
+
+		status = MakeFolder(&parent, leaf, &folder);
+
+		if (status == B_OK)
+		{
+			MakeFiles(&folder, SCALE_DEPTH_FILES, options->withAttrs);
+
+			if (!folderPath.empty()) {
+				folderPath += "/";
+			}
+
+			folderPath += leaf;
+
+			folder.GetEntry(&folderEntry);
+			parent.SetTo(&folderEntry);
+		}
+	}
+
+	if (status == B_OK) {
+		status = OpenVolume(&volume);
+	}
+
+	if (status == B_OK) {
+		MeasureFolder(&volume, "depth", depth, folderPath, SCALE_DEPTH_FILES, options->samples, results);
+	}
+
+	CloseVolume(&volume);
+
+	return( status );
+}
+
+
+/*
+ * ComputeExponents()
+ *
+ * Description:
+ *		For each result, the power of the shape size that the cost
+ *		grew by since the previous size of the same operation.
+ *
+ * Returns: none
+ */
+
+static void ComputeExponents(std::vector<SCALE_RESULT>& results)
+{
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		SCALE_RESULT&	result = results[i];
+
+		for (size_t j = i; j-- > 0; )
+		{
+			const SCALE_RESULT&	prior = results[j];
+
+			if ((strcmp(prior.op, result.op) != 0) || (strcmp(prior.shape, result.shape) != 0)) {
+				continue;
+			}
+
+			if ((prior.size > 0) && (prior.size != result.size) &&
+				(prior.usPerOp > 0) && (result.usPerOp > 0))
+			{
+				result.exponent = log(result.usPerOp / prior.usPerOp) /
+									log((double)result.size / prior.size);
+			}
+
+			break;
+		}
+	}
+}
+
+
+/*
+ * PrintTable()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+static void PrintTable(const std::vector<SCALE_RESULT>& results)
+{
+	printf("%-20s %-6s %8s %8s %12s %9s\n", "operation", "shape", "size", "calls", "us/op", "exponent");
+
+	for (const SCALE_RESULT& result : results)
+	{
+		char	exponent[16] = "-";
+
+		if (!isnan(result.exponent)) {
+			snprintf(exponent, sizeof(exponent), "%.2f", result.exponent);
+		}
+
+		printf("%-20s %-6s %8d %8d %12.1f %9s\n",
+				result.op,
+				result.shape,
+				(int)result.size,
+				(int)result.calls,
+				result.usPerOp,
+				exponent);
+	}
+}
+
+
+/*
+ * PrintJSON()
+ *
+ * Description:
+ *		The exponent is null where there is nothing to compare with.
+ *
+ * Returns: none
+ */
+
+static void PrintJSON(const std::vector<SCALE_RESULT>& results, const SCALE_OPTIONS* options)
+{
+	printf("{\n");
+	printf("\t\"tool\": \"afp_bench\",\n");
+	printf("\t\"format\": 1,\n");
+	printf("\t\"mode\": \"scaling\",\n");
+	printf("\t\"attributes\": %s,\n", options->withAttrs ? "true" : "false");
+	printf("\t\"samples\": %d,\n", (int)options->samples);
+	printf("\t\"results\": [\n");
+
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const SCALE_RESULT&	result = results[i];
+		char				exponent[16] = "null";
+
+		if (!isnan(result.exponent)) {
+			snprintf(exponent, sizeof(exponent), "%.3f", result.exponent);
+		}
+
+		printf("\t\t{ \"name\": \"%s\", \"shape\": \"%s\", \"size\": %d, \"calls\": %d, \"us_per_op\": %.2f, \"exponent\": %s }%s\n",
+				result.op,
+				result.shape,
+				(int)result.size,
+				(int)result.calls,
+				result.usPerOp,
+				exponent,
+				(i + 1 < results.size()) ? "," : "");
+	}
+
+	printf("\t]\n");
+	printf("}\n");
+}
+
+
+/*
+ * RunScaling()
+ *
+ * Description:
+ *		Generates and measures a volume for every folder size and
+ *		tree depth in options, one at a time.
+ *
+ * Returns: exit code for main()
+ */
+
+int RunScaling(const SCALE_OPTIONS* options)
+{
+	std::vector<SCALE_RESULT>	results;
+	char						temp[B_PATH_NAME_LENGTH];
+	char						prefix[B_FILE_NAME_LENGTH];
+
+	if (fp_storage_temp_dir(temp, sizeof(temp)) != B_OK)
+	{
+		fprintf(stderr, "afp_bench: no temp directory\n");
+		return( 1 );
+	}
+
+	//
+	//Volumes are shared under their folder name, which has to be
+	//unique.
+	//
+	snprintf(prefix, sizeof(prefix), "afp_scale.%d", (int)getpid());
+
+	for (int32 size : options->sizes)
+	{
+		if (ScaleFolderSize(temp, prefix, size, options, results) != B_OK) {
+			fprintf(stderr, "afp_bench: couldn't build a folder of %d files\n", (int)size);
+		}
+		else if (!options->json) {
+			fprintf(stderr, ".");
+		}
+	}
+
+	for (int32 depth : options->depths)
+	{
+		if (ScaleTreeDepth(temp, prefix, depth, options, results) != B_OK) {
+			fprintf(stderr, "afp_bench: couldn't build a tree %d deep\n", (int)depth);
+		}
+		else if (!options->json) {
+			fprintf(stderr, ".");
+		}
+	}
+
+	if (!options->json) {
+		fprintf(stderr, "\n");
+	}
+
+	if (results.empty()) {
+		return( 1 );
+	}
+
+	ComputeExponents(results);
+
+	if (options->json) {
+		PrintJSON(results, options);
+	}
+	else {
+		PrintTable(results);
+	}
+
+	return( 0 );
+}
@@ -1,4 +1,5 @@
 #include "afpGlobals.h"
+#include "debug.h"
 #include "afpServerApplication.h"
 
 int afpAppReturnValue(0);
@@ -29,5 +30,7 @@ int main(int, char **)
 	
 	delete be_app;
 	
+	afp_debug_flush();
+	
 	return( afpAppReturnValue );
 }
\ No newline at end of file
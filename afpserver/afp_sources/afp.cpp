@@ -1,5 +1,5 @@
-#include <fs_attr.h>
-#include <DataIO.h>
+#include "fp_storage.h"
+#include "afp_os.h"
 
 #include "debug.h"
 
@@ -12,8 +12,10 @@
 #include "afpaccess.h"
 #include "afpextattr.h"
 #include "afphostname.h"
+#include "afpsrvrinfo.h"
 #include "afpaccess.h"
 #include "afpreplay.h"
+#include "afpcatsearch.h"
 #include "commands.h"
 #include "dsi_stats.h"
 #include "fp_rangelock.h"
@@ -21,10 +23,12 @@
 #include "afp_session.h"
 #include "fp_volume.h"
 #include "fp_objects.h"
+#include "fp_pathcache.h"
+#include "fp_dirwatch.h"
+#include "fp_blockcache.h"
+#include "fp_writebehind.h"
 #include "dsi_scavenger.h"
 
-extern std::unique_ptr<BList> volume_blist;
-
 int16					gMaxAFPSessions = 0;
 extern dsi_scavenger*	gAFPSessionMgr;
 extern dsi_stats		gAFPStats;
@@ -81,7 +85,7 @@ AFP_TABLE afpTable[] = {
 	{FPUnimplemented,			""},					//afpDeleteID
 	{FPResolveID,			    "FPResolveID"},			//afpResolveID
 	{FPUnimplemented,			""},					//afpExchangeFiles
-	{FPUnimplemented,			""},					//43
+	{FPCatSearch,				"FPCatSearch"},
 	{FPUnimplemented,			""},					//44
 	{FPUnimplemented,			""},					//45
 	{FPUnimplemented,			""},					//46
@@ -105,7 +109,7 @@ AFP_TABLE afpTable[] = {
 	{FPGetSessionToken,			"FPGetSessionToken"},
 	{FPDisconnectOldSession,	"FPDisconnectOldSession"},
 	{FPEnumerate,				"FPEnumerateExt"},
-	{FPUnimplemented,			""},					//afpCatSearchExt
+	{FPCatSearch,				"FPCatSearchExt"},
 	{FPEnumerate,				"FPEnumerateExt2"},
 	{FPGetExtAttribute,			"FPGetExtAttribute"},
 	{FPSetExtAttribute,			"FPSetExtAttribute"},
@@ -215,8 +219,14 @@ AFPERROR FPDispatchCommand(
 
 			case afpLoginExt:
 			case afpLogin:
+			{
+				bigtime_t	started = system_time();
+
 				afpError = FPLogin(afpSession, afpReqBuffer, afpReplyBuffer, afpDataSize);
+
+				gAFPStats.Login_RecordTime(system_time() - started);
 				break;
+			}
 
 			case afpContLogin:
 				afpError = FPContLogin(afpSession, afpReqBuffer, afpReplyBuffer, afpDataSize);
@@ -257,7 +267,8 @@ AFPERROR FPDispatchCommand(
  * Description:
  *		The FPGetSrvrInfo() AFP API. This is the only AFP API (other than
  *		FPLogon of course) that can be called without opening a session
- *		and being authenticated.
+ *		and being authenticated. The reply is packed ahead of time by
+ *		gAFPSrvrInfo, so a status probe is just a copy.
  *
  * Returns: None
  */
@@ -272,121 +283,7 @@ AFPERROR FPGetSrvrInfo(
 	#pragma unused(afpSession)
 	#pragma unused(afpReqBuffer)
 
-	char		hostname[MAX_HOSTNAME_LEN];
-	int16		afpFlags				= 0;
-	int8*		pBuffer					= NULL;
-	int8*		pAddressCountOffset		= NULL;
-	int8*		pServerSigOffset		= NULL;
-
-	*afpDataSize = 0;
-
-	//
-	//Set the flags which tell what our server supports.
-	//
-	afpFlags = kSupportsTCPIP
-				| kSupportsSrvrNotification
-				| kSupportsCopyFile
-				| kSupportsSrvrMsgs
-				| kSupportsReconnect
-				| kSupportsChngPswd
-				| kSupportsExtSleep;
-
-	*((int16*)&afpReplyBuffer[SRVRINFO_OFFSET_FLAGS]) = htons(afpFlags);
-
-	//
-	//We don't have a custom volume icon.
-	//
-	*((int16*)&afpReplyBuffer[SRVRINFO_OFFSET_VOLUMEICON]) = 0;
-
-	//
-	//Blast in the computer name.
-	//
-	afp_GetHostname(hostname, sizeof(hostname));
-
-	pBuffer = &afpReplyBuffer[SRVRINFO_OFFSET_SRVRNAME];
-	PUSH_CSTRING(hostname, pBuffer);
-
-	//
-	//Add an extra padding byte if the AFP buffer is not on
-	//an even boundary.
-	//
-	if ((pBuffer - afpReplyBuffer) % 2)
-		*pBuffer++ = 0x00;
-
-	//
-	//Save the server signature offset
-	//
-	pServerSigOffset = pBuffer;
-	pBuffer += sizeof(int16);
-
-	//
-	//Network address count offset, save it for later.
-	//
-	pAddressCountOffset = pBuffer;
-	pBuffer += sizeof(int16);
-
-	//
-	//Set the machine type and offset.
-	//
-	*((int16*)&afpReplyBuffer[SRVRINFO_OFFSET_MACHTYPE]) =
-											htons(pBuffer - afpReplyBuffer);
-
-	PUSH_CSTRING(AFP_MACHINE_TYPE, pBuffer);
-
-	//
-	//Paste in the AFP version we support.
-	//
-	*((int16*)&afpReplyBuffer[SRVRINFO_OFFSET_AFPVERSCOUNT]) =
-											htons(pBuffer - afpReplyBuffer);
-
-	*pBuffer++ = AFP_VERSION_COUNT;
-
-	PUSH_CSTRING(AFP_22_VERSION_STR, pBuffer);
-	PUSH_CSTRING(AFP_30_VERSION_STR, pBuffer);
-	PUSH_CSTRING(AFP_31_VERSION_STR, pBuffer);
-	PUSH_CSTRING(AFP_32_VERSION_STR, pBuffer);
-	PUSH_CSTRING(AFP_33_VERSION_STR, pBuffer);
-
-	//
-	//Now the supported UAM's get included.
-	//
-	*((int16*)&afpReplyBuffer[SRVRINFO_OFFSET_UAMCOUNT]) =
-											htons(pBuffer - afpReplyBuffer);
-
-	if (afpAccountEnabled(AFP_GUEST_NAME))
-	{
-		*pBuffer++ = UAM_COUNT;
-		PUSH_CSTRING(UAM_NONE_STR, pBuffer);
-	}
-	else
-	{
-		*pBuffer++ = UAM_COUNT - 1;
-	}
-
-	//
-	//This is always supported in our server, no matter what.
-	//
-	PUSH_CSTRING(UAM_CLEAR_TEXT, pBuffer);
-	PUSH_CSTRING(UAM_DHCAST128, pBuffer);
-
-	//
-	//Set the server sig offset and value.
-	//
-	*((int16*)pServerSigOffset) = htons(pBuffer - afpReplyBuffer);
-	*pBuffer++ = 0;
-
-	//Network Address: Note, there is no reason for us to pass
-	//back address since we only support connections over TCP/IP.
-	//This feature is only for connection where the initial connection
-	//is done over AppleTalk.
-
-	*((int16*)pAddressCountOffset) = htons(pBuffer - afpReplyBuffer);
-	*pBuffer++ = 0;
-
-	//
-	//This size does NOT include the size of the DSI Header.
-	//
-	*afpDataSize = (pBuffer - afpReplyBuffer);
+	*afpDataSize = gAFPSrvrInfo.Copy(afpReplyBuffer);
 
 	return( AFP_OK );
 }
@@ -470,13 +367,13 @@ AFPERROR FPGetSessionToken(
 
 			afpKillSession = gAFPSessionMgr->FindSessionByID(afpIDSize, afpID);
 
-			if (afpKillSession != NULL)
+			if ((afpKillSession != NULL) && (afpKillSession != afpSession))
 			{
 				DBGWRITE(dbg_level_trace, "Killing old session!\n");
-				afpSession->KillSession();
+				afpKillSession->KillSession();
 			}
 
-			afpSession->SetClientID(afpIDSize, afpID);
+			gAFPSessionMgr->SetClientID(afpSession, afpIDSize, afpID);
 			fSavedID = true;
 			break;
 
@@ -490,7 +387,7 @@ AFPERROR FPGetSessionToken(
 
 			afpKillSession = gAFPSessionMgr->FindSessionByID(afpIDSize, afpID);
 
-			if (afpKillSession != NULL)
+			if ((afpKillSession != NULL) && (afpKillSession != afpSession))
 			{
 				DBGWRITE(dbg_level_trace, "Found old session!!\n");
 
@@ -499,13 +396,12 @@ AFPERROR FPGetSessionToken(
 					//
 					//Time stamps don't match, discard the old session.
 					//
-					afpSession->KillSession();
-					break;
+					afpKillSession->KillSession();
 				}
 			}
 
 			afpSession->SetAFPTimeStamp(afpTimeStamp);
-			afpSession->SetClientID(afpIDSize, afpID);
+			gAFPSessionMgr->SetClientID(afpSession, afpIDSize, afpID);
 
 			fSavedID = true;
 			break;
@@ -525,7 +421,7 @@ AFPERROR FPGetSessionToken(
 			DBGWRITE(dbg_level_trace, "kReconnWithTimeAndID\n");
 
 			afpSession->SetAFPTimeStamp(afpTimeStamp);
-			afpSession->SetClientID(afpIDSize, afpID);
+			gAFPSessionMgr->SetClientID(afpSession, afpIDSize, afpID);
 
 			fSavedID = true;
 			break;
@@ -568,7 +464,9 @@ AFPERROR FPGetSessionToken(
  * Description:
  *		AFP clients call this when they are inadvertantly cutoff from
  *		the file server. The client calls this to transfer all resources
- *		from the old session to this new one.
+ *		from the old session to this new one. Open forks keep their
+ *		reference numbers and locks, so the client doesn't have to
+ *		open everything again.
  *
  * Returns: AFPERROR
  */
@@ -580,12 +478,11 @@ AFPERROR FPDisconnectOldSession(
 	int32*			afpDataSize
 	)
 {
-	#pragma unused(afpSession)
 	#pragma unused(afpDataSize)
 
 	afp_buffer		afpRequest(afpReqBuffer);
 	afp_buffer		afpReply(afpReplyBuffer);
-	afp_session*	afpLostSession	= NULL;
+	AFPERROR		afpError		= AFP_OK;
 	int8			afpType			= 0;
 	int32			afpTokenLength	= 0;
 	int32			afpToken		= 0;
@@ -606,17 +503,10 @@ AFPERROR FPDisconnectOldSession(
 		return( afpParmErr );
 	}
 
-	afpToken 		= afpRequest.GetInt32();
-	afpLostSession 	= gAFPSessionMgr->FindSessionByToken(afpToken);
-
-	if (afpLostSession != NULL)
-	{
-		DBGWRITE(dbg_level_info, "Found diconnected session!\n");
-
-		afpLostSession->KillSession();
-	}
+	afpToken	= afpRequest.GetInt32();
+	afpError	= gAFPSessionMgr->TransferSession(afpToken, afpSession);
 
-	return( AFP_OK );
+	return( afpError );
 }
 
 
@@ -639,9 +529,8 @@ AFPERROR FPGetSrvrParms(
 	#pragma unused(afpSession)
 	#pragma unused(afpReqBuffer)
 
-	afp_buffer	afpReply(afpReplyBuffer);
-	int8		numVolumes;
-	int8		i;
+	afp_buffer				afpReply(afpReplyBuffer);
+	const AFP_VOLUME_TABLE*	volumes = VolumeTable();
 
 	DBGWRITE(dbg_level_info, "Getting server parms...\n");
 
@@ -653,28 +542,23 @@ AFPERROR FPGetSrvrParms(
 	//
 	//Stuff in the number of volumes we have shared out.
 	//
-	numVolumes = volume_blist->CountItems();
-	afpReply.AddInt8(numVolumes);
+	afpReply.AddInt8((int8)volumes->volumes.size());
 
 	//
 	//Now stuff in all the volume names as pascal strings.
 	//
-	for (i = 0; i < numVolumes; i++)
+	for (fp_volume* afpVolume : volumes->volumes)
 	{
-		fp_volume*		afpVolume = NULL;
 		char			volumeName[MAX_AFP_NAME];
 		int8			volumeFlags;
 
-		if ((afpVolume = (fp_volume*)volume_blist->ItemAt(i)) != NULL)
-		{
-			volumeFlags = 0;
-			strcpy(volumeName, afpVolume->GetVolumeName());
+		volumeFlags = 0;
+		strcpy(volumeName, afpVolume->GetVolumeName());
 
-			DBGWRITE(dbg_level_trace, "Adding volume %s\n", volumeName);
+		DBGWRITE(dbg_level_trace, "Adding volume %s\n", volumeName);
 
-			afpReply.AddInt8(volumeFlags);
-			afpReply.AddCStringAsPascal(volumeName);
-		}
+		afpReply.AddInt8(volumeFlags);
+		afpReply.AddCStringAsPascal(volumeName);
 	}
 
 	*afpDataSize = afpReply.GetDataLength();
@@ -955,7 +839,7 @@ AFPERROR FPResolveID(
 		return( afpParmErr );
 	}
 
-	BEntry afpEntry;
+	fp_storage_entry afpEntry;
 	auto afpError = fp_objects::GetEntryFromFileId(afpVolume->GetDirectory(), afpFileID, afpEntry);
 
 	if (!AFP_SUCCESS(afpError))
@@ -970,14 +854,14 @@ AFPERROR FPResolveID(
 		return( afpParmErr );
 	}
 
-	BPath path;
-	if (afpEntry.GetPath(&path) != B_OK)
+	char path[B_PATH_NAME_LENGTH];
+	if (afpEntry.GetPath(path, sizeof(path)) != B_OK)
 	{
 		DBGWRITE(dbg_level_warning, "Failed to get entry path!\n");
 		return( afpParmErr );
 	}
 
-	DBGWRITE(dbg_level_trace, "Found file via ID (%lu): %s\n", afpFileID, path.Path());
+	DBGWRITE(dbg_level_trace, "Found file via ID (%lu): %s\n", afpFileID, path);
 
 	//
 	//Don't support the following bitmaps.
@@ -1050,7 +934,7 @@ AFPERROR FPGetFileDirParms(
 	afp_buffer	afpRequest(afpReqBuffer);
 	afp_buffer	afpReply(afpReplyBuffer);
 	char		afpPathname[MAX_AFP_PATH];
-	BEntry		afpEntry;
+	fp_storage_entry	afpEntry;
 	fp_volume*	afpVolume		= NULL;
 	uint16		afpVolumeID		= 0;
 	int32		afpDirID		= 0;
@@ -1190,6 +1074,14 @@ AFPERROR FPGetFileDirParms(
 	}
 	else if ((afpEntry.IsFile()) || (afpEntry.IsSymLink()))
 	{
+		//
+		//A session may still be holding writes to the data fork in
+		//a write behind buffer, they belong in the length we report.
+		//
+		if (afpFileBitmap & (kFPDFLen | kFPExtDataForkLen)) {
+			afpVolume->FlushWriteBehind(&afpEntry);
+		}
+
 		afpError = fp_objects::fp_GetFileParms(
 									afpSession,
 									afpVolume,
@@ -1231,12 +1123,11 @@ AFPERROR FPEnumerate(
 	afp_buffer	afpRequest(afpReqBuffer);
 	afp_buffer	afpReply(afpReplyBuffer, SRVR_REQUEST_QUANTUM_SIZE);
 	char		afpPathname[MAX_AFP_PATH];
-	BEntry		afpEntry;
+	fp_storage_entry	afpEntry;
 	fp_volume*	afpVolume		= NULL;
 	int16*		afpActCountSpot	= NULL;
 	int8		afpCommand		= 0;
 	int16		afpActCount		= 0;
-	int8		afpAttributes	= 0;
 	int16		afpObjectsFound	= 0;
 	int16		afpVolID		= 0;
 	int32		afpDirID		= 0;
@@ -1384,8 +1275,18 @@ AFPERROR FPEnumerate(
 	//OK, now the hard part. We need to iterate through all the directories
 	//children and include them in the buffer until it is full.
 	//
-	BDirectory	directory(&afpEntry);
-	BEntry		entry;
+	fp_storage_dir	directory(&afpEntry);
+	fp_storage_entry	entry;
+	node_ref	dirRef;
+
+	//
+	//Remember that this session is looking at the directory so it
+	//hears about changes to it.
+	//
+	if (directory.GetNodeRef(&dirRef) == B_OK) {
+
+		gAFPDirWatch.Enumerated(afpSession, dirRef);
+	}
 
 	//
 	//Make sure the directory object got intialized properly.
@@ -1399,8 +1300,8 @@ AFPERROR FPEnumerate(
 	while(directory.GetNextEntry(&entry) != B_ENTRY_NOT_FOUND)
 	{
 		bool 		afpIsDirectory;
-		int8		tempBuffer[1024];
-		afp_buffer	afpParmsBuffer(tempBuffer);
+		bool		afpReplyFull	= false;
+		int8*		afpEntryStart	= afpReply.GetCurrentPosPtr();
 
 		afpIsDirectory = entry.IsDirectory();
 
@@ -1414,12 +1315,6 @@ AFPERROR FPEnumerate(
 			continue;
 		}
 
-		//
-		//Call the appropriate GetXXXParms calls.
-		//
-		afpParmsBuffer.Rewind();
-		afpAttributes = 0;
-
 		if (afpIsDirectory)
 		{
 			//
@@ -1432,19 +1327,6 @@ AFPERROR FPEnumerate(
 				DBGWRITE(dbg_level_warning, "User doesn't have search access to the directory, hiding folders!\n");
 				continue;
 			}
-
-			//
-			//Set the afp flag that marks this as a directory.
-			//
-			afpAttributes |= kFileDirIsDir;
-
-			afpError = fp_objects::fp_GetDirParms(
-										afpSession,
-										afpVolume,
-										&entry,
-										afpDirBitmap,
-										&afpParmsBuffer
-										);
 		}
 		else
 		{
@@ -1458,8 +1340,32 @@ AFPERROR FPEnumerate(
 				DBGWRITE(dbg_level_warning, "User doesn't have read access to the directory, hiding files!\n");
 				continue;
 			}
+		}
 
-			afpError = fp_objects::fp_GetFileParms(afpSession, afpVolume, &entry, afpFileBitmap, &afpParmsBuffer);
+		//
+		//Pack the entry straight into the reply. It is only left there
+		//if it fits within the callers max reply size and we're past
+		//the start index. The first byte (or word for AFP3.x) of the
+		//entry contains the struct len.
+		//
+		afpError = fp_objects::fp_PackFileDirEntry(
+									afpSession,
+									afpVolume,
+									&entry,
+									afpIsDirectory,
+									afpIsDirectory ? afpDirBitmap : afpFileBitmap,
+									(afpCommand > afpEnumerate),
+									afpMaxReplySize,
+									&afpReply,
+									&afpReplyFull
+									);
+
+		if (afpReplyFull)
+		{
+			//
+			//We need to stay inside the callers max reply size in the request.
+			//
+			break;
 		}
 
 		if (AFP_SUCCESS(afpError))
@@ -1470,113 +1376,19 @@ AFPERROR FPEnumerate(
 			afpObjectsFound++;
 
 			//
-			//If we haven't hit the start index yet, continue on...
-			//
-			if (afpObjectsFound < afpStartIndex) {
-				continue;
-			}
-
-			int8*	structLen 		= NULL;
-			int16*	extStructLen	= NULL;
-			int32	sizeRequired;
-			int16	len;
-
-			//
-			//Check to make sure there is enough room in the buffer to add the
-			//file/dir information.
-			//
-			sizeRequired = afpParmsBuffer.GetDataLength() + afpReply.GetDataLength();
-
-			//
-			//There are items after the file dirs parms that are added to the buffer,
-			//so we add a little extra to be safe.
-			//
-			sizeRequired += (4);
-
-			//
-			//wMaxReplySize is the maximum size our return buffer can be.
-			//
-			if (sizeRequired >= afpMaxReplySize)
-			{
-				//
-				//We need to stay inside the callers max reply size in the request.
-				//
-				break;
-			}
-
-			//
-			//Make sure we didn't get bigger then our reply buffer can handle.
+			//If we haven't hit the start index yet, roll the entry back
+			//out and continue on...
 			//
-			if (sizeRequired > afpReply.GetBufferSize())
+			if (afpObjectsFound < afpStartIndex)
 			{
-				//
-				//This should never happen (yeah right). In case it does, just
-				//bail from here.
-				//
-				break;
+				afpReply.SetCurrentPosPtr(afpEntryStart);
+				continue;
 			}
 
 			//
 			//Increment the count of the # of objects we're returning.
 			//
 			afpActCount++;
-
-			//
-			//The first byte (or word for AFP3.x) contains the struct len.
-			//
-			if (afpCommand > afpEnumerate)
-			{
-				extStructLen = (int16*)afpReply.GetCurrentPosPtr();
-				afpReply.Advance(sizeof(int16));
-			}
-			else
-			{
-				structLen = afpReply.GetCurrentPosPtr();
-				afpReply.Advance(sizeof(int8));
-			}
-
-			//
-			//Push in the attributes flag (dir, yes/no)
-			//
-			afpReply.AddInt8(afpAttributes);
-
-			//
-			//For AFP3.x, we add an extra null byte for padding here.
-			//
-			if (afpCommand > afpEnumerate) {
-				afpReply.AddInt8(0);
-			}
-
-			//
-			//Insert the FDP parameters into the reply buffer.
-			//
-			afpReply.AddRawData(afpParmsBuffer.GetBuffer(), afpParmsBuffer.GetDataLength());
-
-			//
-			//Set the structure length byte in the buffer. The extra bytes are
-			//for the first parms in the structure (structLen, attributes and padding).
-			//
-			len = afpParmsBuffer.GetDataLength() + ((afpCommand > afpEnumerate) ? 4 : 2);
-
-			//
-			//This entry must end on an even boundary.
-			//
-			if (len % 2)
-			{
-				afpReply.AddInt8(0);
-				len++;
-			}
-
-			//
-			//AFP3.x uses a word to describe the struct length vs. a byte
-			//
-			if (afpCommand > afpEnumerate)
-			{
-				*extStructLen = htons(len);
-			}
-			else {
-				*structLen = len;
-			}
 		}
 		else
 		{
@@ -1633,7 +1445,7 @@ AFPERROR FPSetFileDirParms(
 
 	afp_buffer	afpRequest(afpReqBuffer);
 	char		afpPathname[MAX_AFP_PATH];
-	BEntry		afpEntry;
+	fp_storage_entry	afpEntry;
 	int8		afpCommand		= 0;
 	fp_volume*	afpVolume		= NULL;
 	int16		afpVolID		= 0;
@@ -1779,7 +1591,11 @@ AFPERROR FPSetFileDirParms(
 	//
 	afpError = fp_objects::fp_SetFileDirParms(afpSession, &afpRequest, &afpEntry, afpBitmap);
 
-	afpVolume->MakeDirty();
+	if (AFP_SUCCESS(afpError)) {
+
+		afpVolume->CatalogUpdate(&afpEntry);
+		gAFPDirWatch.ParentChanged(&afpEntry);
+	}
 
 	return( afpError );
 }
@@ -1804,7 +1620,7 @@ AFPERROR FPCreateDir(
 	afp_buffer	afpRequest(afpReqBuffer);
 	afp_buffer	afpReply(afpReplyBuffer);
 	char		afpPathname[MAX_AFP_PATH];
-	BEntry		afpEntry;
+	fp_storage_entry	afpEntry;
 	fp_volume*	afpVolume		= NULL;
 	int16		afpVolumeID		= 0;
 	int32		afpDirID		= 0;
@@ -1902,11 +1718,11 @@ AFPERROR FPCreateDir(
 	//Now we use the B API's to create the new directory in the
 	//filesystem.
 	//
-	BDirectory	dir(&afpEntry);
+	fp_storage_dir	dir(&afpEntry);
 
 	if (dir.InitCheck() == B_OK)
 	{
-		BDirectory	newdir;
+		fp_storage_dir	newdir;
 		node_ref	nodeRef;
 		status_t	status;
 
@@ -1914,6 +1730,9 @@ AFPERROR FPCreateDir(
 
 		if (status == B_OK)
 		{
+			dir.GetNodeRef(&nodeRef);
+			gAFPPathCache.InvalidateDirectory(nodeRef);
+
 			newdir.GetNodeRef(&nodeRef);
 			afpReply.AddInt32(nodeRef.node);
 		}
@@ -1934,8 +1753,8 @@ AFPERROR FPCreateDir(
 
 	if (AFP_SUCCESS(afpError))
 	{
-		BEntry	newEntry(&dir, afpPathname);
-		mode_t	bperms = 0;
+		fp_storage_entry	newEntry(&dir, afpPathname);
+		FP_STORAGE_STAT		dirStat;
 
 		if (newEntry.InitCheck() == B_OK)
 		{
@@ -1958,16 +1777,17 @@ AFPERROR FPCreateDir(
 			//match the parent directory.
 			//
 
-			dir.GetPermissions(&bperms);
-			newEntry.SetPermissions(bperms);
+			if (dir.GetStat(&dirStat) == B_OK) {
+				newEntry.SetPermissions(dirStat.mode);
+			}
+
+			afpVolume->CatalogUpdate(&newEntry);
 		}
 
 		//
-		//We need to signal to all clients that their picture of this
-		//volume has changed.
+		//Let the clients looking at the parent know it has changed.
 		//
-
-		afpVolume->MakeDirty();
+		gAFPDirWatch.ParentChanged(&newEntry);
 	}
 
 	*afpDataSize = afpReply.GetDataLength();
@@ -2095,6 +1915,10 @@ AFPERROR FPFlushFork(
 				(forkItem->file->InitCheck() == B_OK)	&&
 				(forkItem->file->IsWritable())			)
 			{
+				if (forkItem->writeBehind != NULL) {
+					afpError = forkItem->writeBehind->Flush();
+				}
+
 				forkItem->file->Sync();
 			}
 		}
@@ -2176,7 +2000,7 @@ AFPERROR FPOpenFork(
 	afp_buffer	afpRequest(afpReqBuffer);
 	afp_buffer	afpReply(afpReplyBuffer);
 	char		afpPathname[MAX_AFP_PATH];
-	BEntry		afpEntry;
+	fp_storage_entry	afpEntry;
 	int8		afpFork			= 0;
 	fp_volume*	afpVolume		= NULL;
 	int16		afpVolumeID		= 0;
@@ -2414,6 +2238,12 @@ AFPERROR FPSetForkParms(
 				return( afpBitmapErr );
 			}
 
+			//
+			//Buffered writes have to land before the size changes or
+			//they would extend the file again afterwards.
+			//
+			forkItem->volume->FlushWriteBehind(forkItem->entry);
+
 			switch(forkItem->file->SetSize(afpForkLen))
 			{
 				case B_OK:			afpError = AFP_OK;			break;
@@ -2422,11 +2252,14 @@ AFPERROR FPSetForkParms(
 
 				default:			afpError = afpMiscErr;		break;
 			}
+
+			forkItem->volume->InvalidateCachedData(forkItem->entry);
+			forkItem->volume->RefreshSpace();
 		}
 
 		if ((afpBitmap & kFPRFLen) || (afpBitmap & kFPExtRsrcForkLen))
 		{
-			BNode	node(forkItem->entry);
+			fp_storage_node	node(forkItem->entry);
 
 			DBGWRITE(dbg_level_trace, "Setting rsrc fork length: %lld\n", afpForkLen);
 
@@ -2458,7 +2291,6 @@ AFPERROR FPSetForkParms(
 				afpError = (node.WriteAttr(
 								AFP_RSRC_ATTRIBUTE,
 								B_RAW_TYPE,
-								0,
 								forkItem->rsrcIO->Buffer(),
 								forkItem->rsrcIO->BufferLength() ) < B_OK) ? afpParmErr : AFP_OK;
 			}
@@ -2536,6 +2368,13 @@ AFPERROR FPGetForkParms(
 			return( afpBitmapErr );
 		}
 
+		//
+		//The data fork length has to include any buffered writes.
+		//
+		if (afpBitmap & (kFPDFLen | kFPExtDataForkLen)) {
+			forkItem->volume->FlushWriteBehind(forkItem->entry);
+		}
+
 		//
 		//Add in the bitmap
 		//
@@ -2585,7 +2424,7 @@ AFPERROR FPCreateFile(
 
 	afp_buffer		afpRequest(afpReqBuffer);
 	char			afpPathname[MAX_AFP_PATH];
-	BEntry			afpEntry;
+	fp_storage_entry	afpEntry;
 	fp_volume*		afpVolume		= NULL;
 	int8			createFlag		= 0;
 	int16			afpVolumeID		= 0;
@@ -2683,7 +2522,7 @@ AFPERROR FPCreateFile(
 	//Now we use the B API's to create the new directory in the
 	//filesystem.
 	//
-	BDirectory	dir(&afpEntry);
+	fp_storage_dir	dir(&afpEntry);
 
 	if (dir.InitCheck() == B_OK)
 	{
@@ -2695,6 +2534,17 @@ AFPERROR FPCreateFile(
 
 		DBGWRITE(dbg_level_trace, "CreateFile returned %s\n", GET_BERR_STR(status));
 
+		if (status == B_OK)
+		{
+			node_ref	dirRef;
+
+			//
+			//Forget any cached "not found" for the new name.
+			//
+			dir.GetNodeRef(&dirRef);
+			gAFPPathCache.InvalidateDirectory(dirRef);
+		}
+
 		switch(status)
 		{
 			case B_FILE_EXISTS:			afpError = afpObjectExists;	break;
@@ -2718,7 +2568,7 @@ AFPERROR FPCreateFile(
 
 	if (AFP_SUCCESS(afpError))
 	{
-		BEntry	newEntry(&dir, afpPathname);
+		fp_storage_entry	newEntry(&dir, afpPathname);
 
 		if (newEntry.InitCheck() == B_OK)
 		{
@@ -2734,6 +2584,8 @@ AFPERROR FPCreateFile(
 								true
 								);
 			}
+
+			afpVolume->CatalogUpdate(&newEntry);
 		}
 		else
 		{
@@ -2745,10 +2597,9 @@ AFPERROR FPCreateFile(
 		}
 
 		//
-		//We need to signal to all clients that their picture of this
-		//volume has changed.
+		//Let the clients looking at the parent know it has changed.
 		//
-		afpVolume->MakeDirty();
+		gAFPDirWatch.ParentChanged(&newEntry);
 	}
 
 	DBGWRITE(dbg_level_trace, "Returning %lu\n", afpError);
@@ -2778,7 +2629,7 @@ AFPERROR FPDelete(
 
 	afp_buffer		afpRequest(afpReqBuffer);
 	char			afpPathname[MAX_AFP_PATH];
-	BEntry			afpEntry;
+	fp_storage_entry	afpEntry;
 	fp_volume*		afpVolume		= NULL;
 	int16			afpVolumeID		= 0;
 	int32			afpDirID		= 0;
@@ -2873,8 +2724,8 @@ AFPERROR FPDelete(
 	//
 	//We need to check write access to the parent directory.
 	//
-	BDirectory 	parent;
-	BEntry		pEntry;
+	fp_storage_dir 	parent;
+	fp_storage_entry	pEntry;
 
 	afpEntry.GetParent(&parent);
 	parent.GetEntry(&pEntry);
@@ -2887,6 +2738,16 @@ AFPERROR FPDelete(
 		return( afpError );
 	}
 
+	//
+	//Remember who this was so we can drop it from the catalog and
+	//the path cache.
+	//
+	node_ref	deletedRef;
+	entry_ref	deletedEntryRef;
+
+	afpEntry.GetNodeRef(&deletedRef);
+	afpEntry.GetRef(&deletedEntryRef);
+
 	//
 	//Now call the object method that does all the nasty work for us.
 	//
@@ -2904,183 +2765,24 @@ AFPERROR FPDelete(
 	//
 	if (AFP_SUCCESS(afpError)) {
 
-		afpVolume->MakeDirty();
-	}
-
-	return( afpError );
-}
-
-
-/*
- * FPRead()
- *
- * Description:
- *		Read data from an open file.
- *
- * Returns: AFPERROR
- */
-
-AFPERROR FPRead(
-	afp_session*	afpSession,
-	int8*			afpReqBuffer,
-	int8*			afpReplyBuffer,
-	int32*			afpDataSize
-	)
-{
-	afp_buffer		afpRequest(afpReqBuffer);
-	afp_buffer		afpReply(afpReplyBuffer, SRVR_REQUEST_QUANTUM_SIZE);
-	off_t			seekResult		= 0;
-	int8			afpCommand		= 0;
-	int16			afpForkRef		= 0;
-	off_t			afpOffset		= 0;
-	size_t			afpReqCount		= 0;
-	int32			afpActCount		= 0;
-	AFPERROR		afpError		= AFP_OK;
-	OPEN_FORK_ITEM*	forkItem		= NULL;
-
-	DBGWRITE(dbg_level_trace, "Enter\n");
-
-	//
-	//The first byte contains the afp command.
-	//
-	afpCommand = afpRequest.GetInt8();
-	afpRequest.Advance(sizeof(int8));
-
-	afpForkRef	= afpRequest.GetInt16();
-
-	switch(afpCommand)
-	{
-		case afpRead:
-			afpOffset	= afpRequest.GetInt32();
-			afpReqCount	= afpRequest.GetInt32();
-			break;
-
-		case afpReadExt:
-			afpOffset	= afpRequest.GetInt64();
-			afpReqCount	= (size_t)afpRequest.GetInt64();
-			break;
-
-		default:
-			return( afpParmErr );
-	}
-
-	forkItem = afpSession->GetForkItem(afpForkRef);
-	afpError = (forkItem != NULL) ? AFP_OK : afpParmErr;
-
-	if (AFP_SUCCESS(afpError))
-	{
-		if (afpReqCount > (size_t)afpReply.GetBufferSize())
-		{
-			//
-			//The request is too big, reduce the count to what
-			//we can hold. We'll return to the client what we
-			//actually read.
-			//
-			afpReqCount = afpReply.GetBufferSize();
-
-			DBGWRITE(dbg_level_info, "Resized afpReqCount to buffer size!!\n");
-		}
-
 		//
-		//Check to see if any area in the range we're reading from is
-		//locked.
+		//Lookups in the parent may have found the name, and if this was
+		//a directory its node could be reused.
 		//
-		if (fp_rangelock::RangeLocked(
-						seekResult,
-						seekResult + afpReqCount,
-						forkItem->entry
-						))
-		{
-			DBGWRITE(dbg_level_info, "****Range is currently locked!****\n");
-			return( afpLockErr );
-		}
-
-		if (forkItem->forkopen == kDataFork)
-		{
-			if (!forkItem->file->IsReadable())
-			{
-				DBGWRITE(dbg_level_trace, "Data fork is not readable!\n");
-				return( afpAccessDenied );
-			}
-
-			DBGWRITE(dbg_level_trace, "Reading (DF) %lu bytes from %lld offset\n", afpReqCount, afpOffset);
-
-			//
-			//Seek to the correct position to read from in the file.
-			//
-			seekResult = forkItem->file->Seek(afpOffset, SEEK_SET);
-
-			if (seekResult == B_ERROR)
-			{
-				//
-				//We had an error seeking to the position. Probably a bad
-				//position was requested.
-				//
-				DBGWRITE(dbg_level_trace, "Seek() failed!\n");
-				return( afpParmErr );
-			}
-
-			//
-			//Now, perform the actual read from the file.
-			//
-			afpActCount = forkItem->file->Read(afpReply.GetCurrentPosPtr(), afpReqCount);
-		}
-		else //Reading from resource fork
-		{
-			DBGWRITE(dbg_level_trace, "Reading (RF) %lu bytes from %lld offset\n", afpReqCount, afpOffset);
-
-			//
-			//The resource fork should already be read in and in memory.
-			//
-			if (forkItem->rsrcIO != NULL)
-			{
-				//
-				//Seek to the correct position to read from in the file.
-				//
-				seekResult = forkItem->rsrcIO->Seek(afpOffset, SEEK_SET);
-
-				if (seekResult == B_ERROR)
-				{
-					//
-					//We had an error seeking to the position. Probably a bad
-					//position was requested.
-					//
-					DBGWRITE(dbg_level_error, "Seek() failed (RF)!\n");
-					return( afpParmErr );
-				}
-
-				afpActCount = forkItem->rsrcIO->Read(
-												afpReply.GetCurrentPosPtr(),
-												afpReqCount
-												);
-			}
-			else
-			{
-				DBGWRITE(dbg_level_error, "rsrcIO object is NULL!\n");
-				return( afpParmErr );
-			}
-		}
+		gAFPPathCache.InvalidateDirectory(deletedEntryRef.device, deletedEntryRef.directory);
+		gAFPPathCache.InvalidateDirectory(deletedRef);
 
-		if (afpActCount < B_OK)
-		{
-			DBGWRITE(dbg_level_error, "Failed to read data!\n");
+		afpVolume->CatalogRemove(deletedRef, deletedEntryRef.directory);
+		afpVolume->RefreshSpace();
+		gAFPDirWatch.DirectoryChanged(deletedEntryRef.device, deletedEntryRef.directory);
+		gAFPDirWatch.NodeRemoved(deletedRef);
 
-			afpError = afpMiscErr;
-		}
-		else if (afpReqCount > 0 && afpActCount == 0)
-		{
-			afpError = afpEofError;
-		}
-		else if (afpActCount > 0)
-		{
-			afpReply.Advance(afpActCount);
-		}
+		//
+		//The node could be reused for a new file.
+		//
+		gAFPBlockCache.InvalidateNode(deletedRef);
 	}
 
-	*afpDataSize = afpActCount > 0 ? afpActCount : 0;
-
-	DBGWRITE(dbg_level_trace, "Returning error %ld, act count: %ld\n", afpError, afpActCount);
-
 	return( afpError );
 }
 
@@ -3166,16 +2868,84 @@ AFPERROR FPWrite(
 			return( afpParmErr );
 		}
 
+		if (forkItem->writeBehind != NULL)
+		{
+			if (afpFlag & kWriteStartEndFlag)
+			{
+				//
+				//We need the real end of the fork for this one, so get
+				//what's buffered on disk and write it directly below.
+				//
+				afpError = forkItem->writeBehind->Flush();
+
+				if (AFP_FAILURE(afpError)) {
+					return( afpError );
+				}
+			}
+			else
+			{
+				if (fp_rangelock::RangeLocked(
+								afpOffset,
+								afpOffset + afpReqCount,
+								forkItem->entry
+								))
+				{
+					DBGWRITE(dbg_level_warning, "****Range is currently locked!****\n");
+					return( afpLockErr );
+				}
+
+				forkItem->volume->GetIOScheduler()->Begin(afpSession, afpReqCount);
+
+				afpError = forkItem->writeBehind->Write(
+												afpOffset,
+												afpRequest.GetCurrentPosPtr(),
+												afpReqCount
+												);
+
+				forkItem->volume->GetIOScheduler()->End();
+
+				if (AFP_SUCCESS(afpError))
+				{
+					forkItem->volume->InvalidateCachedData(forkItem->entry);
+					forkItem->volume->SpaceChanged(afpReqCount);
+
+					switch(afpCommand)
+					{
+						case afpWrite:
+							afpReply.AddInt32(afpOffset + afpReqCount);
+							break;
+
+						case afpWriteExt:
+							afpReply.AddInt64(afpOffset + afpReqCount);
+							break;
+					}
+
+					*afpDataSize = afpReply.GetDataLength();
+				}
+
+				return( afpError );
+			}
+		}
+
 		//
 		//If the bit is set, then we are calculating the offset from
 		//the end of the file.
 		//
-		seekResult = forkItem->file->Seek(
-						afpOffset,
-						(afpFlag & kWriteStartEndFlag) ? SEEK_END : SEEK_SET
-						);
+		seekResult = afpOffset;
 
-		if (seekResult == B_ERROR)
+		if (afpFlag & kWriteStartEndFlag)
+		{
+			off_t	forkSize = 0;
+
+			if (forkItem->file->GetSize(&forkSize) == B_OK) {
+				seekResult += forkSize;
+			}
+			else {
+				seekResult = B_ERROR;
+			}
+		}
+
+		if (seekResult < 0)
 		{
 			//
 			//We had an error seeking to the position. Probably a bad
@@ -3193,8 +2963,8 @@ AFPERROR FPWrite(
 
 		//
 		//Check to see if any area in the range we're writing is
-		//locked. Note that we call Position() here because we don't
-		//easily know the offset (range start).
+		//locked. Note that we use the resolved offset here because
+		//afpOffset may be relative to the end of the fork.
 		//
 		if (fp_rangelock::RangeLocked(
 						seekResult,
@@ -3208,13 +2978,19 @@ AFPERROR FPWrite(
 
 		//
 		//Call on the Be file object to do the BeOS specific file
-		//system work for us.
+		//system work for us, once the volume's I/O scheduler says
+		//it's our turn.
 		//
-		afpActCount = forkItem->file->Write(
+		forkItem->volume->GetIOScheduler()->Begin(afpSession, afpReqCount);
+
+		afpActCount = forkItem->file->WriteAt(
+										seekResult,
 										afpRequest.GetCurrentPosPtr(),
 										afpReqCount
 										);
 
+		forkItem->volume->GetIOScheduler()->End();
+
 		if (afpActCount < B_OK)
 		{
 			DBGWRITE(dbg_level_warning, "Failed to write data!\n");
@@ -3224,14 +3000,17 @@ AFPERROR FPWrite(
 		{
 			DBGWRITE(dbg_level_trace, "Actually wrote %lu bytes\n", afpActCount);
 
+			forkItem->volume->InvalidateCachedData(forkItem->entry);
+			forkItem->volume->SpaceChanged(afpActCount);
+
 			switch(afpCommand)
 			{
 				case afpWrite:
-					afpReply.AddInt32(forkItem->file->Position());
+					afpReply.AddInt32(seekResult + afpActCount);
 					break;
 
 				case afpWriteExt:
-					afpReply.AddInt64(forkItem->file->Position());
+					afpReply.AddInt64(seekResult + afpActCount);
 					break;
 			}
 
@@ -3258,8 +3037,8 @@ AFPERROR FPWrite(
 
 		//
 		//Check to see if any area in the range we're writing is
-		//locked. Note that we call Position() here because we don't
-		//easily know the offset (range start).
+		//locked. Note that we use the resolved offset here because
+		//afpOffset may be relative to the end of the fork.
 		//
 		if (fp_rangelock::RangeLocked(
 						afpOffset,
@@ -3341,9 +3120,9 @@ AFPERROR FPMoveAndRename(
 	afp_buffer		afpRequest(afpReqBuffer);
 	char			afpPathname[MAX_AFP_PATH];
 	char			afpNewPathname[MAX_AFP_NAME];
-	BEntry			afpSrcEntry;
-	BEntry			afpDstEntry;
-	BDirectory		afpMoveToDir;
+	fp_storage_entry	afpSrcEntry;
+	fp_storage_entry	afpDstEntry;
+	fp_storage_dir	afpMoveToDir;
 	fp_volume*		afpVolume		= NULL;
 	int16			afpVolumeID		= 0;
 	int32			afpSrcDirID		= 0;
@@ -3521,6 +3300,17 @@ AFPERROR FPMoveAndRename(
 			return( afpError );
 		}
 
+		entry_ref	srcRef;
+		node_ref	srcParentRef;
+		node_ref	dstDirRef;
+
+		if (afpSrcEntry.GetRef(&srcRef) == B_OK) {
+
+			srcParentRef = node_ref(srcRef.device, srcRef.directory);
+		}
+
+		afpMoveToDir.GetNodeRef(&dstDirRef);
+
 		//
 		//If the source and destination dir ID's are the same, then we're
 		//just renaming the file.
@@ -3544,7 +3334,7 @@ AFPERROR FPMoveAndRename(
 			}
 			else
 			{
-				afpVolume->MakeDirty();
+				gAFPDirWatch.DirectoryChanged(srcParentRef);
 				afpError = AFP_OK;
 			}
 		}
@@ -3572,6 +3362,19 @@ AFPERROR FPMoveAndRename(
 				}
 			}
 		}
+
+		//
+		//Even a failed rename may have left the object moved, so forget
+		//the lookups in both directories now that we're done with them.
+		//
+		gAFPPathCache.InvalidateDirectory(srcParentRef);
+		gAFPPathCache.InvalidateDirectory(dstDirRef);
+
+		if (AFP_SUCCESS(afpError)) {
+
+			afpVolume->CatalogUpdate(&afpSrcEntry);
+			gAFPDirWatch.ParentChanged(&afpSrcEntry);
+		}
 	}
 
 	DBGWRITE(dbg_level_trace, "Returning %lu\n", afpError);
@@ -3601,7 +3404,7 @@ AFPERROR FPRename(
 
 	afp_buffer		afpRequest(afpReqBuffer);
 	char			afpPathname[MAX_AFP_PATH];
-	BEntry			afpEntry;
+	fp_storage_entry	afpEntry;
 	fp_volume*		afpVolume		= NULL;
 	int16			afpVolumeID		= 0;
 	int32			afpDirID		= 0;
@@ -3721,18 +3524,19 @@ AFPERROR FPRename(
 	if (strlen(afpPathname) != 0)
 	{
 		afpError = (afpEntry.Rename(afpPathname) == B_OK) ? AFP_OK : afpObjectLocked;
+
+		if (AFP_SUCCESS(afpError)) {
+
+			gAFPPathCache.InvalidateParentOf(&afpEntry);
+			afpVolume->CatalogUpdate(&afpEntry);
+			gAFPDirWatch.ParentChanged(&afpEntry);
+		}
 	}
 	else
 	{
 		afpError = afpParmErr;
 	}
 
-	//
-	//We need to signal to all clients that their picture of this
-	//volume has changed.
-	//
-	afpVolume->MakeDirty();
-
 	return( afpError );
 }
 
@@ -4097,12 +3901,17 @@ AFPERROR FPByteRangeLock(
 	{
 		if (forkItem->forkopen == kDataFork) {
 
-			forkItem->entry->GetSize(&afpFileSize);
+			//
+			//Whoever gets the lock must see all the data written so
+			//far, and we need the real size for end relative ranges.
+			//
+			forkItem->volume->FlushWriteBehind(forkItem->entry);
+			forkItem->file->GetSize(&afpFileSize);
 		}
 		else
 		{
-			attr_info	info = {0,0};
-			BNode		node(forkItem->entry);
+			FP_STORAGE_ATTR_INFO	info = {0,0};
+			fp_storage_node			node(forkItem->entry);
 
 			if (node.GetAttrInfo(AFP_RSRC_ATTRIBUTE, &info) == B_OK) {
 				afpFileSize = info.size;
@@ -4158,7 +3967,7 @@ AFPERROR FPByteRangeLock(
 				//If the length is 0xFFFFFFFF, then we have special handling to do.
 				//
 				if (((afpCommand == afpByteRangeLock) && (afpLength == 0xFFFFFFFF))	||
-					((afpCommand == afpByteRangeLockExt) && ((uint64)afpLength == ULONGLONG_MAX)))
+					((afpCommand == afpByteRangeLockExt) && ((uint64)afpLength == UINT64_MAX)))
 				{
 					switch(afpOffset)
 					{
@@ -4247,8 +4056,8 @@ AFPERROR FPCopyFile(
 	char			afpSrcPathname[MAX_AFP_PATH];
 	char			afpDstPathname[MAX_AFP_PATH];
 	char			afpNewName[MAX_AFP_NAME];
-	BEntry			afpSrcEntry;
-	BEntry			afpDstEntry;
+	fp_storage_entry	afpSrcEntry;
+	fp_storage_entry	afpDstEntry;
 	fp_volume*		afpSrcVolume	= NULL;
 	fp_volume*		afpDstVolume	= NULL;
 	int16			afpSrcVolID		= 0;
@@ -4401,8 +4210,8 @@ AFPERROR FPCopyFile(
 	//
 	//Now construct the new full pathname to what will be the newly created object.
 	//
-	BFile	destFile;
-	BFile	srcFile;
+	fp_storage_node	destFile;
+	fp_storage_node	srcFile;
 
 	if (strlen(afpNewName) == 0)
 	{
@@ -4428,7 +4237,7 @@ AFPERROR FPCopyFile(
 	//Now that we have the new pathname all set, we need to actually create
 	//a new file in the destination.
 	//
-	BDirectory	destDir(&afpDstEntry);
+	fp_storage_dir	destDir(&afpDstEntry);
 
 	if (destDir.CreateFile(afpNewName, &destFile, true) != B_OK)
 	{
@@ -4436,11 +4245,16 @@ AFPERROR FPCopyFile(
 		return( afpParmErr );
 	}
 
-	srcFile.SetTo(&afpSrcEntry, B_READ_WRITE);
+	node_ref	destDirRef;
+
+	destDir.GetNodeRef(&destDirRef);
+	gAFPPathCache.InvalidateDirectory(destDirRef);
+
+	srcFile.SetTo(&afpSrcEntry, FP_STORAGE_READ | FP_STORAGE_WRITE);
 
 	if (srcFile.InitCheck() != B_OK)
 	{
-		DBGWRITE(dbg_level_error, "InitCheck() failed on src BFile!\n");
+		DBGWRITE(dbg_level_error, "InitCheck() failed on src fp_storage_node!\n");
 		return( afpParmErr );
 	}
 
@@ -4453,11 +4267,15 @@ AFPERROR FPCopyFile(
 		return( afpParmErr );
 	}
 
+	fp_storage_entry	destEntry(&destDir, afpNewName);
+
+	afpDstVolume->CatalogUpdate(&destEntry);
+	afpDstVolume->RefreshSpace();
+
 	//
-	//We need to signal to all clients that their picture of this
-	//volume has changed.
+	//Let the clients looking at the destination know it has changed.
 	//
-	afpDstVolume->MakeDirty();
+	gAFPDirWatch.DirectoryChanged(destDirRef);
 
 	return( AFP_OK );
 }
@@ -4483,7 +4301,7 @@ AFPERROR FPCreateID(
 	afp_buffer	afpRequest(afpReqBuffer);
 	afp_buffer	afpReply(afpReplyBuffer, SRVR_REQUEST_QUANTUM_SIZE);
 	char		afpPathname[MAX_AFP_PATH];
-	BEntry		afpEntry;
+	fp_storage_entry	afpEntry;
 	node_ref	nref;
 	fp_volume*	afpVolume		= NULL;
 	int16		afpVolumeID		= 0;
@@ -250,6 +250,7 @@ enum {
 	afpDeleteID					= 40,	//-
 	afpResolveID				= 41,
 	afpExchangeFiles			= 42,
+	afpCatSearch				= 43,	//*
 	afpDTOpen					= 48,	//*						/*AFPCall command codes*/
 	afpDTClose					= 49,	//*						/*AFPCall command codes*/
 	afpGetIcon					= 51,	//*						/*AFPCall command codes*/
@@ -271,7 +272,7 @@ enum {
 	afpGetSessionToken			= 64,	//*
 	afpDisconnectOldSession		= 65,	//*
 	afpEnumerateExt				= 66,	//*
-	afpCatSearchExt				= 67,	//-
+	afpCatSearchExt				= 67,	//*
 	afpEnumerateExt2			= 68,	//*
 	
 	//AFP3.2
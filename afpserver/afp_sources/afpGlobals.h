@@ -1,11 +1,13 @@
 #ifndef __afpGlobals__
 #define __afpGlobals__
 
+#ifdef __HAIKU__
 #include <Application.h>
 #include <Window.h>
 #include <Message.h>
-#include <Debug.h>
-#include <OS.h>
+#endif
+
+#include "afp_os.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -40,56 +42,45 @@ extern int 	afpAppReturnValue;
 
 #endif
 
-#if DEBUG
-
-extern char errString[24];
-
 #define GET_BERR_STR(e) GetBeErrorString(e)
 
-inline char* GetBeErrorString(int32 error)
+inline const char* GetBeErrorString(int32 error)
 {
 	switch(error)
 	{
-		case B_FILE_EXISTS:			strcpy(errString, "B_FILE_EXISTS");			break;
-		case B_ENTRY_NOT_FOUND:		strcpy(errString, "B_ENTRY_NOT_FOUND");		break;
-		case B_NAME_TOO_LONG:		strcpy(errString, "B_NAME_TOO_LONG");		break;
-		case B_NOT_A_DIRECTORY:		strcpy(errString, "B_NOT_A_DIRECTORY");		break;
-		case B_DIRECTORY_NOT_EMPTY:	strcpy(errString, "B_DIRECTORY_NOT_EMPTY");	break;
-		case B_DEVICE_FULL:			strcpy(errString, "B_DEVICE_FULL");			break;
-		case B_READ_ONLY_DEVICE:	strcpy(errString, "B_READ_ONLY_DEVICE");	break;
-		case B_IS_A_DIRECTORY:		strcpy(errString, "B_IS_A_DIRECTORY");		break;
-		case B_NO_MORE_FDS:			strcpy(errString, "B_NO_MORE_FDS");			break;
-		case B_CROSS_DEVICE_LINK:	strcpy(errString, "B_CROSS_DEVICE_LINK");	break;
-		case B_LINK_LIMIT:			strcpy(errString, "B_LINK_LIMIT");			break;
-		case B_BUSTED_PIPE:			strcpy(errString, "B_BUSTED_PIPE");			break;
-		case B_UNSUPPORTED:			strcpy(errString, "B_UNSUPPORTED");			break;
-		case B_PARTITION_TOO_SMALL:	strcpy(errString, "B_PARTITION_TOO_SMALL");	break;
-		case B_PERMISSION_DENIED:	strcpy(errString, "B_PERMISSION_DENIED");	break;
-		case B_NOT_ALLOWED:			strcpy(errString, "B_NOT_ALLOWED");			break;
-		case ECONNRESET:			strcpy(errString, "ECONNRESET");			break;
-		case ENOTCONN:				strcpy(errString, "ENOTCONN");				break;
-		case EBADF:					strcpy(errString, "EBADF");					break;
-		case EADDRINUSE:			strcpy(errString, "EADDRINUSE");			break;
-		case EWOULDBLOCK:			strcpy(errString, "EWOULDBLOCK");			break;
-		case EINTR:					strcpy(errString, "EINTR");					break;
-		case ENOPROTOOPT:			strcpy(errString, "ENOPROTOOPT");			break;
-		case B_ERROR:				strcpy(errString, "B_ERROR");				break;
-		case B_OK:					strcpy(errString, "B_OK");					break;
+		case B_FILE_EXISTS:			return( "B_FILE_EXISTS" );
+		case B_ENTRY_NOT_FOUND:		return( "B_ENTRY_NOT_FOUND" );
+		case B_NAME_TOO_LONG:		return( "B_NAME_TOO_LONG" );
+		case B_NOT_A_DIRECTORY:		return( "B_NOT_A_DIRECTORY" );
+		case B_DIRECTORY_NOT_EMPTY:	return( "B_DIRECTORY_NOT_EMPTY" );
+		case B_DEVICE_FULL:			return( "B_DEVICE_FULL" );
+		case B_READ_ONLY_DEVICE:	return( "B_READ_ONLY_DEVICE" );
+		case B_IS_A_DIRECTORY:		return( "B_IS_A_DIRECTORY" );
+		case B_NO_MORE_FDS:			return( "B_NO_MORE_FDS" );
+		case B_CROSS_DEVICE_LINK:	return( "B_CROSS_DEVICE_LINK" );
+		case B_LINK_LIMIT:			return( "B_LINK_LIMIT" );
+		case B_BUSTED_PIPE:			return( "B_BUSTED_PIPE" );
+		case B_UNSUPPORTED:			return( "B_UNSUPPORTED" );
+		case B_PARTITION_TOO_SMALL:	return( "B_PARTITION_TOO_SMALL" );
+		case B_PERMISSION_DENIED:	return( "B_PERMISSION_DENIED" );
+		case B_NOT_ALLOWED:			return( "B_NOT_ALLOWED" );
+		case ECONNRESET:			return( "ECONNRESET" );
+		case ENOTCONN:				return( "ENOTCONN" );
+		case EBADF:					return( "EBADF" );
+		case EADDRINUSE:			return( "EADDRINUSE" );
+		case EWOULDBLOCK:			return( "EWOULDBLOCK" );
+		case EINTR:					return( "EINTR" );
+		case ENOPROTOOPT:			return( "ENOPROTOOPT" );
+		case B_ERROR:				return( "B_ERROR" );
+		case B_OK:					return( "B_OK" );
 		
 		default:
-			strcpy(errString, "UNKNOWN");
 			break;
 	}
 	
-	return( errString );
+	return( "UNKNOWN" );
 }
 
-#else
-
-#define GET_ERR_STR(e)
-
-#endif //DEBUG
-
 #define PUSH_CSTRING(s,p) {									\
 			*p = strlen(s);									\
 			p += sizeof(int8);								\
@@ -11,15 +11,19 @@
 #include "fp_volume.h"
 #include "dsi_scavenger.h"
 #include "dsi_stats.h"
+#include "dsi_statsfeed.h"
+#include "dsi_trace.h"
 #include "afpmsg.h"
 #include "afplogon.h"
 #include "afpvolume.h"
 #include "afphostname.h"
+#include "fp_pathcache.h"
+#include "fp_blockcache.h"
+#include "fp_dirwatch.h"
+#include "afpdhxpool.h"
 
 extern dsi_scavenger* gAFPSessionMgr;
-extern std::unique_ptr<BList> volume_blist;
-
-dsi_stats gAFPStats;
+extern dsi_stats gAFPStats;
 
 /*
  * afpServerApplication()
@@ -132,6 +136,104 @@ void afpServerApplication::MessageReceived(BMessage* message)
 			break;
 		}
 		
+		case CMD_AFP_GETREADAHEADSTATS:
+		{
+			BMessage reply(be_afp_success);
+			
+			reply.AddInt32(AFP_PARAM_INT32, gAFPStats.RA_HitRate());
+			reply.AddInt64(AFP_PARAM_INT64, gAFPStats.RA_BytesServed());
+			message->SendReply(&reply);
+			break;
+		}
+		
+		case CMD_AFP_GETBLOCKCACHESTATS:
+		{
+			BMessage reply(be_afp_success);
+			
+			reply.AddInt32(AFP_PARAM_INT32, gAFPBlockCache.HitRate());
+			reply.AddInt64(AFP_PARAM_INT64, (int64)gAFPBlockCache.MemoryUsage());
+			message->SendReply(&reply);
+			break;
+		}
+		
+		case CMD_AFP_GETIOQUEUESTATS:
+		{
+			BMessage reply(be_afp_success);
+			
+			reply.AddInt64(AFP_PARAM_INT64, gAFPStats.IO_AverageWait());
+			reply.AddInt64(AFP_PARAM_INT64, gAFPStats.IO_MaxWait());
+			message->SendReply(&reply);
+			break;
+		}
+		
+		case CMD_AFP_GETLOGINSTATS:
+		{
+			BMessage reply(be_afp_success);
+			
+			reply.AddInt64(AFP_PARAM_INT64, gAFPStats.Login_AverageTime());
+			reply.AddInt64(AFP_PARAM_INT64, gAFPStats.Login_MaxTime());
+			reply.AddInt32(AFP_PARAM_INT32, gAFPDHXPool.CountKeys());
+			reply.AddInt64(AFP_PARAM_INT64, gAFPDHXPool.Misses());
+			message->SendReply(&reply);
+			break;
+		}
+		
+		case CMD_AFP_GETLOGLEVEL:
+		{
+			BMessage reply(be_afp_success);
+			
+			reply.AddInt32(AFP_PARAM_INT32, gAFPDebugLevel.load());
+			message->SendReply(&reply);
+			break;
+		}
+		
+		case CMD_AFP_SETLOGLEVEL:
+		{
+			int32	level = 0;
+			
+			if (	(message->FindInt32(AFP_PARAM_INT32, &level) == B_OK)	&&
+					(level >= dbg_level_none)								&&
+					(level <= dbg_level_dump_out)								)
+			{
+				afp_debug_set_level(level);
+				message->SendReply(be_afp_success);
+			}
+			else
+			{
+				message->SendReply(be_afp_failure);
+			}
+			break;
+		}
+		
+		case CMD_AFP_GETTRACE:
+		{
+			BMessage reply(be_afp_success);
+			
+			reply.AddInt32(AFP_PARAM_INT32, gAFPTrace.IsOn() ? 1 : 0);
+			message->SendReply(&reply);
+			break;
+		}
+		
+		case CMD_AFP_SETTRACE:
+		{
+			int32	on = 0;
+			
+			if (message->FindInt32(AFP_PARAM_INT32, &on) != B_OK)
+			{
+				message->SendReply(be_afp_failure);
+			}
+			else if (on == 0)
+			{
+				gAFPTrace.Stop();
+				message->SendReply(be_afp_success);
+			}
+			else
+			{
+				message->SendReply((gAFPTrace.Start() == B_OK) ? be_afp_success : be_afp_failure);
+			}
+			break;
+		}
+		
 		case CMD_AFP_GETUSERSLOGGEDIN:
 		{
 			BMessage reply(be_afp_success);
@@ -141,6 +243,25 @@ void afpServerApplication::MessageReceived(BMessage* message)
 			break;
 		}			
 		
+		case CMD_AFP_SUBSCRIBESTATS:
+		{
+			BMessenger	target;
+			int32		interval = 0;
+			
+			if (	(message->FindMessenger(AFP_PARAM_MESSENGER, &target) == B_OK)	&&
+					(message->FindInt32(AFP_PARAM_INT32, &interval) == B_OK)		&&
+					(interval >= 0)													&&
+					(gAFPStatsFeed.Subscribe(target, interval) == B_OK)					)
+			{
+				message->SendReply(be_afp_success);
+			}
+			else
+			{
+				message->SendReply(be_afp_failure);
+			}
+			break;
+		}
+		
 		case CMD_AFP_GETUSERINFO:
 			if (message->FindString(AFP_PARAM_STRING_USERNAME, &string) == B_OK)
 			{
@@ -155,6 +276,7 @@ void afpServerApplication::MessageReceived(BMessage* message)
 					reply.AddString(AFP_PARAM_STRING_USERNAME, userData.username);
 					reply.AddString(AFP_PARAM_STRING_PASSWORD, userData.password);
 					reply.AddInt32(AFP_PARAM_INT32, userData.flags);
+					reply.AddInt32(AFP_PARAM_INT32_RATELIMIT, userData.rateLimit);
 					
 					DPRINT(("[CMD_AFP_GETUSERINFO]User flags (%s) = 0x%x\n", userData.username, (int)userData.flags));
 					
@@ -195,6 +317,16 @@ void afpServerApplication::MessageReceived(BMessage* message)
 					memset(userData.password, 0, sizeof(userData.password));
 					strcpy(userData.password, password.String());
 					
+					//
+					//The rate limit is optional so older config apps
+					//leave it alone.
+					//
+					int32	rateLimit = 0;
+					
+					if (message->FindInt32(AFP_PARAM_INT32_RATELIMIT, &rateLimit) == B_OK) {
+						userData.rateLimit = rateLimit;
+					}
+					
 					userData.flags	 	= flags;
 					afpError 			= afpUpdateUserInfo(userData);
 					
@@ -441,9 +573,13 @@ void afpServerApplication::MessageReceived(BMessage* message)
 		case CMD_AFP_GETVOLUMENAME:							
 			if (message->FindInt16(AFP_PARAM_INT16, (int16*)&volIndex) == B_OK)
 			{
-				fp_volume* afpVolume = NULL;
-								
-				afpVolume = (fp_volume*)volume_blist->ItemAt(volIndex);
+				fp_volume_reader		reader;
+				const AFP_VOLUME_TABLE*	volumes		= VolumeTable();
+				fp_volume*				afpVolume	= NULL;
+				
+				if (volIndex < volumes->volumes.size()) {
+					afpVolume = volumes->volumes[volIndex];
+				}
 								
 				if (afpVolume != NULL)
 				{
@@ -461,9 +597,13 @@ void afpServerApplication::MessageReceived(BMessage* message)
 		case CMD_AFP_GETVOLUMEPATH:
 			if (message->FindInt16(AFP_PARAM_INT16, (int16*)&volIndex) == B_OK)
 			{
-				fp_volume* afpVolume = NULL;
-								
-				afpVolume = (fp_volume*)volume_blist->ItemAt(volIndex);
+				fp_volume_reader		reader;
+				const AFP_VOLUME_TABLE*	volumes		= VolumeTable();
+				fp_volume*				afpVolume	= NULL;
+				
+				if (volIndex < volumes->volumes.size()) {
+					afpVolume = volumes->volumes[volIndex];
+				}
 								
 				if (afpVolume != NULL)
 				{
@@ -471,7 +611,7 @@ void afpServerApplication::MessageReceived(BMessage* message)
 					
 					reply.AddString(
 							AFP_PARAM_PATHSTRING,
-							(afpVolume->GetPath())->Path()
+							afpVolume->GetPath()
 							);
 					
 					message->SendReply(&reply);
@@ -485,56 +625,127 @@ void afpServerApplication::MessageReceived(BMessage* message)
 		//
 		//We watch the nodes associated with our shared AFP volumes. If
 		//one of the share points for our volumes is moved, renamed or deleted,
-		//then we automatically stop sharing that directory.
+		//then we automatically stop sharing that directory. We also watch
+		//directories clients have open so they hear about local changes.
 		//
 		case B_NODE_MONITOR:
 		{
 			fp_volume*	afpVolume	= NULL;
 			int32		opcode		= 0;
 			node_ref	nref;
+			char		vPath[B_PATH_NAME_LENGTH];
 			
 			message->FindInt32("opcode", &opcode);
 			
 			switch(opcode)
 			{
 				case B_ENTRY_MOVED:
+				{
+					ino_t	fromDir	= 0;
+					ino_t	toDir	= 0;
+
 					DPRINT(("DIR MOVED!!!!!\n"));
 					
 					message->FindInt64("node", &nref.node);
 					message->FindInt32("device", &nref.device);
+
+					//
+					//Cached name lookups in either directory are now stale.
+					//
+					if (message->FindInt64("from directory", &fromDir) == B_OK) {
+						gAFPPathCache.InvalidateDirectory(nref.device, fromDir);
+						gAFPDirWatch.DirectoryChanged(nref.device, fromDir);
+					}
+
+					if (message->FindInt64("to directory", &toDir) == B_OK) {
+						gAFPPathCache.InvalidateDirectory(nref.device, toDir);
+						gAFPDirWatch.DirectoryChanged(nref.device, toDir);
+					}
+
+					//
+					//A rename in place doesn't change what the directory
+					//holds.
+					//
+					if (fromDir != toDir)
+					{
+						VolumeDirectoryChanged(nref.device, fromDir);
+						VolumeDirectoryChanged(nref.device, toDir);
+					}
+					break;
+				}
+				
+				case B_ENTRY_CREATED:
+				{
+					dev_t	device	= 0;
+					ino_t	dir		= 0;
+					
+					//
+					//Something was created in a directory a client is
+					//looking at. We leave nref alone, this is never
+					//about one of our share points.
+					//
+					if ((message->FindInt32("device", &device) == B_OK) &&
+						(message->FindInt64("directory", &dir) == B_OK))
+					{
+						gAFPPathCache.InvalidateDirectory(device, dir);
+						gAFPDirWatch.DirectoryChanged(device, dir);
+						VolumeDirectoryChanged(device, dir);
+					}
 					break;
+				}
 					
 				case B_ENTRY_REMOVED:
+				{
+					ino_t	dir		= 0;
+
 					DPRINT(("DIR REMOVED!!!!!\n"));
 					
 					message->FindInt64("node", &nref.node);
 					message->FindInt32("device", &nref.device);
+
+					if (message->FindInt64("directory", &dir) == B_OK) {
+						gAFPPathCache.InvalidateDirectory(nref.device, dir);
+						gAFPDirWatch.DirectoryChanged(nref.device, dir);
+						VolumeDirectoryChanged(nref.device, dir);
+					}
+
+					gAFPDirWatch.NodeRemoved(nref);
 					break;
+				}
 				
 				default:
 					break;
 			}
 			
 			//
-			//Look for the volume associated to this node.
+			//Look for the volume associated to this node. Only its
+			//path is needed once we have it, the alert can stay up
+			//for as long as the user likes.
 			//
-			afpVolume = FindVolume(nref);
+			{
+				fp_volume_reader	reader;
+				
+				afpVolume = FindVolume(nref);
+				
+				if (afpVolume != NULL) {
+					strlcpy(vPath, afpVolume->GetPath(), sizeof(vPath));
+				}
+			}
 			
 			if (afpVolume != NULL)
 			{	
-				BPath*	vPath = afpVolume->GetPath();
 				char	textmsg[512];
 				
 				sprintf(
 					textmsg,
 					"You have moved, renamed or deleted the AFP share point:\n\n%s\n\nThe volume is no longer shared by afp_server",
-					vPath->Path()
+					vPath
 					);
 				
 				(new BAlert("", textmsg, "OK", NULL, NULL, B_WIDTH_AS_USUAL, B_WARNING_ALERT))->Go();
 
-				StopSharingVolume(vPath->Path());
-				RemoveVolumeData(vPath->Path());
+				StopSharingVolume(vPath);
+				RemoveVolumeData(vPath);
 			}
 			break;
 		}
@@ -1,6 +1,7 @@
 #include <string.h>
-#include <UTF8.h>
+#ifdef __HAIKU__
 #include <NetDebug.h>
+#endif
 
 #include "afp_buffer.h"
 
@@ -18,6 +19,7 @@ afp_buffer::afp_buffer(int8* afpBuffer)
 	mBuffer		= afpBuffer;
 	mCurrentPos	= afpBuffer;
 	mBufferSize	= 0x7FFFFFFF;
+	mOverflow	= false;
 }
 
 
@@ -26,6 +28,7 @@ afp_buffer::afp_buffer(int8* afpBuffer, int32 cbbuffer)
 	mBuffer		= afpBuffer;
 	mCurrentPos	= afpBuffer;
 	mBufferSize	= cbbuffer;
+	mOverflow	= false;
 }
 
 
@@ -60,6 +63,7 @@ bool afp_buffer::Reallocate(int32 newsize)
 	mBuffer		= NULL;
 	mCurrentPos	= NULL;
 	mBufferSize	= 0;
+	mOverflow	= false;
 	
 	mBuffer = (int8*)malloc(newsize);
 	
@@ -117,33 +121,13 @@ AFPERROR afp_buffer::GetString(
 			break;
 	}
 	
-	if ((AFP_SUCCESS(afpError)) && (isPath))
-	{
-		//
-		//If we're dealing with an AFP pathname, then we need to convert
-		//the path separators to Be style ones.
-		//
-		uint8	i;
-		
-		for (i = 0; i < stringLen; i++)
-		{
-			switch(string[i])
-			{
-				//
-				//If we have a slash the first time through, then this is
-				//an error and unallowed filename character.
-				//
-				case '/': string[i] = REPLACE_SLASH_CHAR; break;
-				
-				//
-				//Convert Mac specific path separator to Be specific.
-				//
-				case ':': string[i] = '/'; break;
-				
-				default:
-					break;
-			}
-		}
+	//
+	//If we're dealing with an AFP pathname, then we need to convert
+	//the path separators to Be style ones. Unicode names already had
+	//this done while they were being converted.
+	//
+	if ((AFP_SUCCESS(afpError)) && (isPath) && (pathType == kLongNames)) {
+		ConvertMacPathToBe(string, stringLen);
 	}
 	
 	return( afpError );
@@ -190,15 +174,18 @@ AFPERROR afp_buffer::GetUnicodeString(char* string, uint16 cbstring, int16* sLen
 	if (stringLen > 0)
 	{
 		status_t	status 	= B_OK;
-		int32		destLen	= cbstring;
+		int32		destLen	= cbstring - sizeof(char);
 		
-		status = convert_from_utf8(
-						B_MAC_ROMAN_CONVERSION,
+		//
+		//Convert straight into the caller's buffer, leaving room for
+		//the null terminator.
+		//
+		status = UTF8ToMacRoman(
 						(char*)GetCurrentPosPtr(),
-						&stringLen,
+						stringLen,
 						string,
 						&destLen,
-						0
+						isPath
 						);
 						
 		afpError = (status == B_OK) ? AFP_OK : afpParmErr;
@@ -289,15 +276,14 @@ AFPERROR afp_buffer::GetUniString(char* string, uint16 cbstring, uint16* sLen)
 	if (stringLen > 0)
 	{
 		status_t	status 	= B_OK;
-		int32		destLen	= cbstring;
+		int32		destLen	= cbstring - sizeof(char);
 		
-		status = convert_from_utf8(
-						B_MAC_ROMAN_CONVERSION,
+		status = UTF8ToMacRoman(
 						(char*)GetCurrentPosPtr(),
-						&stringLen,
+						stringLen,
 						string,
 						&destLen,
-						0
+						false
 						);
 						
 		afpError = (status == B_OK) ? AFP_OK : afpParmErr;
@@ -357,6 +343,8 @@ AFPERROR afp_buffer::AddCStringAsPascal(char* string)
 			
 			return( AFP_OK );
 		}
+		
+		mOverflow = true;
 	}
 	
 	return( afpParmErr );
@@ -370,72 +358,100 @@ AFPERROR afp_buffer::AddCStringAsPascal(char* string)
  *		Add a unicode string to the buffer.
  *
  *		This function basically converts a c-style string to an AFPName.
+ *		The UTF-8 is written directly into the buffer and the length
+ *		is filled in afterwards, so nothing is staged on the stack.
  *
  * Returns: None
  */
 
 AFPERROR afp_buffer::AddUniString(char* string, bool isPath, bool isAFPName)
 {
-	char			destString[1024];
-	status_t		status		= B_OK;
-	int32			cbstring 	= strlen(string);
-	int32			destSize	= cbstring * sizeof(wchar_t);
+	int8*		startPos	= mCurrentPos;
+	int8*		lengthPos	= NULL;
+	status_t	status		= B_OK;
+	int32		cbstring	= 0;
+	int32		destSize	= 0;
 	
-	if (string != NULL)
+	if (string == NULL) {
+		return( afpParmErr );
+	}
+	
+	cbstring = strlen(string);
+	
+	if ((isPath) && (isAFPName))
 	{
-		if (((mCurrentPos - mBuffer) + (cbstring*2) + 2) <= mBufferSize)
+		if (!EnoughSpace(sizeof(int32)))
 		{
-			if ((isPath) && (isAFPName))
-			{
-				//
-				//If its a pathname, we need to reconvert the chars back
-				//to Mac specific.
-				//
-				ConvertIllegalCharsBackToMac((uchar*)string, cbstring);
-				
-				//
-				//This is supposed to be the encoding hint. We need to
-				//build an encoding mapping table before we can use this.
-				//for now, 0 == MAC_ROMAN encoding.
-				//
-				AddInt32(0);
-			}
-			
-			status = convert_to_utf8(
-							B_MAC_ROMAN_CONVERSION,
-							string,
-							&cbstring,
-							destString,
-							&destSize,
-							0
-							);
-							
-			if (status == B_OK)
-			{
-				if (isAFPName)
-				{
-					AddInt16(destSize);
-					AddRawData(destString, destSize);
-				}
-				else
-				{
-					AddRawData(destString, destSize + sizeof(char));
-				}
-								
-				return( AFP_OK );
-			}
-			else
-			{
-				//
-				//If conversion failed, we want to write a 0 to the buffer
-				//to show that there is 0 sized string.
-				//
-				AddInt16(0);
-			}
+			mOverflow = true;
+			return( afpParmErr );
 		}
+		
+		//
+		//This is supposed to be the encoding hint. We need to
+		//build an encoding mapping table before we can use this.
+		//for now, 0 == MAC_ROMAN encoding.
+		//
+		AddInt32(0);
 	}
 	
-	return( afpParmErr );
+	if (isAFPName)
+	{
+		if (!EnoughSpace(sizeof(int16)))
+		{
+			mCurrentPos	= startPos;
+			mOverflow	= true;
+			return( afpParmErr );
+		}
+		
+		lengthPos = mCurrentPos;
+		Advance(sizeof(int16));
+	}
+	
+	//
+	//Non AFPName strings get a null terminator, so leave room for it.
+	//
+	destSize = mBufferSize - (mCurrentPos - mBuffer) - (isAFPName ? 0 : sizeof(char));
+	
+	if (destSize >= 0)
+	{
+		//
+		//If its a pathname, the chars we replaced on the way in get
+		//converted back to Mac specific ones as part of the conversion.
+		//
+		status = MacRomanToUTF8(
+						string,
+						cbstring,
+						(char*)mCurrentPos,
+						&destSize,
+						(isPath) && (isAFPName)
+						);
+	}
+	else
+	{
+		status = B_NAME_TOO_LONG;
+	}
+	
+	if (status != B_OK)
+	{
+		DBGWRITE(dbg_level_error, "Not enough space in buffer!\n");
+		
+		mCurrentPos	= startPos;
+		mOverflow	= true;
+		return( afpParmErr );
+	}
+	
+	Advance(destSize);
+	
+	if (isAFPName)
+	{
+		*((uint16*)lengthPos) = htons((uint16)destSize);
+	}
+	else
+	{
+		*mCurrentPos++ = '\0';
+	}
+	
+	return( AFP_OK );
 }
 
 
@@ -459,6 +475,8 @@ AFPERROR afp_buffer::AddRawData(void* data, int16 size)
 		return( AFP_OK );
 	}
 	
+	mOverflow = true;
+	
 	return( afpParmErr );
 }
 
@@ -1,12 +1,12 @@
 #ifndef __afp_buffer__
 #define __afp_buffer__
 
+#include <string.h>
 #include <netinet/in.h>
 #include "debug.h"
 #include "byte_swap.h"
 #include "afp.h"
-
-constexpr uchar REPLACE_SLASH_CHAR = 0xb6; //'π';
+#include "mac_roman.h"
 
 class afp_buffer
 {
@@ -62,10 +62,17 @@ public:
 	//getting of data from the buffer.
 	//
 	int8* GetCurrentPosPtr()	{ return( mCurrentPos ); }
+	void  SetCurrentPosPtr(int8* pos)	{ mCurrentPos = pos; }
 	void  Advance(int32 amount)	{ mCurrentPos += amount; }
 	int8* GetBuffer()			{ return( mBuffer );	 }
 	int32 GetBufferSize()		{ return( mBufferSize ); }
-	void  Rewind()				{ mCurrentPos = mBuffer; }
+	void  Rewind()				{ mCurrentPos = mBuffer; mOverflow = false; }
+
+	//
+	//True if something didn't fit since the buffer was set up. Used
+	//when packing straight into a window of a reply buffer.
+	//
+	bool  Overflowed()			{ return( (mOverflow) || (GetDataLength() > mBufferSize) ); }
 
 private:
 
@@ -75,23 +82,39 @@ private:
 	int8* mBuffer;
 	int8* mCurrentPos;
 	int32 mBufferSize;
+	bool  mOverflow;
 };
 
 inline void ConvertIllegalCharsBackToMac(unsigned char* string, int16 cbstring)
 {
-	int16	i;
+	unsigned char*	end = string + cbstring;
+
+	//
+	//memchr() is vectorized and most names don't contain the character.
+	//
+	while ((string = (unsigned char*)memchr(string, REPLACE_SLASH_CHAR, end - string)) != NULL)
+	{
+		*string++ = '/';
+	}
+}
+
+inline void ConvertMacPathToBe(char* string, int32 cbstring)
+{
+	char*	end = string + cbstring;
+	char*	pos;
+
+	//
+	//A '/' has to become the replacement char before the Mac ':'
+	//separators are turned into '/'.
+	//
+	for (pos = string; (pos = (char*)memchr(pos, '/', end - pos)) != NULL; )
+	{
+		*pos++ = REPLACE_SLASH_CHAR;
+	}
 
-	for (i = 0; i < cbstring; i++)
+	for (pos = string; (pos = (char*)memchr(pos, ':', end - pos)) != NULL; )
 	{
-		switch(string[i])
-		{
-			case REPLACE_SLASH_CHAR:
-				string[i] = '/';
-				break;
-
-			default:
-				break;
-		}
+		*pos++ = '/';
 	}
 }
 
@@ -100,6 +123,7 @@ inline bool afp_buffer::EnoughSpace(int amountToAdd)
 	if ((mCurrentPos - mBuffer) + amountToAdd > mBufferSize)
 	{
 		DBGWRITE(dbg_level_error, "Not enough space in buffer!\n");
+		mOverflow = true;
 		return false;
 	}
 
@@ -0,0 +1,170 @@
+#ifndef __afp_os__
+#define __afp_os__
+
+//
+//The kernel and Support Kit calls the engine makes besides storage.
+//On Haiku these are the real thing. Anywhere else afp_os_posix.cpp
+//provides the handful of them the engine uses, on top of pthreads,
+//so it builds wherever fp_storage_posix.cpp does.
+//
+
+#ifdef __HAIKU__
+
+#include <Autolock.h>
+#include <DataIO.h>
+#include <Debug.h>
+#include <List.h>
+#include <Locker.h>
+#include <OS.h>
+#include <SupportDefs.h>
+
+#include "fp_storage.h"
+
+#else
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <mutex>
+#include <vector>
+
+#include "fp_storage.h"
+
+typedef int32				thread_id;
+typedef int32				sem_id;
+typedef status_t			(*thread_func)(void* data);
+
+#define B_LOW_PRIORITY					5
+#define B_NORMAL_PRIORITY				10
+#define B_DISPLAY_PRIORITY				15
+#define B_URGENT_DISPLAY_PRIORITY		20
+#define B_REAL_TIME_DISPLAY_PRIORITY	100
+
+#define B_INFINITE_TIMEOUT				(9223372036854775807LL)
+
+#if DEBUG
+#define ASSERT(E)		assert(E)
+#else
+#define ASSERT(E)		(void)0
+#endif
+
+//
+//Threads start suspended, as on Haiku, and run once resumed. The
+//priority is only a hint there is nowhere to put.
+//
+thread_id		spawn_thread(thread_func func, const char* name, int32 priority, void* data);
+status_t		resume_thread(thread_id thread);
+status_t		wait_for_thread(thread_id thread, status_t* exitValue);
+thread_id		find_thread(const char* name);
+
+sem_id			create_sem(int32 count, const char* name);
+status_t		delete_sem(sem_id sem);
+status_t		acquire_sem(sem_id sem);
+status_t		release_sem(sem_id sem);
+
+bigtime_t		system_time();
+uint32			real_time_clock();
+bigtime_t		real_time_clock_usecs();
+status_t		snooze(bigtime_t amount);
+
+typedef struct
+{
+	uint32		cpu_count;
+}system_info;
+
+status_t		get_system_info(system_info* info);
+
+#ifdef __GLIBC__
+#if !__GLIBC_PREREQ(2, 38)
+#define AFP_OS_STRLCPY
+size_t			strlcpy(char* dest, const char* source, size_t size);
+#endif
+#endif
+
+//
+//An ordered list of pointers.
+//
+class BList
+{
+public:
+						BList(int32 /*blockSize*/=20)		{}
+	virtual				~BList()							{}
+
+	bool				AddItem(void* item)					{ mItems.push_back(item); return( true ); }
+	bool				AddItem(void* item, int32 index);
+	bool				RemoveItem(void* item);
+	void*				RemoveItem(int32 index);
+	void				MakeEmpty()							{ mItems.clear(); }
+
+	void*				ItemAt(int32 index) const;
+	void*				FirstItem() const					{ return( ItemAt(0) ); }
+	void*				LastItem() const					{ return( ItemAt(CountItems() - 1) ); }
+	int32				IndexOf(void* item) const;
+	bool				HasItem(void* item) const			{ return( IndexOf(item) >= 0 ); }
+	int32				CountItems() const					{ return( (int32)mItems.size() ); }
+	bool				IsEmpty() const						{ return( mItems.empty() ); }
+
+private:
+	std::vector<void*>	mItems;
+};
+
+//
+//A lock the holding thread may take again.
+//
+class BLocker
+{
+public:
+						BLocker()							{}
+						BLocker(const char* /*name*/)		{}
+	virtual				~BLocker()							{}
+
+	bool				Lock()								{ mMutex.lock(); return( true ); }
+	void				Unlock()							{ mMutex.unlock(); }
+
+private:
+	std::recursive_mutex	mMutex;
+};
+
+class BAutolock
+{
+public:
+						BAutolock(BLocker* locker) : mLocker(locker)	{ mLocker->Lock(); }
+						BAutolock(BLocker& locker) : mLocker(&locker)	{ mLocker->Lock(); }
+						~BAutolock()									{ mLocker->Unlock(); }
+
+	bool				IsLocked()							{ return( true ); }
+
+private:
+	BLocker*			mLocker;
+};
+
+//
+//A growable block of memory read and written like a file.
+//
+class BMallocIO
+{
+public:
+						BMallocIO();
+	virtual				~BMallocIO();
+
+	ssize_t				Read(void* buffer, size_t size);
+	ssize_t				Write(const void* buffer, size_t size);
+	ssize_t				ReadAt(off_t position, void* buffer, size_t size);
+	ssize_t				WriteAt(off_t position, const void* buffer, size_t size);
+	off_t				Seek(off_t position, uint32 seekMode);
+	off_t				Position() const					{ return( mPosition ); }
+	status_t			SetSize(off_t size);
+	void				SetBlockSize(size_t /*blockSize*/)	{}
+
+	const void*			Buffer() const						{ return( mData.data() ); }
+	size_t				BufferLength() const				{ return( mData.size() ); }
+
+private:
+	std::vector<char>	mData;
+	off_t				mPosition;
+};
+
+#endif //__HAIKU__
+
+#endif //__afp_os__
@@ -0,0 +1,787 @@
+#ifndef __HAIKU__
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+
+#include "afp_os.h"
+
+typedef struct
+{
+	thread_func				func;
+	void*					data;
+	bool					started;
+	bool					done;
+	status_t				result;
+	std::mutex				mutex;
+	std::condition_variable	finished;
+}AFP_OS_THREAD;
+
+typedef struct
+{
+	int32					count;
+	bool					deleted;
+	std::mutex				mutex;
+	std::condition_variable	available;
+}AFP_OS_SEM;
+
+//
+//Threads and semaphores are looked up by ID as on Haiku. A thread is
+//forgotten once it has finished and, if anybody was waiting for it,
+//they've been told.
+//
+static std::mutex											sThreadLock;
+static std::map<thread_id, std::shared_ptr<AFP_OS_THREAD> >	sThreads;
+static std::atomic<thread_id>								sNextThreadID(1);
+static thread_local thread_id								sCurrentThread = -1;
+
+static std::mutex											sSemLock;
+static std::map<sem_id, std::shared_ptr<AFP_OS_SEM> >		sSems;
+static sem_id												sNextSemID = 1;
+
+/*
+ * FindThread()
+ *
+ * Description:
+ *
+ * Returns: the thread or NULL
+ */
+
+static std::shared_ptr<AFP_OS_THREAD> FindThread(thread_id thread)
+{
+	std::lock_guard<std::mutex> lock(sThreadLock);
+
+	std::map<thread_id, std::shared_ptr<AFP_OS_THREAD> >::iterator	found = sThreads.find(thread);
+
+	if (found == sThreads.end()) {
+		return( std::shared_ptr<AFP_OS_THREAD>() );
+	}
+
+	return( found->second );
+}
+
+
+/*
+ * FindSem()
+ *
+ * Description:
+ *
+ * Returns: the semaphore or NULL
+ */
+
+static std::shared_ptr<AFP_OS_SEM> FindSem(sem_id sem)
+{
+	std::lock_guard<std::mutex> lock(sSemLock);
+
+	std::map<sem_id, std::shared_ptr<AFP_OS_SEM> >::iterator	found = sSems.find(sem);
+
+	if (found == sSems.end()) {
+		return( std::shared_ptr<AFP_OS_SEM>() );
+	}
+
+	return( found->second );
+}
+
+
+/*
+ * ThreadEntry()
+ *
+ * Description:
+ *		Where every spawned thread starts.
+ *
+ * Returns: NULL
+ */
+
+static void* ThreadEntry(void* arg)
+{
+	thread_id						id		= (thread_id)(intptr_t)arg;
+	std::shared_ptr<AFP_OS_THREAD>	thread	= FindThread(id);
+
+	if (thread == NULL) {
+		return( NULL );
+	}
+
+	sCurrentThread = id;
+
+	status_t	result = thread->func(thread->data);
+
+	{
+		std::lock_guard<std::mutex> lock(sThreadLock);
+
+		sThreads.erase(id);
+	}
+
+	std::lock_guard<std::mutex> lock(thread->mutex);
+
+	thread->result	= result;
+	thread->done	= true;
+	thread->finished.notify_all();
+
+	return( NULL );
+}
+
+
+/*
+ * spawn_thread()
+ *
+ * Description:
+ *
+ * Returns: thread_id
+ */
+
+thread_id spawn_thread(thread_func func, const char* /*name*/, int32 /*priority*/, void* data)
+{
+	std::shared_ptr<AFP_OS_THREAD>	thread(new AFP_OS_THREAD);
+	thread_id						id = sNextThreadID++;
+
+	thread->func	= func;
+	thread->data	= data;
+	thread->started	= false;
+	thread->done	= false;
+	thread->result	= B_OK;
+
+	std::lock_guard<std::mutex> lock(sThreadLock);
+
+	sThreads[id] = thread;
+
+	return( id );
+}
+
+
+/*
+ * resume_thread()
+ *
+ * Description:
+ *		Start a spawned thread. It runs detached, wait_for_thread()
+ *		waits on its record rather than joining it.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t resume_thread(thread_id id)
+{
+	std::shared_ptr<AFP_OS_THREAD>	thread = FindThread(id);
+	pthread_attr_t					attr;
+	pthread_t						handle;
+	int								error;
+
+	if (thread == NULL) {
+		return( B_BAD_THREAD_ID );
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(thread->mutex);
+
+		if (thread->started) {
+			return( B_BAD_THREAD_STATE );
+		}
+
+		thread->started = true;
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	error = pthread_create(&handle, &attr, ThreadEntry, (void*)(intptr_t)id);
+
+	pthread_attr_destroy(&attr);
+
+	if (error != 0)
+	{
+		std::lock_guard<std::mutex> lock(sThreadLock);
+
+		sThreads.erase(id);
+		return( B_NO_MORE_THREADS );
+	}
+
+	return( B_OK );
+}
+
+
+/*
+ * wait_for_thread()
+ *
+ * Description:
+ *		A thread that was never resumed is started first, as on Haiku.
+ *
+ * Returns: B_OK or B_BAD_THREAD_ID if it's already gone
+ */
+
+status_t wait_for_thread(thread_id id, status_t* exitValue)
+{
+	std::shared_ptr<AFP_OS_THREAD>	thread = FindThread(id);
+	bool							started;
+
+	if (thread == NULL) {
+		return( B_BAD_THREAD_ID );
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(thread->mutex);
+
+		started = thread->started;
+	}
+
+	if (!started)
+	{
+		status_t	status = resume_thread(id);
+
+		if (status != B_OK) {
+			return( status );
+		}
+	}
+
+	std::unique_lock<std::mutex> lock(thread->mutex);
+
+	thread->finished.wait(lock, [&thread]{ return( thread->done ); });
+
+	if (exitValue != NULL) {
+		*exitValue = thread->result;
+	}
+
+	return( B_OK );
+}
+
+
+/*
+ * find_thread()
+ *
+ * Description:
+ *		Only the calling thread can be found. Threads we didn't spawn
+ *		get an ID the first time they ask.
+ *
+ * Returns: thread_id
+ */
+
+thread_id find_thread(const char* /*name*/)
+{
+	if (sCurrentThread < 0) {
+		sCurrentThread = sNextThreadID++;
+	}
+
+	return( sCurrentThread );
+}
+
+
+/*
+ * create_sem()
+ *
+ * Description:
+ *
+ * Returns: sem_id
+ */
+
+sem_id create_sem(int32 count, const char* /*name*/)
+{
+	std::shared_ptr<AFP_OS_SEM>	sem(new AFP_OS_SEM);
+
+	sem->count		= count;
+	sem->deleted	= false;
+
+	std::lock_guard<std::mutex> lock(sSemLock);
+
+	sSems[sNextSemID] = sem;
+
+	return( sNextSemID++ );
+}
+
+
+/*
+ * delete_sem()
+ *
+ * Description:
+ *		Anyone still waiting gets B_BAD_SEM_ID.
+ *
+ * Returns: B_OK or B_BAD_SEM_ID
+ */
+
+status_t delete_sem(sem_id id)
+{
+	std::shared_ptr<AFP_OS_SEM>	sem;
+
+	{
+		std::lock_guard<std::mutex> lock(sSemLock);
+
+		std::map<sem_id, std::shared_ptr<AFP_OS_SEM> >::iterator	found = sSems.find(id);
+
+		if (found == sSems.end()) {
+			return( B_BAD_SEM_ID );
+		}
+
+		sem = found->second;
+		sSems.erase(found);
+	}
+
+	std::lock_guard<std::mutex> lock(sem->mutex);
+
+	sem->deleted = true;
+	sem->available.notify_all();
+
+	return( B_OK );
+}
+
+
+/*
+ * acquire_sem()
+ *
+ * Description:
+ *
+ * Returns: B_OK or B_BAD_SEM_ID
+ */
+
+status_t acquire_sem(sem_id id)
+{
+	std::shared_ptr<AFP_OS_SEM>	sem = FindSem(id);
+
+	if (sem == NULL) {
+		return( B_BAD_SEM_ID );
+	}
+
+	std::unique_lock<std::mutex> lock(sem->mutex);
+
+	sem->available.wait(lock, [&sem]{ return( sem->deleted || (sem->count > 0) ); });
+
+	if (sem->deleted) {
+		return( B_BAD_SEM_ID );
+	}
+
+	sem->count--;
+
+	return( B_OK );
+}
+
+
+/*
+ * release_sem()
+ *
+ * Description:
+ *
+ * Returns: B_OK or B_BAD_SEM_ID
+ */
+
+status_t release_sem(sem_id id)
+{
+	std::shared_ptr<AFP_OS_SEM>	sem = FindSem(id);
+
+	if (sem == NULL) {
+		return( B_BAD_SEM_ID );
+	}
+
+	std::lock_guard<std::mutex> lock(sem->mutex);
+
+	sem->count++;
+	sem->available.notify_one();
+
+	return( B_OK );
+}
+
+
+/*
+ * system_time()
+ *
+ * Description:
+ *		Microseconds since boot, which never goes backwards.
+ *
+ * Returns: bigtime_t
+ */
+
+bigtime_t system_time()
+{
+	struct timespec	now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return( (bigtime_t)now.tv_sec * 1000000LL + now.tv_nsec / 1000 );
+}
+
+
+/*
+ * real_time_clock()
+ *
+ * Description:
+ *
+ * Returns: seconds since the epoch
+ */
+
+uint32 real_time_clock()
+{
+	return( (uint32)time(NULL) );
+}
+
+
+/*
+ * real_time_clock_usecs()
+ *
+ * Description:
+ *
+ * Returns: microseconds since the epoch
+ */
+
+bigtime_t real_time_clock_usecs()
+{
+	struct timespec	now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	return( (bigtime_t)now.tv_sec * 1000000LL + now.tv_nsec / 1000 );
+}
+
+
+/*
+ * snooze()
+ *
+ * Description:
+ *
+ * Returns: B_OK
+ */
+
+status_t snooze(bigtime_t amount)
+{
+	struct timespec	delay;
+
+	delay.tv_sec	= amount / 1000000LL;
+	delay.tv_nsec	= (amount % 1000000LL) * 1000;
+
+	while((nanosleep(&delay, &delay) < 0) && (errno == EINTR)) {
+	}
+
+	return( B_OK );
+}
+
+
+/*
+ * get_system_info()
+ *
+ * Description:
+ *		Only what the engine looks at.
+ *
+ * Returns: B_OK
+ */
+
+status_t get_system_info(system_info* info)
+{
+	long	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	info->cpu_count = (cpus > 0) ? (uint32)cpus : 1;
+
+	return( B_OK );
+}
+
+
+#ifdef AFP_OS_STRLCPY
+
+/*
+ * strlcpy()
+ *
+ * Description:
+ *
+ * Returns: length of source
+ */
+
+size_t strlcpy(char* dest, const char* source, size_t size)
+{
+	size_t	length = strlen(source);
+
+	if (size > 0)
+	{
+		size_t	copy = (length >= size) ? size - 1 : length;
+
+		memcpy(dest, source, copy);
+		dest[copy] = '\0';
+	}
+
+	return( length );
+}
+
+#endif
+
+
+/*
+ * AddItem()
+ *
+ * Description:
+ *
+ * Returns: false if index is out of range
+ */
+
+bool BList::AddItem(void* item, int32 index)
+{
+	if ((index < 0) || (index > CountItems())) {
+		return( false );
+	}
+
+	mItems.insert(mItems.begin() + index, item);
+
+	return( true );
+}
+
+
+/*
+ * RemoveItem()
+ *
+ * Description:
+ *
+ * Returns: true if it was in the list
+ */
+
+bool BList::RemoveItem(void* item)
+{
+	int32	index = IndexOf(item);
+
+	if (index < 0) {
+		return( false );
+	}
+
+	mItems.erase(mItems.begin() + index);
+
+	return( true );
+}
+
+
+/*
+ * RemoveItem()
+ *
+ * Description:
+ *
+ * Returns: the item removed or NULL
+ */
+
+void* BList::RemoveItem(int32 index)
+{
+	void*	item = ItemAt(index);
+
+	if (item != NULL) {
+		mItems.erase(mItems.begin() + index);
+	}
+
+	return( item );
+}
+
+
+/*
+ * ItemAt()
+ *
+ * Description:
+ *
+ * Returns: the item or NULL
+ */
+
+void* BList::ItemAt(int32 index) const
+{
+	if ((index < 0) || (index >= CountItems())) {
+		return( NULL );
+	}
+
+	return( mItems[index] );
+}
+
+
+/*
+ * IndexOf()
+ *
+ * Description:
+ *
+ * Returns: index or -1
+ */
+
+int32 BList::IndexOf(void* item) const
+{
+	for (size_t i = 0; i < mItems.size(); i++) {
+
+		if (mItems[i] == item) {
+			return( (int32)i );
+		}
+	}
+
+	return( -1 );
+}
+
+
+/*
+ * BMallocIO()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+BMallocIO::BMallocIO()
+{
+	mPosition = 0;
+}
+
+
+/*
+ * ~BMallocIO()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+BMallocIO::~BMallocIO()
+{
+}
+
+
+/*
+ * Read()
+ *
+ * Description:
+ *
+ * Returns: bytes read
+ */
+
+ssize_t BMallocIO::Read(void* buffer, size_t size)
+{
+	ssize_t	result = ReadAt(mPosition, buffer, size);
+
+	if (result > 0) {
+		mPosition += result;
+	}
+
+	return( result );
+}
+
+
+/*
+ * Write()
+ *
+ * Description:
+ *
+ * Returns: bytes written or an error
+ */
+
+ssize_t BMallocIO::Write(const void* buffer, size_t size)
+{
+	ssize_t	result = WriteAt(mPosition, buffer, size);
+
+	if (result > 0) {
+		mPosition += result;
+	}
+
+	return( result );
+}
+
+
+/*
+ * ReadAt()
+ *
+ * Description:
+ *
+ * Returns: bytes read
+ */
+
+ssize_t BMallocIO::ReadAt(off_t position, void* buffer, size_t size)
+{
+	if ((position < 0) || ((size_t)position >= mData.size())) {
+		return( 0 );
+	}
+
+	size_t	available = mData.size() - position;
+
+	if (size > available) {
+		size = available;
+	}
+
+	memcpy(buffer, &mData[position], size);
+
+	return( size );
+}
+
+
+/*
+ * WriteAt()
+ *
+ * Description:
+ *		Writing past the end grows the buffer.
+ *
+ * Returns: bytes written or an error
+ */
+
+ssize_t BMallocIO::WriteAt(off_t position, const void* buffer, size_t size)
+{
+	if (position < 0) {
+		return( B_BAD_VALUE );
+	}
+
+	if ((size_t)position + size > mData.size())
+	{
+		status_t	status = SetSize(position + size);
+
+		if (status != B_OK) {
+			return( status );
+		}
+	}
+
+	memcpy(&mData[position], buffer, size);
+
+	return( size );
+}
+
+
+/*
+ * Seek()
+ *
+ * Description:
+ *
+ * Returns: new position or an error
+ */
+
+off_t BMallocIO::Seek(off_t position, uint32 seekMode)
+{
+	off_t	newPosition;
+
+	switch(seekMode)
+	{
+		case SEEK_SET:	newPosition = position;					break;
+		case SEEK_CUR:	newPosition = mPosition + position;		break;
+		case SEEK_END:	newPosition = mData.size() + position;	break;
+
+		default:
+			return( B_BAD_VALUE );
+	}
+
+	if (newPosition < 0) {
+		return( B_BAD_VALUE );
+	}
+
+	mPosition = newPosition;
+
+	return( mPosition );
+}
+
+
+/*
+ * SetSize()
+ *
+ * Description:
+ *
+ * Returns: B_OK or B_NO_MEMORY
+ */
+
+status_t BMallocIO::SetSize(off_t size)
+{
+	if (size < 0) {
+		return( B_BAD_VALUE );
+	}
+
+	try
+	{
+		mData.resize(size, 0);
+	}
+	catch(...)
+	{
+		return( B_NO_MEMORY );
+	}
+
+	return( B_OK );
+}
+
+#endif //__HAIKU__
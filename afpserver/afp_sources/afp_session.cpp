@@ -1,6 +1,9 @@
-#include <fs_attr.h>
-#include <DataIO.h>
-#include <Node.h>
+#include "fp_storage.h"
+#include "afp_os.h"
+
+#include <atomic>
+
+#include "openssl/rand.h"
 
 #include "debug.h"
 #include "commands.h"
@@ -9,6 +12,10 @@
 #include "dsi_connection.h"
 #include "fp_volume.h"
 #include "fp_rangelock.h"
+#include "fp_readahead.h"
+#include "fp_writebehind.h"
+#include "fp_iosched.h"
+#include "fp_dirwatch.h"
 #include "fp_objects.h"
 
 /*
@@ -21,7 +28,6 @@
 
 afp_session::afp_session(dsi_connection* dsiConnection)
 {
-	mOpenVolumes 		= new BList();
 	mOpenFiles			= new BList();
 	mOpenDesks			= new BList();
 
@@ -32,16 +38,38 @@ afp_session::afp_session(dsi_connection* dsiConnection)
 	mNextFileRef		= 1;
 	mNextDeskRef		= 1;
 	mIsAuthenticated	= false;
+	mOpenVolumeCount	= 0;
 	mIDLength			= 0;
 	mID					= NULL;
-	mToken				= *reinterpret_cast<int32*>(this);
+	mToken				= 0;
 	mUAMLoginType		= 0;
 	mClientIsSleeping	= false;
 	mExtendedLoginBlob	= NULL;
 	mExtendedLoginSize	= 0;
+	mIOWeight			= IOSCHED_DEFAULT_WEIGHT;
+	mIORateLimit		= 0;
+	mIOWaits			= 0;
+	mIOWaitTotal		= 0;
+	mIOWaitMax			= 0;
 
 	mConnection			= dsiConnection;
 
+	//
+	//The token is all FPDisconnectOldSession needs to take this session
+	//over, so it has to be one nobody can guess. Zero is never handed
+	//out and can't be transferred, it's what we're left with if there's
+	//no randomness to be had.
+	//
+	while(mToken == 0)
+	{
+		if (RAND_bytes((unsigned char*)&mToken, sizeof(mToken)) != 1)
+		{
+			DBGWRITE(dbg_level_error, "No random bytes for the session token\n");
+			mToken = 0;
+			break;
+		}
+	}
+
 	memset(mUserName, 0, sizeof(mUserName));
 
 	SetLastTickleSent();
@@ -62,23 +90,31 @@ afp_session::~afp_session()
 	OPEN_FORK_ITEM*	forkitem	= NULL;
 	OPEN_DESK_ITEM*	deskitem	= NULL;
 
-	if (mOpenVolumes->CountItems())
+	//
+	//We may be going away on the scavenger's thread rather than in
+	//the middle of a request.
+	//
+	fp_volume_reader	reader;
+
+	for (int32 volID = 0; (mOpenVolumeCount > 0) && (volID < (int32)mOpenVolumeBits.size() * 64); volID++)
 	{
 		fp_volume*	volume = NULL;
 
-		while(mOpenVolumes->CountItems() > 0)
-		{
-			volume = (fp_volume*)mOpenVolumes->FirstItem();
+		if (!TestVolumeBit(volID)) {
+			continue;
+		}
 
-			if (volume != NULL)
-			{
-				DBGWRITE(dbg_level_warning, "Force closing volume!\n");
-				VolumeClosed(volume);
-			}
-			else
-			{
-				break;
-			}
+		//
+		//A volume that is no longer shared has nothing to forget us.
+		//
+		if ((volume = FindVolume(volID)) != NULL)
+		{
+			DBGWRITE(dbg_level_warning, "Force closing volume!\n");
+			VolumeClosed(volume);
+		}
+		else
+		{
+			SetVolumeBit(volID, false);
 		}
 	}
 
@@ -98,7 +134,6 @@ afp_session::~afp_session()
 		}
 	}
 
-	delete mOpenVolumes;
 	delete mOpenFiles;
 	delete mOpenDesks;
 
@@ -109,6 +144,20 @@ afp_session::~afp_session()
 	if (mExtendedLoginBlob != NULL) {
 		EndExtendedLogin();
 	}
+
+	gAFPDirWatch.ForgetSession(this);
+
+	if (mIOWaits > 0)
+	{
+		DBGWRITE(
+			dbg_level_info,
+			"Session for %s waited on I/O %lld times (avg %lld us, max %lld us)\n",
+			mUserName,
+			mIOWaits.load(),
+			GetAverageIOWait(),
+			GetMaxIOWait()
+			);
+	}
 }
 
 
@@ -177,7 +226,7 @@ AFPERROR afp_session::VolumeOpened(fp_volume* volume)
 {
 	mLock.Lock();
 
-	if (mOpenVolumes->CountItems() >= MAX_AFP_OPEN_VOLUMES)
+	if (mOpenVolumeCount >= MAX_AFP_OPEN_VOLUMES)
 	{
 		//
 		//The client has exceeded his max number of volumes allowed.
@@ -187,7 +236,7 @@ AFPERROR afp_session::VolumeOpened(fp_volume* volume)
 	}
 	else
 	{
-		mOpenVolumes->AddItem(volume);
+		SetVolumeBit(volume->GetVolumeID(), true);
 	}
 
 	mLock.Unlock();
@@ -212,9 +261,10 @@ AFPERROR afp_session::VolumeClosed(fp_volume* volume)
 
 	mLock.Lock();
 
-	if (mOpenVolumes->HasItem(volume))
+	if (TestVolumeBit(volume->GetVolumeID()))
 	{
-		mOpenVolumes->RemoveItem(volume);
+		SetVolumeBit(volume->GetVolumeID(), false);
+		volume->GetIOScheduler()->Forget(this);
 	}
 	else
 	{
@@ -238,14 +288,7 @@ AFPERROR afp_session::VolumeClosed(fp_volume* volume)
 
 bool afp_session::HasVolumeOpen(fp_volume* volume)
 {
-	bool	result;
-
-	mLock.Lock();
-
-	result = mOpenVolumes->HasItem(volume);
-
-	mLock.Unlock();
-	return( result );
+	return( (volume != NULL) && (TestVolumeBit(volume->GetVolumeID())) );
 }
 
 
@@ -262,20 +305,82 @@ bool afp_session::HasVolumeOpen(fp_volume* volume)
 
 bool afp_session::HasVolumeOpen(int16 volID, fp_volume** volume)
 {
-	fp_volume*	afpVolume 	= FindVolume(volID);
-	bool		result		= false;
+	fp_volume*	afpVolume 	= NULL;
 
-	if (afpVolume != NULL)
-	{
-		result = HasVolumeOpen(afpVolume);
+	if (!TestVolumeBit(volID)) {
+		return( false );
+	}
+
+	if ((afpVolume = FindVolume(volID)) == NULL) {
+		return( false );
+	}
+
+	if (volume != NULL) {
+
+		*volume = afpVolume;
+	}
+
+	return( true );
+}
+
+
+/*
+ * TestVolumeBit()
+ *
+ * Description:
+ *
+ * Returns: true if the volume with this ID is open
+ */
+
+bool afp_session::TestVolumeBit(int16 volID)
+{
+	size_t	word = (uint16)volID / 64;
+
+	if (word >= mOpenVolumeBits.size()) {
+		return( false );
+	}
+
+	return( (mOpenVolumeBits[word] & (1ULL << (volID % 64))) != 0 );
+}
+
+
+/*
+ * SetVolumeBit()
+ *
+ * Description:
+ *		Called with mLock held.
+ *
+ * Returns: none
+ */
 
-		if (volume != NULL) {
+void afp_session::SetVolumeBit(int16 volID, bool open)
+{
+	size_t	word	= (uint16)volID / 64;
+	uint64	bit		= 1ULL << (volID % 64);
 
-			*volume = afpVolume;
+	if (word >= mOpenVolumeBits.size())
+	{
+		if (!open) {
+			return;
 		}
+
+		mOpenVolumeBits.resize(word + 1, 0);
 	}
 
-	return( result );
+	if (open == ((mOpenVolumeBits[word] & bit) != 0)) {
+		return;
+	}
+
+	if (open)
+	{
+		mOpenVolumeBits[word] |= bit;
+		mOpenVolumeCount++;
+	}
+	else
+	{
+		mOpenVolumeBits[word] &= ~bit;
+		mOpenVolumeCount--;
+	}
 }
 
 /*
@@ -289,13 +394,13 @@ bool afp_session::HasVolumeOpen(int16 volID, fp_volume** volume)
 
 AFPERROR afp_session::OpenFile(
 	fp_volume* volume,
-	BEntry* 	fentry,
+	fp_storage_entry* 	fentry,
 	int16 		mode,
 	int8 		fork,
 	uint16* 	refnum
 	)
 {
-	BFile*			newFile 	= NULL;
+	fp_storage_node*	newFile 	= NULL;
 	AFPERROR		afpError	= AFP_OK;
 	uint32			openMode	= 0;
 	OPEN_FORK_ITEM*	forkitem 	= NULL;
@@ -311,12 +416,12 @@ AFPERROR afp_session::OpenFile(
 	}
 	else
 	{
-		if ((mode & kReadMode) && (mode & kWriteMode))
-			openMode = B_READ_WRITE;
-		else if (mode & kReadMode)
-			openMode = B_READ_ONLY;
-		else if (mode & kWriteMode)
-			openMode = B_WRITE_ONLY;
+		if (mode & kReadMode)
+			openMode |= FP_STORAGE_READ;
+		if (mode & kWriteMode)
+			openMode |= FP_STORAGE_WRITE;
+		if (openMode == 0)
+			openMode = FP_STORAGE_READ;
 
 		//
 		//Create the bit of memory that will help us track
@@ -331,13 +436,15 @@ AFPERROR afp_session::OpenFile(
 
 		forkitem->refnum 	= mNextFileRef++;
 		forkitem->forkopen	= fork;
-		forkitem->entry		= new BEntry(*fentry);
+		forkitem->entry		= new fp_storage_entry(*fentry);
 		forkitem->volume	= volume;
 		forkitem->mutex		= new BLocker();
 		forkitem->brlList	= new BList();
 		forkitem->file		= NULL;
 		forkitem->rsrcIO	= NULL;
 		forkitem->rsrcDirty	= false;
+		forkitem->readAhead	= NULL;
+		forkitem->writeBehind	= NULL;
 
 		if (fork == kDataFork)
 		{
@@ -345,7 +452,7 @@ AFPERROR afp_session::OpenFile(
 			//Create the file object for this file. The constructor
 			//opens the file for access.
 			//
-			newFile = new BFile(fentry, openMode);
+			newFile = new fp_storage_node(fentry, openMode);
 
 			if (newFile != NULL)
 			{
@@ -354,6 +461,27 @@ AFPERROR afp_session::OpenFile(
 					afpError = afpParmErr;
 					delete newFile;
 				}
+				else
+				{
+					if (mode & kReadMode)
+					{
+						node_ref	nodeRef;
+						bool		cached;
+
+						cached = (!(volume->GetVolumeFlags() & kAFPNoBlockCache)) &&
+								 (newFile->GetNodeRef(&nodeRef) == B_OK);
+
+						forkitem->readAhead = new fp_readahead(
+														newFile,
+														volume->GetIOScheduler(),
+														cached ? &nodeRef : NULL
+														);
+					}
+
+					if ((mode & kWriteMode) && (volume->GetVolumeFlags() & kAFPWriteBehind)) {
+						forkitem->writeBehind = new fp_writebehind(newFile, volume, forkitem->entry);
+					}
+				}
 			}
 
 			forkitem->file = newFile;
@@ -378,6 +506,7 @@ AFPERROR afp_session::OpenFile(
 		//The volume object keeps track of files that are
 		//open on its volume.
 		//
+		volume->AcquireReference();
 		volume->AddOpenFile(forkitem);
 
 		*refnum 	= forkitem->refnum;
@@ -400,13 +529,13 @@ AFPERROR afp_session::OpenFile(
  * Returns: BMallocIO object if successful
  */
 
-BMallocIO* afp_session::OpenAndReadInResourceFork(BEntry* entry)
+BMallocIO* afp_session::OpenAndReadInResourceFork(fp_storage_entry* entry)
 {
-	BNode		node(entry);
+	fp_storage_node	node(entry);
 	int8*		readPtr		= NULL;
 	BMallocIO*	io			= NULL;
 	status_t	status		= 0;
-	attr_info	info 		= {0,0};
+	FP_STORAGE_ATTR_INFO	info	= {0,0};
 	int32		actCount	= 0;
 
 	io = new BMallocIO();
@@ -445,7 +574,6 @@ BMallocIO* afp_session::OpenAndReadInResourceFork(BEntry* entry)
 		//
 		actCount = node.ReadAttr(
 						AFP_RSRC_ATTRIBUTE,
-						B_RAW_TYPE,
 						0,
 						readPtr,
 						info.size
@@ -476,7 +604,7 @@ BMallocIO* afp_session::OpenAndReadInResourceFork(BEntry* entry)
 
 void afp_session::CloseAndWriteOutResourceFork(OPEN_FORK_ITEM* forkItem, bool close)
 {
-	BNode		node(forkItem->entry);
+	fp_storage_node	node(forkItem->entry);
 	size_t		afpActCount	= 0;
 
 	if (forkItem->rsrcDirty)
@@ -489,7 +617,6 @@ void afp_session::CloseAndWriteOutResourceFork(OPEN_FORK_ITEM* forkItem, bool cl
 		afpActCount = node.WriteAttr(
 						AFP_RSRC_ATTRIBUTE,
 						B_RAW_TYPE,
-						0,
 						forkItem->rsrcIO->Buffer(),
 						forkItem->rsrcIO->BufferLength()
 						);
@@ -525,6 +652,7 @@ void afp_session::CloseAndWriteOutResourceFork(OPEN_FORK_ITEM* forkItem, bool cl
 AFPERROR afp_session::CloseFile(uint16 refnum)
 {
 	OPEN_FORK_ITEM*	forkitem = NULL;
+	AFPERROR		afpError = AFP_OK;
 
 	mLock.Lock();
 
@@ -537,13 +665,47 @@ AFPERROR afp_session::CloseFile(uint16 refnum)
 	DBGWRITE(dbg_level_trace, "Closing file with refnum: %lu\n", forkitem->refnum);
 
 	forkitem->mutex->Lock();
+
+	if (forkitem->writeBehind != NULL)
+	{
+		//
+		//Get the buffered data on disk while other sessions can still
+		//find this fork, and report a failure to the client.
+		//
+		afpError = forkitem->writeBehind->Flush();
+
+		DBGWRITE(dbg_level_trace, "Write behind for refnum %lu: %lld writes in %lld flushes\n",
+				forkitem->refnum,
+				forkitem->writeBehind->GetWrites(),
+				forkitem->writeBehind->GetFlushes()
+				);
+	}
+
 	forkitem->volume->RemoveOpenFile(forkitem);
 
+	if (forkitem->writeBehind != NULL) {
+		delete forkitem->writeBehind;
+	}
+
 	if (forkitem->rsrcIO != NULL)
 	{
 		CloseAndWriteOutResourceFork(forkitem);
 	}
 
+	if (forkitem->readAhead != NULL)
+	{
+		DBGWRITE(dbg_level_trace, "Read ahead for refnum %lu: %ld%% hits, window %ld\n",
+				forkitem->refnum,
+				forkitem->readAhead->GetHitRate(),
+				forkitem->readAhead->GetWindowSize()
+				);
+
+		//
+		//Must go before the file, it may still be reading from it.
+		//
+		delete forkitem->readAhead;
+	}
+
 	if (forkitem->file != NULL)
 	{
 		if (forkitem->file->Sync() != B_OK) {
@@ -554,10 +716,22 @@ AFPERROR afp_session::CloseFile(uint16 refnum)
 		delete forkitem->file;
 	}
 
-	if (forkitem->entry != NULL) {
+	if (forkitem->entry != NULL)
+	{
+		//
+		//The fork size and modification date may have changed.
+		//
+		forkitem->volume->CatalogUpdate(forkitem->entry);
+
 		delete forkitem->entry;
 	}
 
+	//
+	//Nothing is working on the fork any more, so it no longer needs
+	//the volume.
+	//
+	forkitem->volume->ReleaseReference();
+
 	forkitem->mutex->Unlock();
 	delete forkitem->mutex;
 
@@ -578,7 +752,7 @@ AFPERROR afp_session::CloseFile(uint16 refnum)
 
 	mLock.Unlock();
 
-	return( AFP_OK );
+	return( afpError );
 }
 
 
@@ -626,7 +800,7 @@ OPEN_FORK_ITEM* afp_session::GetForkItem(uint16 refnum)
  * Returns:
  */
 
-BFile* afp_session::GetBFileFromRef(uint16 refnum)
+fp_storage_node* afp_session::GetBFileFromRef(uint16 refnum)
 {
 	OPEN_FORK_ITEM*	forkitem = NULL;
 
@@ -650,8 +824,8 @@ BFile* afp_session::GetBFileFromRef(uint16 refnum)
  */
 
 AFPERROR afp_session::OpenDesktop(
-	BEntry*		entry,
-	BFile*		file,
+	fp_storage_entry*	entry,
+	fp_storage_node*	file,
 	int16		volID,
 	uint16*		refnum
 	)
@@ -818,12 +992,56 @@ int8 afp_session::GetAFPVersion()
 
 void afp_session::SetUAMLoginInfo(AFP_USER_DATA* userInfo)
 {
-	if (userInfo != NULL) {
+	if (userInfo != NULL)
+	{
 		strncpy(mUserName, userInfo->username, sizeof(mUserName));
+
+		mIOWeight		= (userInfo->flags & kIsAdmin) ? IOSCHED_ADMIN_WEIGHT : IOSCHED_DEFAULT_WEIGHT;
+		mIORateLimit	= userInfo->rateLimit * 1024;
 	}
 }
 
 
+/*
+ * RecordIOWait()
+ *
+ * Description:
+ *		Add the time a data fork read or write spent queued behind
+ *		other sessions.
+ *
+ * Returns: none
+ */
+
+void afp_session::RecordIOWait(bigtime_t delay)
+{
+	bigtime_t	max = mIOWaitMax.load(std::memory_order_relaxed);
+
+	mIOWaits.fetch_add(1, std::memory_order_relaxed);
+	mIOWaitTotal.fetch_add(delay, std::memory_order_relaxed);
+
+	while(	(delay > max) &&
+			(!mIOWaitMax.compare_exchange_weak(max, delay, std::memory_order_relaxed))	)
+	{
+	}
+}
+
+
+/*
+ * GetAverageIOWait()
+ *
+ * Description:
+ *
+ * Returns: Average time in microseconds spent in the I/O queues
+ */
+
+bigtime_t afp_session::GetAverageIOWait()
+{
+	int64	count = mIOWaits.load(std::memory_order_relaxed);
+
+	return( (count > 0) ? (mIOWaitTotal.load(std::memory_order_relaxed) / count) : 0 );
+}
+
+
 /*
  * GetUserInfo()
  *
@@ -990,6 +1208,103 @@ void afp_session::KillSession()
 }
 
 
+/*
+ * TransferTo()
+ *
+ * Description:
+ *		Hands this session's open volumes, forks and desktops to
+ *		another session for the same user. Forks keep their reference
+ *		numbers, and their byte range locks, so the client can carry
+ *		on using them. A fork or desktop whose reference number the new
+ *		session already uses stays here and is closed with this session.
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR afp_session::TransferTo(afp_session* session)
+{
+	OPEN_FORK_ITEM*	forkitem	= NULL;
+	OPEN_DESK_ITEM*	deskitem	= NULL;
+	int32			i			= 0;
+
+	//
+	//Guests all log in under the same name, so a name that matches
+	//doesn't say the session is theirs.
+	//
+	if ((IsGuest()) || (session->IsGuest()))
+	{
+		DBGWRITE(dbg_level_warning, "Guest sessions can't be transferred\n");
+		return( afpAccessDenied );
+	}
+
+	if (strcmp(mUserName, session->mUserName) != 0)
+	{
+		DBGWRITE(dbg_level_warning, "%s tried to take over a session of %s\n", session->mUserName, mUserName);
+		return( afpAccessDenied );
+	}
+
+	mLock.Lock();
+	session->mLock.Lock();
+
+	for (int32 volID = 0; volID < (int32)mOpenVolumeBits.size() * 64; volID++)
+	{
+		fp_volume*	volume = NULL;
+
+		if ((TestVolumeBit(volID)) && ((volume = FindVolume(volID)) != NULL) && (!session->HasVolumeOpen(volume))) {
+			volume->fp_OpenVolume(session);
+		}
+	}
+
+	while((forkitem = (OPEN_FORK_ITEM*)mOpenFiles->ItemAt(i)) != NULL)
+	{
+		bool	inUse = false;
+
+		//
+		//Not GetForkItem(), which complains about refnums it can't find.
+		//
+		for (int32 j = 0; (j < session->mOpenFiles->CountItems()) && (!inUse); j++) {
+			inUse = (((OPEN_FORK_ITEM*)session->mOpenFiles->ItemAt(j))->refnum == forkitem->refnum);
+		}
+
+		if (inUse)
+		{
+			DBGWRITE(dbg_level_warning, "Fork %u already in use, not transferred\n", forkitem->refnum);
+			i++;
+			continue;
+		}
+
+		mOpenFiles->RemoveItem(forkitem);
+		session->mOpenFiles->AddItem(forkitem);
+
+		session->mNextFileRef = std::max(session->mNextFileRef, (uint16)(forkitem->refnum + 1));
+	}
+
+	i = 0;
+
+	while((deskitem = (OPEN_DESK_ITEM*)mOpenDesks->ItemAt(i)) != NULL)
+	{
+		if (session->GetDeskItem(deskitem->refnum) != NULL)
+		{
+			i++;
+			continue;
+		}
+
+		mOpenDesks->RemoveItem(deskitem);
+		session->mOpenDesks->AddItem(deskitem);
+
+		session->mNextDeskRef = std::max(session->mNextDeskRef, (uint16)(deskitem->refnum + 1));
+	}
+
+	DBGWRITE(dbg_level_info, "Transferred %ld forks to the reconnected session for %s\n",
+				session->mOpenFiles->CountItems(), mUserName);
+
+	session->mLock.Unlock();
+	mLock.Unlock();
+
+	return( AFP_OK );
+}
+
+
 /*
  * BeginExtendedLogin()
  *
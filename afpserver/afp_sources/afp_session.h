@@ -1,16 +1,19 @@
 #ifndef __afp_session__
 #define __afp_session__
 
-#include <List.h>
-#include <Locker.h>
-#include <File.h>
-#include <Entry.h>
+#include "afp_os.h"
+#include "fp_storage.h"
+
+#include <atomic>
+#include <vector>
 
 #include "afpGlobals.h"
 #include "afp.h"
 #include "afplogon.h"
 
 class fp_volume;
+class fp_readahead;
+class fp_writebehind;
 class dsi_connection;
 
 #define AFP_SESSION_TOKEN_SIZE	sizeof(int32)
@@ -18,22 +21,24 @@ class dsi_connection;
 typedef struct
 {
 	uint16			refnum;
-	BFile*			file;
+	fp_storage_node*	file;
 	int16			forkopen;	//either kResourceForkBit or kDataFork
-	BEntry*			entry;
+	fp_storage_entry*	entry;
 	fp_volume*		volume;
 	BList*			brlList;
 	BLocker*		mutex;
 	BMallocIO*		rsrcIO;		//Cache that holds entire rsrc fork data
 	bool			rsrcDirty;	//Flag as to whether fork is "dirty" and needs to be written to disk
+	fp_readahead*	readAhead;	//Sequential prefetch for readable data forks
+	fp_writebehind*	writeBehind;//Coalesces small writes, if the volume allows it
 }OPEN_FORK_ITEM;
 
 typedef struct
 {
 	uint16		refnum;
 	int16		volID;
-	BFile*		file;
-	BEntry*		entry;
+	fp_storage_node*	file;
+	fp_storage_entry*	entry;
 }OPEN_DESK_ITEM;
 
 
@@ -58,22 +63,22 @@ public:
 	//File methods
 	virtual AFPERROR		OpenFile(
 								fp_volume* volume,
-								BEntry* 	fentry,
+								fp_storage_entry* 	fentry,
 								int16 		mode,
 								int8 		fork,
 								uint16* 	refnum
 								);
 	
-	virtual BMallocIO* 		OpenAndReadInResourceFork(BEntry* entry);
+	virtual BMallocIO* 		OpenAndReadInResourceFork(fp_storage_entry* entry);
 	virtual void			CloseAndWriteOutResourceFork(OPEN_FORK_ITEM* forkItem, bool close=true);
 	virtual AFPERROR		CloseFile(uint16 refnum);
 	virtual OPEN_FORK_ITEM*	GetForkItem(uint16 refnum);
-	virtual BFile*			GetBFileFromRef(uint16 refnum);
+	virtual fp_storage_node*			GetBFileFromRef(uint16 refnum);
 	
 	//Desktop methods
 	virtual AFPERROR		OpenDesktop(
-								BEntry*		entry,
-								BFile*		file,
+								fp_storage_entry*	entry,
+								fp_storage_node*	file,
 								int16		volID,
 								uint16*		refnum
 								);
@@ -81,13 +86,15 @@ public:
 	virtual AFPERROR		CloseDesktop(uint16 refnum);
 	virtual OPEN_DESK_ITEM* GetDeskItem(uint16 refnum);
 	
-	//Token info
+	//Token info, set the client ID through gAFPSessionMgr so it can be found
 	virtual void		SetClientID(int32 idSize, int8* id);
 	virtual void		GetClientID(int32* idSize, int8** id);
 	virtual void		SetAFPTimeStamp(uint32 timeStamp)	{ mAFPTimeStamp = timeStamp; }
 	virtual uint32		GetAFPTimeStamp()					{ return mAFPTimeStamp; }
 	virtual int32		GetToken()							{ return mToken; }
 	virtual void		KillSession();
+	virtual AFPERROR	TransferTo(afp_session* session);
+	virtual dsi_connection*	GetConnection()					{ return mConnection; }
 	virtual void*		BeginExtendedLogin(
 								uint32	inRequiredBlobSize
 								);
@@ -121,6 +128,13 @@ public:
 	virtual void		SetClientIsSleeping(bool isSleeping) 	{ mClientIsSleeping = isSleeping; }
 	virtual bool		ClientIsSleeping()						{ return mClientIsSleeping; }
 	
+	//I/O scheduling
+	virtual int32		GetIOWeight()		{ return mIOWeight; }
+	virtual uint32		GetIORateLimit()	{ return mIORateLimit; }
+	virtual void		RecordIOWait(bigtime_t delay);
+	virtual bigtime_t	GetAverageIOWait();
+	virtual bigtime_t	GetMaxIOWait()		{ return mIOWaitMax.load(std::memory_order_relaxed); }
+	
 	virtual void		Lock()		{ mLock.Lock(); }
 	virtual void		Unlock()	{ mLock.Unlock(); }
 		
@@ -139,9 +153,19 @@ private:
 	char			mUserName[128];
 	
 	BList*			mOpenFiles;
-	BList*			mOpenVolumes;
 	BList*			mOpenDesks;
 	
+	//
+	//One bit per volume ID for the volumes this session has open.
+	//Only the session's own thread changes it, so checking a bit
+	//needs no lock.
+	//
+	bool			TestVolumeBit(int16 volID);
+	void			SetVolumeBit(int16 volID, bool open);
+	
+	std::vector<uint64>	mOpenVolumeBits;
+	int32			mOpenVolumeCount;
+	
 	BLocker			mLock;
 	
 	dsi_connection*	mConnection;
@@ -166,7 +190,18 @@ private:
 	//For extended UAMs we need to store some extra information
 	//
 	uint8*			mExtendedLoginBlob;
-	uint32			mExtendedLoginSize;
+	uint32			mExtendedLoginSize;	
+	//
+	//Share of the disk this session gets, its user's rate cap in
+	//bytes per second (0 for none) and how long it has spent waiting
+	//in the volume I/O queues. The waits are read by the stats feed
+	//while the session's threads add to them.
+	//
+	int32			mIOWeight;
+	uint32			mIORateLimit;
+	std::atomic<int64>		mIOWaits;
+	std::atomic<bigtime_t>	mIOWaitTotal;
+	std::atomic<bigtime_t>	mIOWaitMax;
 };
 
 
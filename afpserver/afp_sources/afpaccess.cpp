@@ -1,4 +1,4 @@
-#include <StorageKit.h>
+#include "fp_storage.h"
 
 #include "debug.h"
 #include "afpGlobals.h"
@@ -18,11 +18,12 @@
  
 AFPERROR afpAccessCheck(
 	afp_session*	afpSession,
-	BEntry*			afpEntry,
+	fp_storage_entry*	afpEntry,
 	int8			afpAccess
 )
 {
-	BDirectory	parent;
+	fp_storage_dir	parent;
+	FP_STORAGE_STAT	st;
 	mode_t		posixPerms		= 0;
 	AFPERROR	afpResult		= afpAccessDenied;
 
@@ -55,15 +56,15 @@ AFPERROR afpAccessCheck(
 	//
 	if (afpEntry->IsDirectory())
 	{
-		BDirectory dir;
-		
-		dir.SetTo(afpEntry);
-		dir.GetPermissions(&posixPerms);
+		if (afpEntry->GetStat(&st) == B_OK)
+			posixPerms = st.mode;
 	}
 	else {
 		
 		afpEntry->GetParent(&parent);
-		parent.GetPermissions(&posixPerms);
+		
+		if (parent.GetStat(&st) == B_OK)
+			posixPerms = st.mode;
 	}
 	
 	if (afpSession->IsAdmin())
@@ -137,7 +138,7 @@ AFPERROR afpAccessCheck(
 
 AFPERROR afpCheckSearchAccess(
 	afp_session*	afpSession,
-	BEntry*			afpEntry
+	fp_storage_entry*	afpEntry
 )
 {
 	return( afpAccessCheck(afpSession, afpEntry, afpAccessSearch) );
@@ -155,7 +156,7 @@ AFPERROR afpCheckSearchAccess(
 
 AFPERROR afpCheckReadAccess(
 	afp_session*	afpSession,
-	BEntry*			afpEntry
+	fp_storage_entry*	afpEntry
 )
 {	
 	return( afpAccessCheck(afpSession, afpEntry, afpAccessRead) );
@@ -175,7 +176,7 @@ AFPERROR afpCheckReadAccess(
 AFPERROR afpCheckWriteAccess(
 	afp_session*	afpSession,
 	fp_volume*		afpVolume,
-	BEntry*			afpEntry
+	fp_storage_entry*	afpEntry
 )
 {
 	int16	afpAttributes = 0;
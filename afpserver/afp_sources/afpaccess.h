@@ -15,24 +15,24 @@ enum
 
 AFPERROR afpAccessCheck(
 	afp_session*	afpSession,
-	BEntry*			afpEntry,
+	fp_storage_entry*	afpEntry,
 	int8			afpAccess
 );
 
 AFPERROR afpCheckSearchAccess(
 	afp_session*	afpSession,
-	BEntry*			afpEntry
+	fp_storage_entry*	afpEntry
 );
 
 AFPERROR afpCheckReadAccess(
 	afp_session*	afpSession,
-	BEntry*			afpEntry
+	fp_storage_entry*	afpEntry
 );
 
 AFPERROR afpCheckWriteAccess(
 	afp_session*	afpSession,
 	fp_volume*		afpVolume,
-	BEntry*			afpEntry
+	fp_storage_entry*	afpEntry
 );
 
 
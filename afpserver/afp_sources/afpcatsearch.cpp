@@ -0,0 +1,549 @@
+#include "fp_storage.h"
+
+#include <unordered_map>
+#include <vector>
+
+#include "debug.h"
+#include "afp.h"
+#include "afpvolume.h"
+#include "afpaccess.h"
+#include "afpcatsearch.h"
+#include "afp_buffer.h"
+#include "dsi_connection.h"
+#include "fp_volume.h"
+#include "fp_objects.h"
+#include "fp_catalog.h"
+
+//
+//Offsets into the catalog position we hand back to the client.
+//
+#define CATPOS_OFFSET_GENERATION	0
+#define CATPOS_OFFSET_INDEX			4
+
+
+/*
+ * GetSpecName()
+ *
+ * Description:
+ *		Extract the name to search for from a specification. The name is
+ *		found at an offset from the start of the specification parameters
+ *		and is converted to the form used for names on disk.
+ *
+ * Returns: AFPERROR
+ */
+
+static AFPERROR GetSpecName(
+	int8*		specParams,
+	int32		specLength,
+	int16		nameOffset,
+	int8		nameType,
+	char*		name,
+	uint16		cbname
+	)
+{
+	if ((nameOffset < 0) || (nameOffset >= specLength))
+	{
+		DBGWRITE(dbg_level_warning, "Name offset outside of spec (%d)\n", nameOffset);
+		return( afpParmErr );
+	}
+
+	afp_buffer	nameBuffer(specParams + nameOffset, specLength - nameOffset);
+
+	return( nameBuffer.GetString(name, cbname, true, nameType) );
+}
+
+
+/*
+ * GetSpecification()
+ *
+ * Description:
+ *		Parse the two search specifications in an FPCatSearch request.
+ *		Parameters appear in the order of the bits in the request bitmap,
+ *		spec1 holds the values or lower bounds and spec2 holds the masks
+ *		or upper bounds.
+ *
+ * Returns: AFPERROR
+ */
+
+static AFPERROR GetSpecification(
+	int8*				spec1Params,
+	int8*				spec2Params,
+	int32				specLength,
+	AFP_CATALOG_SPEC*	spec
+	)
+{
+	afp_buffer	spec1(spec1Params, specLength);
+	afp_buffer	spec2(spec2Params, specLength);
+	uint32		bitmap		= spec->reqBitmap;
+	AFPERROR	afpError	= AFP_OK;
+
+	if (bitmap & kFPFileAttributes)
+	{
+		spec->attrValue	= spec1.GetInt16();
+		spec->attrMask	= spec2.GetInt16();
+	}
+
+	if (bitmap & kFPParentID)
+	{
+		spec->parentLow		= spec1.GetInt32();
+		spec->parentHigh	= spec2.GetInt32();
+	}
+
+	if (bitmap & kFPCreateDate)
+	{
+		spec->createLow		= spec1.GetInt32();
+		spec->createHigh	= spec2.GetInt32();
+	}
+
+	if (bitmap & kFPModDate)
+	{
+		spec->modLow	= spec1.GetInt32();
+		spec->modHigh	= spec2.GetInt32();
+	}
+
+	if (bitmap & kFPBackupDate)
+	{
+		//
+		//We don't keep backup dates, everything is "never backed up".
+		//
+		spec1.Advance(sizeof(int32));
+		spec2.Advance(sizeof(int32));
+	}
+
+	if (bitmap & kFPFinderInfo)
+	{
+		spec1.GetRawData(spec->finfoValue, sizeof(spec->finfoValue));
+		spec2.GetRawData(spec->finfoMask, sizeof(spec->finfoMask));
+	}
+
+	if (bitmap & kFPLongName)
+	{
+		afpError = GetSpecName(
+						spec1Params,
+						specLength,
+						spec1.GetInt16(),
+						kLongNames,
+						spec->name,
+						sizeof(spec->name)
+						);
+
+		spec2.Advance(sizeof(int16));
+
+		if (!AFP_SUCCESS(afpError)) {
+			return( afpError );
+		}
+	}
+
+	if (bitmap & kFPDFLen)
+	{
+		//
+		//This is the offspring count if we're only looking for
+		//directories, otherwise it's the data fork length.
+		//
+		if (!spec->wantFiles)
+		{
+			spec->offspringLow	= (uint16)spec1.GetInt16();
+			spec->offspringHigh	= (uint16)spec2.GetInt16();
+		}
+		else
+		{
+			spec->dataLow	= (uint32)spec1.GetInt32();
+			spec->dataHigh	= (uint32)spec2.GetInt32();
+		}
+	}
+
+	if (bitmap & kFPRFLen)
+	{
+		spec->rsrcLow	= (uint32)spec1.GetInt32();
+		spec->rsrcHigh	= (uint32)spec2.GetInt32();
+	}
+
+	if (bitmap & kFPExtDataForkLen)
+	{
+		spec->dataLow	= spec1.GetInt64();
+		spec->dataHigh	= spec2.GetInt64();
+	}
+
+	if (bitmap & kFPUnicodeName)
+	{
+		afpError = GetSpecName(
+						spec1Params,
+						specLength,
+						spec1.GetInt16(),
+						kUnicodeNames,
+						spec->name,
+						sizeof(spec->name)
+						);
+
+		spec2.Advance(sizeof(int16));
+
+		if (!AFP_SUCCESS(afpError)) {
+			return( afpError );
+		}
+	}
+
+	if (bitmap & kFPExtRsrcForkLen)
+	{
+		spec->rsrcLow	= spec1.GetInt64();
+		spec->rsrcHigh	= spec2.GetInt64();
+	}
+
+	//
+	//Make sure we didn't run off the end of either specification.
+	//
+	if ((spec1.GetDataLength() > specLength) || (spec2.GetDataLength() > specLength))
+	{
+		DBGWRITE(dbg_level_warning, "Search spec is too short for request bitmap!\n");
+		return( afpParmErr );
+	}
+
+	return( AFP_OK );
+}
+
+
+/*
+ * CanSearchDownTo()
+ *
+ * Description:
+ *		Checks this session has search access to a directory and every
+ *		one above it up to the volume root. What we find is kept in
+ *		searchable so each directory is only checked once per search.
+ *
+ * Returns: true if the session can get to the directory
+ */
+
+static bool CanSearchDownTo(
+	afp_session*					afpSession,
+	const fp_storage_entry&			directory,
+	const node_ref&					rootRef,
+	std::unordered_map<ino_t, bool>&	searchable
+	)
+{
+	std::vector<ino_t>	unchecked;
+	fp_storage_entry	current(directory);
+	fp_storage_entry	parent;
+	node_ref			nodeRef;
+	bool				result	= false;
+
+	for (;;)
+	{
+		if (current.GetNodeRef(&nodeRef) != B_OK) {
+			break;
+		}
+
+		auto	known = searchable.find(nodeRef.node);
+
+		if (known != searchable.end())
+		{
+			result = known->second;
+			break;
+		}
+
+		unchecked.push_back(nodeRef.node);
+
+		if (AFP_FAILURE(afpCheckSearchAccess(afpSession, &current))) {
+			break;
+		}
+
+		if (nodeRef == rootRef)
+		{
+			result = true;
+			break;
+		}
+
+		if (current.GetParent(&parent) != B_OK) {
+			break;
+		}
+
+		current = parent;
+	}
+
+	for (ino_t node : unchecked) {
+		searchable[node] = result;
+	}
+
+	return( result );
+}
+
+
+/*
+ * FPCatSearch()
+ *
+ * Description:
+ *		Searches the volume catalog for files and directories matching
+ *		a set of criteria. Handles both FPCatSearch and FPCatSearchExt.
+ *		The search is run against the volume's in-memory catalog, the
+ *		catalog position returned to the client lets it pick up the
+ *		search where it left off.
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR FPCatSearch(
+	afp_session*	afpSession,
+	int8*			afpReqBuffer,
+	int8*			afpReplyBuffer,
+	int32*			afpDataSize
+	)
+{
+	afp_buffer		afpRequest(afpReqBuffer);
+	afp_buffer		afpReply(afpReplyBuffer, SRVR_REQUEST_QUANTUM_SIZE);
+	AFP_CATALOG_SPEC	spec;
+	std::vector<AFP_CATALOG_MATCH>	matches;
+	std::unordered_map<ino_t, bool>	searchable;
+	uint8			afpCatPosition[CATALOG_POSITION_SIZE];
+	fp_volume*		afpVolume		= NULL;
+	fp_catalog*		catalog			= NULL;
+	int8*			afpPositionSpot	= NULL;
+	int32*			afpActCountSpot	= NULL;
+	int8*			specStart		= NULL;
+	int8			afpCommand		= 0;
+	int16			afpVolID		= 0;
+	int32			afpReqMatches	= 0;
+	int16			afpFileBitmap	= 0;
+	int16			afpDirBitmap	= 0;
+	int32			afpSpecLength	= 0;
+	int32			afpRequestLength	= 0;
+	int32			afpActCount		= 0;
+	uint32			generation		= 0;
+	uint32			startIndex		= 0;
+	uint32			nextIndex		= 0;
+	node_ref		rootRef;
+	bool			afpReplyFull	= false;
+	AFPERROR		afpSearchResult	= AFP_OK;
+	AFPERROR		afpError		= AFP_OK;
+
+	DBGWRITE(dbg_level_trace, "Enter\n");
+
+	//
+	//The first word contains the afp command and padding byte.
+	//
+	afpCommand = afpRequest.GetInt8();
+	afpRequest.Advance(sizeof(int8));
+
+	afpVolID		= afpRequest.GetInt16();
+	afpReqMatches	= afpRequest.GetInt32();
+
+	//
+	//Skip the reserved long.
+	//
+	afpRequest.Advance(sizeof(int32));
+
+	afpRequest.GetRawData(afpCatPosition, sizeof(afpCatPosition));
+
+	afpFileBitmap	= afpRequest.GetInt16();
+	afpDirBitmap	= afpRequest.GetInt16();
+
+	memset(&spec, 0, sizeof(spec));
+
+	spec.reqBitmap	= afpRequest.GetInt32();
+
+	//
+	//Get a pointer to the volume object we'll be working with
+	//
+	afpVolume = FindVolume(afpVolID);
+
+	if (afpVolume == NULL)
+	{
+		DBGWRITE(dbg_level_warning, "Volume not found! (%d)\n", afpVolID);
+		return( afpParmErr );
+	}
+
+	if (!afpSession->HasVolumeOpen(afpVolume))
+	{
+		DBGWRITE(dbg_level_warning, "User doesn't have volume open!\n");
+		return( afpParmErr );
+	}
+
+	if (afpReqMatches <= 0) {
+		return( afpParmErr );
+	}
+
+	//
+	//The old FPCatSearch can only return the parent ID and long name.
+	//
+	if (afpCommand == afpCatSearch)
+	{
+		afpFileBitmap	&= (kFPParentID | kFPLongName);
+		afpDirBitmap	&= (kFPDirParentID | kFPDirLongName);
+	}
+
+	if (afpDirBitmap & kFPDirShortName)		afpDirBitmap  &= ~kFPDirShortName;
+	if (afpFileBitmap & kFPShortName)		afpFileBitmap &= ~kFPShortName;
+
+	if ((afpFileBitmap == kFPFileNone) && (afpDirBitmap == kFPDirNone))
+	{
+		DBGWRITE(dbg_level_warning, "No result bitmaps supplied!\n");
+		return( afpBitmapErr );
+	}
+
+	spec.wantFiles		= (afpFileBitmap != kFPFileNone);
+	spec.wantDirs		= (afpDirBitmap != kFPDirNone);
+
+	//
+	//Each specification begins with its length. It's a byte followed by
+	//a pad byte for FPCatSearch and a word for FPCatSearchExt.
+	//
+	specStart = afpRequest.GetCurrentPosPtr();
+
+	if (afpCommand == afpCatSearchExt) {
+		afpSpecLength = ntohs(*((uint16*)specStart));
+	}
+	else {
+		afpSpecLength = *((uint8*)specStart);
+	}
+
+	//
+	//Both specifications, each with its length word, have to be in
+	//the request we were sent.
+	//
+	afpRequestLength = afpSession->GetConnection()->GetRequestDataLength() - (int32)(specStart - afpReqBuffer);
+
+	if ((2 * (afpSpecLength + (int32)sizeof(int16))) > afpRequestLength)
+	{
+		DBGWRITE(dbg_level_warning, "Search spec runs past the request (%ld)\n", afpSpecLength);
+		return( afpParmErr );
+	}
+
+	afpError = GetSpecification(
+					specStart + sizeof(int16),
+					specStart + afpSpecLength + (2 * sizeof(int16)),
+					afpSpecLength,
+					&spec
+					);
+
+	if (!AFP_SUCCESS(afpError)) {
+		return( afpError );
+	}
+
+	catalog = afpVolume->GetCatalog();
+
+	if (catalog == NULL) {
+		return( afpCallNotSupported );
+	}
+
+	//
+	//The first search after the volume is shared may have to wait for
+	//the initial scan to finish.
+	//
+	if (!catalog->WaitForReady(CATALOG_READY_TIMEOUT))
+	{
+		DBGWRITE(dbg_level_warning, "Catalog not ready, failing search\n");
+		return( afpMiscErr );
+	}
+
+	generation	= ntohl(*((uint32*)&afpCatPosition[CATPOS_OFFSET_GENERATION]));
+	startIndex	= ntohl(*((uint32*)&afpCatPosition[CATPOS_OFFSET_INDEX]));
+
+	afpSearchResult = catalog->Search(
+							spec,
+							&generation,
+							startIndex,
+							afpReqMatches,
+							matches,
+							&nextIndex
+							);
+
+	if (afpSearchResult == afpCatalogChanged) {
+		return( afpSearchResult );
+	}
+
+	//
+	//Build the reply. The catalog position is filled in last since we
+	//may not be able to fit all the matches in the buffer.
+	//
+	afpPositionSpot = afpReply.GetCurrentPosPtr();
+	afpReply.Advance(CATALOG_POSITION_SIZE);
+
+	afpReply.AddInt16(afpFileBitmap);
+	afpReply.AddInt16(afpDirBitmap);
+
+	afpActCountSpot = (int32*)afpReply.GetCurrentPosPtr();
+	afpReply.Advance(sizeof(int32));
+
+	afpVolume->GetDirectory()->GetNodeRef(&rootRef);
+
+	for (size_t i = 0; i < matches.size(); i++)
+	{
+		entry_ref	ref(rootRef.device, matches[i].parent, matches[i].name.c_str());
+		fp_storage_entry	entry(&ref);
+		fp_storage_entry	parentEntry;
+		bool		afpFull		= false;
+
+		if ((entry.InitCheck() != B_OK) || (!entry.Exists()))
+		{
+			//
+			//Something outside of the server changed the volume, get the
+			//catalog rebuilt and just skip this one.
+			//
+			catalog->MarkStale();
+			continue;
+		}
+
+		entry.GetParent(&parentEntry);
+
+		//
+		//Names below a directory the user can't search aren't theirs
+		//to see, however far down they are.
+		//
+		if (!CanSearchDownTo(afpSession, parentEntry, rootRef, searchable)) {
+			continue;
+		}
+
+		if ((!matches[i].isDirectory) && (AFP_FAILURE(afpCheckReadAccess(afpSession, &parentEntry)))) {
+			continue;
+		}
+
+		//
+		//The struct length is a byte for FPCatSearch and a word for
+		//FPCatSearchExt.
+		//
+		afpError = fp_objects::fp_PackFileDirEntry(
+							afpSession,
+							afpVolume,
+							&entry,
+							matches[i].isDirectory,
+							matches[i].isDirectory ? afpDirBitmap : afpFileBitmap,
+							(afpCommand == afpCatSearchExt),
+							afpReply.GetBufferSize(),
+							&afpReply,
+							&afpFull
+							);
+
+		//
+		//Stop if this match won't fit, the client will pick up from
+		//here next time.
+		//
+		if (afpFull)
+		{
+			nextIndex		= matches[i].index;
+			afpReplyFull	= true;
+			break;
+		}
+
+		if (!AFP_SUCCESS(afpError))
+		{
+			DBGWRITE(dbg_level_error, "Error finding parms for object\n");
+			continue;
+		}
+
+		afpActCount++;
+	}
+
+	//
+	//We only hit the end of the catalog if we got every match in.
+	//
+	afpError = afpReplyFull ? AFP_OK : afpSearchResult;
+
+	memset(afpPositionSpot, 0, CATALOG_POSITION_SIZE);
+
+	*((uint32*)&afpPositionSpot[CATPOS_OFFSET_GENERATION])	= htonl(generation);
+	*((uint32*)&afpPositionSpot[CATPOS_OFFSET_INDEX])		= htonl(nextIndex);
+
+	*afpActCountSpot = htonl(afpActCount);
+	*afpDataSize = afpReply.GetDataLength();
+
+	DBGWRITE(dbg_level_trace, "Found %ld matches, returning %ld\n", afpActCount, afpError);
+
+	return( afpError );
+}
@@ -0,0 +1,14 @@
+#ifndef __afpcatsearch__
+#define __afpcatsearch__
+
+#include "afp.h"
+#include "afp_session.h"
+
+AFPERROR FPCatSearch(
+	afp_session*	afpSession,
+	int8*			afpReqBuffer,
+	int8*			afpReplyBuffer,
+	int32*			afpDataSize
+	);
+
+#endif //__afpcatsearch__
@@ -1,6 +1,5 @@
-#include <Locker.h>
-#include <fs_attr.h>
-#include <DataIO.h>
+#include "afp_os.h"
+#include "fp_storage.h"
 #include <memory>
 
 #include "afpdesk.h"
@@ -30,13 +29,14 @@ AFPERROR FPOpenDT(
 {
 	afp_buffer		afpRequest(afpReqBuffer);
 	afp_buffer		afpReply(afpReplyBuffer, SRVR_REQUEST_QUANTUM_SIZE);
-	char			afpDeskPath[MAX_AFP_PATH];
-	BFile*			afpDTFile	= NULL;
-	BEntry*			afpDTEntry	= NULL;
-	BDirectory*		root 		= NULL;
-	fp_volume*		afpVolume	= NULL;
-	int16			afpVolumeID	= 0;
-	AFPERROR		afpError	= AFP_OK;
+	char				afpDeskPath[MAX_AFP_PATH];
+	fp_storage_node*	afpDTFile	= NULL;
+	fp_storage_entry*	afpDTEntry	= NULL;
+	fp_storage_dir*		root 		= NULL;
+	FP_STORAGE_STAT		deskStat;
+	fp_volume*			afpVolume	= NULL;
+	int16				afpVolumeID	= 0;
+	AFPERROR			afpError	= AFP_OK;
 	
 	DBGWRITE(dbg_level_trace, "Enter\n");
 	
@@ -81,14 +81,14 @@ AFPERROR FPOpenDT(
 	//
 	//Build the full path to the desktop database.
 	//
-	sprintf(afpDeskPath, "%s/%s", afpVolume->GetPath()->Path(), DESKTOP_FILE_NAME);
+	sprintf(afpDeskPath, "%s/%s", afpVolume->GetPath(), DESKTOP_FILE_NAME);
 
 	root = afpVolume->GetDirectory();
 	
 	//
 	//Check to see if the desktop db already exists at the root.
 	//
-	if (!root->Contains(DESKTOP_FILE_NAME))
+	if (root->StatEntry(DESKTOP_FILE_NAME, &deskStat) != B_OK)
 	{
 		FINDER_INFO	finfo;
 		
@@ -107,7 +107,7 @@ AFPERROR FPOpenDT(
 		//
 		//Get a BEntry the points to the directory we just created.
 		//
-		afpDTEntry = new BEntry(afpDeskPath);
+		afpDTEntry = new fp_storage_entry(afpDeskPath);
 		
 		if (afpDTEntry != NULL)
 		{
@@ -141,7 +141,7 @@ AFPERROR FPOpenDT(
 	}
 	else
 	{
-		afpDTEntry 	= new BEntry(afpDeskPath);
+		afpDTEntry 	= new fp_storage_entry(afpDeskPath);
 		afpError 	= (afpDTEntry != NULL) ? AFP_OK : afpParmErr;
 	}
 	
@@ -152,7 +152,7 @@ AFPERROR FPOpenDT(
 	if (AFP_SUCCESS(afpError))
 	{
 		afpError	= afpParmErr;
-		afpDTFile 	= new BFile(afpDeskPath, B_READ_WRITE);
+		afpDTFile 	= new fp_storage_node(afpDTEntry, FP_STORAGE_READ | FP_STORAGE_WRITE);
 				
 		if (afpDTFile != NULL)
 		{
@@ -473,7 +473,7 @@ AFPERROR FPAddComment(
 	afp_buffer		afpRequest(afpReqBuffer);
 	char			afpPathname[MAX_AFP_PATH];
 	char			afpComment[MAX_COMMENT_SIZE+1];
-	BEntry			afpEntry;
+	fp_storage_entry	afpEntry;
 	fp_volume*		afpVolume		= NULL;
 	AFPERROR		afpError		= AFP_OK;
 	int16			afpRefID		= 0;
@@ -569,7 +569,7 @@ AFPERROR FPAddComment(
 								
 	if (AFP_SUCCESS(afpError))
 	{
-		BNode		node(&afpEntry);
+		fp_storage_node	node(&afpEntry);
 		off_t		fsize	= 0;
 		
 		node.Lock();
@@ -577,7 +577,6 @@ AFPERROR FPAddComment(
 		fsize = node.WriteAttr(
 						AFP_CMNT_ATTRIBUTE,
 						B_RAW_TYPE,
-						0,
 						afpComment,
 						strlen(afpComment)
 						);
@@ -616,7 +615,7 @@ AFPERROR FPGetComment(
 	afp_buffer		afpReply(afpReplyBuffer, SRVR_REQUEST_QUANTUM_SIZE);
 	char			afpPathname[MAX_AFP_PATH];
 	char			afpComment[MAX_COMMENT_SIZE+1];
-	BEntry			afpEntry;
+	fp_storage_entry	afpEntry;
 	fp_volume*		afpVolume		= NULL;
 	AFPERROR		afpError		= AFP_OK;
 	int16			afpRefID		= 0;
@@ -691,9 +690,9 @@ AFPERROR FPGetComment(
 								
 	if (AFP_SUCCESS(afpError))
 	{
-		BNode		node(&afpEntry);
+		fp_storage_node	node(&afpEntry);
 		off_t		fsize	= 0;
-		attr_info	info	= {0,0};
+		FP_STORAGE_ATTR_INFO	info	= {0,0};
 		
 		//
 		//Initialize the afperror to say we didn't find a comment
@@ -711,7 +710,6 @@ AFPERROR FPGetComment(
 				
 				fsize = node.ReadAttr(
 								AFP_CMNT_ATTRIBUTE,
-								B_RAW_TYPE,
 								0,
 								afpComment,
 								min_c(info.size, sizeof(afpComment)-1)
@@ -772,7 +770,7 @@ AFPERROR FPRemoveComment(
 	
 	afp_buffer		afpRequest(afpReqBuffer);
 	char			afpPathname[MAX_AFP_PATH];
-	BEntry			afpEntry;
+	fp_storage_entry	afpEntry;
 	fp_volume*		afpVolume		= NULL;
 	AFPERROR		afpError		= AFP_OK;
 	int16			afpRefID		= 0;
@@ -847,7 +845,7 @@ AFPERROR FPRemoveComment(
 								
 	if (AFP_SUCCESS(afpError))
 	{
-		BNode	node(&afpEntry);
+		fp_storage_node	node(&afpEntry);
 		
 		node.Lock();
 		
@@ -978,7 +976,7 @@ AFPERROR FPGetAPPL(
 	{
 		OPEN_DESK_ITEM*		deskitem 	= NULL;
 		fp_volume*			afpVolume	= NULL;
-		BEntry				afpEntry;
+		fp_storage_entry	afpEntry;
 		
 		deskitem = afpSession->GetDeskItem(afpRefID);
 		
@@ -1098,7 +1096,7 @@ AFPERROR FPRemoveAPPL(
  */
 
 std::unique_ptr<DESKTOP_ENTRY[]> afp_GetDesktopEntries(
-	BFile* desktop_file,
+	fp_storage_node* desktop_file,
 	int32* entry_count
 	)
 {
@@ -1125,9 +1123,8 @@ std::unique_ptr<DESKTOP_ENTRY[]> afp_GetDesktopEntries(
 	
 	// Read in the entire db for performance reasons.
 	
-	desktop_file->Seek(0, SEEK_SET);
 	auto entries = std::make_unique<DESKTOP_ENTRY[]>(num_entries);
-	auto bytesRead = desktop_file->Read(entries.get(), desk_file_size);
+	auto bytesRead = desktop_file->ReadAt(0, entries.get(), desk_file_size);
 
 	*entry_count = num_entries;
 	
@@ -1389,16 +1386,16 @@ AFPERROR afp_AddEntry(
 			
 			memcpy(&entries[foundPosition], dtEntry, sizeof(DESKTOP_ENTRY));
 
-			deskitem->file->Seek(0, SEEK_SET);			
-			auto bytesWritten = deskitem->file->Write(dtEntry, sizeof(DESKTOP_ENTRY));
+			auto bytesWritten = deskitem->file->WriteAt(0, dtEntry, sizeof(DESKTOP_ENTRY));
 		}
 	}
 	else if (afpError == afpItemNotFound)
 	{
 		std::lock_guard lock(desk_mutex);
 
-		deskitem->file->Seek(0, SEEK_END);
-		auto bytesWritten = deskitem->file->Write(dtEntry, sizeof(DESKTOP_ENTRY));
+		off_t deskSize = 0;
+		deskitem->file->GetSize(&deskSize);
+		auto bytesWritten = deskitem->file->WriteAt(deskSize, dtEntry, sizeof(DESKTOP_ENTRY));
 		
 		if (bytesWritten < B_OK)
 		{
@@ -1477,8 +1474,7 @@ AFPERROR afp_RemoveEntry(
 			memcpy(&entries[foundPosition], &entries[nextPosition], sizeof(DESKTOP_ENTRY) * (entry_count - nextPosition));
 		}
 		
-		deskitem->file->Seek(0, SEEK_SET);
-		auto bytesWritten = deskitem->file->Write(entries.get(), sizeof(DESKTOP_ENTRY) * (entry_count - 1));
+		auto bytesWritten = deskitem->file->WriteAt(0, entries.get(), sizeof(DESKTOP_ENTRY) * (entry_count - 1));
 		deskitem->file->SetSize((entry_count - 1) * sizeof(DESKTOP_ENTRY));
 		
 		if (bytesWritten < B_OK)
@@ -1,9 +1,8 @@
 #ifndef __afpdesk__
 #define __afpdesk__
 
-#include <File.h>
-#include <Entry.h>
-#include <SupportDefs.h>
+#include "fp_storage.h"
+#include "afp_os.h"
 #include <memory>
 #include <string>
 
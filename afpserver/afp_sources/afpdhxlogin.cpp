@@ -1,6 +1,8 @@
 #include <sys/select.h>
+#include <sys/time.h>
 
 #include "afpdhxlogin.h"
+#include "afpdhxpool.h"
 #include "afp_session.h"
 #include "afp_buffer.h"
 
@@ -26,14 +28,9 @@ AFPERROR DHXLogin(
 	afp_buffer			afpBuffer(afpReqBuffer);
 	afp_buffer			afpReply(afpReplyBuffer);
 	unsigned char		iv[] 		= "CJalbert";
-	uint8				p[]			= {	0xBA, 0x28, 0x73, 0xDF, 0xB0, 0x60, 0x57, 0xD4,
-										0x3F, 0x20, 0x24, 0x74, 0x4C, 0xEE, 0xE7, 0x5B	};
-	uint8				g			= 0x07;
-	BIGNUM				*gbn		= NULL;
-	BIGNUM				*pbn		= NULL;
 	DH					*dh			= NULL;
 	AFPERROR			afpError	= afpParmErr;
-	uint16				sessid;
+	uint16				sessid		= dhxhash(afpSession);
 	uint8				randbuf[DHX_RANDBUFSIZE];
 	unsigned char encrypt_buffer[DHX_CRYPTBUFLEN] = {};
 	int					i;
@@ -52,38 +49,11 @@ AFPERROR DHXLogin(
 		goto exit;
 	}
 	
-	// Obtain our primes
-	gbn = BN_bin2bn(&g, sizeof(g), NULL);
-	if (gbn == NULL)
-	{
-		DPRINT(("BN_bin2bn() failed obtaining our primes1\n"));
-		goto exit;
-	}
-
-    pbn = BN_bin2bn(p, sizeof(p), NULL);
-	if (pbn == NULL)
-	{
-		DPRINT(("BN_bin2bn() failed obtaining our primes2\n"));
-		goto exit;
-	}
-
-    dh = DH_new();
+	// Our keypair, made ahead of time by the pool
+	dh = gAFPDHXPool.TakeKey();
 	if (dh == NULL)
 	{
-		DPRINT(("DH_new() failed creating new DH context\n"));
-		goto exit;
-	}
-
-	if (!DH_set0_pqg(dh, pbn, NULL, gbn))
-	{
-		DPRINT(("DH_set0_pqg() failed.\n"));
-		goto exit;
-	}
-
-	// Generate the key
-	if (!DH_generate_key(dh))
-	{
-		DPRINT(("DH_generate_key() failed generating our public keys\n"));
+		DPRINT(("[afp:DHXLogin]No DH keypair available\n"));
 		goto exit;
 	}
 	
@@ -100,7 +70,7 @@ AFPERROR DHXLogin(
 
 	afpReply.AddInt16(sessid);
 
-	BN_bn2bin(pub_key, (unsigned char*)afpReply.GetCurrentPosPtr());
+	BN_bn2binpad(pub_key, (unsigned char*)afpReply.GetCurrentPosPtr(), DHX_KEYSIZE);
 	afpReply.Advance(DHX_KEYSIZE);
 
  	afpGetRandomNumber(afpSession, (char*)randbuf, sizeof(randbuf));
@@ -0,0 +1,241 @@
+#include "debug.h"
+#include "afpdhxpool.h"
+
+afp_dhx_pool	gAFPDHXPool;
+
+
+/*
+ * afp_dhx_pool()
+ *
+ * Description:
+ *		The pool starts out empty, keys are only made once Start()
+ *		is called.
+ *
+ * Returns:
+ */
+
+afp_dhx_pool::afp_dhx_pool()
+{
+	uint8	p[]	= {	0xBA, 0x28, 0x73, 0xDF, 0xB0, 0x60, 0x57, 0xD4,
+					0x3F, 0x20, 0x24, 0x74, 0x4C, 0xEE, 0xE7, 0x5B	};
+	uint8	g	= 0x07;
+
+	mPrime		= BN_bin2bn(p, sizeof(p), NULL);
+	mGenerator	= BN_bin2bn(&g, sizeof(g), NULL);
+	mThread		= -1;
+	mQuit		= false;
+	mMisses		= 0;
+}
+
+
+/*
+ * ~afp_dhx_pool()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+afp_dhx_pool::~afp_dhx_pool()
+{
+	if (mThread >= 0)
+	{
+		status_t	result;
+
+		{
+			std::lock_guard<std::mutex> guard(mMutex);
+
+			mQuit = true;
+		}
+
+		mWake.notify_one();
+		wait_for_thread(mThread, &result);
+	}
+
+	for (DH* dh : mKeys) {
+
+		DH_free(dh);
+	}
+
+	if (mPrime != NULL)		BN_free(mPrime);
+	if (mGenerator != NULL)	BN_free(mGenerator);
+}
+
+
+/*
+ * Start()
+ *
+ * Description:
+ *		Start the thread that keeps the pool filled.
+ *
+ * Returns: None
+ */
+
+void afp_dhx_pool::Start()
+{
+	if (mThread >= 0) {
+		return;
+	}
+
+	//
+	//Filling the pool is never more urgent than serving requests.
+	//
+	mThread = spawn_thread(
+				afp_dhx_pool::FillThread,
+				"afp_dhx_pool",
+				B_LOW_PRIORITY,
+				this
+				);
+
+	resume_thread(mThread);
+}
+
+
+/*
+ * TakeKey()
+ *
+ * Description:
+ *		Hands out a pregenerated keypair. If the pool has run dry
+ *		the caller gets one made on the spot.
+ *
+ * Returns: DH* or NULL on failure
+ */
+
+DH* afp_dhx_pool::TakeKey()
+{
+	DH*		dh		= NULL;
+	bool	refill	= false;
+
+	{
+		std::lock_guard<std::mutex> guard(mMutex);
+
+		if (!mKeys.empty())
+		{
+			dh = mKeys.back();
+			mKeys.pop_back();
+		}
+		else
+		{
+			mMisses++;
+		}
+
+		refill = (mKeys.size() < DHX_POOL_LOW_WATER);
+	}
+
+	if (refill) {
+		mWake.notify_one();
+	}
+
+	if (dh == NULL) {
+		dh = NewKey();
+	}
+
+	return( dh );
+}
+
+
+/*
+ * CountKeys()
+ *
+ * Description:
+ *
+ * Returns: the number of keys ready
+ */
+
+int32 afp_dhx_pool::CountKeys()
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+
+	return( (int32)mKeys.size() );
+}
+
+
+/*
+ * NewKey()
+ *
+ * Description:
+ *		A DH context for the DHCAST128 prime with a freshly
+ *		generated keypair.
+ *
+ * Returns: DH* or NULL on failure
+ */
+
+DH* afp_dhx_pool::NewKey()
+{
+	DH*		dh	= DH_new();
+	BIGNUM*	p	= BN_dup(mPrime);
+	BIGNUM*	g	= BN_dup(mGenerator);
+
+	if ((dh == NULL) || (p == NULL) || (g == NULL) || (!DH_set0_pqg(dh, p, NULL, g)))
+	{
+		DBGWRITE(dbg_level_error, "Failed to set up a DH context\n");
+
+		if (p != NULL)	BN_free(p);
+		if (g != NULL)	BN_free(g);
+		if (dh != NULL)	DH_free(dh);
+
+		return( NULL );
+	}
+
+	if (!DH_generate_key(dh))
+	{
+		DBGWRITE(dbg_level_error, "DH_generate_key() failed\n");
+
+		DH_free(dh);
+		return( NULL );
+	}
+
+	return( dh );
+}
+
+
+/*
+ * FillThread() [STATIC]
+ *
+ * Description:
+ *		Sleeps until the pool drops below the low water mark, then
+ *		fills it back up one key at a time with the pool unlocked.
+ *
+ * Returns: B_OK
+ */
+
+int32 afp_dhx_pool::FillThread(void* data)
+{
+	afp_dhx_pool*	pool = (afp_dhx_pool*)data;
+
+	while(true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(pool->mMutex);
+
+			pool->mWake.wait(lock, [pool]() {
+				return( (pool->mQuit) || (pool->mKeys.size() < DHX_POOL_LOW_WATER) );
+			});
+
+			if (pool->mQuit) {
+				break;
+			}
+		}
+
+		while(true)
+		{
+			DH*	dh = pool->NewKey();
+
+			if (dh == NULL)
+			{
+				snooze(1000000);
+				break;
+			}
+
+			std::lock_guard<std::mutex> guard(pool->mMutex);
+
+			pool->mKeys.push_back(dh);
+
+			if ((pool->mQuit) || (pool->mKeys.size() >= DHX_POOL_SIZE)) {
+				break;
+			}
+		}
+	}
+
+	return( B_OK );
+}
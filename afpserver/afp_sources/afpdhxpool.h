@@ -0,0 +1,63 @@
+#ifndef __afpdhxpool__
+#define __afpdhxpool__
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "afpGlobals.h"
+#include "afpdhxlogin.h"
+
+//
+//Keypairs generated ahead of time for DHCAST128 logins. The pool is
+//topped back up once it drops below the low water mark, so a room
+//full of Macs logging in at once doesn't wait on key generation.
+//
+#define DHX_POOL_SIZE			64
+#define DHX_POOL_LOW_WATER		48
+
+
+class afp_dhx_pool
+{
+public:
+						afp_dhx_pool();
+	virtual				~afp_dhx_pool();
+
+	virtual void		Start();
+
+	//
+	//A keypair for one login, the caller frees it with DH_free(). Each
+	//one is handed out once.
+	//
+	virtual DH*			TakeKey();
+
+	virtual int32		CountKeys();
+	virtual int64		Misses()		{ return( mMisses ); }
+
+private:
+
+	static int32		FillThread(void* data);
+	DH*					NewKey();
+
+	std::mutex				mMutex;
+	std::condition_variable	mWake;
+	std::vector<DH*>		mKeys;
+	thread_id				mThread;
+	bool					mQuit;
+
+	//
+	//The DHCAST128 prime and generator, made once and copied into
+	//each new key.
+	//
+	BIGNUM*					mPrime;
+	BIGNUM*					mGenerator;
+
+	//
+	//Logins that found the pool empty and made their own key.
+	//
+	int64					mMisses;
+};
+
+extern afp_dhx_pool		gAFPDHXPool;
+
+#endif //__afpdhxpool__
@@ -1,10 +1,9 @@
-#include <fs_attr.h>
-#include <DataIO.h>
-#include <Node.h>
-#include <StorageKit.h>
+#include "fp_storage.h"
+#include "afp_os.h"
 
 #include "afp.h"
 #include "afpextattr.h"
+#include "fp_storage.h"
 
 
 /*
@@ -27,8 +26,8 @@ AFPERROR FPGetExtAttribute(
 	afp_buffer		afpReply(afpReplyBuffer);
 	char			afpPathname[MAX_AFP_PATH];
 	char			afpAttrName[B_ATTR_NAME_LENGTH];
-	BEntry			afpEntry;
-	BNode			afpNode;
+	fp_storage_entry	afpEntry;
+	fp_storage_node	afpNode;
 	fp_volume*		afpVolume		= NULL;
 	int16			afpVolID		= 0;
 	int32			afpDirID		= 0;
@@ -41,7 +40,7 @@ AFPERROR FPGetExtAttribute(
 	int32			afpDataLen		= 0;
 	AFPERROR		afpError		= AFP_OK;
 	status_t		status			= B_OK;
-	attr_info		attrInfo		= {0,0};
+	off_t			attrSize		= 0;
 
 	DBGWRITE(dbg_level_trace, "Enter\n");
 
@@ -125,24 +124,24 @@ AFPERROR FPGetExtAttribute(
 	}
 
 	//
-	//Get a BNode to the file so we can get attribute control.
+	//Open the object for attribute access only.
 	//
-	afpNode.SetTo(&afpEntry);
+	afpNode.SetTo(&afpEntry, 0);
 	status = afpNode.InitCheck();
 
 	if (status != B_OK)
 	{
 		//
-		//We failed to get a properly initialized BNode.
+		//We failed to open the object.
 		//
-		DBGWRITE(dbg_level_error, "BNode not initialized! (%s)\n", GET_BERR_STR(status));
+		DBGWRITE(dbg_level_error, "Node not initialized! (%s)\n", GET_BERR_STR(status));
 		return( afpParmErr );
 	}
 
-	status = afpNode.GetAttrInfo(afpAttrName, &attrInfo);
-	if (status == B_OK && attrInfo.size > 0)
+	status = afpNode.GetAttrSize(afpAttrName, &attrSize);
+	if (status == B_OK && attrSize > 0)
 	{
-		afpDataLen = attrInfo.size;
+		afpDataLen = attrSize;
 
 		//Plum the first 2 items in the reply block. These will always be
 		//returned in every case beyond here.
@@ -153,7 +152,6 @@ AFPERROR FPGetExtAttribute(
 		{
 				ssize_t read = afpNode.ReadAttr(
 								afpAttrName,
-								B_RAW_TYPE,
 								0,
 								afpReply.GetCurrentPosPtr(),
 								min_c(afpDataLen, afpMaxReplySize)
@@ -208,8 +206,8 @@ AFPERROR FPSetExtAttribute(
 	afp_buffer		afpReply(afpReplyBuffer);
 	char			afpPathname[MAX_AFP_PATH];
 	char			afpAttrName[B_ATTR_NAME_LENGTH];
-	BEntry			afpEntry;
-	BNode			afpNode;
+	fp_storage_entry	afpEntry;
+	fp_storage_node	afpNode;
 	fp_volume*		afpVolume		= NULL;
 	int16			afpVolID		= 0;
 	int32			afpDirID		= 0;
@@ -300,25 +298,25 @@ AFPERROR FPSetExtAttribute(
 	}
 
 	//
-	//Get a BNode to the file so we can get attribute control.
+	//Open the object for attribute access only.
 	//
-	afpNode.SetTo(&afpEntry);
+	afpNode.SetTo(&afpEntry, 0);
 	status = afpNode.InitCheck();
 
 	if (status != B_OK)
 	{
 		//
-		//We failed to get a properly initialized BNode.
+		//We failed to open the object.
 		//
-		DBGWRITE(dbg_level_error, "BNode not initialized! (%s)\n", GET_BERR_STR(status));
+		DBGWRITE(dbg_level_error, "Node not initialized! (%s)\n", GET_BERR_STR(status));
 		return( afpParmErr );
 	}
 
 	//
 	//Get the size of the attribute data.
 	//
-	attr_info attrInfo;
-	status = afpNode.GetAttrInfo(afpAttrName, &attrInfo);
+	off_t attrSize;
+	status = afpNode.GetAttrSize(afpAttrName, &attrSize);
 
 	//
 	//If the following bit is set, then we fail if the attribute already
@@ -340,7 +338,6 @@ AFPERROR FPSetExtAttribute(
 	bytesWritten = afpNode.WriteAttr(
 					afpAttrName,
 					B_RAW_TYPE,
-					0,
 					afpRequest.GetCurrentPosPtr(),
 					afpAttrDataLen
 					);
@@ -377,9 +374,9 @@ AFPERROR FPListExtAttribute(
 	afp_buffer		afpRequest(afpReqBuffer);
 	afp_buffer		afpReply(afpReplyBuffer);
 	char			afpPathname[MAX_AFP_PATH];
-	char			name[B_ATTR_NAME_LENGTH];
-	BEntry			afpEntry;
-	BNode			afpNode;
+	char			name[FP_STORAGE_ATTR_NAME_LENGTH];
+	fp_storage_entry	afpEntry;
+	fp_storage_node	afpNode;
 	fp_volume*		afpVolume		= NULL;
 	int16			afpVolID		= 0;
 	int32			afpDirID		= 0;
@@ -447,9 +444,9 @@ AFPERROR FPListExtAttribute(
 	}
 
 	//
-	//Get a BNode to the file so we can get attribute control.
+	//Open the object for attribute access only.
 	//
-	status = afpNode.SetTo(&afpEntry);
+	status = afpNode.SetTo(&afpEntry, 0);
 
 	if (status == B_OK) {
 		status = afpNode.InitCheck();
@@ -458,9 +455,9 @@ AFPERROR FPListExtAttribute(
 	if (status != B_OK)
 	{
 		//
-		//We failed to get a properly initialized BNode.
+		//We failed to open the object.
 		//
-		DBGWRITE(dbg_level_error, "BNode not initialized! (%s)\n", GET_BERR_STR(status));
+		DBGWRITE(dbg_level_error, "Node not initialized! (%s)\n", GET_BERR_STR(status));
 		return( afpParmErr );
 	}
 
@@ -555,8 +552,8 @@ AFPERROR FPRemoveExtAttribute(
 	afp_buffer		afpReply(afpReplyBuffer);
 	char			afpPathname[MAX_AFP_PATH];
 	char			afpAttrName[B_ATTR_NAME_LENGTH];
-	BEntry			afpEntry;
-	BNode			afpNode;
+	fp_storage_entry	afpEntry;
+	fp_storage_node	afpNode;
 	fp_volume*		afpVolume		= NULL;
 	int16			afpVolID		= 0;
 	int32			afpDirID		= 0;
@@ -638,9 +635,9 @@ AFPERROR FPRemoveExtAttribute(
 	DBGWRITE(dbg_level_info, "Setting attr, file=%s, attr=%s\n", afpPathname, afpAttrName);
 
 	//
-	//Get a BNode to the file so we can get attribute control.
+	//Open the object for attribute access only.
 	//
-	status = afpNode.SetTo(&afpEntry);
+	status = afpNode.SetTo(&afpEntry, 0);
 
 	if (status == B_OK) {
 		status = afpNode.InitCheck();
@@ -649,7 +646,7 @@ AFPERROR FPRemoveExtAttribute(
 	if (status == B_OK)
 	{
 		//
-		//Use the BNode to delete the attribute by name. Try to
+		//Delete the attribute by name. Try to
 		//capture some common errors.
 		//
 		status = afpNode.RemoveAttr(afpAttrName);
@@ -1,10 +1,16 @@
+#ifdef __HAIKU__
 #include <net_settings.h>
 #include <String.h>
 #include <Message.h>
-#include <StorageKit.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "fp_storage.h"
 
 #include "commands.h"
 #include "afphostname.h"
+#include "afpsrvrinfo.h"
 
 //
 //This is the computer/hostname that this afpserver will
@@ -126,7 +132,12 @@ void afp_FindHostNameFromNetSettings(char* hostname, int32 cbHostname)
 		return;
 	}
 			
+#ifdef __HAIKU__
 	ptr = find_net_setting(NULL, "GLOBAL", "HOSTNAME", buff, sizeof(buff));
+#else
+	ptr = (gethostname(buff, sizeof(buff)) == 0) ? buff : NULL;
+	buff[sizeof(buff) - 1] = '\0';
+#endif
 	
 	memset(hostname, 0, cbHostname);
 	
@@ -170,9 +181,9 @@ void afp_FindHostNameFromNetSettings(char* hostname, int32 cbHostname)
 
 void afp_GetHostnameFromSettingsFile(char* hostname, int32 cbHostname)
 {
-	BPath			path;
-	BFile			file;
-	char			fpath[256];
+	fp_storage_node	file;
+	char			settings[B_PATH_NAME_LENGTH];
+	char			fpath[B_PATH_NAME_LENGTH + B_FILE_NAME_LENGTH];
 	
 	if ((hostname == NULL) || (cbHostname <= 0)) {
 		
@@ -185,16 +196,16 @@ void afp_GetHostnameFromSettingsFile(char* hostname, int32 cbHostname)
 	//and logon UAMs as the name of this server.
 	//
 	
-	if (find_directory(B_USER_SETTINGS_DIRECTORY, &path) == B_OK)
+	if (fp_storage_settings_dir(settings, sizeof(settings)) == B_OK)
 	{	
-		sprintf(fpath, "%s/%s", path.Path(), AFP_HOSTNAME_FILE_NAME);
-		file.SetTo(fpath, B_READ_WRITE);
+		sprintf(fpath, "%s/%s", settings, AFP_HOSTNAME_FILE_NAME);
+		file.SetTo(fpath, FP_STORAGE_READ | FP_STORAGE_WRITE);
 				
 		if (file.InitCheck() == B_OK)
 		{
 			memset(hostname, 0, cbHostname);
 			
-			file.Read(hostname, cbHostname);
+			file.ReadAt(0, hostname, cbHostname);
 		}
 		
 		//
@@ -216,6 +227,8 @@ void afp_GetHostnameFromSettingsFile(char* hostname, int32 cbHostname)
 }
 
 
+#ifdef __HAIKU__
+
 /*
  * afp_HandleGethostnameAppMsg()
  *
@@ -265,6 +278,7 @@ void afp_HandleSethostnameAppMsg(BMessage* message)
 		{
 			if (afp_SetHostname(string.String()) == B_OK) {
 				
+				gAFPSrvrInfo.Update();
 				message->SendReply(be_afp_success);
 				return;
 			}
@@ -280,5 +294,4 @@ void afp_HandleSethostnameAppMsg(BMessage* message)
 	message->SendReply(be_afp_failure);
 }
 
-
-
+#endif //__HAIKU__
@@ -1,7 +1,10 @@
 #ifndef __AFPHOSTNAME__
 #define __AFPHOSTNAME__
 
-#include "Message.h"
+#ifdef __HAIKU__
+#include <Message.h>
+#endif
+
 #include "afpGlobals.h"
 
 #ifndef MAX_HOSTNAME_LEN
@@ -14,7 +17,9 @@ status_t afp_GetHostname(char* hostname, int32 cbHostname);
 void afp_FindHostNameFromNetSettings(char* hostname, int32 cbHostname);
 void afp_GetHostnameFromSettingsFile(char* hostname, int32 cbHostname);
 
+#ifdef __HAIKU__
 void afp_HandleGethostnameAppMsg(BMessage* message);
 void afp_HandleSethostnameAppMsg(BMessage* message);
+#endif
 
 #endif //__AFPHOSTNAME__
@@ -1,9 +1,10 @@
-#include <StorageKit.h>
+#include "fp_storage.h"
 
 #include "commands.h"
 #include "afp.h"
 #include "afpGlobals.h"
 #include "afplogon.h"
+#include "afpsrvrinfo.h"
 
 /*
  * afpImpChangePswd()
@@ -215,10 +216,10 @@ AFPERROR afpSaveNewUser(
 	uint32			flags
 	)
 {
-	BPath			path;
-	BNode			file;
-	BDirectory		dir;
-	char			fpath[256];
+	char			path[B_PATH_NAME_LENGTH];
+	fp_storage_node	file;
+	fp_storage_dir	dir;
+	char			fpath[B_PATH_NAME_LENGTH];
 	char			attrName[B_ATTR_NAME_LENGTH];
 	AFP_USER_DATA	userData;
 	ssize_t			size 	= 0;
@@ -232,13 +233,13 @@ AFPERROR afpSaveNewUser(
 		return( be_afp_useralreadyexists );
 	}
 	
-	if (find_directory(B_USER_SETTINGS_DIRECTORY, &path) == B_OK)
+	if (fp_storage_settings_dir(path, sizeof(path)) == B_OK)
 	{
-		dir.SetTo(path.Path());
+		dir.SetTo(path);
 		dir.CreateFile(AFP_PREFS_FILE_NAME, NULL, true);
 		
-		sprintf(fpath, "%s/%s", path.Path(), AFP_PREFS_FILE_NAME);
-		file.SetTo(fpath);
+		sprintf(fpath, "%s/%s", path, AFP_PREFS_FILE_NAME);
+		file.SetTo(fpath, 0);
 				
 		if (file.InitCheck() == B_OK)
 		{
@@ -275,7 +276,7 @@ AFPERROR afpSaveNewUser(
 			else
 				userData.group = AFP_HAIKU_GROUP_USERS_ID;
 			
-			size = file.WriteAttr(attrName, 0, 0, &userData, sizeof(AFP_USER_DATA));
+			size = file.WriteAttr(attrName, 0, &userData, sizeof(AFP_USER_DATA));
 			
 			//
 			//Now update the user schema version information.
@@ -289,7 +290,7 @@ AFPERROR afpSaveNewUser(
 				//
 				uint32 vers = AFP_USERDB_VERSION;
 				
-				size = file.WriteAttr(AFP_USERS_SCHEMA_VERSION, 0, 0, &vers, sizeof(vers));
+				size = file.WriteAttr(AFP_USERS_SCHEMA_VERSION, 0, &vers, sizeof(vers));
 				
 				if (size != sizeof(vers))
 				{
@@ -304,6 +305,14 @@ AFPERROR afpSaveNewUser(
 		}
 	}
 	
+	//
+	//Whether the guest account is enabled is part of the server info.
+	//
+	if (strcmp(userName, AFP_GUEST_NAME) == 0) {
+		
+		gAFPSrvrInfo.Update();
+	}
+	
 	return( AFP_OK );
 }
 
@@ -358,17 +367,17 @@ AFPERROR afpGetIndUser(
 	int16			index
 	)
 {
-	BPath		path;
-	BNode		file;
-	char		fpath[256];
+	char		path[B_PATH_NAME_LENGTH];
+	fp_storage_node	file;
+	char		fpath[B_PATH_NAME_LENGTH];
 	char		attrName[B_ATTR_NAME_LENGTH];
 	int16		count	= 0;
 	ssize_t		size 	= 0;
 	
-	if (find_directory(B_USER_SETTINGS_DIRECTORY, &path) == B_OK)
+	if (fp_storage_settings_dir(path, sizeof(path)) == B_OK)
 	{	
-		sprintf(fpath, "%s/%s", path.Path(), AFP_PREFS_FILE_NAME);
-		file.SetTo(fpath);
+		sprintf(fpath, "%s/%s", path, AFP_PREFS_FILE_NAME);
+		file.SetTo(fpath, 0);
 		
 		if (file.InitCheck() == B_OK)
 		{
@@ -384,7 +393,7 @@ AFPERROR afpGetIndUser(
 					
 					memset(userData, 0, sizeof(AFP_USER_DATA));
 					
-					size = file.ReadAttr(attrName, 0, 0, userData, sizeof(AFP_USER_DATA));
+					size = file.ReadAttr(attrName, 0, userData, sizeof(AFP_USER_DATA));
 					
 					if (size > B_OK)
 					{
@@ -463,17 +472,17 @@ AFPERROR afpDeleteUser(
 	const char*		userName
 	)
 {
-	BPath		path;
-	BNode		file;
-	BDirectory	dir;
-	char		fpath[256];
+	char		path[B_PATH_NAME_LENGTH];
+	fp_storage_node	file;
+	fp_storage_dir	dir;
+	char		fpath[B_PATH_NAME_LENGTH];
 	char		attrName[B_ATTR_NAME_LENGTH];
 	ssize_t		size 	= 0;
 	
-	if (find_directory(B_USER_SETTINGS_DIRECTORY, &path) == B_OK)
+	if (fp_storage_settings_dir(path, sizeof(path)) == B_OK)
 	{		
-		sprintf(fpath, "%s/%s", path.Path(), AFP_PREFS_FILE_NAME);
-		file.SetTo(fpath);
+		sprintf(fpath, "%s/%s", path, AFP_PREFS_FILE_NAME);
+		file.SetTo(fpath, 0);
 				
 		if (file.InitCheck() == B_OK)
 		{
@@ -482,6 +491,11 @@ AFPERROR afpDeleteUser(
 		}
 	}
 	
+	if (strcmp(userName, AFP_GUEST_NAME) == 0) {
+		
+		gAFPSrvrInfo.Update();
+	}
+	
 	return( AFP_OK );
 }
 
@@ -499,9 +513,9 @@ AFPERROR afpUpdateUserInfo(
 	AFP_USER_DATA	userData
 	)
 {
-	BPath			path;
-	BNode			file;
-	char			fpath[256];
+	char			path[B_PATH_NAME_LENGTH];
+	fp_storage_node	file;
+	char			fpath[B_PATH_NAME_LENGTH];
 	char			attrName[B_ATTR_NAME_LENGTH];
 	AFP_USER_DATA	oldData;
 	ssize_t			size 	= 0;
@@ -524,21 +538,24 @@ AFPERROR afpUpdateUserInfo(
 	userData.id		= oldData.id;
 	userData.group	= oldData.group;
 	
-	if (find_directory(B_USER_SETTINGS_DIRECTORY, &path) == B_OK)
+	if (fp_storage_settings_dir(path, sizeof(path)) == B_OK)
 	{
-		sprintf(fpath, "%s/%s", path.Path(), AFP_PREFS_FILE_NAME);
-		file.SetTo(fpath);
+		sprintf(fpath, "%s/%s", path, AFP_PREFS_FILE_NAME);
+		file.SetTo(fpath, 0);
 				
 		if (file.InitCheck() == B_OK)
 		{
 			sprintf(attrName, "%s%s", AFP_USERS_TYPE, userData.username);
 			
-			size = file.WriteAttr(attrName, 0, 0, &userData, sizeof(AFP_USER_DATA));
+			size = file.WriteAttr(attrName, 0, &userData, sizeof(AFP_USER_DATA));
 			
 			if (size <= 0)
 				return( size );
-			else
-				return( B_OK );
+			
+			if (strcmp(userData.username, AFP_GUEST_NAME) == 0)
+				gAFPSrvrInfo.Update();
+			
+			return( B_OK );
 		}
 	}
 	
@@ -557,22 +574,22 @@ AFPERROR afpUpdateUserInfo(
 
 AFPERROR afpGetUserDBVersion(uint32* version)
 {
-	BPath			path;
-	BNode			file;
-	char			fpath[256];
+	char			path[B_PATH_NAME_LENGTH];
+	fp_storage_node	file;
+	char			fpath[B_PATH_NAME_LENGTH];
 	ssize_t			size = 0;
 	uint32			vers = 0;
 	
 	*version = 0;
 
-	if (find_directory(B_USER_SETTINGS_DIRECTORY, &path) == B_OK)
+	if (fp_storage_settings_dir(path, sizeof(path)) == B_OK)
 	{
-		sprintf(fpath, "%s/%s", path.Path(), AFP_PREFS_FILE_NAME);
-		file.SetTo(fpath);
+		sprintf(fpath, "%s/%s", path, AFP_PREFS_FILE_NAME);
+		file.SetTo(fpath, 0);
 				
 		if (file.InitCheck() == B_OK)
 		{			
-			size = file.ReadAttr(AFP_USERS_SCHEMA_VERSION, 0, 0, &vers, sizeof(vers));
+			size = file.ReadAttr(AFP_USERS_SCHEMA_VERSION, 0, &vers, sizeof(vers));
 			
 			if (size <= 0)
 			{
@@ -624,10 +641,10 @@ AFPERROR afpVerifyUserDatabase()
 			//attribute does not exist (again, the version is old).
 			//
 			
-			BPath			path;
-			BNode			file;
-			BDirectory		dir;
-			char			fpath[256];
+			char			path[B_PATH_NAME_LENGTH];
+			fp_storage_node	file;
+			fp_storage_dir	dir;
+			char			fpath[B_PATH_NAME_LENGTH];
 			AFP_USER_DATA	temp;
 			ssize_t			size  = 0;
 			uint32			index = 0;
@@ -680,14 +697,14 @@ AFPERROR afpVerifyUserDatabase()
 			
 			vers = AFP_USERDB_VERSION;
 			
-			if (find_directory(B_USER_SETTINGS_DIRECTORY, &path) == B_OK)
+			if (fp_storage_settings_dir(path, sizeof(path)) == B_OK)
 			{		
-				sprintf(fpath, "%s/%s", path.Path(), AFP_PREFS_FILE_NAME);
-				file.SetTo(fpath);
+				sprintf(fpath, "%s/%s", path, AFP_PREFS_FILE_NAME);
+				file.SetTo(fpath, 0);
 						
 				if (file.InitCheck() == B_OK)
 				{
-					size = file.WriteAttr(AFP_USERS_SCHEMA_VERSION, 0, 0, &vers, sizeof(vers));
+					size = file.WriteAttr(AFP_USERS_SCHEMA_VERSION, 0, &vers, sizeof(vers));
 					
 					if (size != sizeof(vers))
 					{
@@ -12,7 +12,7 @@ typedef struct
 	uint32	flags;
 	uint32	id;
 	
-	uint32	reserved2;
+	uint32	rateLimit;	//KB per second of file data, 0 for no limit
 }AFP_USER_DATA;
 
 AFPERROR afpImpChangePswd(
@@ -0,0 +1,275 @@
+#include <algorithm>
+
+#include "debug.h"
+#include "afp.h"
+#include "afpread.h"
+#include "afp_buffer.h"
+#include "dsi_connection.h"
+#include "fp_volume.h"
+#include "fp_rangelock.h"
+#include "fp_readahead.h"
+#include "fp_iosched.h"
+
+/*
+ * FPReadCheck()
+ *
+ * Description:
+ *		Unpack an FPRead or FPReadExt request and make sure it can be
+ *		done: the fork is open and readable and nobody has the range
+ *		locked. The request count is cut down to afpMaxCount. The fork's
+ *		length is returned in afpForkLen unless it is NULL.
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR FPReadCheck(
+	afp_session*		afpSession,
+	int8*				afpReqBuffer,
+	size_t				afpMaxCount,
+	off_t*				afpForkLen,
+	OPEN_FORK_ITEM**	afpForkItem,
+	off_t*				afpOffset,
+	size_t*				afpReqCount
+	)
+{
+	afp_buffer		afpRequest(afpReqBuffer);
+	int8			afpCommand		= 0;
+	int16			afpForkRef		= 0;
+	OPEN_FORK_ITEM*	forkItem		= NULL;
+
+	//
+	//The first byte contains the afp command.
+	//
+	afpCommand = afpRequest.GetInt8();
+	afpRequest.Advance(sizeof(int8));
+
+	afpForkRef	= afpRequest.GetInt16();
+
+	switch(afpCommand)
+	{
+		case afpRead:
+			*afpOffset		= afpRequest.GetInt32();
+			*afpReqCount	= afpRequest.GetInt32();
+			break;
+
+		case afpReadExt:
+			*afpOffset		= afpRequest.GetInt64();
+			*afpReqCount	= (size_t)afpRequest.GetInt64();
+			break;
+
+		default:
+			return( afpParmErr );
+	}
+
+	forkItem = afpSession->GetForkItem(afpForkRef);
+
+	if ((forkItem == NULL) || (*afpOffset < 0)) {
+		return( afpParmErr );
+	}
+
+	if (*afpReqCount > afpMaxCount)
+	{
+		//
+		//The request is too big, reduce the count to what
+		//we can hold. We'll return to the client what we
+		//actually read.
+		//
+		*afpReqCount = afpMaxCount;
+
+		DBGWRITE(dbg_level_info, "Resized afpReqCount to buffer size!!\n");
+	}
+
+	if (forkItem->forkopen == kDataFork)
+	{
+		if (!forkItem->file->IsReadable())
+		{
+			DBGWRITE(dbg_level_trace, "Data fork is not readable!\n");
+			return( afpAccessDenied );
+		}
+
+		//
+		//Anything written to this file that is still sitting in a
+		//write behind buffer needs to be on disk before we read.
+		//
+		forkItem->volume->FlushWriteBehind(forkItem->entry);
+
+		if (afpForkLen != NULL) {
+			forkItem->file->GetSize(afpForkLen);
+		}
+	}
+	else
+	{
+		//
+		//The resource fork should already be read in and in memory.
+		//
+		if (forkItem->rsrcIO == NULL)
+		{
+			DBGWRITE(dbg_level_error, "rsrcIO object is NULL!\n");
+			return( afpParmErr );
+		}
+
+		if (afpForkLen != NULL) {
+			*afpForkLen = forkItem->rsrcIO->BufferLength();
+		}
+	}
+
+	//
+	//Check to see if any area in the range we're reading from is
+	//locked.
+	//
+	if (fp_rangelock::RangeLocked(
+					*afpOffset,
+					*afpOffset + *afpReqCount,
+					forkItem->entry
+					))
+	{
+		DBGWRITE(dbg_level_info, "****Range is currently locked!****\n");
+		return( afpLockErr );
+	}
+
+	*afpForkItem = forkItem;
+
+	return( AFP_OK );
+}
+
+
+/*
+ * FPReadFork()
+ *
+ * Description:
+ *		Read from an open fork that FPReadCheck() has approved. Data
+ *		fork reads are queued by the volume's I/O scheduler and go
+ *		through the read ahead engine, resource forks are already in
+ *		memory.
+ *
+ * Returns: Bytes read or a negative error
+ */
+
+ssize_t FPReadFork(
+	afp_session*	afpSession,
+	OPEN_FORK_ITEM*	forkItem,
+	off_t			afpOffset,
+	void*			afpBuffer,
+	size_t			afpCount
+	)
+{
+	if (forkItem->forkopen == kDataFork)
+	{
+		fp_iosched*	ioSched = forkItem->volume->GetIOScheduler();
+		ssize_t		result	= 0;
+
+		DBGWRITE(dbg_level_trace, "Reading (DF) %lu bytes from %lld offset\n", afpCount, afpOffset);
+
+		//
+		//Wait our turn for the disk behind the other sessions.
+		//
+		ioSched->Begin(afpSession, afpCount);
+
+		if (forkItem->readAhead != NULL) {
+			result = forkItem->readAhead->Read(afpOffset, afpBuffer, afpCount);
+		}
+		else {
+			result = forkItem->file->ReadAt(afpOffset, afpBuffer, afpCount);
+		}
+
+		ioSched->End();
+
+		return( result );
+	}
+
+	DBGWRITE(dbg_level_trace, "Reading (RF) %lu bytes from %lld offset\n", afpCount, afpOffset);
+
+	return( forkItem->rsrcIO->ReadAt(afpOffset, afpBuffer, afpCount) );
+}
+
+
+/*
+ * FPReadReply()
+ *
+ * Description:
+ *		Build the reply to a read FPReadCheck() has approved, as much
+ *		of it as fits in one reply buffer.
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR FPReadReply(
+	afp_session*	afpSession,
+	OPEN_FORK_ITEM*	forkItem,
+	off_t			afpOffset,
+	size_t			afpReqCount,
+	int8*			afpReplyBuffer,
+	int32*			afpDataSize
+	)
+{
+	afp_buffer		afpReply(afpReplyBuffer, SRVR_REQUEST_QUANTUM_SIZE);
+	int32			afpActCount		= 0;
+	AFPERROR		afpError		= AFP_OK;
+
+	afpReqCount = std::min(afpReqCount, (size_t)afpReply.GetBufferSize());
+	afpActCount = FPReadFork(afpSession, forkItem, afpOffset, afpReply.GetCurrentPosPtr(), afpReqCount);
+
+	if (afpActCount < B_OK)
+	{
+		DBGWRITE(dbg_level_error, "Failed to read data!\n");
+
+		afpError = afpMiscErr;
+	}
+	else if (afpReqCount > 0 && afpActCount == 0)
+	{
+		afpError = afpEofError;
+	}
+	else if (afpActCount > 0)
+	{
+		afpReply.Advance(afpActCount);
+	}
+
+	*afpDataSize = afpActCount > 0 ? afpActCount : 0;
+
+	DBGWRITE(dbg_level_trace, "Returning error %ld, act count: %ld\n", afpError, afpActCount);
+
+	return( afpError );
+}
+
+
+/*
+ * FPRead()
+ *
+ * Description:
+ *		Read data from an open file.
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR FPRead(
+	afp_session*	afpSession,
+	int8*			afpReqBuffer,
+	int8*			afpReplyBuffer,
+	int32*			afpDataSize
+	)
+{
+	off_t			afpOffset		= 0;
+	size_t			afpReqCount		= 0;
+	AFPERROR		afpError		= AFP_OK;
+	OPEN_FORK_ITEM*	forkItem		= NULL;
+
+	DBGWRITE(dbg_level_trace, "Enter\n");
+
+	*afpDataSize = 0;
+
+	afpError = FPReadCheck(
+					afpSession,
+					afpReqBuffer,
+					SRVR_REQUEST_QUANTUM_SIZE,
+					NULL,
+					&forkItem,
+					&afpOffset,
+					&afpReqCount
+					);
+
+	if (AFP_SUCCESS(afpError)) {
+		afpError = FPReadReply(afpSession, forkItem, afpOffset, afpReqCount, afpReplyBuffer, afpDataSize);
+	}
+
+	return( afpError );
+}
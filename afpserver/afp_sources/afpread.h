@@ -0,0 +1,38 @@
+#ifndef __afpread__
+#define __afpread__
+
+#include "afp.h"
+#include "afp_session.h"
+
+//
+//The pieces of FPRead, shared with the DSI layer so it can stream
+//large FPReadExt replies.
+//
+AFPERROR FPReadCheck(
+	afp_session*		afpSession,
+	int8*				afpReqBuffer,
+	size_t				afpMaxCount,
+	off_t*				afpForkLen,
+	OPEN_FORK_ITEM**	afpForkItem,
+	off_t*				afpOffset,
+	size_t*				afpReqCount
+	);
+
+ssize_t FPReadFork(
+	afp_session*	afpSession,
+	OPEN_FORK_ITEM*	forkItem,
+	off_t			afpOffset,
+	void*			afpBuffer,
+	size_t			afpCount
+	);
+
+AFPERROR FPReadReply(
+	afp_session*	afpSession,
+	OPEN_FORK_ITEM*	forkItem,
+	off_t			afpOffset,
+	size_t			afpReqCount,
+	int8*			afpReplyBuffer,
+	int32*			afpDataSize
+	);
+
+#endif //__afpread__
@@ -10,134 +10,257 @@
 #define DIR_COUNT_ALLOC_SIZE	25
 
 /*
- * AFPReplayAddReply()
+ * afp_replay_cache()
  *
  * Description:
- *		Add a new afp reply to the replay cache.
+ *		Constructor for the per connection replay cache. The ring isn't
+ *		allocated until the first reply is stored.
  *
- * Returns: nothing
+ * Returns: None
+ */
+
+afp_replay_cache::afp_replay_cache()
+{
+	memset(mEntries, 0, sizeof(mEntries));
+	
+	mRingHead	= 0;
+	mHasRing	= false;
+}
+
+
+/*
+ * ~afp_replay_cache()
+ *
+ * Description:
+ *		Destructor for the replay cache.
+ *
+ * Returns: None
+ */
+
+afp_replay_cache::~afp_replay_cache()
+{
+	DBGWRITE(dbg_level_trace, "Freeing replay cache (%lu bytes)\n", GetMemoryUsage());
+}
+
+
+/*
+ * Store()
+ *
+ * Description:
+ *		Copy data into the ring and point the entry for the request ID
+ *		at it. Whatever older entries the copy overwrites are invalidated.
+ *
+ * Returns: The new entry or NULL if the data is too big to cache.
  */
 
-void AFPReplayAddReply(
-	int16 		dsiRequestID, 
-	int8* 		replyBuffer,
-	int32		replySize,
-	BList*		replayCache
+AFP_REPLAY_ENTRY* afp_replay_cache::Store(
+	uint16		requestID,
+	int8		dsiCommand,
+	int8		afpCommand,
+	int8*		data,
+	int32		length
 	)
 {
-	int32 cacheCount 		= replayCache->CountItems();
-	AFPReplayCacheItem*	rci = NULL;
-		
+	AFP_REPLAY_ENTRY*	entry = &mEntries[requestID % AFP_REPLAY_CACHE_SIZE];
+	
 	//
-	//First determine if we need to remove an old item from the cache
-	//to make room for the new one.
+	//Whatever was in this entry is from a request at least
+	//AFP_REPLAY_CACHE_SIZE requests ago, so it goes away regardless.
 	//
-	if (cacheCount >= AFP_REPLAY_CACHE_SIZE)
+	entry->valid = false;
+	
+	if ((length < 0) || (length > AFP_REPLAY_RING_SIZE))
+	{
+		DBGWRITE(dbg_level_trace, "Reply too big for the replay cache (%ld)\n", length);
+		return( NULL );
+	}
+	
+	if (mRing == NULL)
 	{
-		rci = (AFPReplayCacheItem*)replayCache->FirstItem();
+		mRing.reset(new(std::nothrow) int8[AFP_REPLAY_RING_SIZE]);
 		
-		if (rci != NULL)
-		{
-			replayCache->RemoveItem(rci);
-			delete rci;
-			rci = NULL;
+		if (mRing == NULL) {
+			return( NULL );
 		}
+		
+		mHasRing = true;
 	}
 	
 	//
-	//Create the new replay cache buffer
+	//Data is never split across the end of the ring, wrap to the start
+	//if it doesn't fit.
 	//
-	rci = new AFPReplayCacheItem;
+	if (mRingHead + length > AFP_REPLAY_RING_SIZE) {
+		mRingHead = 0;
+	}
 	
-	if (rci != NULL)
+	for (int32 i = 0; i < AFP_REPLAY_CACHE_SIZE; i++)
 	{
-		rci->requestID = dsiRequestID;
-		rci->replySize = replySize;
+		AFP_REPLAY_ENTRY*	old = &mEntries[i];
 		
-		memcpy(rci->reply, replyBuffer, replySize);
+		if (	(old->valid)								&&
+				(old->offset < mRingHead + length)			&&
+				(mRingHead < old->offset + old->length)		)
+		{
+			old->valid = false;
+		}
 	}
 	
-	replayCache->AddItem(rci);
+	memcpy(&mRing[mRingHead], data, length);
+	
+	entry->requestID	= requestID;
+	entry->dsiCommand	= dsiCommand;
+	entry->afpCommand	= afpCommand;
+	entry->isRead		= false;
+	entry->afpError		= AFP_OK;
+	entry->offset		= mRingHead;
+	entry->length		= length;
+	entry->valid		= true;
+	
+	mRingHead += length;
+	
+	return( entry );
 }
 
 
 /*
- * AFPReplaySearchForReply()
+ * AddReply()
  *
  * Description:
- *		Search through our cache for a reply that has the supplied DSI request ID
- *		and a matching afpCommand byte.
+ *		Add a new afp reply to the replay cache. Only the AFP data is
+ *		kept, the DSI header gets rebuilt when it's sent again.
  *
- * Returns: The the reply cache struct containing all the info needed to resend, or NULL
+ * Returns: nothing
  */
 
-AFPReplayCacheItem* AFPReplaySearchForReply(
-	int16	requestID,
-	int8	afpCommand,
-	BList*	replayCache
+void afp_replay_cache::AddReply(
+	uint16		requestID,
+	int8		dsiCommand,
+	int8		afpCommand,
+	int32		afpError,
+	int8*		afpReply,
+	int32		afpDataSize
 	)
 {
-	AFPReplayCacheItem* item = NULL;
-	int32 i = 0;
+	AFP_REPLAY_ENTRY*	entry;
 	
-	//
-	//Perform a linear search, nothing fancy here, keep the buffer small.
-	//
-	item = (AFPReplayCacheItem*)replayCache->ItemAt(i);
+	entry = Store(requestID, dsiCommand, afpCommand, afpReply, afpDataSize);
 	
-	do
+	if (entry != NULL) {
+		entry->afpError = afpError;
+	}
+}
+
+
+/*
+ * AddReadRequest()
+ *
+ * Description:
+ *		Read replies can be as large as the send buffer, so rather than
+ *		copying the data we keep the request and read again on replay.
+ *
+ * Returns: nothing
+ */
+
+void afp_replay_cache::AddReadRequest(
+	uint16		requestID,
+	int8		dsiCommand,
+	int8		afpCommand,
+	int8*		afpRequest,
+	int32		afpRequestSize
+	)
+{
+	AFP_REPLAY_ENTRY*	entry;
+	
+	entry = Store(requestID, dsiCommand, afpCommand, afpRequest, afpRequestSize);
+	
+	if (entry != NULL) {
+		entry->isRead = true;
+	}
+}
+
+
+/*
+ * Find()
+ *
+ * Description:
+ *		Look up the reply for the supplied DSI request ID and a matching
+ *		afpCommand byte.
+ *
+ * Returns: The entry containing all the info needed to resend, or NULL
+ */
+
+const AFP_REPLAY_ENTRY* afp_replay_cache::Find(uint16 requestID, int8 afpCommand)
+{
+	AFP_REPLAY_ENTRY*	entry = &mEntries[requestID % AFP_REPLAY_CACHE_SIZE];
+	
+	if ((entry->valid) && (entry->requestID == requestID) && (entry->afpCommand == afpCommand))
 	{
-		if (item != NULL)
-		{
-			if ((item->requestID == requestID) && (item->reply[0] == afpCommand))
-			{
-				//
-				//We found a match, return the reply in the cache.
-				//
-				return(item);
-			}
-		}
-		
-		i++;
-		item = (AFPReplayCacheItem*)replayCache->ItemAt(i);
-		
-	}while(item != NULL);
+		return( entry );
+	}
 	
-	return(NULL);
+	return( NULL );
 }
 
 
 /*
- * AFPReplayEmptyCache()
+ * Empty()
  *
  * Description:
- *		Clear out all memory associated with a replay cache for a particular
- *		AFP session.
+ *		Forget all cached replies and give back the ring.
  *
  * Returns: nothing
  */
 
-void AFPReplayEmptyCache(BList* replayCache)
+void afp_replay_cache::Empty()
 {
-	AFPReplayCacheItem* item = NULL;
-	int32 i = 0;
-	
 	DBGWRITE(dbg_level_trace, "Enter\n");
 	
-	item = (AFPReplayCacheItem*)replayCache->ItemAt(i);
+	memset(mEntries, 0, sizeof(mEntries));
 	
-	do
+	mRing.reset();
+	mRingHead	= 0;
+	mHasRing	= false;
+}
+
+
+/*
+ * GetMemoryUsage()
+ *
+ * Description:
+ *		How much memory this cache is holding on to. Safe to call
+ *		from other threads, the stats feed reports it per session.
+ *
+ * Returns: size_t
+ */
+
+size_t afp_replay_cache::GetMemoryUsage()
+{
+	return( sizeof(*this) + (mHasRing ? AFP_REPLAY_RING_SIZE : 0) );
+}
+
+
+/*
+ * GetBytesCached()
+ *
+ * Description:
+ *		How many bytes of the ring are used by replies we can still replay.
+ *
+ * Returns: size_t
+ */
+
+size_t afp_replay_cache::GetBytesCached()
+{
+	size_t	total = 0;
+	
+	for (int32 i = 0; i < AFP_REPLAY_CACHE_SIZE; i++)
 	{
-		if (item != NULL)
-		{
-			DBGWRITE(dbg_level_trace, "Deleting replay entry for request id: %d\n", item->requestID);
-			delete item;
+		if (mEntries[i].valid) {
+			total += mEntries[i].length;
 		}
-		
-		i++;
-		item = (AFPReplayCacheItem*)replayCache->ItemAt(i);
-			
-	}while(item != NULL);
+	}
+	
+	return( total );
 }
 
 
@@ -150,11 +273,11 @@ void AFPReplayEmptyCache(BList* replayCache)
  * Returns: AFPERROR
  */
 
-AFPERROR AFPTraverseAndSyncDir(BDirectory* rootDir)
+AFPERROR AFPTraverseAndSyncDir(fp_storage_dir* rootDir)
 {
-	BEntry 		entry;
+	fp_storage_entry 		entry;
 	BList		directories(DIR_COUNT_ALLOC_SIZE);
-	BDirectory*	dir = NULL;
+	fp_storage_dir*	dir = NULL;
 	
 	DBGWRITE(dbg_level_trace, "Enter\n");
 	
@@ -162,7 +285,7 @@ AFPERROR AFPTraverseAndSyncDir(BDirectory* rootDir)
 	
 	do
 	{
-		dir = (BDirectory*)directories.FirstItem();
+		dir = (fp_storage_dir*)directories.FirstItem();
 		
 		if (dir == NULL)
 		{
@@ -178,7 +301,7 @@ AFPERROR AFPTraverseAndSyncDir(BDirectory* rootDir)
 		{
 			if (entry.IsDirectory())
 			{
-				BDirectory *newDir = new BDirectory(&entry);
+				fp_storage_dir *newDir = new fp_storage_dir(&entry);
 				
 				//
 				//Store the newly found directory in our list so we
@@ -188,12 +311,12 @@ AFPERROR AFPTraverseAndSyncDir(BDirectory* rootDir)
 			}
 			else
 			{
-				BNode node(&entry);
+				fp_storage_node node(&entry);
 									
 				#ifdef DEBUG
-				BPath p;
-				entry.GetPath(&p);
-				DBGWRITE(dbg_level_trace, "Syncing file: %s\n", p.Path());
+				char p[B_PATH_NAME_LENGTH];
+				entry.GetPath(p, sizeof(p));
+				DBGWRITE(dbg_level_trace, "Syncing file: %s\n", p);
 				#endif
 				
 				node.Sync();
@@ -241,7 +364,7 @@ AFPERROR FPSyncDir(
 {
 	afp_buffer	afpReply(afpReplyBuffer);
 	afp_buffer	afpRequest(afpReqBuffer);
-	BEntry		afpEntry;
+	fp_storage_entry	afpEntry;
 	fp_volume*	afpVolume		= NULL;
 	int16		afpVolumeID		= 0;
 	int32		afpDirID		= 0;
@@ -301,7 +424,7 @@ AFPERROR FPSyncDir(
 		}
 		else if (afpEntry.IsDirectory())
 		{
-			BDirectory dir(&afpEntry);
+			fp_storage_dir dir(&afpEntry);
 						
 			if (dir.InitCheck() == B_OK)
 			{
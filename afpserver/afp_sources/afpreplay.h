@@ -3,30 +3,90 @@
 #ifndef __afpreplay__
 #define __afpreplay__
 
+#include <atomic>
+#include <memory>
+
+//
+//Replies are kept in a byte ring sized for the typical small reply
+//rather than a SEND_BUFFER_SIZE slot each. Replies bigger than the
+//ring are simply not cached.
+//
+#define AFP_REPLAY_RING_SIZE		(64 * 1024)
+
+//
+//One cached reply. For FPRead/FPReadExt the ring holds the request
+//instead of the reply data, and the read is executed again on replay.
+//
 typedef struct
 {
-	int16	requestID;
-	int32	replySize;
-	int8	reply[SEND_BUFFER_SIZE];
-}AFPReplayCacheItem;
+	uint16	requestID;
+	int8	dsiCommand;
+	int8	afpCommand;
+	bool	valid;
+	bool	isRead;
+	int32	afpError;
+	int32	offset;
+	int32	length;
+}AFP_REPLAY_ENTRY;
 
 
-void AFPReplayAddReply(
-	int16 		dsiRequestID, 
-	int8* 		replyBuffer,
-	int32		replySize,
-	BList*		replayCache
-	);
-
-AFPReplayCacheItem* AFPReplaySearchForReply(
-	int16	requestID,
-	int8	afpCommand,
-	BList*	replayCache
-	);
+class afp_replay_cache
+{
+public:
+							afp_replay_cache();
+	virtual					~afp_replay_cache();
 	
-void AFPReplayEmptyCache(
-	BList* 		replayCache
-	);
+	virtual void			AddReply(
+								uint16		requestID,
+								int8		dsiCommand,
+								int8		afpCommand,
+								int32		afpError,
+								int8*		afpReply,
+								int32		afpDataSize
+								);
+	
+	virtual void			AddReadRequest(
+								uint16		requestID,
+								int8		dsiCommand,
+								int8		afpCommand,
+								int8*		afpRequest,
+								int32		afpRequestSize
+								);
+	
+	virtual const AFP_REPLAY_ENTRY*	Find(uint16 requestID, int8 afpCommand);
+	virtual int8*			GetData(const AFP_REPLAY_ENTRY* entry)	{ return( &mRing[entry->offset] ); }
+	
+	virtual void			Empty();
+	
+	virtual size_t			GetMemoryUsage();
+	virtual size_t			GetBytesCached();
+	
+private:
+	
+	AFP_REPLAY_ENTRY*		Store(
+								uint16		requestID,
+								int8		dsiCommand,
+								int8		afpCommand,
+								int8*		data,
+								int32		length
+								);
+	
+	//
+	//Client request IDs are sequential, so the last AFP_REPLAY_CACHE_SIZE
+	//of them map to distinct entries and lookup is a single index.
+	//
+	AFP_REPLAY_ENTRY		mEntries[AFP_REPLAY_CACHE_SIZE];
+	
+	std::unique_ptr<int8[]>	mRing;
+	int32					mRingHead;
+	
+	//
+	//Whether mRing is allocated, for GetMemoryUsage() callers on
+	//other threads.
+	//
+	std::atomic<bool>		mHasRing;
+};
+
 
 AFPERROR FPSyncDir(
 	afp_session*	afpSession,
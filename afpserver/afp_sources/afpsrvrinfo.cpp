@@ -0,0 +1,217 @@
+#include <netinet/in.h>
+
+#include "debug.h"
+#include "afp.h"
+#include "commands.h"
+#include "afplogon.h"
+#include "afphostname.h"
+#include "afpsrvrinfo.h"
+
+afp_srvrinfo	gAFPSrvrInfo;
+
+
+/*
+ * afp_srvrinfo()
+ *
+ * Description:
+ *		Nothing is packed until the first Update() or Copy().
+ *
+ * Returns:
+ */
+
+afp_srvrinfo::afp_srvrinfo()
+{
+}
+
+
+/*
+ * ~afp_srvrinfo()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+afp_srvrinfo::~afp_srvrinfo()
+{
+}
+
+
+/*
+ * Update()
+ *
+ * Description:
+ *		Pack a new reply and swap it in. Connections still copying
+ *		the old one keep it alive until they are done.
+ *
+ * Returns: None
+ */
+
+void afp_srvrinfo::Update()
+{
+	std::shared_ptr<SRVRINFO_BLOB>	blob(new SRVRINFO_BLOB);
+
+	//
+	//Two updates racing could otherwise leave the older state
+	//swapped in last.
+	//
+	std::lock_guard<std::mutex> guard(mUpdateLock);
+
+	blob->size = Build(blob->data);
+
+	std::atomic_store(&mBlob, std::shared_ptr<const SRVRINFO_BLOB>(blob));
+
+	DBGWRITE(dbg_level_trace, "Server info repacked (%d bytes)\n", (int)blob->size);
+}
+
+
+/*
+ * Copy()
+ *
+ * Description:
+ *		Copy the packed reply into a reply buffer.
+ *
+ * Returns: The size of the reply, not counting the DSI header
+ */
+
+int32 afp_srvrinfo::Copy(int8* buffer)
+{
+	std::shared_ptr<const SRVRINFO_BLOB>	blob = std::atomic_load(&mBlob);
+
+	if (blob == NULL)
+	{
+		Update();
+		blob = std::atomic_load(&mBlob);
+	}
+
+	memcpy(buffer, blob->data, blob->size);
+
+	return( blob->size );
+}
+
+
+/*
+ * Build() [STATIC]
+ *
+ * Description:
+ *		Packs the FPGetSrvrInfo reply from the current settings.
+ *
+ * Returns: The size of the reply
+ */
+
+int32 afp_srvrinfo::Build(int8* buffer)
+{
+	char		hostname[MAX_HOSTNAME_LEN]	= "";
+	int16		afpFlags				= 0;
+	int8*		pBuffer					= NULL;
+	int8*		pAddressCountOffset		= NULL;
+	int8*		pServerSigOffset		= NULL;
+
+	//
+	//Set the flags which tell what our server supports.
+	//
+	afpFlags = kSupportsTCPIP
+				| kSupportsSrvrNotification
+				| kSupportsCopyFile
+				| kSupportsSrvrMsgs
+				| kSupportsReconnect
+				| kSupportsChngPswd
+				| kSupportsExtSleep;
+
+	*((int16*)&buffer[SRVRINFO_OFFSET_FLAGS]) = htons(afpFlags);
+
+	//
+	//We don't have a custom volume icon.
+	//
+	*((int16*)&buffer[SRVRINFO_OFFSET_VOLUMEICON]) = 0;
+
+	//
+	//Blast in the computer name.
+	//
+	afp_GetHostname(hostname, sizeof(hostname));
+
+	pBuffer = &buffer[SRVRINFO_OFFSET_SRVRNAME];
+	PUSH_CSTRING(hostname, pBuffer);
+
+	//
+	//Add an extra padding byte if the AFP buffer is not on
+	//an even boundary.
+	//
+	if ((pBuffer - buffer) % 2)
+		*pBuffer++ = 0x00;
+
+	//
+	//Save the server signature offset
+	//
+	pServerSigOffset = pBuffer;
+	pBuffer += sizeof(int16);
+
+	//
+	//Network address count offset, save it for later.
+	//
+	pAddressCountOffset = pBuffer;
+	pBuffer += sizeof(int16);
+
+	//
+	//Set the machine type and offset.
+	//
+	*((int16*)&buffer[SRVRINFO_OFFSET_MACHTYPE]) =
+											htons(pBuffer - buffer);
+
+	PUSH_CSTRING(AFP_MACHINE_TYPE, pBuffer);
+
+	//
+	//Paste in the AFP version we support.
+	//
+	*((int16*)&buffer[SRVRINFO_OFFSET_AFPVERSCOUNT]) =
+											htons(pBuffer - buffer);
+
+	*pBuffer++ = AFP_VERSION_COUNT;
+
+	PUSH_CSTRING(AFP_22_VERSION_STR, pBuffer);
+	PUSH_CSTRING(AFP_30_VERSION_STR, pBuffer);
+	PUSH_CSTRING(AFP_31_VERSION_STR, pBuffer);
+	PUSH_CSTRING(AFP_32_VERSION_STR, pBuffer);
+	PUSH_CSTRING(AFP_33_VERSION_STR, pBuffer);
+
+	//
+	//Now the supported UAM's get included.
+	//
+	*((int16*)&buffer[SRVRINFO_OFFSET_UAMCOUNT]) =
+											htons(pBuffer - buffer);
+
+	if (afpAccountEnabled(AFP_GUEST_NAME))
+	{
+		*pBuffer++ = UAM_COUNT;
+		PUSH_CSTRING(UAM_NONE_STR, pBuffer);
+	}
+	else
+	{
+		*pBuffer++ = UAM_COUNT - 1;
+	}
+
+	//
+	//This is always supported in our server, no matter what.
+	//
+	PUSH_CSTRING(UAM_CLEAR_TEXT, pBuffer);
+	PUSH_CSTRING(UAM_DHCAST128, pBuffer);
+
+	//
+	//Set the server sig offset and value.
+	//
+	*((int16*)pServerSigOffset) = htons(pBuffer - buffer);
+	*pBuffer++ = 0;
+
+	//Network Address: Note, there is no reason for us to pass
+	//back address since we only support connections over TCP/IP.
+	//This feature is only for connection where the initial connection
+	//is done over AppleTalk.
+
+	*((int16*)pAddressCountOffset) = htons(pBuffer - buffer);
+	*pBuffer++ = 0;
+
+	//
+	//This size does NOT include the size of the DSI Header.
+	//
+	return( (int32)(pBuffer - buffer) );
+}
@@ -0,0 +1,49 @@
+#ifndef __afpsrvrinfo__
+#define __afpsrvrinfo__
+
+#include <memory>
+#include <mutex>
+
+#include "afpGlobals.h"
+
+//
+//Room for the whole FPGetSrvrInfo reply. With the longest hostname
+//it comes to a little under 300 bytes.
+//
+#define SRVRINFO_MAX_SIZE		512
+
+typedef struct
+{
+	int32		size;
+	int8		data[SRVRINFO_MAX_SIZE];
+}SRVRINFO_BLOB;
+
+
+class afp_srvrinfo
+{
+public:
+								afp_srvrinfo();
+	virtual						~afp_srvrinfo();
+
+	//
+	//Repack the reply. Called whenever the hostname, the guest
+	//account or anything else the reply reports changes.
+	//
+	virtual void				Update();
+
+	//
+	//Copy the current reply into buffer.
+	//
+	virtual int32				Copy(int8* buffer);
+
+private:
+
+	static int32				Build(int8* buffer);
+
+	std::mutex								mUpdateLock;
+	std::shared_ptr<const SRVRINFO_BLOB>	mBlob;
+};
+
+extern afp_srvrinfo		gAFPSrvrInfo;
+
+#endif //__afpsrvrinfo__
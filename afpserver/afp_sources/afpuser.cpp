@@ -1,4 +1,4 @@
-#include <StorageKit.h>
+#include "fp_storage.h"
 
 #include "commands.h"
 #include "afpGlobals.h"
@@ -1,17 +1,275 @@
+#include <algorithm>
+#include <atomic>
 #include <mutex>
 #include <memory>
+#include <utility>
 
-#include <String.h>
-#include <List.h>
-#include <StorageKit.h>
-#include <Alert.h>
-#include <Beep.h>
+#include "afp_os.h"
+#include "fp_storage.h"
 
 #include "commands.h"
 #include "afpvolume.h"
 
-std::mutex volume_blist_mutex;
-std::unique_ptr<BList> volume_blist = std::make_unique<BList>();
+//
+//Held only by those changing the volume table, and the reclaim thread.
+//
+static std::mutex								sVolumeTableLock;
+static std::atomic<const AFP_VOLUME_TABLE*>		sVolumeTable(new AFP_VOLUME_TABLE);
+
+//
+//Readers count themselves in the slot of the epoch they started in.
+//The epoch only moves on once the slot of the one before it is empty,
+//so when the previous epoch's slot drains nobody can still be using
+//anything dropped before the current epoch began.
+//
+static std::atomic<uint32>		sReaderEpoch(0);
+static std::atomic<int32>		sReaders[2];
+
+typedef struct
+{
+	uint32					epoch;		//Reader epoch when it was dropped
+	const AFP_VOLUME_TABLE*	table;
+	fp_volume*				volume;
+}AFP_RETIRED_ITEM;
+
+static std::vector<AFP_RETIRED_ITEM>	sRetired;
+static thread_id						sReclaimThread	= -1;
+static int16							sNextVolumeID	= 1;
+
+
+/*
+ * fp_volume_reader()
+ *
+ * Description:
+ *		Count ourselves as a reader of the current epoch. If it moved
+ *		on while we did, count again in the new one.
+ *
+ * Returns:
+ */
+
+fp_volume_reader::fp_volume_reader()
+{
+	for (;;)
+	{
+		uint32	epoch = sReaderEpoch.load();
+
+		mSlot = epoch & 1;
+		sReaders[mSlot]++;
+
+		if (sReaderEpoch.load() == epoch) {
+			break;
+		}
+
+		sReaders[mSlot]--;
+	}
+}
+
+
+/*
+ * ~fp_volume_reader()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_volume_reader::~fp_volume_reader()
+{
+	sReaders[mSlot]--;
+}
+
+
+/*
+ * ReclaimRetired()
+ *
+ * Description:
+ *		Take out what can be freed now. Called with sVolumeTableLock
+ *		held, the caller frees what we return without it since a
+ *		volume waits for its own threads on the way out.
+ *
+ * Returns: none
+ */
+
+static void ReclaimRetired(std::vector<AFP_RETIRED_ITEM>* reclaimed)
+{
+	uint32	epoch	= sReaderEpoch.load();
+	bool	waiting	= false;
+
+	//
+	//Readers from before this epoch are still around.
+	//
+	if (sReaders[(epoch - 1) & 1].load() != 0) {
+		return;
+	}
+
+	for (size_t i = 0; i < sRetired.size(); )
+	{
+		AFP_RETIRED_ITEM&	item = sRetired[i];
+
+		if (item.epoch == epoch)
+		{
+			waiting = true;
+			i++;
+		}
+		else if ((item.volume != NULL) && (item.volume->CountReferences() > 0))
+		{
+			//
+			//Forks still open on it hold on to it directly.
+			//
+			i++;
+		}
+		else
+		{
+			reclaimed->push_back(item);
+			sRetired.erase(sRetired.begin() + i);
+		}
+	}
+
+	//
+	//Anything dropped during this epoch can go once the readers
+	//that started in it are gone.
+	//
+	if (waiting) {
+		sReaderEpoch++;
+	}
+}
+
+
+/*
+ * ReclaimThread()
+ *
+ * Description:
+ *		Frees retired tables and volumes as they become unused. Runs
+ *		for as long as there are any.
+ *
+ * Returns: B_OK
+ */
+
+static status_t ReclaimThread(void* data)
+{
+	#pragma unused(data)
+
+	std::unique_lock<std::mutex> lock(sVolumeTableLock);
+
+	while(!sRetired.empty())
+	{
+		std::vector<AFP_RETIRED_ITEM>	reclaimed;
+
+		lock.unlock();
+		snooze(VOLUME_RECLAIM_INTERVAL);
+		lock.lock();
+
+		ReclaimRetired(&reclaimed);
+
+		if (reclaimed.empty()) {
+			continue;
+		}
+
+		lock.unlock();
+
+		for (AFP_RETIRED_ITEM& item : reclaimed)
+		{
+			if (item.volume != NULL)
+			{
+				DPRINT(("[afpVolume::ReclaimThread]Freeing volume %d\n", item.volume->GetVolumeID()));
+				delete item.volume;
+			}
+
+			delete item.table;
+		}
+
+		lock.lock();
+	}
+
+	sReclaimThread = -1;
+
+	return( B_OK );
+}
+
+
+/*
+ * Retire()
+ *
+ * Description:
+ *		Hand a table or volume no longer published to the reclaim
+ *		thread. Called with sVolumeTableLock held.
+ *
+ * Returns: none
+ */
+
+static void Retire(const AFP_VOLUME_TABLE* table, fp_volume* volume)
+{
+	sRetired.push_back({ sReaderEpoch.load(), table, volume });
+
+	if (sReclaimThread < 0)
+	{
+		sReclaimThread = spawn_thread(
+							ReclaimThread,
+							"afp_volume_reclaim",
+							B_LOW_PRIORITY,
+							NULL
+							);
+
+		resume_thread(sReclaimThread);
+	}
+}
+
+
+/*
+ * PublishTable()
+ *
+ * Description:
+ *		Swap in a new volume table, retiring the old one. Called with
+ *		sVolumeTableLock held.
+ *
+ * Returns: none
+ */
+
+static void PublishTable(AFP_VOLUME_TABLE* table)
+{
+	Retire(sVolumeTable.exchange(table), NULL);
+}
+
+
+/*
+ * NewVolumeID()
+ *
+ * Description:
+ *		IDs are handed out in order. Once they run out we go back to
+ *		the lowest one that is neither shared nor still waiting to be
+ *		freed. Called with sVolumeTableLock held.
+ *
+ * Returns: A volume ID, or -1 if they are all in use
+ */
+
+static int16 NewVolumeID()
+{
+	const AFP_VOLUME_TABLE*	table = VolumeTable();
+
+	if (sNextVolumeID < VOLUME_MAX_ID) {
+		return( sNextVolumeID++ );
+	}
+
+	for (int16 volID = 1; volID <= VOLUME_MAX_ID; volID++)
+	{
+		bool	inUse = ((volID < (int32)table->byID.size()) && (table->byID[volID] != NULL));
+
+		for (size_t i = 0; (i < sRetired.size()) && (!inUse); i++) {
+			inUse = ((sRetired[i].volume != NULL) && (sRetired[i].volume->GetVolumeID() == volID));
+		}
+
+		if (!inUse) {
+			return( volID );
+		}
+
+		if (volID == VOLUME_MAX_ID) {
+			break;
+		}
+	}
+
+	return( -1 );
+}
+
 
 /*
  * SaveVolumeData()
@@ -25,32 +283,27 @@ std::unique_ptr<BList> volume_blist = std::make_unique<BList>();
 
 void SaveVolumeData(VolumeStorageData* volData)
 {
-	BPath		path;
-	BNode		file;
-	BDirectory	dir;
-	char		fpath[256];
+	char		path[B_PATH_NAME_LENGTH];
+	fp_storage_node	file;
+	char		fpath[B_PATH_NAME_LENGTH];
 	char		attrName[B_ATTR_NAME_LENGTH];
 	
 	//
 	//Save the current volume flag settings to the file.
 	//
-	if (find_directory(B_USER_SETTINGS_DIRECTORY, &path) == B_OK)
+	if (fp_storage_settings_dir(path, sizeof(path)) == B_OK)
 	{
-		dir.SetTo(path.Path());
+		sprintf(fpath, "%s/%s", path, AFP_PREFS_FILE_NAME);
 		
-		if (!dir.Contains(AFP_PREFS_FILE_NAME, B_FILE_NODE))
-		{
-			DPRINT(("[SaveVolumeData]Creating volume file!!\n"));
-			dir.CreateFile(AFP_PREFS_FILE_NAME, NULL, true);
-		}
-		
-		sprintf(fpath, "%s/%s", path.Path(), AFP_PREFS_FILE_NAME);
-		file.SetTo(fpath);
+		//
+		//The preferences file is created the first time through.
+		//
+		file.SetTo(fpath, FP_STORAGE_READ | FP_STORAGE_WRITE | FP_STORAGE_CREATE);
 		
 		if (file.InitCheck() == B_OK)
 		{			
 			sprintf(attrName, "%s%s", AFP_VOLUMES_TYPE, volData->path);
-			file.WriteAttr(attrName, 0, 0, volData, sizeof(VolumeStorageData));
+			file.WriteAttr(attrName, 0, volData, sizeof(VolumeStorageData));
 			
 			DPRINT(("[SaveVolumeData]Saved to attribute name '%s'\n", attrName));
 		}
@@ -59,14 +312,11 @@ void SaveVolumeData(VolumeStorageData* volData)
 	//
 	//Now update the volume object live.
 	//
-	fp_volume*	volume 	= NULL;
-	int			i		= 0;
-	
-	std::lock_guard lock(volume_blist_mutex);
+	fp_volume_reader	reader;
 	
-	while((volume = (fp_volume*)volume_blist->ItemAt(i++)) != NULL)
+	for (fp_volume* volume : VolumeTable()->volumes)
 	{
-		if (!strcmp(volume->GetPath()->Path(), volData->path))
+		if (!strcmp(volume->GetPath(), volData->path))
 		{
 			volume->SetVolumeFlags(volData->flags);
 			break;
@@ -87,20 +337,20 @@ void SaveVolumeData(VolumeStorageData* volData)
 
 status_t GetVolumeData(const char* volPath, VolumeStorageData* outData)
 {
-	BPath				path;
-	BNode				file;
-	char				fpath[256];
+	char				path[B_PATH_NAME_LENGTH];
+	fp_storage_node		file;
+	char				fpath[B_PATH_NAME_LENGTH];
 	VolumeStorageData	volData;
 	char				attrName[B_ATTR_NAME_LENGTH];
 	status_t			status	= B_OK;
 	ssize_t				size 	= 0;
 	
-	status = find_directory(B_USER_SETTINGS_DIRECTORY, &path);
+	status = fp_storage_settings_dir(path, sizeof(path));
 	
 	if (status == B_OK)
 	{	
-		sprintf(fpath, "%s/%s", path.Path(), AFP_PREFS_FILE_NAME);
-		file.SetTo(fpath);
+		sprintf(fpath, "%s/%s", path, AFP_PREFS_FILE_NAME);
+		file.SetTo(fpath, 0);
 		
 		status = B_ERROR;
 		
@@ -116,7 +366,7 @@ status_t GetVolumeData(const char* volPath, VolumeStorageData* outData)
 					
 					memset(&volData, 0, sizeof(VolumeStorageData));
 					
-					size = file.ReadAttr(attrName, 0, 0, &volData, sizeof(VolumeStorageData));
+					size = file.ReadAttr(attrName, 0, &volData, sizeof(VolumeStorageData));
 					
 					if (size > B_OK)
 					{
@@ -149,24 +399,40 @@ status_t GetVolumeData(const char* volPath, VolumeStorageData* outData)
  
  status_t StartSharingVolume(VolumeStorageData* volData)
  {
- 	BPath*			bpath;
-	fp_volume*		newVol;
+ 	const char*			leaf;
+	fp_volume*			newVol;
+	AFP_VOLUME_TABLE*	table;
+	int16				volID;
+	
+	std::lock_guard lock(sVolumeTableLock);
+	
+	leaf = strrchr(volData->path, '/');
+	leaf = (leaf != NULL) ? leaf + 1 : volData->path;
+	
+	if (FindVolume(leaf) != NULL) {
+		return( B_ERROR );
+	}
 	
-	bpath = new BPath(volData->path);
+	DPRINT(("[afpVolume::StartSharingVolume]Now sharing: %s\n", leaf));
 	
-	if (FindVolume(bpath->Leaf()) != NULL)
+	if ((volID = NewVolumeID()) < 0)
 	{
-		delete bpath;
-		
+		DPRINT(("[afpVolume::StartSharingVolume]Out of volume IDs for: %s\n", leaf));
 		return( B_ERROR );
 	}
 	
-	DPRINT(("[afpVolume::StartSharingVolume]Now sharing: %s\n", bpath->Leaf()));
+	newVol	= new fp_volume(volData->path, volID, volData->flags);
+	table	= new AFP_VOLUME_TABLE(*VolumeTable());
+	
+	table->volumes.push_back(newVol);
+	
+	if ((int32)table->byID.size() <= newVol->GetVolumeID()) {
+		table->byID.resize(newVol->GetVolumeID() + 1, NULL);
+	}
 	
-	newVol = new fp_volume(bpath, volData->flags);
+	table->byID[newVol->GetVolumeID()] = newVol;
 	
-	std::lock_guard lock(volume_blist_mutex);
-	volume_blist->AddItem(newVol);
+	PublishTable(table);
 	
 	WatchVolume(volData->path);
 	
@@ -186,19 +452,22 @@ status_t GetVolumeData(const char* volPath, VolumeStorageData* outData)
 
 status_t StopSharingVolume(const char* path)
 {
-	fp_volume*	volume 	= NULL;
-	int			i		= 0;
 	status_t	status	= B_ERROR;
 	
-	std::lock_guard lock(volume_blist_mutex);
+	std::lock_guard lock(sVolumeTableLock);
 	
-	while((volume = (fp_volume*)volume_blist->ItemAt(i++)) != NULL)
+	for (fp_volume* volume : VolumeTable()->volumes)
 	{
-		if (!strcmp(volume->GetPath()->Path(), path))
+		if (!strcmp(volume->GetPath(), path))
 		{
-			volume_blist->RemoveItem(volume);
-			delete volume;
-						
+			AFP_VOLUME_TABLE*	table = new AFP_VOLUME_TABLE(*VolumeTable());
+			
+			table->volumes.erase(std::find(table->volumes.begin(), table->volumes.end(), volume));
+			table->byID[volume->GetVolumeID()] = NULL;
+			
+			PublishTable(table);
+			Retire(NULL, volume);
+			
 			status = B_OK;
 			break;
 		}
@@ -222,20 +491,20 @@ status_t StopSharingVolume(const char* path)
 
 status_t ShareAllVolumes()
 {
-	BPath				path;
-	BNode				file;
-	char				fpath[256];
+	char				path[B_PATH_NAME_LENGTH];
+	fp_storage_node		file;
+	char				fpath[B_PATH_NAME_LENGTH];
 	VolumeStorageData	volData;
 	char				attrName[B_ATTR_NAME_LENGTH];
 	status_t			status	= B_OK;
 	ssize_t				size 	= 0;
 	
-	status = find_directory(B_USER_SETTINGS_DIRECTORY, &path);
+	status = fp_storage_settings_dir(path, sizeof(path));
 	
 	if (status == B_OK)
 	{	
-		sprintf(fpath, "%s/%s", path.Path(), AFP_PREFS_FILE_NAME);
-		file.SetTo(fpath);
+		sprintf(fpath, "%s/%s", path, AFP_PREFS_FILE_NAME);
+		file.SetTo(fpath, 0);
 		
 		status = B_ERROR;
 				
@@ -247,7 +516,7 @@ status_t ShareAllVolumes()
 				{
 					memset(&volData, 0, sizeof(VolumeStorageData));
 					
-					size = file.ReadAttr(attrName, 0, 0, &volData, sizeof(VolumeStorageData));
+					size = file.ReadAttr(attrName, 0, &volData, sizeof(VolumeStorageData));
 					
 					if (size > B_OK) {
 					
@@ -273,22 +542,13 @@ status_t ShareAllVolumes()
 
 fp_volume* FindVolume(uint16 volID)
 {
-	fp_volume*	afpVolume 	= NULL;
-	uint16		i			= 0;
+	const AFP_VOLUME_TABLE*	table = VolumeTable();
 	
-	std::lock_guard lock(volume_blist_mutex);
-		
-	while((afpVolume = (fp_volume*)volume_blist->ItemAt(i)) != NULL)
-	{
-		if (afpVolume->GetVolumeID() == volID)
-		{
-			break;
-		}
-		
-		i++;
+	if (volID >= table->byID.size()) {
+		return( NULL );
 	}
-			
-	return( afpVolume );
+	
+	return( table->byID[volID] );
 }
 
 
@@ -303,20 +563,13 @@ fp_volume* FindVolume(uint16 volID)
 
 fp_volume* FindVolume(const char* volName)
 {
-	fp_volume*	afpVolume 	= NULL;
-	int16		i			= 0;
-	
-	std::lock_guard lock(volume_blist_mutex);
-	
-	while((afpVolume = (fp_volume*)volume_blist->ItemAt(i)) != NULL)
+	for (fp_volume* afpVolume : VolumeTable()->volumes)
 	{
 		if (!strcmp(afpVolume->GetVolumeName(), volName))
-			break;
-		
-		i++;
+			return( afpVolume );
 	}
-			
-	return( afpVolume );
+	
+	return( NULL );
 }
 
 
@@ -331,56 +584,51 @@ fp_volume* FindVolume(const char* volName)
 
 fp_volume* FindVolume(node_ref nref)
 {
-	fp_volume*	afpVolume 	= NULL;
-	BDirectory*	dir			= NULL;
-	int16		i			= 0;
-	node_ref	ourRef;
-	
-	std::lock_guard lock(volume_blist_mutex);
-	
-	while((afpVolume = (fp_volume*)volume_blist->ItemAt(i)) != NULL)
+	for (fp_volume* afpVolume : VolumeTable()->volumes)
 	{
-		dir = afpVolume->GetDirectory();
-		
-		if (dir != NULL)
-		{
-			dir->GetNodeRef(&ourRef);
-			
-			if (ourRef == nref) {
-				break;
-			}
-		}
-		
-		i++;
+		if (afpVolume->GetRootNodeRef() == nref)
+			return( afpVolume );
 	}
-			
-	return( afpVolume );
+	
+	return( NULL );
 }
 
 
 /*
- * MarkAllVolumesClean()
+ * VolumeTable()
  *
  * Description:
- *		Marks all volumes as clean. This is usually called by the
- *		scavenger thread.
+ *		The shared volumes as of now. Good for as long as the caller
+ *		holds an fp_volume_reader.
  *
- * Returns:
+ * Returns: const AFP_VOLUME_TABLE*
  */
 
-void MarkAllVolumesClean()
+const AFP_VOLUME_TABLE* VolumeTable()
 {
-	std::lock_guard lock(volume_blist_mutex);
-	
-	fp_volume* volume;
-	int j = 0;
+	return( sVolumeTable.load(std::memory_order_acquire) );
+}
+
+
+/*
+ * VolumeDirectoryChanged()
+ *
+ * Description:
+ *		The node monitor saw a directory change. Pass it on to the
+ *		catalogs of the volumes on that device, the one it belongs to
+ *		knows the directory.
+ *
+ * Returns: none
+ */
+
+void VolumeDirectoryChanged(dev_t device, ino_t directory)
+{
+	fp_volume_reader	reader;
 	
-	while((volume = (fp_volume*)volume_blist->ItemAt(j++)) != NULL)
+	for (fp_volume* volume : VolumeTable()->volumes)
 	{
-		if (volume->IsDirty()) {
-		
-			volume->MakeClean();
-		}
+		if (volume->GetRootNodeRef().device == device)
+			volume->CatalogDirectoryChanged(directory);
 	}
 }
 
@@ -396,20 +644,19 @@ void MarkAllVolumesClean()
 
 status_t RemoveVolumeData(const char* volName)
 {
-	BPath		path;
-	BNode		file;
-	BDirectory	dir;
-	char		fpath[256];
+	char		path[B_PATH_NAME_LENGTH];
+	fp_storage_node	file;
+	char		fpath[B_PATH_NAME_LENGTH];
 	char		attrName[B_ATTR_NAME_LENGTH];
 	size_t		size	= 0;
 	status_t	status 	= B_OK;
 	
-	status = find_directory(B_USER_SETTINGS_DIRECTORY, &path);
+	status = fp_storage_settings_dir(path, sizeof(path));
 	
 	if (status == B_OK)
 	{		
-		sprintf(fpath, "%s/%s", path.Path(), AFP_PREFS_FILE_NAME);
-		file.SetTo(fpath);
+		sprintf(fpath, "%s/%s", path, AFP_PREFS_FILE_NAME);
+		file.SetTo(fpath, 0);
 				
 		if (file.InitCheck() == B_OK)
 		{
@@ -436,7 +683,7 @@ status_t RemoveVolumeData(const char* volName)
 
 void WatchVolume(const char* path)
 {
-	BEntry		entry(path);
+	fp_storage_entry	entry(path);
 	node_ref	nref;
 	status_t	status;
 	
@@ -444,11 +691,7 @@ void WatchVolume(const char* path)
 	{
 		entry.GetNodeRef(&nref);
 		
-		status = watch_node(
-					&nref,
-					B_ENTRY_REMOVED | B_ENTRY_MOVED | B_WATCH_NAME,
-					be_app_messenger
-					);
+		status = fp_storage_watch_node(&nref, FP_STORAGE_WATCH_SHARE);
 					
 		if (status != B_OK)
 		{
@@ -468,13 +711,13 @@ void WatchVolume(const char* path)
 
 void StopWatchingVolume(const char* path)
 {
-	BEntry		entry(path);
+	fp_storage_entry	entry(path);
 	node_ref	nref;
 	
 	if (entry.InitCheck() == B_OK)
 	{
 		entry.GetNodeRef(&nref);
-		watch_node(&nref, B_STOP_WATCHING, be_app_messenger);
+		fp_storage_watch_node(&nref, FP_STORAGE_WATCH_STOP);
 	}
 }
 
@@ -489,5 +732,5 @@ void StopWatchingVolume(const char* path)
 
 void StopWatchingVolume(node_ref nref)
 {
-	watch_node(&nref, B_STOP_WATCHING, be_app_messenger);
+	fp_storage_watch_node(&nref, FP_STORAGE_WATCH_STOP);
 }
@@ -1,9 +1,9 @@
 #ifndef __afpvolume__
 #define __afpvolume__
 
-#include <Path.h>
-#include <Directory.h>
-#include <BlockCache.h>
+#include "fp_storage.h"
+
+#include <vector>
 
 #include "afpGlobals.h"
 #include "fp_volume.h"
@@ -20,6 +20,47 @@ typedef struct
 	uint32		flags;
 }VolumeStorageData, *PVolumeStorageData;
 
+//
+//The shared volumes. A table is never changed once published, sharing
+//or unsharing a volume publishes a new one. Readers take no lock, they
+//hold an fp_volume_reader for as long as they use the table or a
+//volume found in it. A table or volume dropped from the table is freed
+//in the background once every reader that could have seen it is gone
+//and, for a volume, nothing holds a reference to it. Pending ones are
+//looked at every VOLUME_RECLAIM_INTERVAL (microseconds).
+//
+#define VOLUME_RECLAIM_INTERVAL		(1000000LL)
+
+//
+//Volume IDs go up to here, then the ones no longer in use are handed
+//out again.
+//
+#define VOLUME_MAX_ID				0x7fff
+
+typedef struct
+{
+	std::vector<fp_volume*>	volumes;	//In the order they were shared
+	std::vector<fp_volume*>	byID;		//Indexed by volume ID, NULL where there's none
+}AFP_VOLUME_TABLE;
+
+//
+//Keeps the volume table and the volumes in it from being freed while
+//it exists. Cheap enough to take around every request, and it never
+//blocks anyone.
+//
+class fp_volume_reader
+{
+public:
+						fp_volume_reader();
+						~fp_volume_reader();
+
+private:
+						fp_volume_reader(const fp_volume_reader&) = delete;
+	fp_volume_reader&	operator=(const fp_volume_reader&) = delete;
+
+	int32				mSlot;
+};
+
 
 void 		SaveVolumeData(VolumeStorageData* volData);
 status_t 	GetVolumeData(const char* volName, VolumeStorageData* volData);
@@ -29,7 +70,8 @@ status_t 	ShareAllVolumes();
 fp_volume* 	FindVolume(uint16 volID);
 fp_volume* 	FindVolume(const char* volName);
 fp_volume* 	FindVolume(node_ref nref);
-void 		MarkAllVolumesClean();
+const AFP_VOLUME_TABLE*	VolumeTable();
+void		VolumeDirectoryChanged(dev_t device, ino_t directory);
 status_t 	RemoveVolumeData(const char* volName);
 
 void 		WatchVolume(const char* path);
@@ -2,7 +2,7 @@
 #define _H
 
 
-#include <SupportDefs.h>
+#include "afp_os.h"
 
 uint32 _byteswap_ulong(uint32 i);
 uint16 _byteswap_ushort(uint16 i);
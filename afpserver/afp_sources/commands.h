@@ -15,7 +15,7 @@
 //This is the version of the command protocol for communicating
 //with the server (mainly from the config app).
 //
-#define AFP_CMD_VERSION			0x02020000	//version 2.2
+#define AFP_CMD_VERSION			0x02030000	//version 2.3
 
 //
 //This is the version of the user database. It is tracked only
@@ -112,6 +112,7 @@ enum {
 
 #define AFP_PARAM_STRING_USERNAME			"user-string"
 #define AFP_PARAM_STRING_PASSWORD			"pswd-string"
+#define AFP_PARAM_INT32_RATELIMIT			"rate-int32"	//KB/sec cap on a user's file I/O, 0 for none
 
 //*********************Getting Server Statistics
 #define CMD_AFP_GETBYTESPERSECOND			'gbps'
@@ -119,6 +120,60 @@ enum {
 #define CMD_AFP_GETUSERSLOGGEDIN			'gusr'
 #define CMD_AFP_GETRECVBYTES				'grcv'
 #define CMD_AFP_GETSENTBYTES				'gsnt'
+#define CMD_AFP_GETREADAHEADSTATS			'grah'	//Hit rate (int32 %) and bytes served (int64) from read ahead
+#define CMD_AFP_GETBLOCKCACHESTATS			'gbch'	//Hit rate (int32 %) and memory used (int64) by the block cache
+#define CMD_AFP_GETIOQUEUESTATS				'giqs'	//Average and max (int64 usecs) time data I/O waited in the volume queues
+#define CMD_AFP_GETLOGINSTATS				'glgn'	//Average and max (int64 usecs) time spent in FPLogin, DHX keys ready (int32) and logins that found none (int64)
+
+//*********************Statistics Feed
+//NOTE: Instead of polling the commands above, a client can subscribe
+//		once and have the server push it a CMD_AFP_STATSSNAPSHOT every
+//		interval. Subscribing again changes the interval, 0 unsubscribes.
+//		Clients that go away are dropped the next time a push fails.
+#define CMD_AFP_SUBSCRIBESTATS				'ssub'	//Subscribe(BMessenger target, int32 interval msecs)
+#define CMD_AFP_STATSSNAPSHOT				'ssnp'	//Pushed to subscribers, fields below
+
+#define AFP_PARAM_MESSENGER					"afp-messenger"
+
+#define AFP_STATS_MIN_INTERVAL				250		//msecs
+#define AFP_STATS_MAX_INTERVAL				60000	//msecs
+
+#define AFP_STAT_INT32_BPS					"bps-int32"
+#define AFP_STAT_INT64_SENT					"sent-int64"
+#define AFP_STAT_INT64_RECV					"recv-int64"
+#define AFP_STAT_INT32_DSIPACKETS			"dsi-int32"
+#define AFP_STAT_INT32_USERS				"users-int32"
+#define AFP_STAT_INT32_RAHITRATE			"rahit-int32"
+#define AFP_STAT_INT64_RABYTES				"rabytes-int64"
+#define AFP_STAT_INT32_CACHEHITRATE			"cachehit-int32"
+#define AFP_STAT_INT64_CACHEMEMORY			"cachemem-int64"
+#define AFP_STAT_INT64_IOWAITAVG			"ioavg-int64"
+#define AFP_STAT_INT64_IOWAITMAX			"iomax-int64"
+#define AFP_STAT_INT64_LOGINAVG				"loginavg-int64"
+#define AFP_STAT_INT64_LOGINMAX				"loginmax-int64"
+#define AFP_STAT_INT32_DHXKEYS				"dhxkeys-int32"
+#define AFP_STAT_INT64_DHXMISSES			"dhxmiss-int64"
+
+//
+//One entry per AFP command the server has handled, at the same index
+//in each field.
+//
+#define AFP_STAT_INT32_CMD					"cmd-int32"			//AFP command code
+#define AFP_STAT_INT64_CMDCOUNT				"cmdcount-int64"
+#define AFP_STAT_INT64_CMDAVG				"cmdavg-int64"		//usecs from arrival to reply
+#define AFP_STAT_INT64_CMDMAX				"cmdmax-int64"
+
+//
+//One entry per logged in session, at the same index in each field.
+//
+#define AFP_STAT_STRING_SESSUSER			"sessuser-string"
+#define AFP_STAT_INT64_SESSSENT				"sesssent-int64"
+#define AFP_STAT_INT64_SESSRECV				"sessrecv-int64"
+#define AFP_STAT_INT64_SESSCMDS				"sesscmds-int64"
+#define AFP_STAT_INT32_SESSIDLE				"sessidle-int32"	//Seconds since the client was last heard from
+#define AFP_STAT_INT64_SESSIOWAITAVG		"sessioavg-int64"	//usecs data fork I/O was queued
+#define AFP_STAT_INT64_SESSIOWAITMAX		"sessiomax-int64"
+#define AFP_STAT_INT64_SESSREPLAYMEM		"sessreplay-int64"	//Bytes held for reconnect replays
 
 //*********************Hostname
 //NOTE: This sets the AFP-specific server name that Mac clients will see. It
@@ -126,4 +181,10 @@ enum {
 #define CMD_AFP_GETHOSTNAME					'ghst'	//Returns the current hostname for the afp server
 #define CMD_AFP_SETHOSTNAME					'shst'	//Sets the hostname for the afp server
 
+//*********************Logging
+#define CMD_AFP_GETLOGLEVEL					'glog'	//Returns the current log level (int32, see debug.h)
+#define CMD_AFP_SETLOGLEVEL					'slog'	//Sets the log level (int32), takes effect immediately
+#define CMD_AFP_GETTRACE					'gtrc'	//Returns whether requests are being traced (int32 0 or 1)
+#define CMD_AFP_SETTRACE					'strc'	//Starts (int32 1) or stops (int32 0) tracing requests to afpTrace.0
+
 #endif //__afpcommands__
@@ -1,178 +1,513 @@
-#if DEBUG
+#include "afp_os.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
 
-#include <OS.h>
 #include "debug.h"
 
-const std::string currentDateTime()
+std::atomic<int32>	gAFPDebugLevel(DBG_DEFAULT_LEVEL);
+
+//
+//Each thread that logs gets its own ring of records. The thread is the
+//only writer and the drain thread the only reader, so neither ever
+//waits on the other. When a ring is full the message is dropped and
+//counted rather than holding up the caller.
+//
+#define LOG_RING_SLOTS			128
+#define LOG_MAX_TEXT			256
+
+//
+//How often (in microseconds) the drain thread empties the rings.
+//
+#define LOG_DRAIN_INTERVAL		20000
+
+typedef struct
 {
-    time_t     now = time(0);
-    struct tm  tstruct;
-    char       buf[80];
-    tstruct = *localtime(&now);
-    // Visit http://en.cppreference.com/w/cpp/chrono/c/strftime
-    // for more information about date/time format
-    strftime(buf, sizeof(buf), "%Y-%m-%d.%X", &tstruct);
+	bigtime_t			when;		//real_time_clock_usecs() when it was logged
+	dbg_level			level;
+	const char*			function;	//Always a __func__, so it never goes away
+	int32				length;		//Bytes of raw data for a dump, -1 for text
+	char				text[LOG_MAX_TEXT];
+}AFPLogRecord;
 
-    return buf;
-}
+typedef struct
+{
+	AFPLogRecord		records[LOG_RING_SLOTS];
+	std::atomic<uint32>	head;		//Next slot the owner writes
+	std::atomic<uint32>	tail;		//Next slot the drain thread reads
+	std::atomic<int32>	dropped;
+	std::atomic<bool>	orphaned;	//The owning thread has exited
+	thread_id			owner;
+}AFPLogRing;
 
-void afp_debug_write(const dbg_level debug_level, const std::string& function, const char* format, ...)
+//
+//Marks the thread's ring as orphaned when the thread exits so the
+//drain thread can free it once it's empty.
+//
+class afp_log_ring_owner
 {
-	if (debug_level > current_debug_level)
+public:
+	~afp_log_ring_owner()
 	{
-		return;
+		if (ring != NULL) {
+			ring->orphaned.store(true, std::memory_order_release);
+		}
 	}
 
-	va_list args;
-	va_start(args, format);
-	
-	std::string timestamp = "[" + currentDateTime() + "]";
-
-	std::string level;
-    switch (debug_level)
-    {
-    case dbg_level_error:
-		level = "[ERROR]";
-		break;
-    case dbg_level_warning:
-		level = "[WARNING]";
-		break;
-    case dbg_level_info:
-		level = "[INFO]";
-		break;
-    case dbg_level_trace:
-		level ="[TRACE]";
-		break;
-    case dbg_level_dump_in:
-		level = "[DUMP__IN]";
-        break;
-    case dbg_level_dump_out:
-		level = "[DUMP_OUT]";
-        break;
-    }
-
-	std::string combined;
-
-	if (debug_level != dbg_level_dump_in && debug_level != dbg_level_dump_out)
-	{
-		combined = timestamp + level + "[" + function + "]" + format;
-	}
-	else
+	AFPLogRing*		ring = NULL;
+};
+
+static thread_local afp_log_ring_owner	sThreadRing;
+
+static std::mutex					sRingLock;
+static std::vector<AFPLogRing*>		sRings;
+static std::once_flag				sDrainStarted;
+
+
+/*
+ * LevelName()
+ *
+ * Description:
+ *
+ * Returns: const char*
+ */
+
+static const char* LevelName(const dbg_level debug_level)
+{
+	switch(debug_level)
 	{
-		// Dumping buffer.
-		combined = level + " " + format;
+		case dbg_level_error:		return( "[ERROR]" );
+		case dbg_level_warning:		return( "[WARNING]" );
+		case dbg_level_info:		return( "[INFO]" );
+		case dbg_level_trace:		return( "[TRACE]" );
+		case dbg_level_dump_in:		return( "[DUMP__IN]" );
+		case dbg_level_dump_out:	return( "[DUMP_OUT]" );
+
+		default:
+			break;
 	}
 
-	char buffer[1024];
-	vsprintf(buffer, combined.c_str(), args);
-	
-	printf("%s", buffer);
-	
-	va_end(args);
+	return( "" );
 }
 
-#ifndef __HAIKU_ARCH_X86
-std::string char_to_hex(const char n)
+
+/*
+ * FormatTimestamp()
+ *
+ * Description:
+ *		Local date and time, to the millisecond.
+ *
+ * Returns: none
+ */
+
+static void FormatTimestamp(bigtime_t when, char* buffer, size_t bufferSize)
 {
-    constexpr char hex_chars[16] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
-	std::string result;
+	time_t		seconds = (time_t)(when / 1000000);
+	struct tm	tstruct;
+	char		date[64];
 
-	result.push_back(hex_chars[(n & 0xF0) >> 4]);
-	result.push_back(hex_chars[(n & 0x0F) >> 0]);
+	localtime_r(&seconds, &tstruct);
+	strftime(date, sizeof(date), "%Y-%m-%d.%X", &tstruct);
 
-	return result;
+	snprintf(buffer, bufferSize, "%s.%03d", date, (int)((when % 1000000) / 1000));
 }
 
-void hex_dump(const char* buffer, const size_t length, const dbg_level level)
+
+/*
+ * WriteDump()
+ *
+ * Description:
+ *		Write the raw bytes of a dump record 16 to a line, in hex and
+ *		as text.
+ *
+ * Returns: none
+ */
+
+static void WriteDump(const AFPLogRecord* record)
 {
-	if (level > current_debug_level)
-	{
-		return;
-	}
+	static const char	hex_chars[16] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
 
-	std::string line;
-	std::string readable;
-    uint32_t j = 0;
+	const char*	level = LevelName(record->level);
 
-    for (uint32_t i = 0; i < length; i++)
+	for (int32 offset = 0; offset < record->length; offset += 16)
 	{
-	    if (i % 16 == 0 && j > 0)
-	    {
-			line.append("    ");
+		char	line[128];
+		char*	p		= line;
+		int32	count	= std::min(record->length - offset, (int32)16);
 
-			for (uint32_t k = 0; k < j; k++)
+		for (int32 i = 0; i < 16; i++)
+		{
+			if (i < count)
 			{
-				line.push_back(std::isprint(readable[k]) ? readable[k] : '.');
+				uint8	ch = (uint8)record->text[offset + i];
+
+				*p++ = hex_chars[(ch & 0xF0) >> 4];
+				*p++ = hex_chars[(ch & 0x0F) >> 0];
+				*p++ = ' ';
 			}
+			else
+			{
+				*p++ = ' ';
+				*p++ = ' ';
+				*p++ = ' ';
+			}
+		}
 
-			DBGWRITE(level, "%s\n", line.c_str());
+		memcpy(p, "    ", 4);
+		p += 4;
 
-			line.erase();
-			readable.erase();
+		for (int32 i = 0; i < count; i++)
+		{
+			char	ch = record->text[offset + i];
+
+			*p++ = ((ch > 0) && isprint(ch)) ? ch : '.';
+		}
 
-			j = 0;
-	    }
+		*p = '\0';
 
-		char ch = buffer[i];
-		if (ch < 0)
+		printf("%s %s\n", level, line);
+	}
+}
+
+
+/*
+ * WriteRecord()
+ *
+ * Description:
+ *		Write one record to the console. Dumps keep their old layout
+ *		without a timestamp so consecutive lines still read as a block.
+ *
+ * Returns: none
+ */
+
+static void WriteRecord(const AFPLogRing* ring, const AFPLogRecord* record)
+{
+	char	timestamp[96];
+
+	if (record->length >= 0)
+	{
+		WriteDump(record);
+		return;
+	}
+
+	FormatTimestamp(record->when, timestamp, sizeof(timestamp));
+
+	printf("[%s]%s[%d][%s]%s", timestamp, LevelName(record->level), (int)ring->owner, record->function, record->text);
+}
+
+
+/*
+ * DrainRings()
+ *
+ * Description:
+ *		Write out everything in every ring and free the rings of threads
+ *		that have exited. Only ever called with sRingLock held, which
+ *		keeps us the single reader of each ring.
+ *
+ * Returns: none
+ */
+
+static void DrainRings()
+{
+	std::vector<AFPLogRing*>::iterator	it = sRings.begin();
+
+	while(it != sRings.end())
+	{
+		AFPLogRing*	ring		= *it;
+		bool		orphaned	= ring->orphaned.load(std::memory_order_acquire);
+		uint32		tail		= ring->tail.load(std::memory_order_relaxed);
+		uint32		head		= ring->head.load(std::memory_order_acquire);
+
+		while(tail != head)
 		{
-			ch = 0;
+			WriteRecord(ring, &ring->records[tail % LOG_RING_SLOTS]);
+			tail++;
 		}
 
-        if (std::string part = char_to_hex(ch); part.length() == 1)
+		ring->tail.store(tail, std::memory_order_release);
+
+		int32	dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+
+		if (dropped > 0) {
+			printf("%s[%d] %d log messages dropped\n", LevelName(dbg_level_warning), (int)ring->owner, (int)dropped);
+		}
+
+		if (orphaned)
 		{
-			line.push_back('0');
-			line.append(part);
-			line.push_back(' ');
+			delete ring;
+			it = sRings.erase(it);
 		}
 		else
 		{
-			line.append(part);
-			line.push_back(' ');
+			it++;
 		}
+	}
+
+	fflush(stdout);
+}
+
+
+/*
+ * DrainThread()
+ *
+ * Description:
+ *		Runs for the life of the server writing out what the other
+ *		threads have logged.
+ *
+ * Returns: B_OK
+ */
+
+static int32 DrainThread(void*)
+{
+	while(true)
+	{
+		snooze(LOG_DRAIN_INTERVAL);
+
+		std::lock_guard<std::mutex> lock(sRingLock);
+
+		DrainRings();
+	}
+
+	return( B_OK );
+}
+
 
-		readable.push_back(ch);
-		j++;
+/*
+ * StartDrainThread()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+static void StartDrainThread()
+{
+	thread_id	thread = spawn_thread(DrainThread, "afp_log_drain", B_LOW_PRIORITY, NULL);
+
+	if (thread > 0) {
+		resume_thread(thread);
 	}
+}
+
 
-	if (j != 0)
+/*
+ * ThreadRing()
+ *
+ * Description:
+ *		The calling thread's ring, made the first time the thread logs
+ *		something. Threads that never log never get one.
+ *
+ * Returns: AFPLogRing* or NULL if out of memory
+ */
+
+static AFPLogRing* ThreadRing()
+{
+	if (sThreadRing.ring == NULL)
 	{
-	    for (uint32_t i = j; i <= 15; i++)
-	    {
-			line.append("   ");
-	    }
+		AFPLogRing*	ring = new(std::nothrow) AFPLogRing;
+
+		if (ring == NULL) {
+			return( NULL );
+		}
+
+		ring->head		= 0;
+		ring->tail		= 0;
+		ring->dropped	= 0;
+		ring->orphaned	= false;
+		ring->owner		= find_thread(NULL);
 
-		line.append("    ");
+		std::call_once(sDrainStarted, StartDrainThread);
 
-		for (uint32_t k = 0; k < j; k++)
 		{
-			line.push_back(std::isprint(readable[k]) ? readable[k] : '.');
+			std::lock_guard<std::mutex> lock(sRingLock);
+
+			sRings.push_back(ring);
 		}
 
-		DBGWRITE(level, "%s\n", line.c_str());
+		sThreadRing.ring = ring;
 	}
+
+	return( sThreadRing.ring );
 }
 
-#endif //__HAIKU_ARCH_X86
 
-void dump_bitmap(uint32 dwBitmap, const dbg_level level)
+/*
+ * ReserveRecord()
+ *
+ * Description:
+ *		The next free record in the calling thread's ring. Fill it in
+ *		and hand it over with CommitRecord().
+ *
+ * Returns: AFPLogRecord* or NULL if the ring is full
+ */
+
+static AFPLogRecord* ReserveRecord(AFPLogRing** ring)
 {
-	if (level > current_debug_level)
+	*ring = ThreadRing();
+
+	if (*ring == NULL) {
+		return( NULL );
+	}
+
+	uint32	head = (*ring)->head.load(std::memory_order_relaxed);
+
+	if (head - (*ring)->tail.load(std::memory_order_acquire) >= LOG_RING_SLOTS)
 	{
+		(*ring)->dropped.fetch_add(1, std::memory_order_relaxed);
+		return( NULL );
+	}
+
+	return( &(*ring)->records[head % LOG_RING_SLOTS] );
+}
+
+
+/*
+ * CommitRecord()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+static void CommitRecord(AFPLogRing* ring)
+{
+	ring->head.store(ring->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+
+/*
+ * afp_debug_write()
+ *
+ * Description:
+ *		Format a message into the calling thread's ring. The slow work
+ *		of stamping the date and writing to the console is left to the
+ *		drain thread. Callers go through DBGWRITE which has already
+ *		checked the level.
+ *
+ * Returns: none
+ */
+
+void afp_debug_write(const dbg_level debug_level, const char* function, const char* format, ...)
+{
+	AFPLogRing*		ring	= NULL;
+	AFPLogRecord*	record	= ReserveRecord(&ring);
+
+	if (record == NULL) {
 		return;
 	}
 
+	va_list args;
+	va_start(args, format);
+
+	vsnprintf(record->text, sizeof(record->text), format, args);
+
+	va_end(args);
+
+	record->when		= real_time_clock_usecs();
+	record->level		= debug_level;
+	record->function	= function;
+	record->length		= -1;
+
+	CommitRecord(ring);
+}
+
+
+/*
+ * afp_debug_set_level()
+ *
+ * Description:
+ *		Change what gets logged from here on.
+ *
+ * Returns: none
+ */
+
+void afp_debug_set_level(const dbg_level debug_level)
+{
+	gAFPDebugLevel.store(debug_level, std::memory_order_relaxed);
+}
+
+
+/*
+ * afp_debug_flush()
+ *
+ * Description:
+ *		Write out everything logged so far without waiting for the
+ *		drain thread. Called on the way out so nothing is lost.
+ *
+ * Returns: none
+ */
+
+void afp_debug_flush()
+{
+	std::lock_guard<std::mutex> lock(sRingLock);
+
+	DrainRings();
+}
+
+
+/*
+ * hex_dump()
+ *
+ * Description:
+ *		Copy raw bytes into the ring. Turning them into hex is done by
+ *		the drain thread, so dumping a packet in Send() costs a copy.
+ *
+ * Returns: none
+ */
+
+void hex_dump(const char* buffer, const size_t length, const dbg_level level)
+{
+	for (size_t offset = 0; offset < length; offset += LOG_MAX_TEXT)
+	{
+		AFPLogRing*		ring	= NULL;
+		AFPLogRecord*	record	= ReserveRecord(&ring);
+
+		if (record == NULL) {
+			return;
+		}
+
+		record->length		= (int32)std::min(length - offset, (size_t)LOG_MAX_TEXT);
+		record->when		= real_time_clock_usecs();
+		record->level		= level;
+		record->function	= __func__;
+
+		memcpy(record->text, buffer + offset, record->length);
+
+		CommitRecord(ring);
+	}
+}
+
+
+/*
+ * dump_bitmap()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+void dump_bitmap(uint32 dwBitmap, const dbg_level level)
+{
 	uint32	bit = 0x01;
 	int16	x;
 	char	buffer[128];
-	
-	printf("Bitmap dump:\n\n");
-	printf("0         10        20        30\n");
-	
-	printf("01234567890123456789012345678901\n");
-	
+	char	line[128];
+
+	afp_debug_write(level, __func__, "Bitmap dump:\n\n");
+	afp_debug_write(level, __func__, "0         10        20        30\n");
+	afp_debug_write(level, __func__, "01234567890123456789012345678901\n");
+
 	memset(buffer, 0, sizeof(buffer));
-	
+
 	for(x = 1; x <= 32; x++, bit += bit)
 	{
 		if (dwBitmap & bit) {
@@ -183,19 +518,20 @@ void dump_bitmap(uint32 dwBitmap, const dbg_level level)
 		}
 	}
 
-	strcat(buffer, "\n");
-	printf(buffer);
-	
+	afp_debug_write(level, __func__, "%s\n", buffer);
+
 	bit = 0x01;
-	
+	line[0] = '\0';
+
 	for(x = 1; x <= 32; x++, bit += bit)
 	{
-		printf("%#-10x = %d\t", (int)bit, ((dwBitmap & bit)?1:0));
-		if (x % 3 == 0)
+		snprintf(buffer, sizeof(buffer), "%#-10x = %d\t", (int)bit, ((dwBitmap & bit)?1:0));
+		strcat(line, buffer);
+
+		if ((x % 3 == 0) || (x == 32))
 		{
-			printf("\n");
+			afp_debug_write(level, __func__, "%s\n", line);
+			line[0] = '\0';
 		}
 	}
 }
-
-#endif //DEBUG
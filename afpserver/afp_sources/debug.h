@@ -1,14 +1,15 @@
 #ifndef __debug__
 #define __debug__
 
-#if DEBUG
+#include "afp_os.h"
 
-#include <string>
+#include <atomic>
 
 typedef int dbg_level;
 enum
 {
-	dbg_level_error = 1,
+	dbg_level_none = 0,	// nothing is logged
+	dbg_level_error,
 	dbg_level_warning,
 	dbg_level_info,
 	dbg_level_trace,
@@ -16,26 +17,48 @@ enum
 	dbg_level_dump_out  // outgoing data
 };
 
-const dbg_level current_debug_level = dbg_level_trace;
+//
+//The level we log at when we start up. It can be changed while we run
+//with CMD_AFP_SETLOGLEVEL, so tracing can be turned on in the field
+//without a debug build.
+//
+#if DEBUG
+#define DBG_DEFAULT_LEVEL		dbg_level_trace
+#else
+#define DBG_DEFAULT_LEVEL		dbg_level_none
+#endif
 
-#define DBGWRITE(level, message, ...) afp_debug_write(level, __func__, message, ##__VA_ARGS__)
-void afp_debug_write(const dbg_level debug_level, const std::string& function, const char* format, ...);
+extern std::atomic<int32>	gAFPDebugLevel;
 
-void dump_bitmap(int32_t bitmap, const dbg_level level);
-#define DBG_DUMP_BITMAP(bm, level) dump_bitmap(bm, level);
+//
+//A message above the current level costs a load and one branch the
+//compiler is told won't be taken. Its arguments are never evaluated.
+//
+#define DBG_LEVEL_ENABLED(level)	__builtin_expect((level) <= gAFPDebugLevel.load(std::memory_order_relaxed), 0)
 
-#ifndef __HAIKU_ARCH_X86
-void hex_dump(const char* buffer, const size_t length, const dbg_level level);
-#define DBG_DUMP_BUFFER(buffer, cb_buffer, level) hex_dump(buffer, cb_buffer, level)
-#endif //__HAIKU_ARCH_X86
+#define DBGWRITE(level, message, ...)											\
+			do {																\
+				if (DBG_LEVEL_ENABLED(level))									\
+					afp_debug_write(level, __func__, message, ##__VA_ARGS__);	\
+			} while(0)
 
-#else //DEBUG
+#define DBG_DUMP_BITMAP(bm, level)												\
+			do {																\
+				if (DBG_LEVEL_ENABLED(level))									\
+					dump_bitmap(bm, level);										\
+			} while(0)
 
-#define DBGWRITE(level, message, ...)
-#define DBG_DUMP_BITMAP(bm, level)
-#define DBG_DUMP_BUFFER(buffer, cb_buffer, level)
+#define DBG_DUMP_BUFFER(buffer, cb_buffer, level)								\
+			do {																\
+				if (DBG_LEVEL_ENABLED(level))									\
+					hex_dump(buffer, cb_buffer, level);							\
+			} while(0)
 
-#endif
+void afp_debug_write(const dbg_level debug_level, const char* function, const char* format, ...);
+void afp_debug_set_level(const dbg_level debug_level);
+void afp_debug_flush();
 
-#endif //__debug__
+void dump_bitmap(uint32 bitmap, const dbg_level level);
+void hex_dump(const char* buffer, const size_t length, const dbg_level level);
 
+#endif //__debug__
@@ -1,21 +1,26 @@
 #include <stdio.h>
 #include <errno.h>
 #include <memory>
+#include <algorithm>
 
-#include <OS.h>
+#include "afp_os.h"
 #include <sys/socket.h>
 #include <sys/select.h>
 #include <netinet/in.h>
 #include <netdb.h>
-#include <Autolock.h>
+#include <unistd.h>
 
 #include "debug.h"
 #include "dsi_connection.h"
 #include "afp_buffer.h"
 #include "dsi_scavenger.h"
 #include "dsi_stats.h"
+#include "dsi_trace.h"
+#include "afpread.h"
+#include "fp_iosched.h"
 #include "afpreplay.h"
 #include "afpdesk.h"
+#include "afpvolume.h"
 
 extern dsi_scavenger*	gAFPSessionMgr;
 extern dsi_stats		gAFPStats;
@@ -41,7 +46,18 @@ dsi_connection::dsi_connection(int socket, thread_id th_id)
 	mBytesInReceiveBuffer	= 0;
 	mAttentionQuantumSize	= 0;
 	mContinueRecv			= true;
-	mReplayCache			= std::make_unique<BList>(AFP_REPLAY_CACHE_SIZE);
+	mReplayCache			= std::make_unique<afp_replay_cache>();
+	mExpectedDSIClientRequestID	= 0;
+	mExpectedAFPCommand		= 0;
+	mRequestDataLength		= 0;
+	mTraceStart				= 0;
+	mTraceArrival			= 0;
+	mTraceRequestID			= 0;
+	mRequestStart			= 0;
+	mBytesSent				= 0;
+	mBytesRecv				= 0;
+	mCommandCount			= 0;
+	mStreaming				= false;
 
 	gAFPSessionMgr->TrackConnection(this);
 }
@@ -67,8 +83,6 @@ dsi_connection::~dsi_connection()
 
 	shutdown(mSocket, SHUT_RDWR);
 
-	AFPReplayEmptyCache(mReplayCache.get());
-
 	DBGWRITE(dbg_level_trace, "Delete completed\n");
 }
 
@@ -91,6 +105,37 @@ void dsi_connection::Send(
 	//Can only send one at a time.
 	std::lock_guard<std::mutex> guard(mSendMutex);
 
+	//
+	//A streamed reply is going out in pieces, anything sent from
+	//another thread goes after it rather than into the middle.
+	//
+	if (mStreaming)
+	{
+		if (sendBuffer != NULL) {
+			mDeferredSends.emplace_back(sendBuffer, sendBuffer + sendBufferSize);
+		}
+
+		return;
+	}
+
+	SendLocked(sendBuffer, sendBufferSize);
+}
+
+
+/*
+ * SendLocked()
+ *
+ * Description:
+ *		Does the work for Send(). The caller holds mSendMutex.
+ *
+ * Returns: false if the send failed and the session is going away
+ */
+
+bool dsi_connection::SendLocked(
+		int8*		sendBuffer,
+		int32		sendBufferSize
+		)
+{
 	uint32	offset 		= 0;
 	int32	bytesSent	= 0;
 	int32	bufferSize 	= sendBufferSize;
@@ -101,7 +146,7 @@ void dsi_connection::Send(
 		//Error: the caller send us a null pointer, bail out now.
 		//
 
-		return;
+		return( false );
 	}
 
 	mSession->SetLastTickleSent();
@@ -144,12 +189,17 @@ void dsi_connection::Send(
 	{
 		DBGWRITE(dbg_level_error, "send() failed! (%s)\n", GET_BERR_STR(errno));
 		KillSession();
+
+		return( false );
 	}
 
 	//
 	//Keep stats for how many bytes the server has sent.
 	//
 	gAFPStats.Net_UpdateBytesSent(bytesSent + offset);
+	mBytesSent.fetch_add(bytesSent + offset, std::memory_order_relaxed);
+
+	return( true );
 }
 
 
@@ -292,6 +342,7 @@ void dsi_connection::Receive()
 		//Keep stats of how many bytes we've received.
 		//
 		gAFPStats.Net_UpdateBytesReceived(bytesReceived);
+		mBytesRecv.fetch_add(bytesReceived, std::memory_order_relaxed);
 
 		bytesReceiveInBuffer += bytesReceived;
 
@@ -400,11 +451,34 @@ void dsi_connection::ProcessReceivedBytes()
 
 	if (dsiFlags == DSI_REQUEST_FLAG)
 	{
+		//
+		//Volumes found while handling the request can't be freed
+		//before we are done with it, however long that takes.
+		//
+		fp_volume_reader	volumeReader;
+
 		//
 		//We save the expected request ID in a member variable since we'll need it
 		//later for storing the reply in the replay cache.
 		//
 		mExpectedDSIClientRequestID = mSession->GetNextClientRequestID(dsiRequestID);
+		mExpectedAFPCommand			= (int8)mReceiveBuffer[DSI_OFFSET_DATASTART];
+		mRequestDataLength			= dsiDataLength;
+		mRequestStart				= system_time();
+
+		//
+		//Only requests that arrive while tracing is on are traced. Clear
+		//the start left by one whose reply went out after tracing was
+		//turned off, so it isn't taken for this one's.
+		//
+		mTraceStart = 0;
+
+		if (gAFPTrace.IsOn())
+		{
+			mTraceStart		= mRequestStart;
+			mTraceArrival	= real_time_clock_usecs();
+			mTraceRequestID	= dsiRequestID;
+		}
 
 		if (mExpectedDSIClientRequestID != dsiRequestID)
 		{
@@ -414,30 +488,52 @@ void dsi_connection::ProcessReceivedBytes()
 			//
 			if (afpVers >= afpVersion33)
 			{
-				AFPReplayCacheItem* rci = NULL;
+				const AFP_REPLAY_ENTRY* rce = NULL;
 
-				rci = AFPReplaySearchForReply(
+				rce = mReplayCache->Find(
 									dsiRequestID,
-									(int8)mReceiveBuffer[DSI_OFFSET_DATASTART],
-									mReplayCache.get()
+									(int8)mReceiveBuffer[DSI_OFFSET_DATASTART]
 									);
 
-				if (rci != NULL)
+				if (rce != NULL)
 				{
+					std::unique_ptr<int8[]>	replay_buffer = std::make_unique<int8[]>(SEND_BUFFER_SIZE);
+					int32					replaySize	= 0;
+					AFPERROR				replayError	= rce->afpError;
+
 					//
 					//We found an item in the cache, now we just resend this reply
 					//to the client and exit.
 					//
 					DBGWRITE(dbg_level_trace, "Matching reply found in the replay cache!!!\n");
 
+					if (rce->isRead)
+					{
+						//
+						//Reads aren't copied into the cache, perform the read
+						//again from the saved request.
+						//
+						replayError = FPRead(
+										mSession.get(),
+										mReplayCache->GetData(rce),
+										&replay_buffer[DSI_OFFSET_DATASTART],
+										&replaySize
+										);
+					}
+					else
+					{
+						memcpy(&replay_buffer[DSI_OFFSET_DATASTART], mReplayCache->GetData(rce), rce->length);
+						replaySize = rce->length;
+					}
+
 					//
 					//NOTE: new DSI header information will be written to the beginning of the buffer.
 					//
 					FormatAndSendReply(
-							rci->reply,
-							dsiCommand,
-							AFP_OK,
-							rci->replySize - DSI_HEADER_SIZE,
+							replay_buffer.get(),
+							rce->dsiCommand,
+							replayError,
+							replaySize,
 							true
 							);
 				}
@@ -532,8 +628,11 @@ void dsi_connection::ProcessReceivedBytes()
 					//routine for this high performance function.
 					//
 
-					case afpRead:
 					case afpReadExt:
+						dsi_StreamRead(reply_buffer.get());
+						break;
+
+					case afpRead:
 						afpError = FPRead(
 										mSession.get(),
 										&mReceiveBuffer[DSI_OFFSET_DATASTART],
@@ -545,6 +644,20 @@ void dsi_connection::ProcessReceivedBytes()
 						break;
 
 					default:
+					{
+						//
+						//Let the volume's I/O scheduler know the Finder is
+						//waiting on this one so bulk data on it backs off.
+						//
+						fp_iosched*	metadata = fp_iosched::ForMetadataCommand(
+													mSession.get(),
+													&mReceiveBuffer[DSI_OFFSET_DATASTART]
+													);
+
+						if (metadata != NULL) {
+							metadata->BeginMetadata();
+						}
+
 						afpError = FPDispatchCommand(
 										mSession.get(),
 										&mReceiveBuffer[DSI_OFFSET_DATASTART],
@@ -552,6 +665,10 @@ void dsi_connection::ProcessReceivedBytes()
 										&afpDataSize
 										);
 
+						if (metadata != NULL) {
+							metadata->EndMetadata();
+						}
+
 						FormatAndSendReply(reply_buffer.get(), dsiCommand, afpError, afpDataSize);
 
 						if ((!mSession->IsAuthenticated()) && (afpError != afpAuthContinue))
@@ -560,6 +677,7 @@ void dsi_connection::ProcessReceivedBytes()
 							KillSession();
 						}
 						break;
+					}
 				}
 				break;
 
@@ -704,21 +822,276 @@ void dsi_connection::FormatAndSendReply(
 			afpDataSize
 			);
 
-	//Add this reply to the replay cache for AFP3.3
-	if ((!fromCache) && (mSession->GetAFPVersion() >= afpVersion33) &&
-		((dsiCommand == DSI_CMD_Command) || (dsiCommand == DSI_CMD_Write)))
-	{
-		AFPReplayAddReply(
-				mExpectedDSIClientRequestID,
-				replyBuffer,
-				DSI_HEADER_SIZE+afpDataSize,
-				mReplayCache.get()
-				);
+	if (!fromCache) {
+		CacheReply(replyBuffer, dsiCommand, afpError, afpDataSize);
 	}
 
 	//DBG_DUMP_BUFFER((char*)replyBuffer, DSI_HEADER_SIZE+afpDataSize, dbg_level_trace);
 
 	Send(replyBuffer, DSI_HEADER_SIZE+afpDataSize);
+
+	RecordReply(dsiCommand);
+
+	if (gAFPTrace.IsOn()) {
+		TraceReply(dsiCommand, afpError, afpDataSize);
+	}
+}
+
+
+/*
+ * CacheReply()
+ *
+ * Description:
+ *		Add this reply to the replay cache for AFP3.3 and later. Read
+ *		replies aren't copied, only the request is kept so the read can
+ *		be done again.
+ *
+ * Returns: None
+ */
+
+void dsi_connection::CacheReply(
+	int8* 	replyBuffer,
+	int8 	dsiCommand,
+	int32 	afpError,
+	int32	afpDataSize
+	)
+{
+	if ((mSession->GetAFPVersion() >= afpVersion33) &&
+		((dsiCommand == DSI_CMD_Command) || (dsiCommand == DSI_CMD_Write)))
+	{
+		if (	(dsiCommand == DSI_CMD_Command) &&
+				(((uint8)mExpectedAFPCommand == afpRead) || ((uint8)mExpectedAFPCommand == afpReadExt))	)
+		{
+			//
+			//The request is still in the receive buffer at this point.
+			//
+			mReplayCache->AddReadRequest(
+					mExpectedDSIClientRequestID,
+					dsiCommand,
+					mExpectedAFPCommand,
+					&mReceiveBuffer[DSI_OFFSET_DATASTART],
+					std::min(mRequestDataLength, (int32)AFP_MAX_CMD_SIZE)
+					);
+		}
+		else
+		{
+			mReplayCache->AddReply(
+					mExpectedDSIClientRequestID,
+					dsiCommand,
+					mExpectedAFPCommand,
+					afpError,
+					&replyBuffer[DSI_OFFSET_DATASTART],
+					afpDataSize
+					);
+		}
+	}
+}
+
+
+/*
+ * TraceReply()
+ *
+ * Description:
+ *		Add the request we just replied to to the trace. Requests that
+ *		arrived before tracing was turned on are skipped.
+ *
+ * Returns: None
+ */
+
+void dsi_connection::TraceReply(
+	int8 	dsiCommand,
+	int32 	afpError,
+	int32	afpDataSize
+	)
+{
+	AFP_TRACE_RECORD	record;
+
+	if (mTraceStart == 0) {
+		return;
+	}
+
+	record.timestamp	= mTraceArrival;
+	record.session		= (uint32)mThreadId;
+	record.serviceTime	= (uint32)(system_time() - mTraceStart);
+	record.requestBytes	= (uint32)mRequestDataLength;
+	record.replyBytes	= (uint32)afpDataSize;
+	record.afpError		= afpError;
+	record.requestID	= mTraceRequestID;
+	record.dsiCommand	= dsiCommand;
+	record.afpCommand	= ((dsiCommand == DSI_CMD_Command) || (dsiCommand == DSI_CMD_Write)) ? (uint8)mExpectedAFPCommand : 0;
+
+	gAFPTrace.Record(record);
+
+	mTraceStart = 0;
+}
+
+
+/*
+ * RecordReply()
+ *
+ * Description:
+ *		Count the AFP command we just replied to and how long it
+ *		took, for the stats feed.
+ *
+ * Returns: None
+ */
+
+void dsi_connection::RecordReply(int8 dsiCommand)
+{
+	if (mRequestStart == 0) {
+		return;
+	}
+
+	if ((dsiCommand == DSI_CMD_Command) || (dsiCommand == DSI_CMD_Write))
+	{
+		gAFPStats.Cmd_Record((uint8)mExpectedAFPCommand, system_time() - mRequestStart);
+		mCommandCount.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	mRequestStart = 0;
+}
+
+
+/*
+ * dsi_StreamRead()
+ *
+ * Description:
+ *		An FPReadExt for more than fits in one reply buffer is sent as
+ *		a single DSI reply whose payload goes out in several socket
+ *		writes, one buffer's worth at a time. Each piece is read before
+ *		the send lock is taken, so the disk and the I/O scheduler never
+ *		hold up tickles and attentions from other threads. Those are
+ *		held back until the reply is complete instead.
+ *
+ *		Requests with a problem, or small enough for one buffer, get
+ *		the normal FPRead() reply.
+ *
+ * Returns: None
+ */
+
+void dsi_connection::dsi_StreamRead(int8* replyBuffer)
+{
+	int8*			dataStart	= &replyBuffer[DSI_OFFSET_DATASTART];
+	size_t			segmentSize	= SEND_BUFFER_SIZE - DSI_HEADER_SIZE;
+	size_t			sent		= 0;
+	off_t			afpOffset	= 0;
+	off_t			afpForkLen	= 0;
+	size_t			afpReqCount	= 0;
+	size_t			streamCount	= 0;
+	int32			afpDataSize	= 0;
+	OPEN_FORK_ITEM*	forkItem	= NULL;
+	AFPERROR		afpError	= AFP_OK;
+
+	afpError = FPReadCheck(
+					mSession.get(),
+					&mReceiveBuffer[DSI_OFFSET_DATASTART],
+					DSI_MAX_STREAMED_READ,
+					&afpForkLen,
+					&forkItem,
+					&afpOffset,
+					&afpReqCount
+					);
+
+	if (AFP_SUCCESS(afpError)) {
+		streamCount = (afpOffset < afpForkLen) ? std::min(afpReqCount, (size_t)(afpForkLen - afpOffset)) : 0;
+	}
+
+	if ((AFP_FAILURE(afpError)) || (streamCount <= segmentSize))
+	{
+		if (AFP_SUCCESS(afpError)) {
+			afpError = FPReadReply(mSession.get(), forkItem, afpOffset, afpReqCount, dataStart, &afpDataSize);
+		}
+
+		FormatAndSendReply(replyBuffer, DSI_CMD_Command, afpError, afpDataSize);
+		return;
+	}
+
+	DBGWRITE(dbg_level_trace, "Streaming %lu bytes from %lld offset\n", streamCount, afpOffset);
+
+	{
+		std::lock_guard<std::mutex> guard(mSendMutex);
+
+		mStreaming = true;
+	}
+
+	PrepareDSIHeaderForReply(replyBuffer, DSI_CMD_Command, AFP_OK, streamCount);
+	CacheReply(replyBuffer, DSI_CMD_Command, AFP_OK, 0);
+
+	while(sent < streamCount)
+	{
+		size_t	count	= std::min(segmentSize, streamCount - sent);
+		ssize_t	actual	= FPReadFork(mSession.get(), forkItem, afpOffset + sent, dataStart, count);
+		bool	ok		= false;
+
+		if (actual != (ssize_t)count)
+		{
+			//
+			//The client has already been told how much is coming. If
+			//the fork shrank or the read failed there is no way to
+			//report it, the only thing left is to drop the connection.
+			//
+			DBGWRITE(dbg_level_error, "Short read while streaming (%ld of %lu)!\n", actual, count);
+			KillSession();
+			break;
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(mSendMutex);
+
+			//
+			//The first piece goes out with the DSI header in front of it.
+			//
+			ok = (sent == 0) ?
+					SendLocked(replyBuffer, DSI_HEADER_SIZE + count) :
+					SendLocked(dataStart, count);
+		}
+
+		if (!ok) {
+			break;
+		}
+
+		sent += count;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(mSendMutex);
+
+		mStreaming = false;
+
+		//
+		//After a short stream the connection is going away and the
+		//client won't make sense of anything more.
+		//
+		if (sent == streamCount)
+		{
+			for (std::vector<int8>& deferred : mDeferredSends) {
+				SendLocked(deferred.data(), (int32)deferred.size());
+			}
+		}
+
+		mDeferredSends.clear();
+	}
+
+	RecordReply(DSI_CMD_Command);
+
+	if (gAFPTrace.IsOn()) {
+		TraceReply(DSI_CMD_Command, (sent == streamCount) ? AFP_OK : afpMiscErr, (int32)sent);
+	}
+}
+
+
+/*
+ * GetReplayCacheMemoryUsage()
+ *
+ * Description:
+ *		Memory held by this connection's replay cache.
+ *
+ * Returns: size_t
+ */
+
+size_t dsi_connection::GetReplayCacheMemoryUsage()
+{
+	return( mReplayCache->GetMemoryUsage() );
 }
 
 
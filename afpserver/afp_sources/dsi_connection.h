@@ -1,14 +1,16 @@
 #ifndef __BAFPConnection__
 #define __BAFPConnection__
 
+#include <atomic>
 #include <mutex>
 #include <memory>
-#include <Looper.h>
-#include <BlockCache.h>
+#include <vector>
 
 #include "afp.h"
 #include "afp_session.h"
 
+class afp_replay_cache;
+
 //
 //This is the largest request that the server can receive
 //from the client. It does not include the DSI header size
@@ -18,6 +20,12 @@
 
 #define RECV_BUFFER_SIZE		(UINT16_MAX) 
 #define SEND_BUFFER_SIZE		(UINT16_MAX)
+
+//
+//Largest FPReadExt reply we'll stream back in one DSI reply. The
+//payload goes out SEND_BUFFER_SIZE at a time so this is not memory.
+//
+#define DSI_MAX_STREAMED_READ	(8 * 1024 * 1024)
 #define OVERFLOW_BUFFER_SIZE	4096
 
 //
@@ -125,15 +133,60 @@ public:
 								int8* 	afpReplyBuffer,
 								int32*	afpDataSize
 								);
+	virtual void			dsi_StreamRead(int8* replyBuffer);
 	
 	virtual afp_session*	GetAFPSessionObject()		{return mSession.get();}
 	virtual int32			GetAttnQuantumSize()		{return mAttentionQuantumSize;}
+	virtual size_t			GetReplayCacheMemoryUsage();
+	virtual int32			GetRequestDataLength()		{return mRequestDataLength;}
+	
+	//
+	//Traffic on this connection, read by the stats feed thread.
+	//
+	virtual int64			BytesSent()		{ return mBytesSent.load(std::memory_order_relaxed); }
+	virtual int64			BytesRecv()		{ return mBytesRecv.load(std::memory_order_relaxed); }
+	virtual int64			CommandCount()	{ return mCommandCount.load(std::memory_order_relaxed); }
 		
 private:
 	
+	bool					SendLocked(
+								int8*		sendBuffer,
+								int32		sendBufferSize
+								);
+	void					CacheReply(
+								int8* 			replyBuffer,
+								int8 			dsiCommand,
+								int32 			afpError,
+								int32			afpDataSize
+								);
+	void					TraceReply(
+								int8 			dsiCommand,
+								int32 			afpError,
+								int32			afpDataSize
+								);
+	void					RecordReply(int8 dsiCommand);
+	
 	int mSocket;
 	thread_id mThreadId;
 	int16 mExpectedDSIClientRequestID;
+	int8 mExpectedAFPCommand;
+	int32 mRequestDataLength;
+	
+	//
+	//When the request being handled arrived, only kept while tracing.
+	//
+	bigtime_t mTraceStart;
+	bigtime_t mTraceArrival;
+	uint16 mTraceRequestID;
+	
+	//
+	//When the request being handled arrived, for the per command stats.
+	//
+	bigtime_t mRequestStart;
+	
+	std::atomic<int64> mBytesSent;
+	std::atomic<int64> mBytesRecv;
+	std::atomic<int64> mCommandCount;
 	
 	//
 	//This is the AFP session associated with this network connection.
@@ -154,14 +207,21 @@ private:
 	bool mContinueRecv;
 	
 	//
-	//This BList serves as the replay cache for AFP3.3 and later connections
+	//The replay cache for AFP3.3 and later connections
 	//
-	std::unique_ptr<BList> mReplayCache;
+	std::unique_ptr<afp_replay_cache> mReplayCache;
 	
 	//
 	//Only one send at a time...
 	//
 	std::mutex mSendMutex;
+	
+	//
+	//While a streamed reply is going out, whatever other threads send
+	//waits here until it is done. Both are protected by mSendMutex.
+	//
+	bool mStreaming;
+	std::vector<std::vector<int8>> mDeferredSends;
 };
 
 status_t ServerConnection(void* data);
@@ -1,4 +1,4 @@
-#include <OS.h>
+#include "afp_os.h"
 #include <stdio.h>
 #include <strings.h>
 
@@ -8,6 +8,8 @@
 #include "dsi_network.h"
 #include "dsi_connection.h"
 #include "dsi_scavenger.h"
+#include "afpdhxpool.h"
+#include "afpsrvrinfo.h"
 
 bool 			gServerRunning	= true;
 dsi_scavenger*	gAFPSessionMgr 	= NULL;
@@ -37,6 +39,16 @@ void afpInitializeServerNetworking()
 	//for a delay in the first logon to the server.
 	//
 	afp_GetHostname(NULL, 0);
+	
+	//
+	//Pack the server info reply now rather than on the first probe.
+	//
+	gAFPSrvrInfo.Update();
+	
+	//
+	//Have DHX keys ready before the first encrypted login.
+	//
+	gAFPDHXPool.Start();
 		
 	newID = spawn_thread(
 				afpSrvrConnectThread,
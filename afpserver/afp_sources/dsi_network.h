@@ -4,7 +4,9 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#ifdef __HAIKU__
 #include <net_settings.h>
+#endif
 
 #include "afpGlobals.h"
 #include "afp.h"
@@ -1,11 +1,25 @@
-#include "afpvolume.h"
+#include <algorithm>
+
 #include "debug.h"
+#include "commands.h"
 #include "dsi_scavenger.h"
-#include "fp_volume.h"
+#include "fp_dirwatch.h"
 
 
-extern std::mutex volume_blist_mutex;
-extern std::unique_ptr<BList> volume_blist;
+/*
+ * ClientIDKey()
+ *
+ * Description:
+ *		Client IDs are opaque bytes, the index keys them as strings.
+ *
+ * Returns: std::string
+ */
+
+static std::string ClientIDKey(int32 idSize, const int8* id)
+{
+	return( std::string((const char*)id, idSize) );
+}
+
 
 /*
  * dsi_scavenger()
@@ -20,7 +34,8 @@ dsi_scavenger::dsi_scavenger()
 {
 	thread_id	newID;
 	
-	mOpenConnections = new BList();
+	mOpenConnections	= new BList();
+	mWheel				= new dsi_timerwheel(WheelTime());
 	
 	newID = spawn_thread(
 				dsi_scavenger::ScavengerThread,
@@ -48,6 +63,8 @@ dsi_scavenger::~dsi_scavenger()
 	
 		delete mOpenConnections;
 	}
+	
+	delete mWheel;
 }
 
 
@@ -55,7 +72,8 @@ dsi_scavenger::~dsi_scavenger()
  * TrackConnection()
  *
  * Description:
- *		Destructor
+ *		Start keeping an eye on a new connection. Its first check is
+ *		due when it would first need a tickle.
  *
  * Returns:
  */
@@ -67,6 +85,9 @@ void dsi_scavenger::TrackConnection(dsi_connection* connection)
 	if (connection != NULL) {
 	
 		mOpenConnections->AddItem(connection);
+		mWheel->Schedule(connection, WheelTime() + SEND_TICKLE_INTERVAL);
+		
+		mByToken[connection->GetAFPSessionObject()->GetToken()] = connection;
 	}
 }
 
@@ -75,18 +96,45 @@ void dsi_scavenger::TrackConnection(dsi_connection* connection)
  * StopTracking()
  *
  * Description:
- *		Destructor
+ *		The connection is going away. If we're in the middle of sending
+ *		to it we wait for that to finish first.
  *
  * Returns:
  */
 
 void dsi_scavenger::StopTracking(dsi_connection* connection)
 {
-	std::lock_guard<std::mutex> guard(mMutex);
+	std::unique_lock<std::mutex> lock(mMutex);
 	
 	if (connection != NULL) {
 	
+		afp_session*	session	= connection->GetAFPSessionObject();
+		int32			idSize	= 0;
+		int8*			id		= NULL;
+		
 		mOpenConnections->RemoveItem(connection);
+		mWheel->Cancel(connection);
+		
+		mByToken.erase(session->GetToken());
+		
+		//
+		//A session that reconnected may have taken the ID over, it
+		//stays with the new one.
+		//
+		session->GetClientID(&idSize, &id);
+		
+		if (id != NULL)
+		{
+			auto	found = mByClientID.find(ClientIDKey(idSize, id));
+			
+			if ((found != mByClientID.end()) && (found->second == connection)) {
+				mByClientID.erase(found);
+			}
+		}
+		
+		mVisitDone.wait(lock, [&]() {
+			return( std::find(mVisiting.begin(), mVisiting.end(), connection) == mVisiting.end() );
+		});
 	}
 }
 
@@ -96,9 +144,12 @@ void dsi_scavenger::StopTracking(dsi_connection* connection)
  *
  * Description:
  *		This thread performs 2 functions. It is both a scavanger, looking
- *		for orphaned sessions and a thread that notifies when a volume's
- *		contents has changed and notifies the clients who have the volume
- *		mounted.
+ *		for orphaned sessions and a thread that notifies clients when a
+ *		directory they are looking at has changed.
+ *
+ *		Sessions sit on a timer wheel so each tick we only look at the
+ *		ones that are due, and the network sends happen without the
+ *		connection list locked.
  *
  * Returns: None
  */
@@ -106,103 +157,244 @@ void dsi_scavenger::StopTracking(dsi_connection* connection)
 int32 dsi_scavenger::ScavengerThread(void* data)
 {
 	dsi_scavenger*		manager 		= (dsi_scavenger*)data;
-	dsi_connection*		connection		= NULL;
-	afp_session*		session			= NULL;
-	fp_volume*			volume			= NULL;
-	int32				recvInterval	= 0;
-	int32				sentInterval	= 0;
-	int32				now				= 0;
-	int32				i, j;
 	
 	while(true)
 	{
-		snooze(SEND_TICKLE_INTERVAL*1000000);
+		std::vector<void*>	due;
 		
-		std::lock_guard<std::mutex> guard(manager->mMutex);
+		snooze(SCAVENGER_TICK_INTERVAL*1000000);
 		
-		now = real_time_clock();
-		i	= 0;
+		{
+			std::lock_guard<std::mutex> guard(manager->mMutex);
+			
+			manager->mWheel->Advance(WheelTime(), due);
+		}
 		
-		while((connection = (dsi_connection*)manager->mOpenConnections->ItemAt(i++)) != NULL)
+		for (void* item : due)
 		{
-			session = connection->GetAFPSessionObject();
+			dsi_connection*	connection = (dsi_connection*)item;
 			
-			if (session != NULL)
-			{
-				//
-				//If we haven't sent any packets to the client for a while,
-				//we'll want to "tickle" him so he doesn't things we've
-				//forgoten all about him.
-				//
-				sentInterval = (now - session->GetLastTickleSent());
-				
-				if ((sentInterval > SEND_TICKLE_INTERVAL) && (!session->ClientIsSleeping()))
-				{
-					connection->SendTickle();
-				}
+			if (manager->BeginVisit(connection)) {
+			
+				manager->EndVisit(connection, manager->CheckConnection(connection));
+			}
+		}
+		
+		//
+		//See if there are directory changes that need to be reported
+		//to clients via the attention mechanism.
+		//
+		manager->SendChangeNotifications();
 				
+	} //while(true)
+}
+
+
+/*
+ * WheelTime() [STATIC]
+ *
+ * Description:
+ *		The timer wheel runs off the system clock in seconds so it
+ *		isn't upset by someone changing the time of day.
+ *
+ * Returns: int32
+ */
+
+int32 dsi_scavenger::WheelTime()
+{
+	return( (int32)(system_time() / 1000000) );
+}
+
+
+/*
+ * BeginVisit()
+ *
+ * Description:
+ *		Mark a connection as in use before we send to it without the
+ *		lock held. Fails if the connection is no longer tracked.
+ *
+ * Returns: true if the connection can be used
+ */
+
+bool dsi_scavenger::BeginVisit(dsi_connection* connection)
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	
+	if (!mWheel->Contains(connection)) {
+		return( false );
+	}
+	
+	mVisiting.push_back(connection);
+	
+	return( true );
+}
+
+
+/*
+ * EndVisit()
+ *
+ * Description:
+ *		Done with a connection. If nextCheck is given the connection is
+ *		put back on the wheel that many seconds from now.
+ *
+ * Returns: none
+ */
+
+void dsi_scavenger::EndVisit(dsi_connection* connection, int32 nextCheck)
+{
+	{
+		std::lock_guard<std::mutex> guard(mMutex);
+		
+		mVisiting.erase(std::find(mVisiting.begin(), mVisiting.end(), connection));
+		
+		if ((nextCheck >= 0) && (mWheel->Contains(connection))) {
+		
+			mWheel->Schedule(connection, WheelTime() + nextCheck);
+		}
+	}
+	
+	mVisitDone.notify_all();
+}
+
+
+/*
+ * CheckConnection()
+ *
+ * Description:
+ *		Tickle the client if we haven't sent it anything for a while
+ *		and kill the session if we haven't heard from it.
+ *
+ * Returns: Seconds until the connection needs to be checked again
+ */
+
+int32 dsi_scavenger::CheckConnection(dsi_connection* connection)
+{
+	afp_session*	session			= connection->GetAFPSessionObject();
+	int32			recvInterval	= 0;
+	int32			sentInterval	= 0;
+	int32			nextCheck		= 0;
+	int32			now				= real_time_clock();
+	
+	if (session == NULL) {
+		return( SEND_TICKLE_INTERVAL );
+	}
+	
+	//
+	//If we haven't sent any packets to the client for a while,
+	//we'll want to "tickle" him so he doesn't things we've
+	//forgoten all about him.
+	//
+	sentInterval = (now - session->GetLastTickleSent());
+	
+	if ((sentInterval >= SEND_TICKLE_INTERVAL) && (!session->ClientIsSleeping()))
+	{
+		connection->SendTickle();
+		sentInterval = 0;
+	}
+	
+	//
+	//Now check to make sure we've heard from the client in
+	//in a reasonable amount of time.
+	//
+	recvInterval = (now - session->GetLastTickleRecvd());
+	
+	if (recvInterval > SESSION_DEAD_INTERVAL)
+	{
+		if (!session->ClientIsSleeping())
+		{
+			connection->KillSession();
+			DBGWRITE(dbg_level_warning, "Client died! Killed connection\n");
+			
+			return( SEND_TICKLE_INTERVAL );
+		}
+		else
+		{
+			//
+			//The client is asleep. Check to see if its been sleeping past
+			//the time we allow them to sleep before killing.
+			//
+			DBGWRITE(dbg_level_trace, "Client is sleeping\n");
+			
+			if (recvInterval > SESSION_SLEEPING_INTERVAL)
+			{
 				//
-				//Now check to make sure we've heard from the client in
-				//in a reasonable amount of time.
+				//The client has been sleeping for too long. Kill it.
 				//
-				recvInterval = (now - session->GetLastTickleRecvd());
+				connection->KillSession();
+				DBGWRITE(dbg_level_warning, "Killing sleeping client\n");
 				
-				if (recvInterval > SESSION_DEAD_INTERVAL)
-				{
-					if (!session->ClientIsSleeping())
-					{
-						connection->KillSession();
-						DBGWRITE(dbg_level_warning, "Client died! Killed connection\n");
-					}
-					else
-					{
-						//
-						//The client is asleep. Check to see if its been sleeping past
-						//the time we allow them to sleep before killing.
-						//
-						DBGWRITE(dbg_level_trace, "Client is sleeping\n");
-						
-						if (recvInterval > SESSION_SLEEPING_INTERVAL)
-						{
-							//
-							//The client has been sleeping for too long. Kill it.
-							//
-							connection->KillSession();
-							DBGWRITE(dbg_level_warning, "Killing sleeping client\n");
-						}
-					}
-				}
-				else
-				{
-					j = 0;
-					
-					//
-					//If we're still alive, see if there are dirty volumes that
-					//need to be reported to clients via the attention mechanism.
-					//					
-					std::lock_guard lock(volume_blist_mutex);
-							
-					while((volume = (fp_volume*)volume_blist->ItemAt(j++)) != NULL)
-					{						
-						if (volume->IsDirty())
-						{							
-							if (session->HasVolumeOpen(volume))
-							{
-								connection->SendAttention(ATTN_SERVER_NOTIFY);						
-							}
-						}
-					}
-				}
+				return( SEND_TICKLE_INTERVAL );
 			}
 		}
+	}
+	
+	//
+	//Come back when the next tickle is due or when the client would
+	//be given up on. We look at least every SESSION_DEAD_INTERVAL since
+	//a sleeping client can wake up and then go quiet.
+	//
+	if (session->ClientIsSleeping()) {
+		nextCheck = std::min(SESSION_SLEEPING_INTERVAL - recvInterval, SESSION_DEAD_INTERVAL);
+	}
+	else {
+		nextCheck = std::min(SESSION_DEAD_INTERVAL - recvInterval, SEND_TICKLE_INTERVAL - sentInterval);
+	}
+	
+	return( std::max(nextCheck + 1, (int32)SCAVENGER_TICK_INTERVAL) );
+}
+
+
+/*
+ * SendChangeNotifications()
+ *
+ * Description:
+ *		Tell the sessions looking at directories that have changed to
+ *		have another look. Nothing is sent, and the connections aren't
+ *		looked at, unless something changed.
+ *
+ * Returns: none
+ */
+
+void dsi_scavenger::SendChangeNotifications()
+{
+	std::vector<afp_session*>		sessions;
+	std::vector<dsi_connection*>	connections;
+
+	gAFPDirWatch.CollectNotifications(sessions);
+	
+	if (sessions.empty()) {
+		return;
+	}
+	
+	{
+		std::lock_guard<std::mutex> guard(mMutex);
+		
+		for (int32 i = 0; i < mOpenConnections->CountItems(); i++) {
+		
+			connections.push_back((dsi_connection*)mOpenConnections->ItemAt(i));
+		}
+	}
+	
+	for (dsi_connection* connection : connections)
+	{
+		if (!BeginVisit(connection)) {
+			continue;
+		}
 		
 		//
-		//We've just been through all sessions, now make sure all
-		//the volumes are marked as clean.
+		//The session list is only compared against, the sessions in
+		//it may be gone by now.
 		//
-		MarkAllVolumesClean();
-				
-	} //while(true)
+		afp_session*	session = connection->GetAFPSessionObject();
+		
+		if (std::find(sessions.begin(), sessions.end(), session) != sessions.end())
+		{
+			DBGWRITE(dbg_level_trace, "Notifying session %p of changes\n", session);
+			connection->SendAttention(ATTN_SERVER_NOTIFY);
+		}
+		
+		EndVisit(connection);
+	}
 }
 
 
@@ -218,18 +410,28 @@ int32 dsi_scavenger::ScavengerThread(void* data)
 
 void dsi_scavenger::SendGlobalAttention(uint16 attentionMsg)
 {
-	dsi_connection*	connection	= NULL;
-	int				i			= 0;
+	std::vector<dsi_connection*>	connections;
 
-	std::lock_guard<std::mutex> guard(mMutex);
+	{
+		std::lock_guard<std::mutex> guard(mMutex);
+		
+		for (int32 i = 0; i < mOpenConnections->CountItems(); i++) {
+		
+			connections.push_back((dsi_connection*)mOpenConnections->ItemAt(i));
+		}
+	}
 	
 	//
 	//Loop through the connection objects and send them
 	//the passed attention code.
 	//
 		
-	while((connection = (dsi_connection*)mOpenConnections->ItemAt(i++)) != NULL)
+	for (dsi_connection* connection : connections)
 	{
+		if (!BeginVisit(connection)) {
+			continue;
+		}
+		
 		DBGWRITE(dbg_level_trace, "Sending global attention (0x%x)\n", attentionMsg);
 		
 		//
@@ -238,48 +440,74 @@ void dsi_scavenger::SendGlobalAttention(uint16 attentionMsg)
 		//
 		
 		connection->SendAttention(attentionMsg);
+		
+		EndVisit(connection);
 	}
 }
 
 
 /*
- * FindSessionByID()
+ * AddSessionStats()
  *
  * Description:
- *		Finds a session using the ID supplied by the client via
- *		FPGetSessionToken().
+ *		Adds the traffic, idle time, I/O queueing delay and replay
+ *		cache memory of every logged in session to stats. Nothing here sends, so we can hold mMutex
+ *		throughout and the connections can't go away under us.
  *
  * Returns: None
  */
 
-afp_session* dsi_scavenger::FindSessionByID(int32 idSize, int8* id)
+void dsi_scavenger::AddSessionStats(std::vector<AFP_SESSION_STATS>& stats)
 {
-	dsi_connection*	connection	= NULL;
-	afp_session*	session		= NULL;
-	afp_session*	result		= NULL;
-	int32			cSize		= 0;
-	int8*			cID			= NULL;
-	int				i			= 0;
-
 	std::lock_guard<std::mutex> guard(mMutex);
+	int32		now = real_time_clock();
 	
-	while((connection = (dsi_connection*)mOpenConnections->ItemAt(i++)) != NULL)
+	for (int32 i = 0; i < mOpenConnections->CountItems(); i++)
 	{
-		session = connection->GetAFPSessionObject();
+		dsi_connection*	connection	= (dsi_connection*)mOpenConnections->ItemAt(i);
+		afp_session*	session		= connection->GetAFPSessionObject();
 		
-		if (session != NULL)
-		{			
-			session->GetClientID(&cSize, &cID);
-						
-			if ((cSize == idSize) && (cID != NULL) && (!memcmp(id, cID, idSize)))
-			{
-				result = session;
-				break;
-			}
+		if ((session == NULL) || (!session->IsAuthenticated())) {
+			continue;
 		}
-	}
 		
-	return( result );
+		AFP_SESSION_STATS	entry;
+		
+		entry.user		= session->GetUserName();
+		entry.sent		= connection->BytesSent();
+		entry.recv		= connection->BytesRecv();
+		entry.commands	= connection->CommandCount();
+		entry.idle		= std::max((int32)0, now - session->GetLastTickleRecvd());
+		entry.ioWaitAvg	= session->GetAverageIOWait();
+		entry.ioWaitMax	= session->GetMaxIOWait();
+		entry.replayMemory	= connection->GetReplayCacheMemoryUsage();
+		
+		stats.push_back(entry);
+	}
+}
+
+
+/*
+ * FindSessionByID()
+ *
+ * Description:
+ *		Finds a session using the ID supplied by the client via
+ *		FPGetSessionToken().
+ *
+ * Returns: afp_session* or NULL if there isn't one
+ */
+
+afp_session* dsi_scavenger::FindSessionByID(int32 idSize, int8* id)
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+	
+	auto	found = mByClientID.find(ClientIDKey(idSize, id));
+	
+	if (found == mByClientID.end()) {
+		return( NULL );
+	}
+	
+	return( found->second->GetAFPSessionObject() );
 }
 
 
@@ -289,54 +517,109 @@ afp_session* dsi_scavenger::FindSessionByID(int32 idSize, int8* id)
  * Description:
  *		Finds a session using the session token.
  *
- * Returns: None
+ * Returns: afp_session* or NULL if there isn't one
  */
 
 afp_session* dsi_scavenger::FindSessionByToken(int32 token)
 {
-	dsi_connection*	connection	= NULL;
-	afp_session*	session		= NULL;
-	afp_session*	result		= NULL;
-	int				i			= 0;
+	std::lock_guard<std::mutex> guard(mMutex);
+	
+	auto	found = mByToken.find(token);
+	
+	if (found == mByToken.end()) {
+		return( NULL );
+	}
+	
+	return( found->second->GetAFPSessionObject() );
+}
+
 
+/*
+ * SetClientID()
+ *
+ * Description:
+ *		Gives a session the client ID from FPGetSessionToken. If another
+ *		session had the ID, lookups by ID find this one from now on.
+ *
+ * Returns: none
+ */
+
+void dsi_scavenger::SetClientID(afp_session* session, int32 idSize, int8* id)
+{
 	std::lock_guard<std::mutex> guard(mMutex);
-		
-	while((connection = (dsi_connection*)mOpenConnections->ItemAt(i++)) != NULL)
+	
+	int32	oldSize	= 0;
+	int8*	oldID	= NULL;
+	
+	session->GetClientID(&oldSize, &oldID);
+	
+	if (oldID != NULL)
 	{
-		session = connection->GetAFPSessionObject();
+		auto	found = mByClientID.find(ClientIDKey(oldSize, oldID));
 		
-		if (session != NULL)
-		{			
-			if (session->GetToken() == token)
-			{
-				result = session;
-				break;
-			}
+		if ((found != mByClientID.end()) && (found->second == session->GetConnection())) {
+			mByClientID.erase(found);
 		}
 	}
-		
-	return( result );
+	
+	session->SetClientID(idSize, id);
+	
+	if (id != NULL) {
+		mByClientID[ClientIDKey(idSize, id)] = session->GetConnection();
+	}
 }
 
 
+/*
+ * TransferSession()
+ *
+ * Description:
+ *		A client that was cut off has logged in again and wants what it
+ *		had open back. The old session's volumes, forks and the locks
+ *		on them are handed to the new session under the same reference
+ *		numbers, then the old session is killed. Holding mMutex keeps
+ *		the old session from being deleted while we work on it.
+ *
+ * Returns: AFPERROR, AFP_OK if the old session is already gone
+ */
 
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+AFPERROR dsi_scavenger::TransferSession(int32 token, afp_session* session)
+{
+	dsi_connection*	connection	= NULL;
+	AFPERROR		afpError	= AFP_OK;
+	
+	{
+		std::lock_guard<std::mutex> guard(mMutex);
+		
+		if (token == 0) {
+			return( afpAccessDenied );
+		}
+		
+		auto	found = mByToken.find(token);
+		
+		if ((found == mByToken.end()) || (found->second == session->GetConnection())) {
+			return( AFP_OK );
+		}
+		
+		connection	= found->second;
+		afpError	= connection->GetAFPSessionObject()->TransferTo(session);
+		
+		if (AFP_FAILURE(afpError)) {
+			return( afpError );
+		}
+		
+		DBGWRITE(dbg_level_info, "Took over disconnected session %lx\n", token);
+		
+		//
+		//Killing it sends an attention, which we don't do with the
+		//lock held.
+		//
+		mVisiting.push_back(connection);
+	}
+	
+	connection->GetAFPSessionObject()->KillSession();
+	
+	EndVisit(connection);
+	
+	return( AFP_OK );
+}
@@ -1,11 +1,16 @@
 #ifndef __dsi_scavenger__
 #define __dsi_scavenger__
 
+#include <condition_variable>
 #include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "afpGlobals.h"
 #include "afp.h"
 #include "dsi_connection.h"
+#include "dsi_timerwheel.h"
 
 //
 //The server will send tickles to the client every 15 seconds
@@ -26,6 +31,26 @@
 //
 #define SESSION_SLEEPING_INTERVAL	(60*60*24)
 
+//
+//How often the scavenger thread wakes up to see which sessions are due.
+//
+#define SCAVENGER_TICK_INTERVAL		1		//seconds
+
+//
+//What a stats snapshot shows for one logged in session.
+//
+typedef struct
+{
+	std::string		user;
+	int64			sent;
+	int64			recv;
+	int64			commands;
+	int32			idle;			//seconds since the last tickle
+	bigtime_t		ioWaitAvg;		//usecs data fork I/O spent queued
+	bigtime_t		ioWaitMax;
+	int64			replayMemory;	//bytes held by the reconnect replay cache
+}AFP_SESSION_STATS;
+
 
 class dsi_scavenger
 {
@@ -41,15 +66,58 @@ public:
 	virtual afp_session*	FindSessionByID(int32 idSize, int8* id);
 	virtual afp_session*	FindSessionByToken(int32 token);
 	
+	//
+	//Sets a session's client ID and keeps the ID index up to date,
+	//the session owns id afterwards.
+	//
+	virtual void			SetClientID(afp_session* session, int32 idSize, int8* id);
+	
+	//
+	//Moves the open volumes, forks and locks of the session with the
+	//token to session, then kills the old one.
+	//
+	virtual AFPERROR		TransferSession(int32 token, afp_session* session);
+	
 	virtual int32			NumOpenSessions() { return mOpenConnections->CountItems(); }
 	
+	//
+	//Adds one entry per logged in session to stats.
+	//
+	virtual void			AddSessionStats(std::vector<AFP_SESSION_STATS>& stats);
+	
 private:
 	
 	static int32		ScavengerThread(void* data);
+	static int32		WheelTime();
+	
+	bool				BeginVisit(dsi_connection* connection);
+	void				EndVisit(dsi_connection* connection, int32 nextCheck=-1);
+	int32				CheckConnection(dsi_connection* connection);
+	void				SendChangeNotifications();
 	
 	//Guard the list that keeps track of open connections.
 	std::mutex			mMutex;
 	BList*				mOpenConnections;
+	
+	//
+	//The same connections by session token and by the client ID from
+	//FPGetSessionToken, for reconnects.
+	//
+	std::unordered_map<int32, dsi_connection*>			mByToken;
+	std::unordered_map<std::string, dsi_connection*>	mByClientID;
+	
+	//
+	//Every connection is on the wheel, due when it next needs a tickle
+	//or to be checked for being dead.
+	//
+	dsi_timerwheel*		mWheel;
+	
+	//
+	//Connections we're sending to outside of mMutex. StopTracking()
+	//waits for a connection to be off this list.
+	//
+	std::vector<dsi_connection*>	mVisiting;
+	std::condition_variable			mVisitDone;
 };
 
 #endif //__dsi_scavenger__
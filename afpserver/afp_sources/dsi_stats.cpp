@@ -1,5 +1,7 @@
 #include "dsi_stats.h"
 
+dsi_stats	gAFPStats;
+
 
 /*
  * dsi_stats()
@@ -21,6 +23,25 @@ dsi_stats::dsi_stats()
 	mLastBPS				= 0;
 	
 	mDSIPacketsProcessed	= 0;
+	
+	mReadAheadHits			= 0;
+	mReadAheadMisses		= 0;
+	mReadAheadBytes			= 0;
+	
+	mIOWaits				= 0;
+	mIOWaitTotal			= 0;
+	mIOWaitMax				= 0;
+	
+	mLogins					= 0;
+	mLoginTotal				= 0;
+	mLoginMax				= 0;
+	
+	for (int32 i = 0; i < 256; i++)
+	{
+		mCmdCount[i]		= 0;
+		mCmdTotal[i]		= 0;
+		mCmdMax[i]			= 0;
+	}
 }
 
 
@@ -147,7 +168,157 @@ void dsi_stats::Stat_EndOperation()
 }
 
 
+/*
+ * RA_HitRate()
+ *
+ * Description:
+ *		Percentage of data fork reads that were served, at least in
+ *		part, from the read ahead buffers.
+ *
+ * Returns: int32
+ */
 
+int32 dsi_stats::RA_HitRate()
+{
+	int64	total = mReadAheadHits + mReadAheadMisses;
+	
+	if (total == 0) {
+		
+		return( 0 );
+	}
+	
+	return( (int32)((mReadAheadHits * 100) / total) );
+}
 
 
+/*
+ * IO_RecordWait()
+ *
+ * Description:
+ *		Add the time one data fork read or write spent waiting on a
+ *		volume's I/O scheduler.
+ *
+ * Returns: None
+ */
 
+void dsi_stats::IO_RecordWait(bigtime_t inDelay)
+{
+	bigtime_t	max = mIOWaitMax.load(std::memory_order_relaxed);
+	
+	mIOWaits.fetch_add(1, std::memory_order_relaxed);
+	mIOWaitTotal.fetch_add(inDelay, std::memory_order_relaxed);
+	
+	while(	(inDelay > max) &&
+			(!mIOWaitMax.compare_exchange_weak(max, inDelay, std::memory_order_relaxed))	)
+	{
+	}
+}
+
+
+/*
+ * IO_AverageWait()
+ *
+ * Description:
+ *		Average time in microseconds data fork I/O has been queued.
+ *
+ * Returns: bigtime_t
+ */
+
+bigtime_t dsi_stats::IO_AverageWait()
+{
+	int64	count = mIOWaits.load(std::memory_order_relaxed);
+	
+	if (count == 0) {
+		
+		return( 0 );
+	}
+	
+	return( mIOWaitTotal.load(std::memory_order_relaxed) / count );
+}
+
+
+/*
+ * Login_RecordTime()
+ *
+ * Description:
+ *		Add the time it took to handle one FPLogin request.
+ *
+ * Returns: None
+ */
+
+void dsi_stats::Login_RecordTime(bigtime_t inTime)
+{
+	mLogins++;
+	mLoginTotal += inTime;
+	
+	if (inTime > mLoginMax) {
+		
+		mLoginMax = inTime;
+	}
+}
+
+
+/*
+ * Login_AverageTime()
+ *
+ * Description:
+ *		Average time in microseconds spent in FPLogin.
+ *
+ * Returns: bigtime_t
+ */
+
+bigtime_t dsi_stats::Login_AverageTime()
+{
+	if (mLogins == 0) {
+		
+		return( 0 );
+	}
+	
+	return( mLoginTotal / mLogins );
+}
+
+
+/*
+ * Cmd_Record()
+ *
+ * Description:
+ *		Add the time it took to handle one AFP command, from the
+ *		request arriving to the reply being sent.
+ *
+ * Returns: None
+ */
+
+void dsi_stats::Cmd_Record(uint8 afpCommand, bigtime_t inTime)
+{
+	bigtime_t	max = mCmdMax[afpCommand].load(std::memory_order_relaxed);
+	
+	mCmdCount[afpCommand].fetch_add(1, std::memory_order_relaxed);
+	mCmdTotal[afpCommand].fetch_add(inTime, std::memory_order_relaxed);
+	
+	while(	(inTime > max) &&
+			(!mCmdMax[afpCommand].compare_exchange_weak(max, inTime, std::memory_order_relaxed))	)
+	{
+	}
+}
+
+
+/*
+ * Cmd_AverageTime()
+ *
+ * Description:
+ *		Average time in microseconds spent handling an AFP command.
+ *
+ * Returns: bigtime_t
+ */
+
+bigtime_t dsi_stats::Cmd_AverageTime(uint8 afpCommand)
+{
+	int64	count = mCmdCount[afpCommand].load(std::memory_order_relaxed);
+	
+	if (count == 0) {
+		
+		return( 0 );
+	}
+	
+	return( mCmdTotal[afpCommand].load(std::memory_order_relaxed) / count );
+}
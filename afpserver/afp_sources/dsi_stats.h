@@ -1,7 +1,9 @@
 #ifndef __dsi_stats__
 #define __dsi_stats__
 
-#include <OS.h>
+#include "afp_os.h"
+
+#include <atomic>
 
 typedef enum
 {
@@ -31,6 +33,28 @@ public:
 	virtual void 		Stat_EndOperation();
 	virtual uint32		Stat_LastOpTime()				{return mLastOpTime;}
 	
+	virtual void		RA_RecordHit(uint32 inBytes)	{ mReadAheadHits++; mReadAheadBytes += inBytes; }
+	virtual void		RA_RecordMiss()					{ mReadAheadMisses++; }
+	virtual int32		RA_HitRate();
+	virtual int64		RA_BytesServed()				{ return mReadAheadBytes; }
+	
+	virtual void		IO_RecordWait(bigtime_t inDelay);
+	virtual bigtime_t	IO_AverageWait();
+	virtual bigtime_t	IO_MaxWait()					{ return mIOWaitMax.load(std::memory_order_relaxed); }
+	
+	virtual void		Login_RecordTime(bigtime_t inTime);
+	virtual bigtime_t	Login_AverageTime();
+	virtual bigtime_t	Login_MaxTime()					{ return mLoginMax; }
+	
+	//
+	//Per AFP command counts and service times, recorded as each
+	//reply goes out.
+	//
+	virtual void		Cmd_Record(uint8 afpCommand, bigtime_t inTime);
+	virtual int64		Cmd_Count(uint8 afpCommand)		{ return mCmdCount[afpCommand].load(std::memory_order_relaxed); }
+	virtual bigtime_t	Cmd_AverageTime(uint8 afpCommand);
+	virtual bigtime_t	Cmd_MaxTime(uint8 afpCommand)	{ return mCmdMax[afpCommand].load(std::memory_order_relaxed); }
+	
 private:
 	//
 	//Track the raw transfered bytes to and from the server and
@@ -57,6 +81,35 @@ private:
 	//
 	bigtime_t			mOpStartTime;
 	uint32				mLastOpTime;
+	
+	//
+	//Data fork reads served out of the read ahead buffers.
+	//
+	int64				mReadAheadHits;
+	int64				mReadAheadMisses;
+	int64				mReadAheadBytes;
+	
+	//
+	//Time data fork I/O spent queued in the volume I/O schedulers.
+	//
+	std::atomic<int64>		mIOWaits;
+	std::atomic<bigtime_t>	mIOWaitTotal;
+	std::atomic<bigtime_t>	mIOWaitMax;
+	
+	//
+	//Time the server spent handling FPLogin requests.
+	//
+	int64				mLogins;
+	bigtime_t			mLoginTotal;
+	bigtime_t			mLoginMax;
+	
+	//
+	//Indexed by AFP command code. Every session thread updates these
+	//so they're atomic, they don't need to agree with each other.
+	//
+	std::atomic<int64>		mCmdCount[256];
+	std::atomic<bigtime_t>	mCmdTotal[256];
+	std::atomic<bigtime_t>	mCmdMax[256];
 };
 
 
@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <chrono>
+
+#include "debug.h"
+#include "commands.h"
+#include "dsi_statsfeed.h"
+#include "dsi_stats.h"
+#include "dsi_scavenger.h"
+#include "fp_blockcache.h"
+#include "afpdhxpool.h"
+
+extern dsi_stats		gAFPStats;
+extern dsi_scavenger*	gAFPSessionMgr;
+
+dsi_statsfeed	gAFPStatsFeed;
+
+
+/*
+ * dsi_statsfeed()
+ *
+ * Description:
+ *		The feed thread is started by the first subscriber.
+ *
+ * Returns:
+ */
+
+dsi_statsfeed::dsi_statsfeed()
+{
+	mThread		= -1;
+	mQuit		= false;
+	mLastSample	= 0;
+	mLastBytes	= 0;
+}
+
+
+/*
+ * ~dsi_statsfeed()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+dsi_statsfeed::~dsi_statsfeed()
+{
+	if (mThread >= 0)
+	{
+		status_t	result;
+
+		{
+			std::lock_guard<std::mutex> guard(mMutex);
+
+			mQuit = true;
+		}
+
+		mWake.notify_one();
+		wait_for_thread(mThread, &result);
+	}
+}
+
+
+/*
+ * Subscribe()
+ *
+ * Description:
+ *		Add, change or remove a subscriber. A new or changed one gets
+ *		its first snapshot right away.
+ *
+ * Returns: B_OK or B_BAD_VALUE
+ */
+
+status_t dsi_statsfeed::Subscribe(const BMessenger& target, int32 interval)
+{
+	//
+	//A target that went away can still be unsubscribed.
+	//
+	if ((interval != 0) && (!target.IsValid())) {
+		return( B_BAD_VALUE );
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(mMutex);
+
+		auto it = std::find_if(mSubscribers.begin(), mSubscribers.end(),
+					[&target](const STATS_SUBSCRIBER& subscriber) {
+						return( subscriber.target == target );
+					});
+
+		if (interval == 0)
+		{
+			if (it != mSubscribers.end()) {
+				mSubscribers.erase(it);
+			}
+
+			return( B_OK );
+		}
+
+		interval = std::min(std::max(interval, (int32)AFP_STATS_MIN_INTERVAL), (int32)AFP_STATS_MAX_INTERVAL);
+
+		if (it == mSubscribers.end())
+		{
+			STATS_SUBSCRIBER	subscriber;
+
+			subscriber.target = target;
+			mSubscribers.push_back(subscriber);
+			it = mSubscribers.end() - 1;
+		}
+
+		it->interval	= (bigtime_t)interval * 1000;
+		it->due			= system_time();
+
+		if (mThread < 0)
+		{
+			//
+			//Pushing stats is never more urgent than serving requests.
+			//
+			mThread = spawn_thread(
+						dsi_statsfeed::FeedThread,
+						"afp_statsfeed",
+						B_LOW_PRIORITY,
+						this
+						);
+
+			resume_thread(mThread);
+		}
+	}
+
+	mWake.notify_one();
+
+	return( B_OK );
+}
+
+
+/*
+ * CountSubscribers()
+ *
+ * Description:
+ *
+ * Returns: int32
+ */
+
+int32 dsi_statsfeed::CountSubscribers()
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+
+	return( (int32)mSubscribers.size() );
+}
+
+
+/*
+ * BuildSnapshot()
+ *
+ * Description:
+ *		Everything the config app used to ask for one message at a
+ *		time, plus the per command and per session numbers.
+ *
+ * Returns: None
+ */
+
+void dsi_statsfeed::BuildSnapshot(BMessage* snapshot)
+{
+	bigtime_t	now		= system_time();
+	int64		bytes	= gAFPStats.Net_BytesSent() + gAFPStats.Net_BytesRecv();
+	int32		bps		= 0;
+
+	if ((mLastSample != 0) && (now > mLastSample)) {
+		bps = (int32)(((bytes - mLastBytes) * 1000000) / (now - mLastSample));
+	}
+
+	mLastSample	= now;
+	mLastBytes	= bytes;
+
+	snapshot->AddInt32(AFP_STAT_INT32_BPS, std::max(bps, (int32)0));
+	snapshot->AddInt64(AFP_STAT_INT64_SENT, gAFPStats.Net_BytesSent());
+	snapshot->AddInt64(AFP_STAT_INT64_RECV, gAFPStats.Net_BytesRecv());
+	snapshot->AddInt32(AFP_STAT_INT32_DSIPACKETS, gAFPStats.DSI_NumPacketsProcessed());
+	snapshot->AddInt32(AFP_STAT_INT32_USERS, gAFPSessionMgr->NumOpenSessions());
+	snapshot->AddInt32(AFP_STAT_INT32_RAHITRATE, gAFPStats.RA_HitRate());
+	snapshot->AddInt64(AFP_STAT_INT64_RABYTES, gAFPStats.RA_BytesServed());
+	snapshot->AddInt32(AFP_STAT_INT32_CACHEHITRATE, gAFPBlockCache.HitRate());
+	snapshot->AddInt64(AFP_STAT_INT64_CACHEMEMORY, (int64)gAFPBlockCache.MemoryUsage());
+	snapshot->AddInt64(AFP_STAT_INT64_IOWAITAVG, gAFPStats.IO_AverageWait());
+	snapshot->AddInt64(AFP_STAT_INT64_IOWAITMAX, gAFPStats.IO_MaxWait());
+	snapshot->AddInt64(AFP_STAT_INT64_LOGINAVG, gAFPStats.Login_AverageTime());
+	snapshot->AddInt64(AFP_STAT_INT64_LOGINMAX, gAFPStats.Login_MaxTime());
+	snapshot->AddInt32(AFP_STAT_INT32_DHXKEYS, gAFPDHXPool.CountKeys());
+	snapshot->AddInt64(AFP_STAT_INT64_DHXMISSES, gAFPDHXPool.Misses());
+
+	for (int32 command = 0; command < 256; command++)
+	{
+		int64	count = gAFPStats.Cmd_Count((uint8)command);
+
+		if (count == 0) {
+			continue;
+		}
+
+		snapshot->AddInt32(AFP_STAT_INT32_CMD, command);
+		snapshot->AddInt64(AFP_STAT_INT64_CMDCOUNT, count);
+		snapshot->AddInt64(AFP_STAT_INT64_CMDAVG, gAFPStats.Cmd_AverageTime((uint8)command));
+		snapshot->AddInt64(AFP_STAT_INT64_CMDMAX, gAFPStats.Cmd_MaxTime((uint8)command));
+	}
+
+	std::vector<AFP_SESSION_STATS>	sessions;
+
+	gAFPSessionMgr->AddSessionStats(sessions);
+
+	for (const AFP_SESSION_STATS& session : sessions)
+	{
+		snapshot->AddString(AFP_STAT_STRING_SESSUSER, session.user.c_str());
+		snapshot->AddInt64(AFP_STAT_INT64_SESSSENT, session.sent);
+		snapshot->AddInt64(AFP_STAT_INT64_SESSRECV, session.recv);
+		snapshot->AddInt64(AFP_STAT_INT64_SESSCMDS, session.commands);
+		snapshot->AddInt32(AFP_STAT_INT32_SESSIDLE, session.idle);
+		snapshot->AddInt64(AFP_STAT_INT64_SESSIOWAITAVG, session.ioWaitAvg);
+		snapshot->AddInt64(AFP_STAT_INT64_SESSIOWAITMAX, session.ioWaitMax);
+		snapshot->AddInt64(AFP_STAT_INT64_SESSREPLAYMEM, session.replayMemory);
+	}
+}
+
+
+/*
+ * FeedThread() [STATIC]
+ *
+ * Description:
+ *		Sleeps until the next subscriber is due, then builds one
+ *		snapshot for everyone due and pushes it without waiting. A
+ *		subscriber whose port is full misses that push, one whose
+ *		port is gone is dropped.
+ *
+ * Returns: B_OK
+ */
+
+int32 dsi_statsfeed::FeedThread(void* data)
+{
+	dsi_statsfeed*	feed = (dsi_statsfeed*)data;
+
+	while(true)
+	{
+		std::vector<BMessenger>	targets;
+		std::vector<BMessenger>	gone;
+
+		{
+			std::unique_lock<std::mutex> lock(feed->mMutex);
+			bigtime_t	now;
+			bigtime_t	due = B_INFINITE_TIMEOUT;
+
+			for (const STATS_SUBSCRIBER& subscriber : feed->mSubscribers) {
+				due = std::min(due, subscriber.due);
+			}
+
+			if (due == B_INFINITE_TIMEOUT)
+			{
+				feed->mWake.wait(lock);
+			}
+			else if (due > system_time())
+			{
+				feed->mWake.wait_for(lock, std::chrono::microseconds(due - system_time()));
+			}
+
+			if (feed->mQuit) {
+				break;
+			}
+
+			now = system_time();
+
+			for (STATS_SUBSCRIBER& subscriber : feed->mSubscribers)
+			{
+				if (subscriber.due > now) {
+					continue;
+				}
+
+				targets.push_back(subscriber.target);
+				subscriber.due = now + subscriber.interval;
+			}
+		}
+
+		if (targets.empty()) {
+			continue;
+		}
+
+		BMessage	snapshot(CMD_AFP_STATSSNAPSHOT);
+
+		feed->BuildSnapshot(&snapshot);
+
+		for (BMessenger& target : targets)
+		{
+			status_t	status = target.SendMessage(&snapshot, (BHandler*)NULL, 0);
+
+			if ((status == B_BAD_PORT_ID) || (status == B_BAD_TEAM_ID) || (!target.IsValid()))
+			{
+				DBGWRITE(dbg_level_info, "Dropping stats subscriber that went away\n");
+				gone.push_back(target);
+			}
+		}
+
+		for (BMessenger& target : gone) {
+			feed->Subscribe(target, 0);
+		}
+	}
+
+	return( B_OK );
+}
@@ -0,0 +1,59 @@
+#ifndef __dsi_statsfeed__
+#define __dsi_statsfeed__
+
+#include <Message.h>
+#include <Messenger.h>
+#include <OS.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+//
+//A client that asked for stats to be pushed to it, see
+//CMD_AFP_SUBSCRIBESTATS in commands.h.
+//
+typedef struct
+{
+	BMessenger	target;
+	bigtime_t	interval;		//usecs
+	bigtime_t	due;			//system_time() of the next push
+}STATS_SUBSCRIBER;
+
+
+class dsi_statsfeed
+{
+public:
+						dsi_statsfeed();
+	virtual				~dsi_statsfeed();
+
+	//
+	//Push a snapshot to target every interval msecs, starting now. An
+	//interval of 0 stops the pushes.
+	//
+	virtual status_t	Subscribe(const BMessenger& target, int32 interval);
+
+	virtual int32		CountSubscribers();
+
+private:
+
+	static int32		FeedThread(void* data);
+	void				BuildSnapshot(BMessage* snapshot);
+
+	std::mutex						mMutex;
+	std::condition_variable			mWake;
+	std::vector<STATS_SUBSCRIBER>	mSubscribers;
+	thread_id						mThread;
+	bool							mQuit;
+
+	//
+	//Traffic totals at the last snapshot, for the bytes per second.
+	//Only the feed thread touches these.
+	//
+	bigtime_t						mLastSample;
+	int64							mLastBytes;
+};
+
+extern dsi_statsfeed	gAFPStatsFeed;
+
+#endif //__dsi_statsfeed__
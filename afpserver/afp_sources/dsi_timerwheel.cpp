@@ -0,0 +1,202 @@
+#include <algorithm>
+
+#include "dsi_timerwheel.h"
+
+/*
+ * dsi_timerwheel()
+ *
+ * Description:
+ *		A hierarchical timer wheel with one second resolution. Items
+ *		are kept in the slot for their deadline so advancing the wheel
+ *		only looks at what is due. Times are in seconds and only need
+ *		to be consistent with each other.
+ *
+ * Returns:
+ */
+
+dsi_timerwheel::dsi_timerwheel(int32 now)
+{
+	mCurrent = now;
+}
+
+
+/*
+ * ~dsi_timerwheel()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+dsi_timerwheel::~dsi_timerwheel()
+{
+}
+
+
+/*
+ * Schedule()
+ *
+ * Description:
+ *		Schedule item to expire at deadline, replacing any deadline
+ *		it already had. A deadline that has already passed expires on
+ *		the next Advance().
+ *
+ * Returns: none
+ */
+
+void dsi_timerwheel::Schedule(void* item, int32 deadline)
+{
+	std::unordered_map<void*, AFPTimerEntry>::iterator	found = mEntries.find(item);
+
+	if (found == mEntries.end())
+	{
+		AFPTimerEntry	newEntry;
+
+		newEntry.level	= -1;
+		newEntry.slot	= 0;
+
+		found = mEntries.emplace(item, newEntry).first;
+	}
+
+	AFPTimerEntry&	entry = found->second;
+
+	if (entry.level >= 0) {
+		Remove(entry);
+	}
+
+	entry.deadline = deadline;
+
+	Insert(item, entry, mCurrent + 1);
+}
+
+
+/*
+ * Cancel()
+ *
+ * Description:
+ *		Forget about item altogether.
+ *
+ * Returns: none
+ */
+
+void dsi_timerwheel::Cancel(void* item)
+{
+	std::unordered_map<void*, AFPTimerEntry>::iterator	entry = mEntries.find(item);
+
+	if (entry != mEntries.end())
+	{
+		if (entry->second.level >= 0) {
+			Remove(entry->second);
+		}
+
+		mEntries.erase(entry);
+	}
+}
+
+
+/*
+ * Contains()
+ *
+ * Description:
+ *		Whether item is known to the wheel. Expired items stay known
+ *		until they're scheduled again or cancelled.
+ *
+ * Returns: bool
+ */
+
+bool dsi_timerwheel::Contains(void* item)
+{
+	return( mEntries.find(item) != mEntries.end() );
+}
+
+
+/*
+ * Advance()
+ *
+ * Description:
+ *		Move the wheel up to now, adding every item that expired on
+ *		the way to expired. Second level slots are spread out over
+ *		the first level as we reach them.
+ *
+ * Returns: none
+ */
+
+void dsi_timerwheel::Advance(int32 now, std::vector<void*>& expired)
+{
+	while(mCurrent < now)
+	{
+		mCurrent++;
+
+		if ((mCurrent % TIMERWHEEL_SLOTS) == 0)
+		{
+			std::list<void*>	cascade;
+
+			cascade.swap(mSlots[1][(mCurrent / TIMERWHEEL_SLOTS) % TIMERWHEEL_SLOTS]);
+
+			for (void* item : cascade) {
+
+				Insert(item, mEntries[item], mCurrent);
+			}
+		}
+
+		std::list<void*>&	slot = mSlots[0][mCurrent % TIMERWHEEL_SLOTS];
+
+		for (void* item : slot)
+		{
+			mEntries[item].level = -1;
+			expired.push_back(item);
+		}
+
+		slot.clear();
+	}
+}
+
+
+/*
+ * Insert()
+ *
+ * Description:
+ *		Put an item in the slot for its deadline, but no sooner than
+ *		earliest.
+ *
+ * Returns: none
+ */
+
+void dsi_timerwheel::Insert(void* item, AFPTimerEntry& entry, int32 earliest)
+{
+	int32	when = std::max(entry.deadline, earliest);
+
+	if (when - mCurrent < TIMERWHEEL_SLOTS)
+	{
+		entry.level	= 0;
+		entry.slot	= when % TIMERWHEEL_SLOTS;
+	}
+	else
+	{
+		int32	ahead = std::min((when / TIMERWHEEL_SLOTS) - (mCurrent / TIMERWHEEL_SLOTS), (int32)TIMERWHEEL_SLOTS - 1);
+
+		entry.level	= 1;
+		entry.slot	= ((mCurrent / TIMERWHEEL_SLOTS) + ahead) % TIMERWHEEL_SLOTS;
+	}
+
+	std::list<void*>&	slot = mSlots[entry.level][entry.slot];
+
+	entry.position = slot.insert(slot.end(), item);
+}
+
+
+/*
+ * Remove()
+ *
+ * Description:
+ *		Take a scheduled item out of its slot.
+ *
+ * Returns: none
+ */
+
+void dsi_timerwheel::Remove(AFPTimerEntry& entry)
+{
+	mSlots[entry.level][entry.slot].erase(entry.position);
+
+	entry.level = -1;
+}
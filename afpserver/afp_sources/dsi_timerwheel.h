@@ -0,0 +1,50 @@
+#ifndef __dsi_timerwheel__
+#define __dsi_timerwheel__
+
+#include "afp_os.h"
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+//
+//Two levels of 64 one second slots. The first level covers the next
+//minute, the second the next hour. Anything further out waits in the
+//last slot and is put back when its slot comes around.
+//
+#define TIMERWHEEL_SLOTS		64
+#define TIMERWHEEL_LEVELS		2
+
+
+class dsi_timerwheel
+{
+public:
+						dsi_timerwheel(int32 now);
+	virtual				~dsi_timerwheel();
+
+	virtual void		Schedule(void* item, int32 deadline);
+	virtual void		Cancel(void* item);
+	virtual bool		Contains(void* item);
+
+	virtual void		Advance(int32 now, std::vector<void*>& expired);
+	virtual int32		Count()		{ return (int32)mEntries.size(); }
+
+private:
+
+	typedef struct
+	{
+		int32						deadline;
+		int32						level;		//-1 once it has expired
+		int32						slot;
+		std::list<void*>::iterator	position;
+	}AFPTimerEntry;
+
+	void				Insert(void* item, AFPTimerEntry& entry, int32 earliest);
+	void				Remove(AFPTimerEntry& entry);
+
+	std::list<void*>	mSlots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];
+	std::unordered_map<void*, AFPTimerEntry>	mEntries;
+	int32				mCurrent;
+};
+
+#endif //__dsi_timerwheel__
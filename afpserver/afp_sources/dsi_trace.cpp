@@ -0,0 +1,350 @@
+#include "fp_storage.h"
+#include "afp_os.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "dsi_trace.h"
+
+dsi_trace		gAFPTrace;
+
+/*
+ * dsi_trace()
+ *
+ * Description:
+ *		Optional capture of every request the server handles, kept as
+ *		fixed size binary records in a memory mapped file so writing
+ *		one is a copy. The files are read by the afp_trace tool.
+ *
+ * Returns:
+ */
+
+dsi_trace::dsi_trace()
+{
+	mOn			= false;
+	mNext		= AFP_TRACE_FILE_RECORDS;
+	mWriters	= 0;
+	mFile		= -1;
+	mHeader		= NULL;
+	mRecords	= NULL;
+	mMappedSize	= 0;
+}
+
+
+/*
+ * ~dsi_trace()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+dsi_trace::~dsi_trace()
+{
+	Stop();
+}
+
+
+/*
+ * Start()
+ *
+ * Description:
+ *		Start recording into a fresh trace file.
+ *
+ * Returns: B_OK if tracing is on
+ */
+
+status_t dsi_trace::Start()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+
+	if (mOn) {
+		return( B_OK );
+	}
+
+	status_t	result = Rotate();
+
+	if (result == B_OK) {
+		result = OpenFile();
+	}
+
+	if (result == B_OK)
+	{
+		mNext	= 0;
+		mOn		= true;
+	}
+
+	return( result );
+}
+
+
+/*
+ * Stop()
+ *
+ * Description:
+ *		Stop recording and close the current file.
+ *
+ * Returns: none
+ */
+
+void dsi_trace::Stop()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+
+	mOn		= false;
+	mNext	= AFP_TRACE_FILE_RECORDS;
+
+	WaitForWriters();
+	CloseFile();
+}
+
+
+/*
+ * Record()
+ *
+ * Description:
+ *		Add a record to the trace, starting a new file when the current
+ *		one is full. Every connection calls this, so the common case
+ *		is two atomic adds and a copy.
+ *
+ * Returns: none
+ */
+
+void dsi_trace::Record(const AFP_TRACE_RECORD& record)
+{
+	static_assert(sizeof(std::atomic<uint32>) == sizeof(uint32), "header count is updated in place");
+
+	for (;;)
+	{
+		mWriters++;
+
+		uint32	slot = mNext++;
+
+		if (slot < AFP_TRACE_FILE_RECORDS)
+		{
+			mRecords[slot] = record;
+
+			//
+			//Records can finish out of order, a file left by a crash
+			//may have a hole or two in it, which the analyzer skips.
+			//
+			((std::atomic<uint32>*)&mHeader->count)->fetch_add(1, std::memory_order_release);
+
+			mWriters--;
+			return;
+		}
+
+		mWriters--;
+
+		if (!NextFile()) {
+			return;
+		}
+	}
+}
+
+
+/*
+ * NextFile()
+ *
+ * Description:
+ *		Called when Record() finds no room. The first caller starts a
+ *		new file, the rest find it already done and try again.
+ *
+ * Returns: true if there may be room now, false if tracing is off
+ */
+
+bool dsi_trace::NextFile()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+
+	if (!mOn) {
+		return( false );
+	}
+
+	if (mNext < AFP_TRACE_FILE_RECORDS) {
+		return( true );
+	}
+
+	WaitForWriters();
+	CloseFile();
+
+	if ((Rotate() != B_OK) || (OpenFile() != B_OK))
+	{
+		DBGWRITE(dbg_level_error, "Failed to start a new trace file, tracing stopped\n");
+		mOn = false;
+		return( false );
+	}
+
+	mNext = 0;
+
+	return( true );
+}
+
+
+/*
+ * WaitForWriters()
+ *
+ * Description:
+ *		Wait for records being copied into the current file to be
+ *		done. mNext is past the end, so no new ones start. mLock
+ *		must be held.
+ *
+ * Returns: none
+ */
+
+void dsi_trace::WaitForWriters()
+{
+	while(mWriters > 0) {
+		snooze(10);
+	}
+}
+
+
+/*
+ * OpenFile()
+ *
+ * Description:
+ *		Create and map afpTrace.0. mLock must be held.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t dsi_trace::OpenFile()
+{
+	char	path[B_PATH_NAME_LENGTH];
+	char	fpath[B_PATH_NAME_LENGTH];
+	int		length;
+
+	if (fp_storage_settings_dir(path, sizeof(path)) != B_OK) {
+		return( B_ERROR );
+	}
+
+	length = snprintf(fpath, sizeof(fpath), "%s/%s.0", path, AFP_TRACE_FILE_NAME);
+
+	if ((length < 0) || ((size_t)length >= sizeof(fpath)))
+	{
+		DBGWRITE(dbg_level_error, "Trace file path too long (%s)\n", path);
+		return( B_NAME_TOO_LONG );
+	}
+
+	mMappedSize	= sizeof(AFP_TRACE_HEADER) + ((size_t)AFP_TRACE_FILE_RECORDS * sizeof(AFP_TRACE_RECORD));
+	mFile		= open(fpath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	if (mFile < 0)
+	{
+		DBGWRITE(dbg_level_error, "Can't create trace file %s (%s)\n", fpath, strerror(errno));
+		return( B_ERROR );
+	}
+
+	if (ftruncate(mFile, mMappedSize) < 0)
+	{
+		CloseFile();
+		return( B_DEVICE_FULL );
+	}
+
+	void*	mapped = mmap(NULL, mMappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFile, 0);
+
+	if (mapped == MAP_FAILED)
+	{
+		DBGWRITE(dbg_level_error, "Can't map trace file (%s)\n", strerror(errno));
+		CloseFile();
+		return( B_NO_MEMORY );
+	}
+
+	mHeader		= (AFP_TRACE_HEADER*)mapped;
+	mRecords	= (AFP_TRACE_RECORD*)(mHeader + 1);
+
+	mHeader->magic		= AFP_TRACE_MAGIC;
+	mHeader->version	= AFP_TRACE_VERSION;
+	mHeader->recordSize	= sizeof(AFP_TRACE_RECORD);
+	mHeader->capacity	= AFP_TRACE_FILE_RECORDS;
+	mHeader->startTime	= real_time_clock_usecs();
+	mHeader->count		= 0;
+	mHeader->reserved	= 0;
+
+	DBGWRITE(dbg_level_info, "Tracing requests to %s\n", fpath);
+
+	return( B_OK );
+}
+
+
+/*
+ * CloseFile()
+ *
+ * Description:
+ *		Unmap the current file and cut it down to the records actually
+ *		written. mLock must be held.
+ *
+ * Returns: none
+ */
+
+void dsi_trace::CloseFile()
+{
+	off_t	used = sizeof(AFP_TRACE_HEADER);
+
+	if (mHeader != NULL)
+	{
+		used += (off_t)mHeader->count * sizeof(AFP_TRACE_RECORD);
+
+		munmap(mHeader, mMappedSize);
+
+		mHeader		= NULL;
+		mRecords	= NULL;
+	}
+
+	if (mFile >= 0)
+	{
+		ftruncate(mFile, used);
+		close(mFile);
+
+		mFile = -1;
+	}
+}
+
+
+/*
+ * Rotate()
+ *
+ * Description:
+ *		Move each trace file down one, dropping the oldest, to make
+ *		room for a new afpTrace.0. mLock must be held. A file that
+ *		isn't there yet is fine, a name that doesn't fit isn't, since
+ *		renaming a truncated one could clobber some other file.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t dsi_trace::Rotate()
+{
+	char	path[B_PATH_NAME_LENGTH];
+	char	from[B_PATH_NAME_LENGTH];
+	char	to[B_PATH_NAME_LENGTH];
+	int		fromLength;
+	int		toLength;
+
+	if (fp_storage_settings_dir(path, sizeof(path)) != B_OK) {
+		return( B_ERROR );
+	}
+
+	for (int32 i = AFP_TRACE_FILES - 1; i > 0; i--)
+	{
+		fromLength	= snprintf(from, sizeof(from), "%s/%s.%d", path, AFP_TRACE_FILE_NAME, (int)(i - 1));
+		toLength	= snprintf(to, sizeof(to), "%s/%s.%d", path, AFP_TRACE_FILE_NAME, (int)i);
+
+		if ((fromLength < 0) || ((size_t)fromLength >= sizeof(from)) ||
+			(toLength < 0) || ((size_t)toLength >= sizeof(to)))
+		{
+			DBGWRITE(dbg_level_error, "Trace file path too long (%s)\n", path);
+			return( B_NAME_TOO_LONG );
+		}
+
+		rename(from, to);
+	}
+
+	return( B_OK );
+}
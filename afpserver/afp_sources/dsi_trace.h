@@ -0,0 +1,97 @@
+#ifndef __dsi_trace__
+#define __dsi_trace__
+
+#include "afp_os.h"
+
+#include <atomic>
+#include <mutex>
+
+//
+//Trace files live in the user settings directory as afpTrace.0 (the
+//one being written) through afpTrace.3 (the oldest). When the current
+//file fills up the others move down one and the oldest is lost.
+//
+#define AFP_TRACE_FILE_NAME			"afpTrace"
+#define AFP_TRACE_FILES				4
+#define AFP_TRACE_FILE_RECORDS		(256 * 1024)
+
+#define AFP_TRACE_MAGIC				'AFPT'
+#define AFP_TRACE_VERSION			1
+
+//
+//The start of every trace file. count is updated as records are
+//added so a file left behind by a crash can still be read.
+//
+typedef struct
+{
+	uint32		magic;
+	uint32		version;
+	uint32		recordSize;
+	uint32		capacity;			//Records the file has room for
+	int64		startTime;			//real_time_clock_usecs() when the file was started
+	uint32		count;				//Records written so far
+	uint32		reserved;
+}AFP_TRACE_HEADER;
+
+//
+//One request and its reply. Records are written in the byte order
+//of the machine the server runs on.
+//
+typedef struct
+{
+	int64		timestamp;			//real_time_clock_usecs() when the request arrived
+	uint32		session;			//Thread id of the connection, unique while it lives
+	uint32		serviceTime;		//usecs from arrival to the reply being sent
+	uint32		requestBytes;		//DSI payload, not counting the header
+	uint32		replyBytes;
+	int32		afpError;
+	uint16		requestID;
+	int8		dsiCommand;
+	uint8		afpCommand;			//0 unless dsiCommand is a command or write
+}AFP_TRACE_RECORD;
+
+
+class dsi_trace
+{
+public:
+							dsi_trace();
+	virtual					~dsi_trace();
+
+	virtual status_t		Start();
+	virtual void			Stop();
+
+	//
+	//Checked on every request, so it's kept inline and cheap.
+	//
+	inline bool				IsOn()		{ return( mOn.load(std::memory_order_relaxed) ); }
+
+	virtual void			Record(const AFP_TRACE_RECORD& record);
+
+private:
+
+	status_t				OpenFile();
+	void					CloseFile();
+	status_t				Rotate();
+	bool					NextFile();
+	void					WaitForWriters();
+
+	std::atomic<bool>		mOn;
+
+	//
+	//Record() doesn't lock. It takes the next slot from mNext and
+	//copies into the file while counted in mWriters. mLock is only
+	//for starting, stopping and moving on to a new file, which wait
+	//for mWriters to drain first.
+	//
+	std::mutex				mLock;
+	std::atomic<uint32>		mNext;
+	std::atomic<int32>		mWriters;
+	int						mFile;
+	AFP_TRACE_HEADER*		mHeader;
+	AFP_TRACE_RECORD*		mRecords;
+	size_t					mMappedSize;
+};
+
+extern dsi_trace		gAFPTrace;
+
+#endif //__dsi_trace__
@@ -31,7 +31,7 @@ void FinderInfoBasedOnExtension(std::string filename, FINDER_INFO* finfo)
 	
 	memset(finfo, 0, sizeof(FINDER_INFO));
 
-	for (int i = 0; i < sizeof(extMap); i++)
+	for (size_t i = 0; i < sizeof(extMap) / sizeof(extMap[0]); i++)
 	{
 		if (extension == extMap[i].extension)
 		{
@@ -0,0 +1,502 @@
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <new>
+
+#include "debug.h"
+#include "fp_blockcache.h"
+
+fp_blockcache	gAFPBlockCache;
+
+/*
+ * fp_blockcache()
+ *
+ * Description:
+ *		A server wide cache of data fork blocks. When a lab full of
+ *		Macs launch the same application off the server, only the
+ *		first session has to go to the disk.
+ *
+ * Returns:
+ */
+
+fp_blockcache::fp_blockcache()
+{
+	for (int32 i = 0; i < BLOCKCACHE_SHARDS; i++) {
+		mNodeShards[i].generation = 0;
+	}
+
+	mBytes	= 0;
+	mHits	= 0;
+	mMisses	= 0;
+}
+
+
+/*
+ * ~fp_blockcache()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_blockcache::~fp_blockcache()
+{
+	Flush();
+}
+
+
+/*
+ * KeyHash::operator()
+ *
+ * Description:
+ *		Hash function for the lookup key.
+ *
+ * Returns: size_t
+ */
+
+size_t fp_blockcache::KeyHash::operator()(const AFPBlockCacheKey& key) const
+{
+	size_t	hash = std::hash<int64>()(key.node);
+
+	hash ^= std::hash<int64>()(key.block) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+	hash ^= std::hash<int32>()(key.device) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+
+	return( hash );
+}
+
+
+/*
+ * KeyEqual::operator()
+ *
+ * Description:
+ *		Equality test for the lookup key.
+ *
+ * Returns: bool
+ */
+
+bool fp_blockcache::KeyEqual::operator()(
+	const AFPBlockCacheKey& a,
+	const AFPBlockCacheKey& b
+	) const
+{
+	return(	(a.device == b.device)	&&
+			(a.node == b.node)		&&
+			(a.block == b.block)	);
+}
+
+
+/*
+ * NodeHash::operator()
+ *
+ * Description:
+ *		Hash function for the per file block lists.
+ *
+ * Returns: size_t
+ */
+
+size_t fp_blockcache::NodeHash::operator()(const node_ref& ref) const
+{
+	size_t	hash = std::hash<int64>()(ref.node);
+
+	hash ^= std::hash<int32>()(ref.device) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+
+	return( hash );
+}
+
+
+/*
+ * ShardFor()
+ *
+ * Description:
+ *		The shard a block lives in, picked by node and block so the
+ *		blocks of one file are spread over all the shards.
+ *
+ * Returns: AFPBlockCacheShard&
+ */
+
+fp_blockcache::AFPBlockCacheShard& fp_blockcache::ShardFor(const AFPBlockCacheKey& key)
+{
+	uint64	hash = (uint64)KeyHash()(key) * 0x9e3779b97f4a7c15ULL;
+
+	return( mShards[(hash >> 32) % BLOCKCACHE_SHARDS] );
+}
+
+
+/*
+ * NodeShardFor()
+ *
+ * Description:
+ *		The shard holding a file's list of cached blocks, picked by
+ *		node only.
+ *
+ * Returns: AFPBlockCacheNodeShard&
+ */
+
+fp_blockcache::AFPBlockCacheNodeShard& fp_blockcache::NodeShardFor(dev_t device, ino_t node)
+{
+	uint64	hash = ((uint64)node * 0x9e3779b97f4a7c15ULL) ^ (uint64)device;
+
+	return( mNodeShards[(hash >> 32) % BLOCKCACHE_SHARDS] );
+}
+
+
+/*
+ * Read()
+ *
+ * Description:
+ *		Read count bytes at offset from the data fork of file. Blocks
+ *		we don't have are read whole from the file and kept. A block
+ *		is only used if the file's modification time and size haven't
+ *		changed since we read it, which catches local apps changing
+ *		the file behind our back.
+ *
+ * Returns: Bytes read or a negative error
+ */
+
+ssize_t fp_blockcache::Read(
+	fp_storage_node*	file,
+	const node_ref&	nodeRef,
+	off_t			offset,
+	void*			buffer,
+	size_t			count
+	)
+{
+	AFPBlockCacheNodeShard&	nodeShard	= NodeShardFor(nodeRef.device, nodeRef.node);
+	int8*					dest		= (int8*)buffer;
+	size_t					done		= 0;
+	FP_STORAGE_STAT			st;
+
+	if (file->GetStat(&st) != B_OK) {
+		return( file->ReadAt(offset, buffer, count) );
+	}
+
+	bigtime_t	modified = st.modifiedUsecs;
+
+	while(done < count)
+	{
+		off_t				position	= offset + done;
+		AFPBlockCacheKey	key			= { nodeRef.device, nodeRef.node, position / BLOCKCACHE_BLOCK_SIZE };
+		AFPBlockCacheShard&	shard		= ShardFor(key);
+		size_t				within		= position % BLOCKCACHE_BLOCK_SIZE;
+		size_t				length		= 0;
+		size_t				n			= 0;
+		bool				found		= false;
+		uint32				generation	= 0;
+
+		{
+			std::lock_guard<std::mutex> lock(shard.lock);
+
+			ItemMap::iterator	entry = shard.index.find(key);
+
+			if (entry != shard.index.end())
+			{
+				ItemList::iterator	item = entry->second;
+
+				if ((item->modified == modified) && (item->size == st.size))
+				{
+					shard.items.splice(shard.items.begin(), shard.items, item);
+
+					length	= item->length;
+					n		= (within < length) ? std::min(count - done, length - within) : 0;
+					found	= true;
+
+					memcpy(dest + done, item->data.get() + within, n);
+				}
+				else
+				{
+					RemoveItem(shard, item);
+				}
+			}
+
+			generation = nodeShard.generation;
+		}
+
+		if (found)
+		{
+			mHits++;
+		}
+		else
+		{
+			//
+			//Read the whole block without holding the shard lock.
+			//
+			std::unique_ptr<int8[]>	data(new (std::nothrow) int8[BLOCKCACHE_BLOCK_SIZE]);
+			ssize_t					result;
+
+			mMisses++;
+
+			if (data == nullptr)
+			{
+				result = file->ReadAt(position, dest + done, count - done);
+
+				return( (result < B_OK) ? ((done > 0) ? (ssize_t)done : result) : (ssize_t)(done + result) );
+			}
+
+			result = file->ReadAt(key.block * BLOCKCACHE_BLOCK_SIZE, data.get(), BLOCKCACHE_BLOCK_SIZE);
+
+			if (result < B_OK) {
+				return( (done > 0) ? (ssize_t)done : result );
+			}
+
+			length	= result;
+			n		= (within < length) ? std::min(count - done, length - within) : 0;
+
+			memcpy(dest + done, data.get() + within, n);
+
+			//
+			//Short blocks at the end of a file only take what they need.
+			//
+			if ((length > 0) && (length < BLOCKCACHE_BLOCK_SIZE))
+			{
+				std::unique_ptr<int8[]>	shortData(new (std::nothrow) int8[length]);
+
+				if (shortData != nullptr)
+				{
+					memcpy(shortData.get(), data.get(), length);
+					data = std::move(shortData);
+				}
+			}
+
+			bool	added = false;
+
+			if (length > 0)
+			{
+				std::lock_guard<std::mutex> lock(shard.lock);
+
+				if (shard.index.find(key) == shard.index.end())
+				{
+					std::lock_guard<std::mutex> nodeLock(nodeShard.lock);
+
+					//
+					//Don't add what we read if the file was invalidated
+					//while we were at the disk, or someone else beat us
+					//to it.
+					//
+					if (generation == nodeShard.generation)
+					{
+						nodeShard.blocks[nodeRef].insert(key.block);
+
+						shard.items.push_front(AFPBlockCacheItem());
+
+						AFPBlockCacheItem&	item = shard.items.front();
+
+						item.key		= key;
+						item.modified	= modified;
+						item.size		= st.size;
+						item.length		= length;
+						item.data		= std::move(data);
+
+						shard.index[key] = shard.items.begin();
+
+						mBytes += length;
+						added	= true;
+					}
+				}
+			}
+
+			if ((added) && (mBytes > BLOCKCACHE_MAX_BYTES)) {
+				Trim(shard);
+			}
+		}
+
+		done += n;
+
+		//
+		//A short block means we hit the end of the file.
+		//
+		if ((n == 0) || (length < BLOCKCACHE_BLOCK_SIZE)) {
+			break;
+		}
+	}
+
+	return( done );
+}
+
+
+/*
+ * InvalidateNode()
+ *
+ * Description:
+ *		The file was written to or its size changed. Drop all of its
+ *		blocks.
+ *
+ * Returns: none
+ */
+
+void fp_blockcache::InvalidateNode(const node_ref& nodeRef)
+{
+	AFPBlockCacheNodeShard&	nodeShard = NodeShardFor(nodeRef.device, nodeRef.node);
+	std::unordered_set<int64>	blocks;
+
+	//
+	//Take the file's block list so we only visit the shards holding
+	//its blocks. Bumping the generation keeps reads that were already
+	//at the disk from putting stale blocks back.
+	//
+	{
+		std::lock_guard<std::mutex> nodeLock(nodeShard.lock);
+
+		NodeBlockMap::iterator	entry = nodeShard.blocks.find(nodeRef);
+
+		nodeShard.generation++;
+
+		if (entry == nodeShard.blocks.end()) {
+			return;
+		}
+
+		blocks.swap(entry->second);
+		nodeShard.blocks.erase(entry);
+	}
+
+	for (int64 block : blocks)
+	{
+		AFPBlockCacheKey	key		= { nodeRef.device, nodeRef.node, block };
+		AFPBlockCacheShard&	shard	= ShardFor(key);
+
+		std::lock_guard<std::mutex> lock(shard.lock);
+
+		ItemMap::iterator	entry = shard.index.find(key);
+
+		if (entry != shard.index.end()) {
+			RemoveItem(shard, entry->second);
+		}
+	}
+}
+
+
+/*
+ * Flush()
+ *
+ * Description:
+ *		Empty the cache.
+ *
+ * Returns: none
+ */
+
+void fp_blockcache::Flush()
+{
+	for (int32 i = 0; i < BLOCKCACHE_SHARDS; i++)
+	{
+		std::lock_guard<std::mutex> lock(mShards[i].lock);
+
+		while(!mShards[i].items.empty()) {
+			RemoveItem(mShards[i], mShards[i].items.begin());
+		}
+	}
+
+	for (int32 i = 0; i < BLOCKCACHE_SHARDS; i++)
+	{
+		std::lock_guard<std::mutex> nodeLock(mNodeShards[i].lock);
+
+		mNodeShards[i].generation++;
+		mNodeShards[i].blocks.clear();
+	}
+}
+
+
+/*
+ * HitRate()
+ *
+ * Description:
+ *
+ * Returns: Percentage of blocks that were found in the cache
+ */
+
+int32 fp_blockcache::HitRate()
+{
+	int64	hits	= mHits;
+	int64	total	= hits + mMisses;
+
+	return( (total > 0) ? (int32)((hits * 100) / total) : 0 );
+}
+
+
+/*
+ * MemoryUsage()
+ *
+ * Description:
+ *
+ * Returns: Bytes of file data currently held by the cache
+ */
+
+size_t fp_blockcache::MemoryUsage()
+{
+	return( mBytes );
+}
+
+
+/*
+ * Trim()
+ *
+ * Description:
+ *		Bring the cache back under BLOCKCACHE_MAX_BYTES. The least
+ *		recently used block of each shard goes in turn, starting with
+ *		the shard that just grew, so no one shard is drained to make
+ *		room for another. No shard lock may be held.
+ *
+ * Returns: none
+ */
+
+void fp_blockcache::Trim(AFPBlockCacheShard& start)
+{
+	int32	index	= &start - mShards;
+	int32	idle	= 0;
+
+	while((mBytes > BLOCKCACHE_MAX_BYTES) && (idle < BLOCKCACHE_SHARDS))
+	{
+		AFPBlockCacheShard&	shard = mShards[index];
+
+		{
+			std::lock_guard<std::mutex> lock(shard.lock);
+
+			if (shard.items.empty())
+			{
+				idle++;
+			}
+			else
+			{
+				RemoveItem(shard, std::prev(shard.items.end()));
+				idle = 0;
+			}
+		}
+
+		index = (index + 1) % BLOCKCACHE_SHARDS;
+	}
+}
+
+
+/*
+ * RemoveItem()
+ *
+ * Description:
+ *		Remove an item from a shard and from its file's block list.
+ *		The shard lock must be held.
+ *
+ * Returns: none
+ */
+
+void fp_blockcache::RemoveItem(AFPBlockCacheShard& shard, ItemList::iterator item)
+{
+	node_ref				nodeRef(item->key.device, item->key.node);
+	AFPBlockCacheNodeShard&	nodeShard = NodeShardFor(nodeRef.device, nodeRef.node);
+
+	{
+		std::lock_guard<std::mutex> nodeLock(nodeShard.lock);
+
+		NodeBlockMap::iterator	entry = nodeShard.blocks.find(nodeRef);
+
+		if (entry != nodeShard.blocks.end())
+		{
+			entry->second.erase(item->key.block);
+
+			if (entry->second.empty()) {
+				nodeShard.blocks.erase(entry);
+			}
+		}
+	}
+
+	mBytes -= item->length;
+	shard.index.erase(item->key);
+	shard.items.erase(item);
+}
@@ -0,0 +1,120 @@
+#ifndef __fp_blockcache__
+#define __fp_blockcache__
+
+#include "fp_storage.h"
+#include "afp_os.h"
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+//
+//Data fork contents are cached in blocks of this size, keyed by the
+//file's node and the block index. The total across all shards is
+//bounded by BLOCKCACHE_MAX_BYTES, however the blocks are spread.
+//
+#define BLOCKCACHE_BLOCK_SIZE		(64 * 1024)
+#define BLOCKCACHE_MAX_BYTES		(64 * 1024 * 1024)
+
+//
+//The blocks of a file are spread over the shards by block index, so
+//one hot file can use the whole budget and its readers don't all
+//queue on one lock. Which blocks each file has cached is kept apart,
+//sharded by node, for invalidation.
+//
+#define BLOCKCACHE_SHARDS			16
+
+
+typedef struct
+{
+	dev_t		device;
+	ino_t		node;
+	int64		block;
+}AFPBlockCacheKey;
+
+
+class fp_blockcache
+{
+public:
+						fp_blockcache();
+	virtual				~fp_blockcache();
+
+	virtual ssize_t		Read(
+							fp_storage_node*	file,
+							const node_ref&	nodeRef,
+							off_t			offset,
+							void*			buffer,
+							size_t			count
+							);
+
+	virtual void		InvalidateNode(const node_ref& nodeRef);
+	virtual void		Flush();
+
+	virtual int64		Hits()		{ return mHits;		}
+	virtual int64		Misses()	{ return mMisses;	}
+	virtual int32		HitRate();
+	virtual size_t		MemoryUsage();
+
+private:
+
+	typedef struct
+	{
+		AFPBlockCacheKey		key;
+		bigtime_t				modified;	//Modification time of the file when read
+		off_t					size;		//Size of the file when read
+		size_t					length;		//Less than a full block at the end of the file
+		std::unique_ptr<int8[]>	data;
+	}AFPBlockCacheItem;
+
+	struct KeyHash
+	{
+		size_t operator()(const AFPBlockCacheKey& key) const;
+	};
+
+	struct KeyEqual
+	{
+		bool operator()(const AFPBlockCacheKey& a, const AFPBlockCacheKey& b) const;
+	};
+
+	typedef std::list<AFPBlockCacheItem>		ItemList;
+	typedef std::unordered_map<AFPBlockCacheKey, ItemList::iterator, KeyHash, KeyEqual> ItemMap;
+
+	typedef struct
+	{
+		std::mutex			lock;
+		ItemList			items;
+		ItemMap				index;
+	}AFPBlockCacheShard;
+
+	struct NodeHash
+	{
+		size_t operator()(const node_ref& ref) const;
+	};
+
+	typedef std::unordered_map<node_ref, std::unordered_set<int64>, NodeHash> NodeBlockMap;
+
+	typedef struct
+	{
+		std::mutex				lock;
+		NodeBlockMap			blocks;		//Cached block indexes of each file
+		std::atomic<uint32>		generation;	//Bumped when one of its files is invalidated
+	}AFPBlockCacheNodeShard;
+
+	AFPBlockCacheShard&		ShardFor(const AFPBlockCacheKey& key);
+	AFPBlockCacheNodeShard&	NodeShardFor(dev_t device, ino_t node);
+	void					RemoveItem(AFPBlockCacheShard& shard, ItemList::iterator item);
+	void					Trim(AFPBlockCacheShard& start);
+
+	AFPBlockCacheShard		mShards[BLOCKCACHE_SHARDS];
+	AFPBlockCacheNodeShard	mNodeShards[BLOCKCACHE_SHARDS];
+	std::atomic<size_t>		mBytes;
+	std::atomic<int64>		mHits;
+	std::atomic<int64>		mMisses;
+};
+
+extern fp_blockcache	gAFPBlockCache;
+
+#endif //__fp_blockcache__
@@ -0,0 +1,958 @@
+#include "fp_storage.h"
+#include <algorithm>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <strings.h>
+
+#include "debug.h"
+#include "fp_catalog.h"
+#include "fp_objects.h"
+#include "finder_info.h"
+
+/*
+ * fp_catalog()
+ *
+ * Description:
+ *		The catalog is an in-memory copy of the metadata FPCatSearch can
+ *		search on for every object in a shared volume. It is built by a
+ *		background thread and kept current by the AFP calls that change
+ *		the volume.
+ *
+ * Returns:
+ */
+
+fp_catalog::fp_catalog(const node_ref& rootRef)
+{
+	mRootRef		= rootRef;
+	mThread			= -1;
+	mGeneration		= 0;
+	mLastBuild		= 0;
+	mReady			= false;
+	mBuilding		= false;
+	mNeedsRebuild	= false;
+	mQuit			= false;
+}
+
+
+/*
+ * ~fp_catalog()
+ *
+ * Description:
+ *		Stops the build thread and waits for it to go away.
+ *
+ * Returns:
+ */
+
+fp_catalog::~fp_catalog()
+{
+	status_t	result;
+
+	mQuit = true;
+
+	if (mThread >= 0) {
+
+		wait_for_thread(mThread, &result);
+	}
+}
+
+
+/*
+ * StartBuilding()
+ *
+ * Description:
+ *		Spawns the thread that builds the catalog and periodically
+ *		rebuilds it.
+ *
+ * Returns: none
+ */
+
+void fp_catalog::StartBuilding()
+{
+	if (mThread >= 0) {
+		return;
+	}
+
+	mThread = spawn_thread(
+				BuildThread,
+				"afp_catalog",
+				B_LOW_PRIORITY,
+				this
+				);
+
+	if (mThread >= 0) {
+
+		resume_thread(mThread);
+	}
+	else {
+
+		DBGWRITE(dbg_level_error, "Failed to spawn catalog thread!\n");
+	}
+}
+
+
+/*
+ * WaitForReady()
+ *
+ * Description:
+ *		Waits for the first build of the catalog to complete.
+ *
+ * Returns: true if the catalog is ready, false if we timed out.
+ */
+
+bool fp_catalog::WaitForReady(bigtime_t timeout)
+{
+	bigtime_t	giveUp = system_time() + timeout;
+
+	do
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			if (mReady) {
+				return( true );
+			}
+		}
+
+		snooze(100000);
+
+	}while(system_time() < giveUp);
+
+	return( false );
+}
+
+
+/*
+ * GetGeneration()
+ *
+ * Description:
+ *		Every full rebuild moves records around, so it gets a new
+ *		generation number. Catalog positions from an older generation
+ *		are no longer valid.
+ *
+ * Returns: uint32
+ */
+
+uint32 fp_catalog::GetGeneration()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	return( mGeneration );
+}
+
+
+/*
+ * UpdateEntry()
+ *
+ * Description:
+ *		Re-read an object's metadata and update (or add) its record.
+ *		Call this after an object is created, moved, renamed or had
+ *		its parameters changed.
+ *
+ * Returns: none
+ */
+
+void fp_catalog::UpdateEntry(fp_storage_entry* entry)
+{
+	AFP_CATALOG_RECORD	record;
+	entry_ref			ref;
+	ino_t				oldParent	= CATALOG_NO_PARENT;
+
+	if ((entry == NULL) || (entry->GetRef(&ref) != B_OK)) {
+		return;
+	}
+
+	if (!ReadRecord(entry, ref.directory, &record)) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	//
+	//If a rebuild is in progress it may have already passed this
+	//object, so remember to apply the change again afterwards.
+	//
+	if (mBuilding) {
+
+		mPendingUpdates.push_back(ref);
+	}
+
+	oldParent = ApplyUpdate(record);
+
+	if (oldParent != record.parent)
+	{
+		ExpectChange(record.parent);
+
+		if (oldParent != CATALOG_NO_PARENT) {
+			ExpectChange(oldParent);
+		}
+	}
+}
+
+
+/*
+ * RemoveEntry()
+ *
+ * Description:
+ *		Convenience version of RemoveEntry() below. This has to be called
+ *		before the object is removed from disk.
+ *
+ * Returns: none
+ */
+
+void fp_catalog::RemoveEntry(fp_storage_entry* entry)
+{
+	node_ref	nodeRef;
+	entry_ref	ref;
+
+	if ((entry == NULL)						||
+		(entry->GetNodeRef(&nodeRef) != B_OK)	||
+		(entry->GetRef(&ref) != B_OK)			)
+	{
+		return;
+	}
+
+	RemoveEntry(nodeRef, ref.directory);
+}
+
+
+/*
+ * RemoveEntry()
+ *
+ * Description:
+ *		Forget about an object that has been deleted.
+ *
+ * Returns: none
+ */
+
+void fp_catalog::RemoveEntry(const node_ref& nodeRef, ino_t parent)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	if (mBuilding) {
+
+		mPendingRemoves.push_back(nodeRef.node);
+	}
+
+	ApplyRemove(nodeRef.node);
+	ExpectChange(parent);
+}
+
+
+/*
+ * MarkStale()
+ *
+ * Description:
+ *		Ask the build thread to rescan the volume as soon as it can. Used
+ *		when we find the catalog disagrees with what's on disk.
+ *
+ * Returns: none
+ */
+
+void fp_catalog::MarkStale()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	mNeedsRebuild = true;
+}
+
+
+/*
+ * DirectoryChanged()
+ *
+ * Description:
+ *		Something was added to, removed from or moved out of a
+ *		directory. Changes made through AFP have already been counted,
+ *		so we only go to the disk for the ones we didn't make.
+ *
+ * Returns: none
+ */
+
+void fp_catalog::DirectoryChanged(ino_t directory)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		if (mIndex.find(directory) == mIndex.end()) {
+			return;
+		}
+
+		std::unordered_map<ino_t, AFP_CATALOG_ECHO>::iterator echo = mEchoes.find(directory);
+
+		if (echo != mEchoes.end())
+		{
+			bool	ours = (echo->second.expires > system_time());
+
+			if ((!ours) || (--echo->second.count == 0)) {
+				mEchoes.erase(echo);
+			}
+
+			if (ours) {
+				return;
+			}
+		}
+	}
+
+	RefreshOffspring(directory);
+}
+
+
+/*
+ * Search()
+ *
+ * Description:
+ *		Run through the catalog starting at startIndex looking for
+ *		records matching the spec. At most maxMatches are returned.
+ *		nextIndex is set to where the next search should resume.
+ *
+ *		A generation of zero means the client is starting a new search,
+ *		in which case it is set to the current generation on return.
+ *
+ * Returns: afpEofError if the whole catalog has been searched,
+ *			afpCatalogChanged if the position is from an older
+ *			generation, AFP_OK otherwise.
+ */
+
+AFPERROR fp_catalog::Search(
+	const AFP_CATALOG_SPEC&			spec,
+	uint32*							generation,
+	uint32							startIndex,
+	int32							maxMatches,
+	std::vector<AFP_CATALOG_MATCH>&	matches,
+	uint32*							nextIndex
+	)
+{
+	uint32	index = startIndex;
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	if (*generation == 0)
+	{
+		*generation	= mGeneration;
+		index		= 0;
+	}
+	else if (*generation != mGeneration)
+	{
+		DBGWRITE(dbg_level_info, "Catalog position from generation %lu, now %lu\n", *generation, mGeneration);
+		return( afpCatalogChanged );
+	}
+
+	while((index < mRecords.size()) && ((int32)matches.size() < maxMatches))
+	{
+		const AFP_CATALOG_RECORD& record = mRecords[index];
+
+		if ((!record.isDeleted) && Matches(record, spec))
+		{
+			AFP_CATALOG_MATCH	match;
+
+			match.index			= index;
+			match.parent		= record.parent;
+			match.isDirectory	= record.isDirectory;
+			match.name			= record.name;
+
+			matches.push_back(match);
+		}
+
+		index++;
+	}
+
+	*nextIndex = index;
+
+	return( (index >= mRecords.size()) ? afpEofError : AFP_OK );
+}
+
+
+/*
+ * BuildThread() [STATIC]
+ *
+ * Description:
+ *		Builds the catalog for the first time then keeps rebuilding it
+ *		every so often, or when asked to by MarkStale().
+ *
+ * Returns: B_OK
+ */
+
+status_t fp_catalog::BuildThread(void* data)
+{
+	fp_catalog*	catalog = (fp_catalog*)data;
+
+	while(!catalog->mQuit)
+	{
+		bool	rebuild = false;
+
+		{
+			std::lock_guard<std::mutex> lock(catalog->mMutex);
+
+			rebuild = (	(!catalog->mReady)			||
+						(catalog->mNeedsRebuild)	||
+						((system_time() - catalog->mLastBuild) > CATALOG_REBUILD_INTERVAL)
+						);
+		}
+
+		if (rebuild) {
+
+			catalog->Rebuild();
+		}
+
+		snooze(1000000);
+	}
+
+	return( B_OK );
+}
+
+
+/*
+ * Rebuild()
+ *
+ * Description:
+ *		Walk the entire volume and build a fresh set of records. The
+ *		new set replaces the old one in a single step so searches
+ *		running during the build see the old catalog.
+ *
+ * Returns: none
+ */
+
+void fp_catalog::Rebuild()
+{
+	std::vector<AFP_CATALOG_RECORD>		records;
+	std::unordered_map<ino_t, uint32>	index;
+	std::vector<ino_t>					directories;
+	std::vector<entry_ref>				updates;
+	std::vector<ino_t>					removes;
+	bigtime_t							started	= system_time();
+	size_t								total	= 0;
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		mBuilding		= true;
+		mNeedsRebuild	= false;
+
+		mPendingUpdates.clear();
+		mPendingRemoves.clear();
+	}
+
+	DBGWRITE(dbg_level_info, "Building catalog for device %ld\n", mRootRef.device);
+
+	directories.push_back(mRootRef.node);
+
+	while((!directories.empty()) && (!mQuit))
+	{
+		node_ref	dirRef;
+		fp_storage_entry	entry;
+		int32		count	= 0;
+
+		dirRef.device	= mRootRef.device;
+		dirRef.node		= directories.back();
+
+		directories.pop_back();
+
+		fp_storage_dir	dir(&dirRef);
+
+		if (dir.InitCheck() != B_OK) {
+			continue;
+		}
+
+		while(dir.GetNextEntry(&entry, false) == B_OK)
+		{
+			AFP_CATALOG_RECORD	record;
+
+			if (!ReadRecord(&entry, dirRef.node, &record)) {
+				continue;
+			}
+
+			count++;
+
+			if (record.isDirectory) {
+
+				directories.push_back(record.node);
+			}
+
+			index[record.node] = records.size();
+			records.push_back(record);
+		}
+
+		//
+		//Now that we've counted them, fill in the directory's offspring.
+		//
+		std::unordered_map<ino_t, uint32>::iterator found = index.find(dirRef.node);
+
+		if (found != index.end()) {
+
+			records[found->second].offspring = count;
+		}
+	}
+
+	if (mQuit) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		mRecords.swap(records);
+		mIndex.swap(index);
+
+		mGeneration++;
+		mLastBuild	= system_time();
+		mReady		= true;
+		mBuilding	= false;
+
+		updates.swap(mPendingUpdates);
+		removes.swap(mPendingRemoves);
+
+		total = mRecords.size();
+	}
+
+	//
+	//Replay anything that changed while we were walking the volume.
+	//
+	for (size_t i = 0; i < updates.size(); i++)
+	{
+		fp_storage_entry	entry(&updates[i]);
+		AFP_CATALOG_RECORD	record;
+
+		if (ReadRecord(&entry, updates[i].directory, &record))
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			ApplyUpdate(record);
+		}
+	}
+
+	for (size_t i = 0; i < removes.size(); i++)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		ApplyRemove(removes[i]);
+	}
+
+	DBGWRITE(dbg_level_info, "Catalog built, %lu records in %lld ms\n",
+			total, (system_time() - started) / 1000);
+}
+
+
+/*
+ * Matches()
+ *
+ * Description:
+ *		Compare a catalog record against the search criteria.
+ *
+ * Returns: true if the record matches.
+ */
+
+bool fp_catalog::Matches(
+	const AFP_CATALOG_RECORD&	record,
+	const AFP_CATALOG_SPEC&		spec
+	)
+{
+	uint32	bitmap = spec.reqBitmap;
+
+	if ((record.isDirectory && !spec.wantDirs) || (!record.isDirectory && !spec.wantFiles)) {
+		return( false );
+	}
+
+	if (bitmap & kFPFileAttributes)
+	{
+		if ((record.attributes ^ spec.attrValue) & spec.attrMask) {
+			return( false );
+		}
+	}
+
+	if (bitmap & kFPParentID)
+	{
+		uint32	parent = (record.parent == mRootRef.node) ? kRootDirID : (uint32)record.parent;
+
+		if ((parent < spec.parentLow) || (parent > spec.parentHigh)) {
+			return( false );
+		}
+	}
+
+	if (bitmap & kFPCreateDate)
+	{
+		if ((record.createDate < spec.createLow) || (record.createDate > spec.createHigh)) {
+			return( false );
+		}
+	}
+
+	if (bitmap & kFPModDate)
+	{
+		if ((record.modDate < spec.modLow) || (record.modDate > spec.modHigh)) {
+			return( false );
+		}
+	}
+
+	if (bitmap & kFPFinderInfo)
+	{
+		for (size_t i = 0; i < sizeof(FINDER_INFO); i++)
+		{
+			if ((record.finderInfo[i] ^ spec.finfoValue[i]) & spec.finfoMask[i]) {
+				return( false );
+			}
+		}
+	}
+
+	if (bitmap & (kFPLongName | kFPUnicodeName))
+	{
+		bool	partial = ((bitmap & kFPCatPartialName) != 0);
+
+		if ((!NameMatches(record.name, spec.name, partial)) &&
+			(record.longName.empty() || !NameMatches(record.longName, spec.name, partial)))
+		{
+			return( false );
+		}
+	}
+
+	//
+	//Bit 9 is the data fork length for files and the offspring
+	//count for directories. We only use it for directories when
+	//the client is searching for nothing but directories.
+	//
+	if (bitmap & kFPDFLen)
+	{
+		if (record.isDirectory)
+		{
+			if ((!spec.wantFiles) &&
+				((record.offspring < spec.offspringLow) || (record.offspring > spec.offspringHigh)))
+			{
+				return( false );
+			}
+		}
+		else if ((record.dataLength < spec.dataLow) || (record.dataLength > spec.dataHigh))
+		{
+			return( false );
+		}
+	}
+
+	if ((bitmap & kFPExtDataForkLen) && (!record.isDirectory))
+	{
+		if ((record.dataLength < spec.dataLow) || (record.dataLength > spec.dataHigh)) {
+			return( false );
+		}
+	}
+
+	if ((bitmap & (kFPRFLen | kFPExtRsrcForkLen)) && (!record.isDirectory))
+	{
+		if ((record.rsrcLength < spec.rsrcLow) || (record.rsrcLength > spec.rsrcHigh)) {
+			return( false );
+		}
+	}
+
+	return( true );
+}
+
+
+/*
+ * ReadRecord() [STATIC]
+ *
+ * Description:
+ *		Fill in a catalog record from what's on disk. Unlike the
+ *		fp_objects routines, this never creates missing attributes.
+ *
+ * Returns: true if successful.
+ */
+
+bool fp_catalog::ReadRecord(
+	fp_storage_entry*	entry,
+	ino_t				parent,
+	AFP_CATALOG_RECORD*	record
+	)
+{
+	char					name[B_FILE_NAME_LENGTH];
+	node_ref				nodeRef;
+	FP_STORAGE_STAT			st;
+	FP_STORAGE_ATTR_INFO	info	= {0,0};
+	FINDER_INFO				finfo;
+	ssize_t					size	= 0;
+
+	if ((entry->GetNodeRef(&nodeRef) != B_OK)	||
+		(entry->GetStat(&st) != B_OK)			||
+		(entry->GetName(name) != B_OK)			)
+	{
+		return( false );
+	}
+
+	record->node		= nodeRef.node;
+	record->parent		= parent;
+	record->isDirectory	= st.isDirectory;
+	record->isDeleted	= false;
+	record->createDate	= TO_AFP_TIME(st.created);
+	record->modDate		= TO_AFP_TIME(st.modified);
+	record->dataLength	= record->isDirectory ? 0 : st.size;
+	record->rsrcLength	= 0;
+	record->attributes	= 0;
+	record->offspring	= 0;
+	record->name		= name;
+
+	fp_storage_node		node(entry);
+
+	if (node.InitCheck() == B_OK)
+	{
+		size = node.ReadAttr(AFP_ATTR_ATTRIBUTE, 0, &record->attributes, sizeof(int16));
+
+		if (size != sizeof(int16)) {
+			record->attributes = 0;
+		}
+
+		size = node.ReadAttr(AFP_FINFO_ATTRIBUTE, 0, &finfo, sizeof(finfo));
+
+		if (size != sizeof(finfo))
+		{
+			memset(&finfo, 0, sizeof(finfo));
+
+			if (!record->isDirectory) {
+
+				FinderInfoBasedOnExtension(name, &finfo);
+			}
+		}
+
+		if (node.GetAttrInfo(AFP_RSRC_ATTRIBUTE, &info) == B_OK) {
+
+			record->rsrcLength = info.size;
+		}
+
+		size = node.ReadAttr(AFP_ATTR_LONGNAME, 0, name, sizeof(name) - 1);
+
+		if (size > 0)
+		{
+			name[size]			= 0;
+			record->longName	= name;
+		}
+	}
+	else
+	{
+		memset(&finfo, 0, sizeof(finfo));
+	}
+
+	//
+	//Store the finder info the way it goes out on the wire.
+	//
+	finfo.fdFlags		= htons(finfo.fdFlags);
+	finfo.fdLocation.x	= htons(finfo.fdLocation.x);
+	finfo.fdLocation.y	= htons(finfo.fdLocation.y);
+	finfo.fdFldr		= htons(finfo.fdFldr);
+
+	memcpy(record->finderInfo, &finfo, sizeof(finfo));
+
+	return( true );
+}
+
+
+/*
+ * NameMatches() [STATIC]
+ *
+ * Description:
+ *		Case insensitive name compare. If partial is true the pattern
+ *		only has to appear somewhere in the name.
+ *
+ * Returns: true if the name matches.
+ */
+
+bool fp_catalog::NameMatches(
+	const std::string&	name,
+	const char*			pattern,
+	bool				partial
+	)
+{
+	size_t	patternLen = strlen(pattern);
+
+	if (!partial)
+	{
+		return( (name.size() == patternLen) &&
+				(strncasecmp(name.c_str(), pattern, patternLen) == 0) );
+	}
+
+	if (patternLen == 0) {
+		return( true );
+	}
+
+	for (size_t i = 0; (i + patternLen) <= name.size(); i++)
+	{
+		if (strncasecmp(name.c_str() + i, pattern, patternLen) == 0) {
+			return( true );
+		}
+	}
+
+	return( false );
+}
+
+
+/*
+ * ApplyUpdate()
+ *
+ * Description:
+ *		Store a record, replacing the existing one for the same node.
+ *		The offspring counts of the directories it left and arrived in
+ *		are adjusted. Applying the same record twice changes nothing.
+ *		The caller must be holding mMutex.
+ *
+ * Returns: The parent the object had before, CATALOG_NO_PARENT if
+ *			it is new
+ */
+
+ino_t fp_catalog::ApplyUpdate(const AFP_CATALOG_RECORD& record)
+{
+	std::unordered_map<ino_t, uint32>::iterator found = mIndex.find(record.node);
+	ino_t	oldParent = CATALOG_NO_PARENT;
+
+	if (found != mIndex.end())
+	{
+		//
+		//Keep the offspring count, it's maintained separately.
+		//
+		int32	offspring = mRecords[found->second].offspring;
+
+		oldParent = mRecords[found->second].parent;
+
+		mRecords[found->second]				= record;
+		mRecords[found->second].offspring	= offspring;
+	}
+	else
+	{
+		//
+		//New records always go on the end so existing catalog
+		//positions stay valid.
+		//
+		mIndex[record.node] = mRecords.size();
+		mRecords.push_back(record);
+	}
+
+	if (oldParent != record.parent)
+	{
+		AdjustOffspring(record.parent, 1);
+
+		if (oldParent != CATALOG_NO_PARENT) {
+			AdjustOffspring(oldParent, -1);
+		}
+	}
+
+	return( oldParent );
+}
+
+
+/*
+ * ApplyRemove()
+ *
+ * Description:
+ *		Mark a record as deleted. We don't erase it since that would
+ *		move every record after it and break catalog positions held by
+ *		clients. The caller must be holding mMutex.
+ *
+ * Returns: The parent the object had, -1 if we didn't know it
+ */
+
+ino_t fp_catalog::ApplyRemove(ino_t node)
+{
+	std::unordered_map<ino_t, uint32>::iterator found = mIndex.find(node);
+	ino_t	parent = -1;
+
+	if (found != mIndex.end())
+	{
+		parent = mRecords[found->second].parent;
+
+		mRecords[found->second].isDeleted = true;
+		mRecords[found->second].name.clear();
+		mRecords[found->second].longName.clear();
+
+		mIndex.erase(found);
+
+		AdjustOffspring(parent, -1);
+	}
+
+	return( parent );
+}
+
+
+/*
+ * AdjustOffspring()
+ *
+ * Description:
+ *		Add delta to a directory's offspring count. The caller must be
+ *		holding mMutex.
+ *
+ * Returns: none
+ */
+
+void fp_catalog::AdjustOffspring(ino_t directory, int32 delta)
+{
+	std::unordered_map<ino_t, uint32>::iterator found = mIndex.find(directory);
+
+	if (found != mIndex.end()) {
+
+		mRecords[found->second].offspring = std::max(mRecords[found->second].offspring + delta, (int32)0);
+	}
+}
+
+
+/*
+ * ExpectChange()
+ *
+ * Description:
+ *		We changed what's in a directory. If the node monitor is
+ *		watching it, it will tell us shortly, and DirectoryChanged()
+ *		must not count that as someone else's change. The caller must
+ *		be holding mMutex.
+ *
+ * Returns: none
+ */
+
+void fp_catalog::ExpectChange(ino_t directory)
+{
+	bigtime_t	now = system_time();
+
+	//
+	//Most directories aren't watched and the echo never comes, so
+	//forget the ones that are overdue now and then.
+	//
+	if (mEchoes.size() >= 256)
+	{
+		for (std::unordered_map<ino_t, AFP_CATALOG_ECHO>::iterator echo = mEchoes.begin(); echo != mEchoes.end(); )
+		{
+			if (echo->second.expires <= now) {
+				echo = mEchoes.erase(echo);
+			}
+			else {
+				echo++;
+			}
+		}
+	}
+
+	AFP_CATALOG_ECHO&	echo = mEchoes[directory];
+
+	echo.count		= (echo.expires > now) ? echo.count + 1 : 1;
+	echo.expires	= now + CATALOG_ECHO_WINDOW;
+}
+
+
+/*
+ * RefreshOffspring()
+ *
+ * Description:
+ *		Recount the number of objects in a directory from the disk.
+ *
+ * Returns: none
+ */
+
+void fp_catalog::RefreshOffspring(ino_t directory)
+{
+	node_ref	dirRef;
+
+	dirRef.device	= mRootRef.device;
+	dirRef.node		= directory;
+
+	fp_storage_dir	dir(&dirRef);
+
+	if (dir.InitCheck() != B_OK) {
+		return;
+	}
+
+	int32	count = dir.CountEntries();
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	std::unordered_map<ino_t, uint32>::iterator found = mIndex.find(directory);
+
+	if (found != mIndex.end()) {
+
+		mRecords[found->second].offspring = count;
+	}
+}
@@ -0,0 +1,209 @@
+#ifndef __fp_catalog__
+#define __fp_catalog__
+
+#include "fp_storage.h"
+#include "afp_os.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "afp.h"
+
+//
+//How often we rescan the whole volume to pick up changes made by
+//local applications (AFP changes are applied incrementally).
+//
+#define CATALOG_REBUILD_INTERVAL	(15LL * 60LL * 1000000LL)
+
+//
+//How long a search will wait on the very first index build before
+//giving up and telling the client to try again.
+//
+#define CATALOG_READY_TIMEOUT		(10 * 1000000)
+
+//
+//How long (in microseconds) we expect the node monitor to take to
+//tell us about a change we made ourselves.
+//
+#define CATALOG_ECHO_WINDOW			(2 * 1000000)
+
+//
+//Size of the opaque catalog position passed back and forth with
+//the client in FPCatSearch.
+//
+#define CATALOG_POSITION_SIZE		16
+
+//
+//What ApplyUpdate() hands back for an object that wasn't in the
+//catalog yet. ino_t is unsigned on some platforms, so test for this
+//rather than for a negative node.
+//
+#define CATALOG_NO_PARENT			((ino_t)-1)
+
+//
+//FPCatSearch request bitmap bits that aren't part of the file and
+//directory parameter bitmaps.
+//
+enum
+{
+	kFPCatPartialName	= (int32)0x80000000
+};
+
+
+//
+//One file or directory in the volume as seen by the last scan. The
+//finder info is kept in network byte order so it can be compared
+//against the client's search spec directly.
+//
+typedef struct
+{
+	ino_t			node;
+	ino_t			parent;
+	bool			isDirectory;
+	bool			isDeleted;
+	int16			attributes;
+	uint32			createDate;
+	uint32			modDate;
+	uint8			finderInfo[sizeof(FINDER_INFO)];
+	off_t			dataLength;
+	off_t			rsrcLength;
+	int32			offspring;
+	std::string		name;
+	std::string		longName;
+}AFP_CATALOG_RECORD;
+
+
+//
+//The search criteria extracted from the two specifications in an
+//FPCatSearch request. Low and high hold the range for items that
+//are ranges, value and mask for items that are bit compared.
+//
+typedef struct
+{
+	uint32			reqBitmap;
+	bool			wantFiles;
+	bool			wantDirs;
+	int16			attrValue;
+	int16			attrMask;
+	uint32			parentLow;
+	uint32			parentHigh;
+	uint32			createLow;
+	uint32			createHigh;
+	uint32			modLow;
+	uint32			modHigh;
+	uint8			finfoValue[sizeof(FINDER_INFO)];
+	uint8			finfoMask[sizeof(FINDER_INFO)];
+	char			name[B_FILE_NAME_LENGTH];
+	off_t			dataLow;
+	off_t			dataHigh;
+	off_t			rsrcLow;
+	off_t			rsrcHigh;
+	int32			offspringLow;
+	int32			offspringHigh;
+}AFP_CATALOG_SPEC;
+
+
+//
+//A search hit. index is where the record lives in the catalog so the
+//search can be resumed from the next one.
+//
+typedef struct
+{
+	uint32			index;
+	ino_t			parent;
+	bool			isDirectory;
+	std::string		name;
+}AFP_CATALOG_MATCH;
+
+
+class fp_catalog
+{
+public:
+						fp_catalog(const node_ref& rootRef);
+	virtual				~fp_catalog();
+
+	virtual void		StartBuilding();
+	virtual bool		WaitForReady(bigtime_t timeout);
+	virtual uint32		GetGeneration();
+
+	//
+	//Incremental updates from the AFP calls that change the volume.
+	//
+	virtual void		UpdateEntry(fp_storage_entry* entry);
+	virtual void		RemoveEntry(fp_storage_entry* entry);
+	virtual void		RemoveEntry(const node_ref& nodeRef, ino_t parent);
+	virtual void		MarkStale();
+
+	//
+	//The node monitor saw a directory change. Unless it was one of
+	//ours, its offspring count is taken again.
+	//
+	virtual void		DirectoryChanged(ino_t directory);
+
+	virtual AFPERROR	Search(
+							const AFP_CATALOG_SPEC&			spec,
+							uint32*							generation,
+							uint32							startIndex,
+							int32							maxMatches,
+							std::vector<AFP_CATALOG_MATCH>&	matches,
+							uint32*							nextIndex
+							);
+
+private:
+
+	static status_t		BuildThread(void* data);
+
+	virtual void		Rebuild();
+	virtual bool		Matches(
+							const AFP_CATALOG_RECORD&	record,
+							const AFP_CATALOG_SPEC&		spec
+							);
+
+	static bool			ReadRecord(
+							fp_storage_entry*			entry,
+							ino_t				parent,
+							AFP_CATALOG_RECORD*	record
+							);
+
+	static bool			NameMatches(
+							const std::string&	name,
+							const char*			pattern,
+							bool				partial
+							);
+
+	ino_t				ApplyUpdate(const AFP_CATALOG_RECORD& record);
+	ino_t				ApplyRemove(ino_t node);
+	void				AdjustOffspring(ino_t directory, int32 delta);
+	void				ExpectChange(ino_t directory);
+	void				RefreshOffspring(ino_t directory);
+
+	//
+	//Changes we made to a directory that the node monitor may still
+	//tell us about.
+	//
+	typedef struct
+	{
+		int32			count;
+		bigtime_t		expires;
+	}AFP_CATALOG_ECHO;
+
+	std::mutex			mMutex;
+	std::vector<AFP_CATALOG_RECORD>		mRecords;
+	std::unordered_map<ino_t, uint32>	mIndex;
+	std::vector<entry_ref>				mPendingUpdates;
+	std::vector<ino_t>					mPendingRemoves;
+	std::unordered_map<ino_t, AFP_CATALOG_ECHO>	mEchoes;
+
+	node_ref			mRootRef;
+	thread_id			mThread;
+	uint32				mGeneration;
+	bigtime_t			mLastBuild;
+	bool				mReady;
+	bool				mBuilding;
+	bool				mNeedsRebuild;
+	volatile bool		mQuit;
+};
+
+#endif //__fp_catalog__
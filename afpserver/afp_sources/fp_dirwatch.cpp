@@ -0,0 +1,320 @@
+#include <algorithm>
+
+#include "afp_os.h"
+
+#include "debug.h"
+#include "afpvolume.h"
+#include "fp_dirwatch.h"
+
+fp_dirwatch		gAFPDirWatch;
+
+//
+//How often (in microseconds) we drop sessions that have lost interest
+//and stop watching directories nobody is looking at.
+//
+#define DIRWATCH_PRUNE_INTERVAL		(60 * 1000000LL)
+
+/*
+ * fp_dirwatch()
+ *
+ * Description:
+ *		Keeps track of which sessions have recently enumerated which
+ *		directories, so a change to a directory is only reported to
+ *		the clients that have it on screen. Changes come from our own
+ *		AFP calls and from node monitors on the watched directories.
+ *
+ * Returns:
+ */
+
+fp_dirwatch::fp_dirwatch()
+{
+	mPending	= 0;
+	mWatched	= 0;
+	mLastPrune	= 0;
+}
+
+
+/*
+ * ~fp_dirwatch()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_dirwatch::~fp_dirwatch()
+{
+}
+
+
+/*
+ * Enumerated()
+ *
+ * Description:
+ *		A session enumerated a directory. It's interested in changes
+ *		to it for a while. The first time we see a directory we try to
+ *		put a node monitor on it.
+ *
+ * Returns: none
+ */
+
+void fp_dirwatch::Enumerated(afp_session* session, const node_ref& dirRef)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	DirMap::iterator	dir = mDirs.find(dirRef);
+
+	if (dir == mDirs.end())
+	{
+		AFPDirInterest	interest;
+
+		interest.changed	= 0;
+		interest.watched	= false;
+
+		dir = mDirs.emplace(dirRef, interest).first;
+	}
+
+	dir->second.sessions[session] = system_time();
+
+	if ((!dir->second.watched) && (mWatched < DIRWATCH_MAX_WATCHED))
+	{
+		if (fp_storage_watch_node(&dirRef, FP_STORAGE_WATCH_DIRECTORY) == B_OK)
+		{
+			dir->second.watched = true;
+			mWatched++;
+		}
+	}
+}
+
+
+/*
+ * ForgetSession()
+ *
+ * Description:
+ *		The session is going away.
+ *
+ * Returns: none
+ */
+
+void fp_dirwatch::ForgetSession(afp_session* session)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	for (DirMap::iterator dir = mDirs.begin(); dir != mDirs.end(); dir++) {
+
+		dir->second.sessions.erase(session);
+	}
+}
+
+
+/*
+ * DirectoryChanged()
+ *
+ * Description:
+ *		Something was added to, removed from or changed in a directory.
+ *		If anyone cares, the change is held until the coalesce window
+ *		is up.
+ *
+ * Returns: none
+ */
+
+void fp_dirwatch::DirectoryChanged(const node_ref& dirRef)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	DirMap::iterator	dir = mDirs.find(dirRef);
+
+	if ((dir == mDirs.end()) || (dir->second.sessions.empty())) {
+		return;
+	}
+
+	if (dir->second.changed == 0)
+	{
+		dir->second.changed = system_time();
+		mPending++;
+	}
+}
+
+
+/*
+ * DirectoryChanged()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+void fp_dirwatch::DirectoryChanged(dev_t device, ino_t directory)
+{
+	DirectoryChanged(node_ref(device, directory));
+}
+
+
+/*
+ * ParentChanged()
+ *
+ * Description:
+ *		The directory that holds entry changed. An entry_ref still
+ *		names the parent after the entry is removed.
+ *
+ * Returns: none
+ */
+
+void fp_dirwatch::ParentChanged(fp_storage_entry* entry)
+{
+	entry_ref	ref;
+
+	if ((entry != NULL) && (entry->GetRef(&ref) == B_OK)) {
+
+		DirectoryChanged(ref.device, ref.directory);
+	}
+}
+
+
+/*
+ * NodeRemoved()
+ *
+ * Description:
+ *		A node was deleted. If it was a directory we track, forget it.
+ *
+ * Returns: none
+ */
+
+void fp_dirwatch::NodeRemoved(const node_ref& nodeRef)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	DirMap::iterator	dir = mDirs.find(nodeRef);
+
+	if (dir != mDirs.end())
+	{
+		if (dir->second.changed != 0) {
+			mPending--;
+		}
+
+		StopWatching(dir);
+		mDirs.erase(dir);
+	}
+}
+
+
+/*
+ * CollectNotifications()
+ *
+ * Description:
+ *		Called regularly by the scavenger thread. Adds to sessions each
+ *		session that has an interest in a directory whose changes have
+ *		been held for the coalesce window. A session is only added
+ *		once no matter how many of its directories changed.
+ *
+ * Returns: none
+ */
+
+void fp_dirwatch::CollectNotifications(std::vector<afp_session*>& sessions)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	bigtime_t	now = system_time();
+
+	if (mPending > 0)
+	{
+		for (DirMap::iterator dir = mDirs.begin(); dir != mDirs.end(); dir++)
+		{
+			if ((dir->second.changed == 0) || (now - dir->second.changed < DIRWATCH_COALESCE_WINDOW)) {
+				continue;
+			}
+
+			for (auto& interest : dir->second.sessions)
+			{
+				if ((now - interest.second < DIRWATCH_INTEREST_TIME) &&
+					(std::find(sessions.begin(), sessions.end(), interest.first) == sessions.end()))
+				{
+					sessions.push_back(interest.first);
+				}
+			}
+
+			dir->second.changed = 0;
+			mPending--;
+		}
+	}
+
+	if (now - mLastPrune > DIRWATCH_PRUNE_INTERVAL)
+	{
+		Prune(now);
+		mLastPrune = now;
+	}
+}
+
+
+/*
+ * Prune()
+ *
+ * Description:
+ *		Drop sessions that haven't looked at a directory in a while and
+ *		directories nobody is looking at. mMutex must be held.
+ *
+ * Returns: none
+ */
+
+void fp_dirwatch::Prune(bigtime_t now)
+{
+	DirMap::iterator	dir = mDirs.begin();
+
+	while(dir != mDirs.end())
+	{
+		std::map<afp_session*, bigtime_t>&			sessions	= dir->second.sessions;
+		std::map<afp_session*, bigtime_t>::iterator	interest	= sessions.begin();
+
+		while(interest != sessions.end())
+		{
+			if (now - interest->second >= DIRWATCH_INTEREST_TIME) {
+				interest = sessions.erase(interest);
+			}
+			else {
+				interest++;
+			}
+		}
+
+		if ((sessions.empty()) && (dir->second.changed == 0))
+		{
+			StopWatching(dir);
+			dir = mDirs.erase(dir);
+		}
+		else
+		{
+			dir++;
+		}
+	}
+}
+
+
+/*
+ * StopWatching()
+ *
+ * Description:
+ *		Take our node monitor off a directory. Stopping removes every
+ *		monitor we have on the node, so if it's a share point we put
+ *		the volume's own monitor back. mMutex must be held.
+ *
+ * Returns: none
+ */
+
+void fp_dirwatch::StopWatching(DirMap::iterator dir)
+{
+	if (!dir->second.watched) {
+		return;
+	}
+
+	fp_storage_watch_node(&dir->first, FP_STORAGE_WATCH_STOP);
+
+	dir->second.watched = false;
+	mWatched--;
+
+	fp_volume_reader	reader;
+	fp_volume*			volume = FindVolume(dir->first);
+
+	if (volume != NULL) {
+
+		WatchVolume(volume->GetPath());
+	}
+}
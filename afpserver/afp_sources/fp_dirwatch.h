@@ -0,0 +1,76 @@
+#ifndef __fp_dirwatch__
+#define __fp_dirwatch__
+
+#include "fp_storage.h"
+#include "afp_os.h"
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+class afp_session;
+
+//
+//Changes to a directory are held this long (in microseconds) before
+//we tell anyone, so a burst of them (a folder being copied in) turns
+//into a single notification.
+//
+#define DIRWATCH_COALESCE_WINDOW	2000000
+
+//
+//A session is told about changes to a directory for this long after
+//it last enumerated it. That's about how long the Finder keeps a
+//window open without asking again.
+//
+#define DIRWATCH_INTEREST_TIME		(10 * 60 * 1000000LL)
+
+//
+//Most directories we'll have a node monitor on at once, so local
+//changes get noticed too. Past this only changes made through AFP
+//are reported.
+//
+#define DIRWATCH_MAX_WATCHED		1024
+
+
+class fp_dirwatch
+{
+public:
+						fp_dirwatch();
+	virtual				~fp_dirwatch();
+
+	virtual void		Enumerated(afp_session* session, const node_ref& dirRef);
+	virtual void		ForgetSession(afp_session* session);
+
+	virtual void		DirectoryChanged(dev_t device, ino_t directory);
+	virtual void		DirectoryChanged(const node_ref& dirRef);
+	virtual void		ParentChanged(fp_storage_entry* entry);
+	virtual void		NodeRemoved(const node_ref& nodeRef);
+
+	virtual void		CollectNotifications(std::vector<afp_session*>& sessions);
+
+	virtual int32		WatchedCount()	{ return mWatched; }
+
+private:
+
+	typedef struct
+	{
+		std::map<afp_session*, bigtime_t>	sessions;	//When each last enumerated it
+		bigtime_t							changed;	//First change not yet reported
+		bool								watched;	//We have a node monitor on it
+	}AFPDirInterest;
+
+	typedef std::map<node_ref, AFPDirInterest>	DirMap;
+
+	void				Prune(bigtime_t now);
+	void				StopWatching(DirMap::iterator dir);
+
+	std::mutex			mMutex;
+	DirMap				mDirs;
+	int32				mPending;
+	int32				mWatched;
+	bigtime_t			mLastPrune;
+};
+
+extern fp_dirwatch		gAFPDirWatch;
+
+#endif //__fp_dirwatch__
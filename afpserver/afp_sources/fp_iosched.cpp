@@ -0,0 +1,399 @@
+#include <algorithm>
+
+#include "debug.h"
+#include "afp.h"
+#include "afp_buffer.h"
+#include "afp_session.h"
+#include "afpvolume.h"
+#include "dsi_stats.h"
+#include "fp_iosched.h"
+#include "fp_volume.h"
+
+extern dsi_stats		gAFPStats;
+
+std::mutex										fp_iosched::sRateLock;
+std::map<std::string, fp_iosched::AFPIORateBucket>	fp_iosched::sRateBuckets;
+
+/*
+ * fp_iosched()
+ *
+ * Description:
+ *		Arbitrates data fork I/O on a volume between sessions using
+ *		weighted fair queuing. Every operation is tagged with a virtual
+ *		finish time based on its size and the session's weight, and
+ *		the waiter with the earliest tag goes next. A session copying
+ *		a large folder can then only take its share of the disk.
+ *
+ * Returns:
+ */
+
+fp_iosched::fp_iosched()
+{
+	mVirtualTime	= 0;
+	mActive			= 0;
+	mMetadataActive	= 0;
+}
+
+
+/*
+ * ~fp_iosched()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_iosched::~fp_iosched()
+{
+}
+
+
+/*
+ * Begin()
+ *
+ * Description:
+ *		Called before a session reads or writes bytes of a data fork
+ *		on this volume. Blocks until the user's rate cap allows it and
+ *		it's the session's turn. Every Begin() must be paired with an
+ *		End(). Waiters sleep until End() or EndMetadata() lets them in.
+ *
+ * Returns: none
+ */
+
+void fp_iosched::Begin(afp_session* session, size_t bytes)
+{
+	bigtime_t		began	= system_time();
+	uint64			weight	= IOSCHED_DEFAULT_WEIGHT;
+	AFPIOWaiter		waiter;
+
+	if (session != NULL)
+	{
+		weight = std::max(session->GetIOWeight(), (int32)1);
+
+		Throttle(session, bytes);
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(mLock);
+
+		waiter.start	= std::max(mVirtualTime, mFinishTags[session]);
+		waiter.finish	= waiter.start + (std::max(bytes, (size_t)1) / weight);
+		waiter.granted	= false;
+
+		mFinishTags[session] = waiter.finish;
+
+		mWaiting.push_back(&waiter);
+		Dispatch();
+
+		mWakeUp.wait(lock, [&waiter]() { return( waiter.granted ); });
+	}
+
+	if (session == NULL) {
+		return;
+	}
+
+	bigtime_t	delay = system_time() - began;
+
+	session->RecordIOWait(delay);
+	gAFPStats.IO_RecordWait(delay);
+}
+
+
+/*
+ * End()
+ *
+ * Description:
+ *		The operation started with Begin() is done, let the next one in.
+ *
+ * Returns: none
+ */
+
+void fp_iosched::End()
+{
+	std::lock_guard<std::mutex> lock(mLock);
+
+	mActive--;
+
+	//
+	//Sessions that have caught up with virtual time would start at
+	//mVirtualTime anyway, so we can stop tracking them.
+	//
+	std::map<afp_session*, uint64>::iterator	tag = mFinishTags.begin();
+
+	while(tag != mFinishTags.end())
+	{
+		if (tag->second <= mVirtualTime) {
+			tag = mFinishTags.erase(tag);
+		}
+		else {
+			tag++;
+		}
+	}
+
+	Dispatch();
+}
+
+
+/*
+ * Forget()
+ *
+ * Description:
+ *		The session closed the volume.
+ *
+ * Returns: none
+ */
+
+void fp_iosched::Forget(afp_session* session)
+{
+	std::lock_guard<std::mutex> lock(mLock);
+
+	mFinishTags.erase(session);
+}
+
+
+/*
+ * BeginMetadata()
+ *
+ * Description:
+ *		A metadata call on this volume is starting.
+ *
+ * Returns: none
+ */
+
+void fp_iosched::BeginMetadata()
+{
+	mMetadataActive++;
+}
+
+
+/*
+ * EndMetadata()
+ *
+ * Description:
+ *		A metadata call on this volume is done. When it was the last
+ *		one, data operations that were held back can go.
+ *
+ * Returns: none
+ */
+
+void fp_iosched::EndMetadata()
+{
+	if (--mMetadataActive > 0) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mLock);
+
+	Dispatch();
+}
+
+
+/*
+ * IsMetadataCommand()
+ *
+ * Description:
+ *		Whether an AFP command is one of the quick catalog or desktop
+ *		calls that keep the Finder responsive, and so takes priority
+ *		over bulk data.
+ *
+ * Returns: bool
+ */
+
+bool fp_iosched::IsMetadataCommand(uint8 afpCommand)
+{
+	switch(afpCommand)
+	{
+		case afpEnumerate:
+		case afpEnumerateExt:
+		case afpEnumerateExt2:
+		case afpGetFlDrParms:
+		case afpGetFileParms:
+		case afpGetDirParms:
+		case afpGetForkParms:
+		case afpGetVolParms:
+		case afpOpenDir:
+		case afpMapID:
+		case afpResolveID:
+		case afpDTOpen:
+		case afpGetIcon:
+		case afpGtIcnInfo:
+		case afpGetAPPL:
+		case afpGetCmt:
+		case afpGetExtAttr:
+		case afpListExtAttr:
+			return( true );
+
+		default:
+			break;
+	}
+
+	return( false );
+}
+
+
+/*
+ * ForMetadataCommand() [STATIC]
+ *
+ * Description:
+ *		Finds the scheduler of the volume a metadata call works on.
+ *		Fork and desktop calls name the volume through the session's
+ *		open refnum, everything else by volume ID. The caller must
+ *		keep the volume table pinned while using the result.
+ *
+ * Returns: fp_iosched* or NULL if it isn't a metadata call on a volume
+ */
+
+fp_iosched* fp_iosched::ForMetadataCommand(afp_session* session, int8* afpRequest)
+{
+	afp_buffer		request(afpRequest);
+	uint8			afpCommand	= request.GetInt8();
+	fp_volume*		volume		= NULL;
+
+	if (!IsMetadataCommand(afpCommand)) {
+		return( NULL );
+	}
+
+	request.Advance(sizeof(int8));
+
+	switch(afpCommand)
+	{
+		case afpMapID:
+			break;
+
+		case afpGetForkParms:
+		{
+			OPEN_FORK_ITEM*	forkItem = session->GetForkItem(request.GetInt16());
+
+			if (forkItem != NULL) {
+				volume = forkItem->volume;
+			}
+			break;
+		}
+
+		case afpGetIcon:
+		case afpGtIcnInfo:
+		case afpGetAPPL:
+		case afpGetCmt:
+		{
+			OPEN_DESK_ITEM*	deskItem = session->GetDeskItem(request.GetInt16());
+
+			if (deskItem != NULL) {
+				volume = FindVolume(deskItem->volID);
+			}
+			break;
+		}
+
+		default:
+			volume = FindVolume(request.GetInt16());
+			break;
+	}
+
+	return( (volume != NULL) ? volume->GetIOScheduler() : NULL );
+}
+
+
+/*
+ * CanAdmit()
+ *
+ * Description:
+ *		Whether another data operation can start. One is always let
+ *		through so data is never starved. mLock must be held.
+ *
+ * Returns: bool
+ */
+
+bool fp_iosched::CanAdmit()
+{
+	if (mActive == 0) {
+		return( true );
+	}
+
+	return( (mActive < IOSCHED_MAX_ACTIVE) && (mMetadataActive == 0) );
+}
+
+
+/*
+ * Dispatch()
+ *
+ * Description:
+ *		Let in waiters, earliest finish tag first, for as long as there
+ *		is room. mLock must be held.
+ *
+ * Returns: none
+ */
+
+void fp_iosched::Dispatch()
+{
+	bool	granted = false;
+
+	while((!mWaiting.empty()) && (CanAdmit()))
+	{
+		std::vector<AFPIOWaiter*>::iterator	next = std::min_element(
+					mWaiting.begin(),
+					mWaiting.end(),
+					[](const AFPIOWaiter* a, const AFPIOWaiter* b) { return( a->finish < b->finish ); }
+					);
+
+		AFPIOWaiter*	waiter = *next;
+
+		mWaiting.erase(next);
+
+		waiter->granted	= true;
+		mVirtualTime	= std::max(mVirtualTime, waiter->start);
+		mActive++;
+
+		granted = true;
+	}
+
+	if (granted) {
+		mWakeUp.notify_all();
+	}
+}
+
+
+/*
+ * Throttle()
+ *
+ * Description:
+ *		Enforce the user's rate cap, if they have one. Each user has a
+ *		token bucket that refills at their rate and holds up to one
+ *		second's worth. Going over puts the bucket in debt and we sleep
+ *		until it's paid back.
+ *
+ * Returns: none
+ */
+
+void fp_iosched::Throttle(afp_session* session, size_t bytes)
+{
+	uint32		rate	= session->GetIORateLimit();
+	bigtime_t	wait	= 0;
+
+	if (rate == 0) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(sRateLock);
+
+		AFPIORateBucket&	bucket	= sRateBuckets[session->GetUserName()];
+		bigtime_t			now		= system_time();
+
+		if (bucket.lastFill == 0) {
+			bucket.tokens = rate;
+		}
+		else {
+			bucket.tokens = std::min((double)rate, bucket.tokens + ((double)(now - bucket.lastFill) * rate / 1000000.0));
+		}
+
+		bucket.lastFill	= now;
+		bucket.tokens	-= bytes;
+
+		if (bucket.tokens < 0) {
+			wait = (bigtime_t)(-bucket.tokens * 1000000.0 / rate);
+		}
+	}
+
+	if (wait > 0) {
+		snooze(wait);
+	}
+}
@@ -0,0 +1,89 @@
+#ifndef __fp_iosched__
+#define __fp_iosched__
+
+#include "afp_os.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class afp_session;
+
+//
+//Number of data fork reads/writes we let hit a volume at the same
+//time. Anyone else waits in line and is let in by fair share.
+//
+#define IOSCHED_MAX_ACTIVE			2
+
+//
+//A session's share of the volume is proportional to its weight.
+//Admins get twice what everyone else does.
+//
+#define IOSCHED_DEFAULT_WEIGHT		1
+#define IOSCHED_ADMIN_WEIGHT		2
+
+
+class fp_iosched
+{
+public:
+							fp_iosched();
+	virtual					~fp_iosched();
+
+	//
+	//The server's own background I/O (write behind flushes, read
+	//ahead) passes a NULL session. It's queued like everyone else's
+	//but isn't rate capped or counted in the wait stats.
+	//
+	virtual void			Begin(afp_session* session, size_t bytes);
+	virtual void			End();
+	virtual void			Forget(afp_session* session);
+
+	//
+	//Metadata calls (enumerate, get parms, desktop) are never queued.
+	//While any are in progress on a volume only one data operation
+	//on it is let through.
+	//
+	virtual void			BeginMetadata();
+	virtual void			EndMetadata();
+
+	static bool				IsMetadataCommand(uint8 afpCommand);
+	static fp_iosched*		ForMetadataCommand(afp_session* session, int8* afpRequest);
+
+private:
+
+	typedef struct
+	{
+		uint64				start;		//Virtual start and finish tags
+		uint64				finish;
+		bool				granted;
+	}AFPIOWaiter;
+
+	typedef struct
+	{
+		bigtime_t			lastFill;
+		double				tokens;		//Bytes the user may move right now
+	}AFPIORateBucket;
+
+	bool					CanAdmit();
+	void					Dispatch();
+	void					Throttle(afp_session* session, size_t bytes);
+
+	std::mutex				mLock;
+	std::condition_variable	mWakeUp;
+	std::vector<AFPIOWaiter*>	mWaiting;
+	std::map<afp_session*, uint64>	mFinishTags;
+	uint64					mVirtualTime;
+	int32					mActive;
+	std::atomic<int32>		mMetadataActive;
+
+	//
+	//Rate caps are per user, across all their sessions and volumes.
+	//
+	static std::mutex		sRateLock;
+	static std::map<std::string, AFPIORateBucket>	sRateBuckets;
+};
+
+#endif //__fp_iosched__
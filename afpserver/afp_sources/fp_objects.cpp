@@ -1,7 +1,5 @@
-#include <Node.h>
-#include <Directory.h>
-#include <fs_attr.h>
-#include <SupportDefs.h>
+#include "fp_storage.h"
+#include "afp_os.h"
 
 #include <stdlib.h>
 #include <strings.h>
@@ -10,12 +8,9 @@
 #include "commands.h"
 #include "fp_objects.h"
 #include "fp_volume.h"
+#include "fp_pathcache.h"
 #include "finder_info.h"
 
-#if DEBUG
-char errString[24];
-#endif
-
 
 /*
  * SetAFPEntry()
@@ -30,15 +25,15 @@ AFPERROR fp_objects::SetAFPEntry(
 	fp_volume*		afpVolume,
 	int32 			afpDirID,
 	const char*		afpPathname,
-	BEntry& 		afpEntry,
+	fp_storage_entry& 		afpEntry,
 	bool			traverse
 	)
 {
-	BDirectory	directory;
-	BEntry 		rootDirEntry;
-	BEntry		parentOfRoot;
+	fp_storage_dir	directory;
+	fp_storage_entry 		rootDirEntry;
+	fp_storage_entry	parentOfRoot;
 	status_t	status		= 0;
-	BDirectory*	volumeDir	= NULL;
+	fp_storage_dir*	volumeDir	= NULL;
 	AFPERROR	afpError 	= AFP_OK;
 		
 	volumeDir = afpVolume->GetDirectory();
@@ -140,7 +135,7 @@ AFPERROR fp_objects::SetAFPEntry(
 					return( error );
 				}
 				
-				DBGWRITE(dbg_level_error, "BDirectory.InitCheck() failed (%s)\n", GET_BERR_STR(status));
+				DBGWRITE(dbg_level_error, "fp_storage_dir.InitCheck() failed (%s)\n", GET_BERR_STR(status));
 				afpError = afpObjectNotFound;
 			}
 		}
@@ -166,21 +161,84 @@ AFPERROR fp_objects::SetAFPEntry(
 		}
 		else
 		{
-			status = directory.FindEntry(afpPathname, &afpEntry, traverse);
-			
-			if (status != B_OK)
+			node_ref	dirRef;
+			entry_ref	cachedRef;
+			FP_STORAGE_STAT	dirStat;
+			bigtime_t	dirModified	= 0;
+			bool		negative	= false;
+			bool		cached		= false;
+
+			//
+			//The cache is keyed on the directory the name is in, a path
+			//with more than one component is looked up in full each time
+			//since a change further down wouldn't invalidate it.
+			//
+			bool		cacheable	= (strchr(afpPathname, '/') == NULL);
+
+			directory.GetNodeRef(&dirRef);
+
+			//
+			//See if we've resolved this name in this directory before.
+			//
+			if ((cacheable) && (gAFPPathCache.Lookup(dirRef, afpPathname, traverse, &cachedRef, &negative, &dirModified)))
 			{
 				//
-				//We failed to find the object by name, perhaps the client
-				//is looking for a longname?
+				//A name that wasn't there may have been created since by
+				//something that doesn't tell us, unless the directory
+				//is just as it was.
 				//
-				if (!AFP_SUCCESS(GetEntryByLongName(directory, afpPathname, afpEntry)))
+				if (negative)
 				{
-					DBGWRITE(dbg_level_error, "FindEntry() and GetEntryByLongName() failed for %s (%s)\n",
-						afpPathname,
-						GET_BERR_STR(status));
-						
-					return( afpObjectNotFound );
+					if ((directory.GetStat(&dirStat) == B_OK) && (dirStat.modifiedUsecs == dirModified))
+					{
+						DBGWRITE(dbg_level_trace, "Cached lookup failure for %s\n", afpPathname);
+						return( afpObjectNotFound );
+					}
+				}
+				else
+				{
+					//
+					//The cached ref may have gone stale if something outside
+					//of the server changed the directory. In that case we
+					//just fall through to the slow path.
+					//
+					cached = ((afpEntry.SetTo(&cachedRef) == B_OK) && afpEntry.Exists());
+				}
+			}
+
+			if (!cached)
+			{
+				//
+				//Taken before the lookup, so anything created while we
+				//look makes a "not found" we cache out of date.
+				//
+				dirModified = (directory.GetStat(&dirStat) == B_OK) ? dirStat.modifiedUsecs : -1;
+
+				status = directory.FindEntry(afpPathname, &afpEntry, traverse);
+
+				if (status != B_OK)
+				{
+					//
+					//We failed to find the object by name, perhaps the client
+					//is looking for a longname?
+					//
+					if (!AFP_SUCCESS(GetEntryByLongName(directory, afpPathname, afpEntry)))
+					{
+						DBGWRITE(dbg_level_error, "FindEntry() and GetEntryByLongName() failed for %s (%s)\n",
+							afpPathname,
+							GET_BERR_STR(status));
+
+						if ((cacheable) && (dirModified >= 0)) {
+							gAFPPathCache.Insert(dirRef, afpPathname, traverse, NULL, dirModified);
+						}
+
+						return( afpObjectNotFound );
+					}
+				}
+
+				if ((cacheable) && (afpEntry.InitCheck() == B_OK) && afpEntry.Exists() && (afpEntry.GetRef(&cachedRef) == B_OK)) {
+
+					gAFPPathCache.Insert(dirRef, afpPathname, traverse, &cachedRef);
 				}
 			}
 		}
@@ -214,27 +272,26 @@ AFPERROR fp_objects::SetAFPEntry(
  */
 
 AFPERROR fp_objects::GetEntryFromFileId(
-	BDirectory* 	volumeDirectory,
+	fp_storage_dir* 	volumeDirectory,
 	uint32		 	fileId,
-	BEntry& 		afpEntry
+	fp_storage_entry& 		afpEntry
 	)
 {
-	entry_ref	ref;
+	fp_storage_entry	tempEntry;
 
 	volumeDirectory->Rewind();
 	
-	while(volumeDirectory->GetNextRef(&ref) == B_OK)
+	while(volumeDirectory->GetNextEntry(&tempEntry) == B_OK)
 	{
-		BEntry tempEntry(&ref);
 		
 		if (tempEntry.IsDirectory())
 		{
-			BDirectory tempDirectory(&tempEntry);
+			fp_storage_dir tempDirectory(&tempEntry);
 			status_t status = tempDirectory.InitCheck();
 			
 			if (status != B_OK)
 			{
-				DBGWRITE(dbg_level_error, "BDirectory.InitCheck() failed (%s)\n", GET_BERR_STR(status));
+				DBGWRITE(dbg_level_error, "fp_storage_dir.InitCheck() failed (%s)\n", GET_BERR_STR(status));
 				continue;
 			}
 			
@@ -254,7 +311,7 @@ AFPERROR fp_objects::GetEntryFromFileId(
 				
 		if (nodeRef.node == fileId)
 		{
-			afpEntry.SetTo(&ref);
+			afpEntry = tempEntry;
 			return AFP_OK;
 		}
 	}
@@ -274,24 +331,23 @@ AFPERROR fp_objects::GetEntryFromFileId(
  */
 
 AFPERROR fp_objects::GetEntryByLongName(
-	BDirectory& 	dir,
+	fp_storage_dir& 	dir,
 	const char* 	afpPathname,
-	BEntry& 		afpEntry
+	fp_storage_entry& 		afpEntry
 	)
 {
 	char 	longName[B_FILE_NAME_LENGTH];
-	BEntry	temp;
+	fp_storage_entry	temp;
 
 	dir.Rewind();
 	
 	while(dir.GetNextEntry(&temp) == B_OK)
 	{
-		BNode	node(&temp);
+		fp_storage_node	node(&temp);
 		ssize_t	sizeRead = 0;
 					
 		sizeRead = node.ReadAttr(
 						AFP_ATTR_LONGNAME,
-						B_STRING_TYPE,
 						0,
 						longName, 
 						sizeof(longName));
@@ -335,13 +391,13 @@ AFPERROR fp_objects::GetEntryByLongName(
 
 void fp_objects::CreateLongName(
 	char*		afpPathname,
-	BEntry* 	afpEntry,
+	fp_storage_entry* 	afpEntry,
 	bool		afpHardCreate
 	)
 {
-	BDirectory	dir;
-	BEntry		temp;
-	BNode		node(afpEntry);
+	fp_storage_dir	dir;
+	fp_storage_entry	temp;
+	fp_storage_node	node(afpEntry);
 	char		afpNewName[B_FILE_NAME_LENGTH];
 	char		afpName[MAX_AFP_2_NAME+1];	
 	char		numstr[16];
@@ -352,7 +408,6 @@ void fp_objects::CreateLongName(
 	
 	sizeRead = node.ReadAttr(
 						AFP_ATTR_LONGNAME,
-						B_STRING_TYPE,
 						0,
 						afpNewName, 
 						sizeof(afpNewName)
@@ -410,7 +465,6 @@ void fp_objects::CreateLongName(
 		node.WriteAttr(
 			AFP_ATTR_LONGNAME,
 			B_STRING_TYPE,
-			0,
 			afpName, 
 			strlen(afpName)
 			);
@@ -454,18 +508,31 @@ void fp_objects::CreateLongName(
 AFPERROR fp_objects::fp_GetDirParms(
 	afp_session*	afpSession,
 	fp_volume*		afpVolume,
-	BEntry* 		afpEntry,
+	fp_storage_entry* 		afpEntry,
 	int16			afpDirBitmap,
 	afp_buffer* 	afpReply
 	)
 {
-	BDirectory	dir;
+	fp_storage_dir	dir;
 	node_ref	ref;
 	char		name[B_FILE_NAME_LENGTH];
 	int16*		nameOffset		= NULL;
 	int16*		uniNameOffset	= NULL;
 	int8*		parmsStart		= afpReply->GetCurrentPosPtr();
-	time_t		ctime			= 0;
+	FP_STORAGE_STAT	st;
+	bool		haveStat		= false;
+	
+	//
+	//The dates and directory ID come out of a single stat.
+	//
+	memset(&st, 0, sizeof(st));
+	
+	if (	(afpDirBitmap & kFPDirCreateDate)	||
+			(afpDirBitmap & kFPDirModDate)		||
+			(afpDirBitmap & kFPDirID)			)
+	{
+		haveStat = (afpEntry->GetStat(&st) == B_OK);
+	}
 	
 	if (afpDirBitmap & kFPDirAttribute)
 	{
@@ -533,14 +600,12 @@ AFPERROR fp_objects::fp_GetDirParms(
 	
 	if (afpDirBitmap & kFPDirCreateDate)
 	{
-		afpEntry->GetCreationTime(&ctime);		
-		afpReply->AddInt32(TO_AFP_TIME(ctime));
+		afpReply->AddInt32(TO_AFP_TIME(st.created));
 	}
 
 	if (afpDirBitmap & kFPDirModDate)
 	{
-		afpEntry->GetModificationTime(&ctime);
-		afpReply->AddInt32(TO_AFP_TIME(ctime));
+		afpReply->AddInt32(TO_AFP_TIME(st.modified));
 	}
 
 	if (afpDirBitmap & kFPDirBackupDate)
@@ -582,8 +647,10 @@ AFPERROR fp_objects::fp_GetDirParms(
 
 	if (afpDirBitmap & kFPDirID)
 	{
-		if (afpEntry->GetNodeRef(&ref) == B_OK)
+		if (haveStat)
 		{
+			ref.node = st.node;
+			
 			//
 			//We check to see if the client is indeed looking at
 			//one of the pre-defined constant dirs (kRootDirID &
@@ -685,8 +752,10 @@ AFPERROR fp_objects::fp_GetDirParms(
 		int16	userType	= 0;
 		mode_t	posixPerms	= 0;
 		
-		dir.SetTo(afpEntry);
-		dir.GetPermissions(&posixPerms);
+		FP_STORAGE_STAT	dirStat;
+
+		if (afpEntry->GetStat(&dirStat) == B_OK)
+			posixPerms = dirStat.mode;
 		
 		if (afpSession->IsAdmin())
 			userType = kUserType_Owner;
@@ -749,23 +818,39 @@ AFPERROR fp_objects::fp_GetDirParms(
 AFPERROR fp_objects::fp_GetFileParms(
 	afp_session*	afpSession,
 	fp_volume*		afpVolume,
-	BEntry* 		afpEntry,
+	fp_storage_entry* 		afpEntry,
 	int16			afpFileBitmap,
 	afp_buffer* 	afpReply
 	)
 {
-	BDirectory		dir;
+	fp_storage_dir	dir;
 	node_ref		ref;
-	time_t			ctime;
+	FP_STORAGE_STAT	st;
+	bool			haveStat		= false;
 	char			name[B_FILE_NAME_LENGTH];
 	uint16			afpForkRef		= 0;
 	bool			afpRsrcOpen		= false;
-	attr_info		info			= {0,0};
+	FP_STORAGE_ATTR_INFO	info			= {0,0};
 	int16*			longNameOffset 	= NULL;
 	int16*			uniNameOffset	= NULL;
 	int8*			parmsStart		= afpReply->GetCurrentPosPtr();
 	OPEN_FORK_ITEM*	forkItem		= NULL;
 	
+	//
+	//The dates, file number and data fork length all come out of a
+	//single stat instead of a call (and stat) per field.
+	//
+	memset(&st, 0, sizeof(st));
+	
+	if (	(afpFileBitmap & kFPCreateDate)	||
+			(afpFileBitmap & kFPModDate)		||
+			(afpFileBitmap & kFPFileNum)		||
+			(afpFileBitmap & kFPDFLen)			||
+			(afpFileBitmap & kFPExtDataForkLen)	)
+	{
+		haveStat = (afpEntry->GetStat(&st) == B_OK);
+	}
+	
 	if (afpFileBitmap & kFPFileAttributes)
 	{	
 		int16	afpAttributes = 0;
@@ -849,14 +934,12 @@ AFPERROR fp_objects::fp_GetFileParms(
 	
 	if (afpFileBitmap & kFPCreateDate)
 	{
-		afpEntry->GetCreationTime(&ctime);		
-		afpReply->push_num<uint32>(TO_AFP_TIME(ctime));
+		afpReply->push_num<uint32>(TO_AFP_TIME(st.created));
 	}
 	
 	if (afpFileBitmap & kFPModDate)
 	{
-		afpEntry->GetModificationTime(&ctime);
-		afpReply->push_num<uint32>(TO_AFP_TIME(ctime));
+		afpReply->push_num<uint32>(TO_AFP_TIME(st.modified));
 	}
 	
 	if (afpFileBitmap & kFPBackupDate) {
@@ -886,9 +969,9 @@ AFPERROR fp_objects::fp_GetFileParms(
 	
 	if (afpFileBitmap & kFPFileNum)
 	{
-		if (afpEntry->GetNodeRef(&ref) == B_OK)
+		if (haveStat)
 		{
-			if (ref.node > ULONG_MAX)
+			if (st.node > ULONG_MAX)
 			{
 				//
 				//AFP cannot handle node id's greater than a 4 byte
@@ -898,7 +981,7 @@ AFPERROR fp_objects::fp_GetFileParms(
 				return( afpParmErr );
 			}
 			
-			afpReply->push_num<uint32>(ref.node);
+			afpReply->push_num<uint32>(st.node);
 		}
 		else
 		{
@@ -909,9 +992,7 @@ AFPERROR fp_objects::fp_GetFileParms(
 	
 	if (afpFileBitmap & kFPDFLen)
 	{
-		off_t fsize = 0;
-				
-		afpEntry->GetSize(&fsize);
+		off_t fsize = st.size;
 		
 		//
 		//AFP 2.2 can only handle file sizes of 4GB
@@ -939,7 +1020,7 @@ AFPERROR fp_objects::fp_GetFileParms(
 		}
 		else
 		{
-			BNode	node(afpEntry);
+			fp_storage_node	node(afpEntry);
 					
 			if (node.GetAttrInfo(AFP_RSRC_ATTRIBUTE, &info) == B_OK) {
 				fsize = info.size;
@@ -959,9 +1040,7 @@ AFPERROR fp_objects::fp_GetFileParms(
 	
 	if (afpFileBitmap & kFPExtDataForkLen)
 	{
-		off_t fsize = 0;
-				
-		afpEntry->GetSize(&fsize);
+		off_t fsize = st.size;
 		afpReply->push_num(fsize);
 	}
 		
@@ -984,7 +1063,7 @@ AFPERROR fp_objects::fp_GetFileParms(
 		}
 		else
 		{
-			BNode	node(afpEntry);
+			fp_storage_node	node(afpEntry);
 					
 			if (node.GetAttrInfo(AFP_RSRC_ATTRIBUTE, &info) == B_OK) {
 				fsize = info.size;
@@ -1037,6 +1116,118 @@ AFPERROR fp_objects::fp_GetFileParms(
 }
 
 
+/*
+ * fp_PackFileDirEntry()
+ *
+ * Description:
+ *		Add one file/dir parameter structure, as used by FPEnumerate and
+ *		FPCatSearch, to the reply. The parms are packed straight into the
+ *		reply buffer behind room left for the struct header, and the
+ *		length is patched in afterwards. If the entry doesn't fit within
+ *		afpMaxSize nothing is added and afpFull is set.
+ *
+ *		afpWordLength selects the AFP3.x style header (word length and
+ *		pad byte) over the byte length one.
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR fp_objects::fp_PackFileDirEntry(
+	afp_session*	afpSession,
+	fp_volume*		afpVolume,
+	fp_storage_entry* 		afpEntry,
+	bool			afpIsDirectory,
+	int16			afpBitmap,
+	bool			afpWordLength,
+	int32			afpMaxSize,
+	afp_buffer* 	afpReply,
+	bool*			afpFull
+	)
+{
+	int8*		entryStart	= afpReply->GetCurrentPosPtr();
+	int32		headerSize	= afpWordLength ? 4 : 2;
+	int32		limit		= afpMaxSize;
+	int32		room		= 0;
+	int16		len			= 0;
+	AFPERROR	afpError	= AFP_OK;
+	
+	*afpFull = false;
+	
+	//
+	//The packers reserve name offsets with an unchecked Advance(), so
+	//keep a word of slack at the end of the real buffer.
+	//
+	if (limit > (int32)(afpReply->GetBufferSize() - sizeof(int16))) {
+		limit = afpReply->GetBufferSize() - sizeof(int16);
+	}
+	
+	//
+	//Leave room for the header and a possible pad byte.
+	//
+	room = limit - afpReply->GetDataLength() - headerSize - sizeof(int8);
+	
+	if (room <= 0)
+	{
+		*afpFull = true;
+		return( AFP_OK );
+	}
+	
+	afp_buffer	afpParms(entryStart + headerSize, room);
+	
+	if (afpIsDirectory) {
+		afpError = fp_GetDirParms(afpSession, afpVolume, afpEntry, afpBitmap, &afpParms);
+	}
+	else {
+		afpError = fp_GetFileParms(afpSession, afpVolume, afpEntry, afpBitmap, &afpParms);
+	}
+	
+	if (AFP_FAILURE(afpError)) {
+		return( afpError );
+	}
+	
+	if (afpParms.Overflowed())
+	{
+		*afpFull = true;
+		return( AFP_OK );
+	}
+	
+	//
+	//Now fill in the header in front of the parms. The struct length
+	//includes the header itself and must be even.
+	//
+	len = headerSize + afpParms.GetDataLength();
+	
+	if (afpWordLength)
+	{
+		afpReply->AddInt16(0);
+		afpReply->AddInt8(afpIsDirectory ? kFileDirIsDir : 0);
+		afpReply->AddInt8(0);
+	}
+	else
+	{
+		afpReply->AddInt8(0);
+		afpReply->AddInt8(afpIsDirectory ? kFileDirIsDir : 0);
+	}
+	
+	afpReply->Advance(afpParms.GetDataLength());
+	
+	if (len % 2)
+	{
+		afpReply->AddInt8(0);
+		len++;
+	}
+	
+	if (afpWordLength) {
+		*((int16*)entryStart) = htons(len);
+	}
+	else {
+		*entryStart = (int8)len;
+	}
+	
+	return( AFP_OK );
+}
+
+
 /*
  * fp_SetFileDirParms()
  *
@@ -1049,7 +1240,7 @@ AFPERROR fp_objects::fp_GetFileParms(
 AFPERROR fp_objects::fp_SetFileDirParms(
 	afp_session*	afpSession,
 	afp_buffer*		afpRequest,
-	BEntry* 		afpEntry,
+	fp_storage_entry* 		afpEntry,
 	int16			afpBitmap
 	)
 {
@@ -1280,11 +1471,11 @@ uint32 fp_objects::BtoAFPPermissions(
  */
 
 AFPERROR fp_objects::GetAFPFinderInfo(
-	BEntry* 		afpEntry,
+	fp_storage_entry* 		afpEntry,
 	FINDER_INFO*	afpFInfo
 	)
 {
-	BNode		node(afpEntry);
+	fp_storage_node	node(afpEntry);
 	char		name[B_FILE_NAME_LENGTH];
 	ssize_t		bytesRead;
 	
@@ -1303,7 +1494,6 @@ AFPERROR fp_objects::GetAFPFinderInfo(
 	//
 	bytesRead = node.ReadAttr(
 					AFP_FINFO_ATTRIBUTE,
-					B_RAW_TYPE,
 					0,
 					afpFInfo,
 					sizeof(FINDER_INFO)
@@ -1348,11 +1538,11 @@ AFPERROR fp_objects::GetAFPFinderInfo(
  */
 
 AFPERROR fp_objects::SetAFPFinderInfo(
-	BEntry* 		afpEntry,
+	fp_storage_entry* 		afpEntry,
 	FINDER_INFO*	afpFInfo
 	)
 {
-	BNode		node(afpEntry);
+	fp_storage_node	node(afpEntry);
 	ssize_t		bytesWritten;
 	
 	//
@@ -1367,7 +1557,6 @@ AFPERROR fp_objects::SetAFPFinderInfo(
 	bytesWritten = node.WriteAttr(
 					AFP_FINFO_ATTRIBUTE,
 					B_RAW_TYPE,
-					0,
 					afpFInfo,
 					sizeof(FINDER_INFO)
 					);
@@ -1395,11 +1584,11 @@ AFPERROR fp_objects::SetAFPFinderInfo(
  */
 
 AFPERROR fp_objects::GetAFPAttributes(
-	BEntry* 		afpEntry,
+	fp_storage_entry* 		afpEntry,
 	int16*			afpAttributes
 	)
 {
-	BNode		node(afpEntry);
+	fp_storage_node	node(afpEntry);
 	ssize_t		bytesRead;
 	
 	//
@@ -1416,7 +1605,6 @@ AFPERROR fp_objects::GetAFPAttributes(
 	//
 	bytesRead = node.ReadAttr(
 					AFP_ATTR_ATTRIBUTE,
-					B_INT16_TYPE,
 					0,
 					afpAttributes,
 					sizeof(int16)
@@ -1463,11 +1651,11 @@ AFPERROR fp_objects::GetAFPAttributes(
  */
 
 AFPERROR fp_objects::SetAFPAttributes(
-	BEntry* 		afpEntry,
+	fp_storage_entry* 		afpEntry,
 	int16*			afpAttributes
 	)
 {
-	BNode		node(afpEntry);
+	fp_storage_node	node(afpEntry);
 	ssize_t		bytesWritten;
 	
 	//
@@ -1482,7 +1670,6 @@ AFPERROR fp_objects::SetAFPAttributes(
 	bytesWritten = node.WriteAttr(
 					AFP_ATTR_ATTRIBUTE,
 					B_INT16_TYPE,
-					0,
 					afpAttributes,
 					sizeof(int16)
 					);
@@ -1509,7 +1696,7 @@ AFPERROR fp_objects::SetAFPAttributes(
  * Returns: None
  */
 
-status_t fp_objects::CopyAttrs(BNode& inFrom, BNode& inTo)
+status_t fp_objects::CopyAttrs(fp_storage_node& inFrom, fp_storage_node& inTo)
 {
 	char			attrname[64];
 	status_t		err = 0;
@@ -1522,8 +1709,8 @@ status_t fp_objects::CopyAttrs(BNode& inFrom, BNode& inTo)
 	
 	while (B_NO_ERROR == inFrom.GetNextAttrName(attrname))
 	{
-		attr_info		fromInfo;
-		attr_info		toInfo;
+		FP_STORAGE_ATTR_INFO	fromInfo;
+		FP_STORAGE_ATTR_INFO	toInfo;
 		ssize_t			size;
 
 		if (!strcmp(attrname, AFP_ATTR_LONGNAME))
@@ -1550,16 +1737,16 @@ status_t fp_objects::CopyAttrs(BNode& inFrom, BNode& inTo)
 			
 			ssize_t		sizeRead;
 			
-			sizeRead = inFrom.ReadAttr(attrname, fromInfo.type, 0, buffer, fromInfo.size);
+			sizeRead = inFrom.ReadAttr(attrname, 0, buffer, fromInfo.size);
 
 			err = inTo.GetAttrInfo(attrname, &toInfo);
 			// Attribute already exists
 			if (err == B_NO_ERROR && fromInfo.size > toInfo.size)
 				err = inTo.RemoveAttr(attrname);
-			if (err == B_NO_ERROR || err == ENOENT)	// ENOENT means entry doesn't exist
+			if (err == B_NO_ERROR || err == B_ENTRY_NOT_FOUND)
 			{
 				// Attribute doesn't already exist
-				size = inTo.WriteAttr(attrname, fromInfo.type, 0, buffer, fromInfo.size);
+				size = inTo.WriteAttr(attrname, fromInfo.type, buffer, fromInfo.size);
 				err = size != fromInfo.size ? B_ERROR : B_NO_ERROR;		
 			}
 		}
@@ -1580,16 +1767,18 @@ status_t fp_objects::CopyAttrs(BNode& inFrom, BNode& inTo)
  * Returns: None
  */
 
-status_t fp_objects::CopyFile(BFile& inFrom, BFile& inTo)
+status_t fp_objects::CopyFile(fp_storage_node& inFrom, fp_storage_node& inTo)
 {
 	const size_t 	chunkSize = 64 * 1024;
 	char*			buffer = new char[chunkSize];
 	ssize_t			readSize = 0;
+	off_t			offset = 0;
 	status_t		err = B_OK;
 
-	while ((readSize = inFrom.Read(buffer, chunkSize)) > 0)
+	while ((readSize = inFrom.ReadAt(offset, buffer, chunkSize)) > 0)
 	{
-		inTo.Write(buffer, readSize);
+		inTo.WriteAt(offset, buffer, readSize);
+		offset += readSize;
 	}
 
 	delete [] buffer;
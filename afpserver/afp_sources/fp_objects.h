@@ -1,8 +1,7 @@
 #ifndef __fp_objects__
 #define __fp_objects__
 
-#include <Entry.h>
-#include <Directory.h>
+#include "fp_storage.h"
 
 #include "afp.h"
 #include "fp_volume.h"
@@ -40,7 +39,7 @@
 #define POSIX_AFP_ISGUEST	S_IXOTH
 
 
-class fp_objects : public BEntry
+class fp_objects : public fp_storage_entry
 {
 public:
 
@@ -58,23 +57,23 @@ public:
 									fp_volume*		afpVolume,
 									int32 			afpDirID,
 									const char*		afpPathname,
-									BEntry& 		afpEntry,
+									fp_storage_entry& 		afpEntry,
 									bool			traverse=false
 									);
 	
 	static AFPERROR 	GetEntryFromFileId(
-									BDirectory* 	volumeDirectory,
+									fp_storage_dir* 	volumeDirectory,
 									uint32		 	fileId,
-									BEntry& 		afpEntry
+									fp_storage_entry& 		afpEntry
 									);
 									
-	static AFPERROR		GetEntryByLongName(BDirectory& dir, const char* afpPathname, BEntry& afpEntry);
-	static void			CreateLongName(char* afpPathname, BEntry* afpEntry, bool afpHardCreate=false);
+	static AFPERROR		GetEntryByLongName(fp_storage_dir& dir, const char* afpPathname, fp_storage_entry& afpEntry);
+	static void			CreateLongName(char* afpPathname, fp_storage_entry* afpEntry, bool afpHardCreate=false);
 		
 	static AFPERROR		fp_GetDirParms(
 									afp_session*	afpSession,
 									fp_volume*		afpVolume,
-									BEntry* 		afpEntry,
+									fp_storage_entry* 		afpEntry,
 									int16			afpDirBitmap,
 									afp_buffer* 	afpReply
 									);
@@ -82,15 +81,27 @@ public:
 	static AFPERROR		fp_GetFileParms(
 									afp_session*	afpSession,
 									fp_volume*		afpVolume,
-									BEntry* 		afpEntry,
+									fp_storage_entry* 		afpEntry,
 									int16			afpFileBitmap,
 									afp_buffer* 	afpReply
 									);
 									
+	static AFPERROR		fp_PackFileDirEntry(
+									afp_session*	afpSession,
+									fp_volume*		afpVolume,
+									fp_storage_entry* 		afpEntry,
+									bool			afpIsDirectory,
+									int16			afpBitmap,
+									bool			afpWordLength,
+									int32			afpMaxSize,
+									afp_buffer* 	afpReply,
+									bool*			afpFull
+									);
+									
 	static AFPERROR 	fp_SetFileDirParms(
 									afp_session*	afpSession,
 									afp_buffer*		afpRequest,
-									BEntry* 		afpEntry,
+									fp_storage_entry* 		afpEntry,
 									int16			afpBitmap
 									);
 									
@@ -104,27 +115,27 @@ public:
 									);
 	
 	static AFPERROR 	GetAFPFinderInfo(
-									BEntry* 		afpEntry,
+									fp_storage_entry* 		afpEntry,
 									FINDER_INFO*	afpFInfo
 									);
 									
 	static AFPERROR 	SetAFPFinderInfo(
-									BEntry* 		afpEntry,
+									fp_storage_entry* 		afpEntry,
 									FINDER_INFO*	afpFInfo
 									);
 
 	static AFPERROR 	GetAFPAttributes(
-									BEntry* 		afpEntry,
+									fp_storage_entry* 		afpEntry,
 									int16*			afpAttributes
 									);
 
 	static AFPERROR 	SetAFPAttributes(
-									BEntry* 		afpEntry,
+									fp_storage_entry* 		afpEntry,
 									int16*			afpAttributes
 									);
 	
-	static status_t 	CopyAttrs(BNode& inFrom, BNode& inTo);
-	static status_t 	CopyFile(BFile& inFrom, BFile& inTo);
+	static status_t 	CopyAttrs(fp_storage_node& inFrom, fp_storage_node& inTo);
+	static status_t 	CopyFile(fp_storage_node& inFrom, fp_storage_node& inTo);
 	
 private:
 };
@@ -0,0 +1,376 @@
+#include "afp_os.h"
+
+#include "debug.h"
+#include "fp_pathcache.h"
+
+fp_pathcache	gAFPPathCache;
+
+/*
+ * fp_pathcache()
+ *
+ * Description:
+ *		Remembers the result of resolving a name within a directory so
+ *		repeated lookups (and especially the longname scan when FindEntry()
+ *		fails) don't have to touch the filesystem again.
+ *
+ * Returns:
+ */
+
+fp_pathcache::fp_pathcache()
+{
+	mHits	= 0;
+	mMisses	= 0;
+}
+
+
+/*
+ * ~fp_pathcache()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_pathcache::~fp_pathcache()
+{
+	Flush();
+}
+
+
+/*
+ * KeyHash::operator()
+ *
+ * Description:
+ *		Hash function for the lookup key.
+ *
+ * Returns: size_t
+ */
+
+size_t fp_pathcache::KeyHash::operator()(const AFPPathCacheKey& key) const
+{
+	size_t	hash = std::hash<std::string>()(key.name);
+
+	hash ^= std::hash<int64>()(key.directory) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+	hash ^= std::hash<int32>()(key.device) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+
+	return( key.traverse ? ~hash : hash );
+}
+
+
+/*
+ * KeyEqual::operator()
+ *
+ * Description:
+ *		Equality test for the lookup key.
+ *
+ * Returns: bool
+ */
+
+bool fp_pathcache::KeyEqual::operator()(
+	const AFPPathCacheKey& a,
+	const AFPPathCacheKey& b
+	) const
+{
+	return(	(a.device == b.device)			&&
+			(a.directory == b.directory)	&&
+			(a.traverse == b.traverse)		&&
+			(a.name == b.name)				);
+}
+
+
+/*
+ * DirHash::operator()
+ *
+ * Description:
+ *		Hash function for the per directory lists.
+ *
+ * Returns: size_t
+ */
+
+size_t fp_pathcache::DirHash::operator()(const node_ref& ref) const
+{
+	size_t	hash = std::hash<int64>()(ref.node);
+
+	hash ^= std::hash<int32>()(ref.device) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+
+	return( hash );
+}
+
+
+/*
+ * Lookup()
+ *
+ * Description:
+ *		Look for a previous resolution of name within the directory. If
+ *		we remembered that the name does not exist, negative is set to
+ *		true, ref is left untouched and dirModified is set to when the
+ *		directory was last modified as of the lookup that failed. The
+ *		caller has to check the directory hasn't changed since. Expired
+ *		negative entries are treated as a miss.
+ *
+ * Returns: true if the cache had an answer, false otherwise.
+ */
+
+bool fp_pathcache::Lookup(
+	const node_ref&	dirRef,
+	const char*		name,
+	bool			traverse,
+	entry_ref*		ref,
+	bool*			negative,
+	bigtime_t*		dirModified
+	)
+{
+	AFPPathCacheKey	key = { dirRef.device, dirRef.node, traverse, name };
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	ItemMap::iterator found = mIndex.find(key);
+
+	if (found == mIndex.end())
+	{
+		mMisses++;
+		return( false );
+	}
+
+	ItemList::iterator item = found->second;
+
+	if (item->negative && ((system_time() - item->created) > PATH_CACHE_NEGATIVE_TTL))
+	{
+		//
+		//We don't trust old "not found" answers, something else on
+		//this machine may have created the object since then.
+		//
+		RemoveItem(item);
+
+		mMisses++;
+		return( false );
+	}
+
+	//
+	//Move the item to the front of the LRU list.
+	//
+	mItems.splice(mItems.begin(), mItems, item);
+
+	*negative = item->negative;
+
+	if (!item->negative) {
+
+		*ref = item->ref;
+	}
+	else {
+
+		*dirModified = item->dirModified;
+	}
+
+	mHits++;
+
+	return( true );
+}
+
+
+/*
+ * Insert()
+ *
+ * Description:
+ *		Remember how name resolved within a directory. Pass a NULL ref
+ *		to record that the name does not exist, along with the
+ *		directory's modifiedUsecs from before the lookup was made.
+ *
+ * Returns: none
+ */
+
+void fp_pathcache::Insert(
+	const node_ref&		dirRef,
+	const char*			name,
+	bool				traverse,
+	const entry_ref*	ref,
+	bigtime_t			dirModified
+	)
+{
+	AFPPathCacheItem	item;
+
+	item.key.device		= dirRef.device;
+	item.key.directory	= dirRef.node;
+	item.key.traverse	= traverse;
+	item.key.name		= name;
+	item.negative		= (ref == NULL);
+	item.dirModified	= dirModified;
+	item.created		= system_time();
+
+	if (ref != NULL) {
+
+		item.ref = *ref;
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	ItemMap::iterator found = mIndex.find(item.key);
+
+	if (found != mIndex.end()) {
+
+		RemoveItem(found->second);
+	}
+
+	//
+	//Make room for the new item by dropping the least recently used.
+	//
+	while(mItems.size() >= PATH_CACHE_MAX_ENTRIES) {
+
+		RemoveItem(std::prev(mItems.end()));
+	}
+
+	mItems.push_front(item);
+	mIndex[mItems.front().key] = mItems.begin();
+
+	DirItemList&	dirItems = mByDirectory[dirRef];
+
+	mItems.front().dirPos = dirItems.insert(dirItems.end(), mItems.begin());
+}
+
+
+/*
+ * InvalidateDirectory()
+ *
+ * Description:
+ *		Forget everything we know about names within a directory. This
+ *		must be called whenever an object is created, deleted, renamed
+ *		or moved into or out of the directory, after the change has
+ *		been made so a lookup racing with it can't leave the old
+ *		answer behind.
+ *
+ * Returns: none
+ */
+
+void fp_pathcache::InvalidateDirectory(dev_t device, ino_t directory)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	DirMap::iterator found = mByDirectory.find(node_ref(device, directory));
+
+	if (found == mByDirectory.end()) {
+		return;
+	}
+
+	//
+	//RemoveItem() drops the directory's list along with the last item.
+	//
+	DirItemList&	dirItems	= found->second;
+	size_t			count		= dirItems.size();
+
+	while(count-- > 0) {
+
+		RemoveItem(dirItems.front());
+	}
+}
+
+
+/*
+ * InvalidateDirectory()
+ *
+ * Description:
+ *		Convenience version of the above taking a node_ref.
+ *
+ * Returns: none
+ */
+
+void fp_pathcache::InvalidateDirectory(const node_ref& dirRef)
+{
+	InvalidateDirectory(dirRef.device, dirRef.node);
+}
+
+
+/*
+ * InvalidateParentOf()
+ *
+ * Description:
+ *		Forget everything we know about the directory that contains
+ *		entry. The entry must still be valid, so after a Remove() use
+ *		the parent's node_ref taken beforehand instead.
+ *
+ * Returns: none
+ */
+
+void fp_pathcache::InvalidateParentOf(fp_storage_entry* entry)
+{
+	entry_ref	ref;
+
+	if ((entry != NULL) && (entry->GetRef(&ref) == B_OK)) {
+
+		InvalidateDirectory(ref.device, ref.directory);
+	}
+}
+
+
+/*
+ * InvalidateDevice()
+ *
+ * Description:
+ *		Forget everything we know about a device. Used when we learn
+ *		of an external change we can't pin to a single directory.
+ *
+ * Returns: none
+ */
+
+void fp_pathcache::InvalidateDevice(dev_t device)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	ItemList::iterator item = mItems.begin();
+
+	while(item != mItems.end())
+	{
+		ItemList::iterator next = std::next(item);
+
+		if (item->key.device == device) {
+
+			RemoveItem(item);
+		}
+
+		item = next;
+	}
+}
+
+
+/*
+ * Flush()
+ *
+ * Description:
+ *		Empty the cache.
+ *
+ * Returns: none
+ */
+
+void fp_pathcache::Flush()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	mIndex.clear();
+	mByDirectory.clear();
+	mItems.clear();
+}
+
+
+/*
+ * RemoveItem()
+ *
+ * Description:
+ *		Remove a single item from the list and index. The caller must
+ *		be holding mMutex.
+ *
+ * Returns: none
+ */
+
+void fp_pathcache::RemoveItem(ItemList::iterator item)
+{
+	DirMap::iterator dir = mByDirectory.find(node_ref(item->key.device, item->key.directory));
+
+	dir->second.erase(item->dirPos);
+
+	if (dir->second.empty()) {
+
+		mByDirectory.erase(dir);
+	}
+
+	mIndex.erase(item->key);
+	mItems.erase(item);
+}
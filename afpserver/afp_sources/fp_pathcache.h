@@ -0,0 +1,119 @@
+#ifndef __fp_pathcache__
+#define __fp_pathcache__
+
+#include "fp_storage.h"
+#include "afp_os.h"
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+//
+//Maximum number of (directory, name) lookups we remember across all
+//shared volumes. Old entries fall off the end of the LRU list.
+//
+#define PATH_CACHE_MAX_ENTRIES		4096
+
+//
+//How long (in microseconds) we trust a "not found" answer. A directory
+//that has been modified since the answer was cached isn't trusted at
+//all, this is only a backstop.
+//
+#define PATH_CACHE_NEGATIVE_TTL		2000000
+
+
+typedef struct
+{
+	dev_t		device;
+	ino_t		directory;
+	bool		traverse;
+	std::string	name;
+}AFPPathCacheKey;
+
+
+class fp_pathcache
+{
+public:
+						fp_pathcache();
+	virtual				~fp_pathcache();
+
+	virtual bool		Lookup(
+							const node_ref&	dirRef,
+							const char*		name,
+							bool			traverse,
+							entry_ref*		ref,
+							bool*			negative,
+							bigtime_t*		dirModified
+							);
+
+	virtual void		Insert(
+							const node_ref&	dirRef,
+							const char*		name,
+							bool			traverse,
+							const entry_ref* ref,
+							bigtime_t		dirModified=0
+							);
+
+	virtual void		InvalidateDirectory(dev_t device, ino_t directory);
+	virtual void		InvalidateDirectory(const node_ref& dirRef);
+	virtual void		InvalidateParentOf(fp_storage_entry* entry);
+	virtual void		InvalidateDevice(dev_t device);
+	virtual void		Flush();
+
+	virtual int64		Hits()		{ return mHits;		}
+	virtual int64		Misses()	{ return mMisses;	}
+
+private:
+
+	struct AFPPathCacheItem;
+
+	typedef std::list<AFPPathCacheItem>			ItemList;
+	typedef std::list<ItemList::iterator>		DirItemList;
+
+	struct AFPPathCacheItem
+	{
+		AFPPathCacheKey			key;
+		entry_ref				ref;
+		bool					negative;
+		bigtime_t				dirModified;	//The directory's modifiedUsecs for a negative item
+		bigtime_t				created;
+		DirItemList::iterator	dirPos;		//Where we are in our directory's list
+	};
+
+	struct KeyHash
+	{
+		size_t operator()(const AFPPathCacheKey& key) const;
+	};
+
+	struct KeyEqual
+	{
+		bool operator()(const AFPPathCacheKey& a, const AFPPathCacheKey& b) const;
+	};
+
+	struct DirHash
+	{
+		size_t operator()(const node_ref& ref) const;
+	};
+
+	typedef std::unordered_map<AFPPathCacheKey, ItemList::iterator, KeyHash, KeyEqual> ItemMap;
+	typedef std::unordered_map<node_ref, DirItemList, DirHash>	DirMap;
+
+	void				RemoveItem(ItemList::iterator item);
+
+	std::mutex			mMutex;
+	ItemList			mItems;
+	ItemMap				mIndex;
+
+	//
+	//The same items by the directory they were looked up in, so a
+	//directory can be invalidated without walking the whole cache.
+	//
+	DirMap				mByDirectory;
+	int64				mHits;
+	int64				mMisses;
+};
+
+extern fp_pathcache		gAFPPathCache;
+
+#endif //__fp_pathcache__
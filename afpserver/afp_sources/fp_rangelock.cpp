@@ -1,5 +1,4 @@
-#include "List.h"
-#include "Entry.h"
+#include "afp_os.h"
 #include "fp_rangelock.h"
 
 BList	gLockList;
@@ -61,7 +60,7 @@ fp_rangelock::~fp_rangelock()
 bool fp_rangelock::RangeLocked(
 	off_t 		rangeStart,
 	off_t 		rangeEnd,
-	BEntry* 	entry
+	fp_storage_entry* 	entry
 	)
 {
 	bool		result	= false;
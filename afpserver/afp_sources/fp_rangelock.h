@@ -14,7 +14,7 @@ public:
 	static bool			RangeLocked(
 							off_t 		rangeStart,
 							off_t 		rangeEnd,
-							BEntry* 	entry
+							fp_storage_entry* 	entry
 							);
 	
 	static fp_rangelock*	SessionRangeLocked(
@@ -26,11 +26,11 @@ public:
 	virtual AFPERROR	Lock(off_t offset, off_t len);
 	virtual void		GetLockRange(off_t* start, off_t* end);
 	virtual uint16		GetForkRef()		{ return mForkRef->refnum; }
-	virtual BEntry*		GetLockEntry()		{ return mEntry;  }
+	virtual fp_storage_entry*		GetLockEntry()		{ return mEntry;  }
 	
 private:
 
-	BEntry*			mEntry;
+	fp_storage_entry*	mEntry;
 	off_t			mStart;
 	off_t			mEnd;
 	OPEN_FORK_ITEM*	mForkRef;
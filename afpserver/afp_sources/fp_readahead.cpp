@@ -0,0 +1,505 @@
+#include <string.h>
+
+#include <algorithm>
+#include <deque>
+#include <new>
+
+#include "debug.h"
+#include "dsi_stats.h"
+#include "fp_readahead.h"
+#include "fp_blockcache.h"
+#include "fp_iosched.h"
+
+extern dsi_stats		gAFPStats;
+
+//
+//One low priority worker does the prefetching for every open fork on
+//the server. It's started the first time a fork turns out to be read
+//sequentially.
+//
+static std::mutex					sQueueLock;
+static std::deque<fp_readahead*>	sQueue;
+static sem_id						sQueueSem	= -1;
+static thread_id					sWorker		= -1;
+
+/*
+ * fp_readahead()
+ *
+ * Description:
+ *		Watches the reads made against an open data fork and, once
+ *		they look sequential and are going to the disk, keeps the next
+ *		window of the file read in ahead of the client. The buffers
+ *		aren't allocated until the first prefetch. ioSched is the
+ *		fork's volume scheduler, which outlives us since the fork
+ *		holds a volume reference.
+ *
+ * Returns:
+ */
+
+fp_readahead::fp_readahead(fp_storage_node* file, fp_iosched* ioSched, const node_ref* cacheRef)
+{
+	mFile			= file;
+	mIOSched		= ioSched;
+	mUseBlockCache	= (cacheRef != NULL);
+
+	if (cacheRef != NULL) {
+		mNodeRef = *cacheRef;
+	}
+
+	mStart		= 0;
+	mLength		= 0;
+	mEOF		= false;
+	mFilledAt	= 0;
+	mNextOffset	= 0;
+	mSequential	= 0;
+	mWindow		= READAHEAD_MIN_WINDOW;
+	mGeneration	= 0;
+	mQueued		= false;
+	mBusy		= false;
+	mHits		= 0;
+	mMisses		= 0;
+
+	mDirectBytes	= 0;
+	mDirectTime		= 0;
+}
+
+
+/*
+ * ~fp_readahead()
+ *
+ * Description:
+ *		Pull ourselves out of the worker's queue and wait for any
+ *		prefetch that is already in progress to finish.
+ *
+ * Returns:
+ */
+
+fp_readahead::~fp_readahead()
+{
+	for (;;)
+	{
+		{
+			std::lock_guard<std::mutex> lock(sQueueLock);
+
+			if (mQueued)
+			{
+				sQueue.erase(std::remove(sQueue.begin(), sQueue.end(), this), sQueue.end());
+				mQueued = false;
+			}
+
+			if (!mBusy) {
+				break;
+			}
+		}
+
+		snooze(1000);
+	}
+}
+
+
+/*
+ * Read()
+ *
+ * Description:
+ *		Read count bytes at offset. Whatever part of the request is
+ *		already prefetched is copied out of the buffer, the rest comes
+ *		from the file (or the shared block cache). We use ReadAt() so
+ *		the fork's position is never touched.
+ *
+ * Returns: Bytes read or a negative error
+ */
+
+ssize_t fp_readahead::Read(off_t offset, void* buffer, size_t count)
+{
+	int8*		dest		= (int8*)buffer;
+	size_t		copied		= 0;
+	ssize_t		result		= 0;
+	bool		complete	= false;
+	bool		schedule	= false;
+	bigtime_t	readTime	= 0;
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		if (offset == mNextOffset) {
+			mSequential++;
+		}
+		else {
+			mSequential		= 0;
+			mWindow			= READAHEAD_MIN_WINDOW;
+			mDirectBytes	= 0;
+			mDirectTime		= 0;
+		}
+
+		if ((mLength > 0) && (system_time() - mFilledAt > READAHEAD_MAX_AGE))
+		{
+			mLength	= 0;
+			mEOF	= false;
+		}
+
+		if ((mLength > 0) && (offset >= mStart) && (offset < mStart + (off_t)mLength))
+		{
+			copied = std::min(count, (size_t)(mStart + mLength - offset));
+			memcpy(dest, mData.get() + (offset - mStart), copied);
+
+			//
+			//If the buffer runs out at the end of the file there
+			//is nothing more to go get.
+			//
+			complete = (copied == count) || mEOF;
+		}
+	}
+
+	if (!complete)
+	{
+		readTime	= system_time();
+		result		= ReadFile(offset + copied, dest + copied, count - copied);
+		readTime	= system_time() - readTime;
+
+		if (result < B_OK)
+		{
+			if (copied == 0) {
+				return( result );
+			}
+
+			result = 0;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		mNextOffset = offset + copied + result;
+
+		if (result > 0)
+		{
+			mDirectBytes	+= result;
+			mDirectTime		+= readTime;
+		}
+
+		if (copied > 0)
+		{
+			mHits++;
+
+			if (mSequential >= READAHEAD_SEQUENTIAL_HITS) {
+				mWindow = std::min(mWindow * 2, (size_t)READAHEAD_MAX_WINDOW);
+			}
+		}
+		else {
+			mMisses++;
+		}
+
+		//
+		//If the client has moved past what we have buffered, what
+		//we have is of no more use.
+		//
+		if ((mNextOffset < mStart) || (mNextOffset > mStart + (off_t)mLength))
+		{
+			mLength	= 0;
+			mEOF	= false;
+		}
+
+		if ((mSequential >= READAHEAD_SEQUENTIAL_HITS) && (!mEOF) && (IsSlow()))
+		{
+			size_t	remaining = (mLength > 0) ? (size_t)(mStart + mLength - mNextOffset) : 0;
+
+			schedule = (remaining < mWindow / 2);
+		}
+	}
+
+	if (copied > 0) {
+		gAFPStats.RA_RecordHit(copied);
+	}
+	else {
+		gAFPStats.RA_RecordMiss();
+	}
+
+	if (schedule) {
+		Schedule();
+	}
+
+	return( copied + result );
+}
+
+
+/*
+ * Invalidate()
+ *
+ * Description:
+ *		The fork was written to or truncated. Throw away what we have
+ *		and make sure a prefetch that is in flight doesn't put old
+ *		data back.
+ *
+ * Returns: none
+ */
+
+void fp_readahead::Invalidate()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	mGeneration++;
+	mLength	= 0;
+	mEOF	= false;
+}
+
+
+/*
+ * GetWindowSize()
+ *
+ * Description:
+ *		The number of bytes we're currently trying to keep ahead of
+ *		the client, zero if the fork isn't being read sequentially.
+ *
+ * Returns: int32
+ */
+
+int32 fp_readahead::GetWindowSize()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	return( (mSequential >= READAHEAD_SEQUENTIAL_HITS) ? (int32)mWindow : 0 );
+}
+
+
+/*
+ * GetHitRate()
+ *
+ * Description:
+ *
+ * Returns: Percentage of reads served at least in part from the buffer
+ */
+
+int32 fp_readahead::GetHitRate()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	int64	total = mHits + mMisses;
+
+	return( (total > 0) ? (int32)((mHits * 100) / total) : 0 );
+}
+
+
+/*
+ * ReadFile()
+ *
+ * Description:
+ *		Read from the data fork, through the block cache if the
+ *		volume uses it.
+ *
+ * Returns: Bytes read or a negative error
+ */
+
+ssize_t fp_readahead::ReadFile(off_t offset, void* buffer, size_t count)
+{
+	if (mUseBlockCache) {
+		return( gAFPBlockCache.Read(mFile, mNodeRef, offset, buffer, count) );
+	}
+
+	return( mFile->ReadAt(offset, buffer, count) );
+}
+
+
+/*
+ * IsSlow()
+ *
+ * Description:
+ *		Whether the reads we've had to make ourselves are waiting on
+ *		the disk. Once a prefetch is keeping ahead of the client we
+ *		stop reading the file directly, so the answer holds until the
+ *		client catches up with us or moves somewhere else. mMutex must
+ *		be held.
+ *
+ * Returns: bool
+ */
+
+bool fp_readahead::IsSlow()
+{
+	return( (mDirectTime > 0) && (mDirectBytes < mDirectTime * READAHEAD_SLOW_RATE) );
+}
+
+
+/*
+ * Schedule()
+ *
+ * Description:
+ *		Queue this fork for the worker, starting the worker if this is
+ *		the first time through.
+ *
+ * Returns: none
+ */
+
+void fp_readahead::Schedule()
+{
+	std::lock_guard<std::mutex> lock(sQueueLock);
+
+	if (mQueued) {
+		return;
+	}
+
+	if (sWorker < 0)
+	{
+		if (sQueueSem < 0) {
+			sQueueSem = create_sem(0, "afp_readahead_queue");
+		}
+
+		sWorker = spawn_thread(
+					WorkerThread,
+					"afp_readahead",
+					B_LOW_PRIORITY,
+					NULL
+					);
+
+		if (sWorker < 0)
+		{
+			DBGWRITE(dbg_level_error, "Failed to spawn read ahead thread!\n");
+			return;
+		}
+
+		resume_thread(sWorker);
+	}
+
+	mQueued = true;
+	sQueue.push_back(this);
+
+	release_sem(sQueueSem);
+}
+
+
+/*
+ * Fill()
+ *
+ * Description:
+ *		Read the next part of the window in from disk. The file read
+ *		happens without our lock held so the client can keep being
+ *		served from what's already buffered, and goes through the
+ *		volume's I/O scheduler so prefetching can't crowd out other
+ *		sessions.
+ *
+ * Returns: none
+ */
+
+void fp_readahead::Fill()
+{
+	off_t		fillStart	= 0;
+	size_t		fillLength	= 0;
+	uint32		generation	= 0;
+	ssize_t		result		= 0;
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		if (mData == nullptr)
+		{
+			mData.reset(new (std::nothrow) int8[READAHEAD_MAX_WINDOW]);
+			mFillBuffer.reset(new (std::nothrow) int8[READAHEAD_MAX_WINDOW]);
+
+			if ((mData == nullptr) || (mFillBuffer == nullptr))
+			{
+				DBGWRITE(dbg_level_warning, "No memory for read ahead buffers\n");
+
+				mData.reset();
+				mFillBuffer.reset();
+				return;
+			}
+		}
+
+		size_t	remaining = (mLength > 0) ? (size_t)(mStart + mLength - mNextOffset) : 0;
+
+		if (remaining >= mWindow) {
+			return;
+		}
+
+		fillStart	= mNextOffset + remaining;
+		fillLength	= mWindow - remaining;
+		generation	= mGeneration;
+	}
+
+	mIOSched->Begin(NULL, fillLength);
+
+	result = ReadFile(fillStart, mFillBuffer.get(), fillLength);
+
+	mIOSched->End();
+
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	if ((result < B_OK) || (generation != mGeneration)) {
+		return;
+	}
+
+	//
+	//The client may have kept reading while we were at the disk, so
+	//work out again what's left of the old data. The new buffer always
+	//starts where the client will read next.
+	//
+	off_t		oldEnd	= mStart + mLength;
+	size_t		keep	= 0;
+	size_t		skip	= 0;
+
+	if ((mLength > 0) && (oldEnd == fillStart) &&
+		(mNextOffset >= mStart) && (mNextOffset <= oldEnd))
+	{
+		keep = oldEnd - mNextOffset;
+		memmove(mData.get(), mData.get() + (mNextOffset - mStart), keep);
+	}
+	else if ((mNextOffset >= fillStart) && (mNextOffset <= fillStart + result))
+	{
+		skip = mNextOffset - fillStart;
+	}
+	else
+	{
+		return;
+	}
+
+	size_t	usable = std::min((size_t)result - skip, (size_t)READAHEAD_MAX_WINDOW - keep);
+
+	memcpy(mData.get() + keep, mFillBuffer.get() + skip, usable);
+
+	mStart		= mNextOffset;
+	mLength		= keep + usable;
+	mEOF		= ((size_t)result < fillLength) && (skip + usable == (size_t)result);
+	mFilledAt	= system_time();
+}
+
+
+/*
+ * WorkerThread()
+ *
+ * Description:
+ *		Services the prefetch queue for all open forks.
+ *
+ * Returns: B_OK
+ */
+
+status_t fp_readahead::WorkerThread(void*)
+{
+	while(acquire_sem(sQueueSem) == B_OK)
+	{
+		fp_readahead*	item = NULL;
+
+		{
+			std::lock_guard<std::mutex> lock(sQueueLock);
+
+			//
+			//A fork that was closed while queued leaves an extra
+			//count on the semaphore behind.
+			//
+			if (sQueue.empty()) {
+				continue;
+			}
+
+			item = sQueue.front();
+			sQueue.pop_front();
+
+			item->mQueued	= false;
+			item->mBusy		= true;
+		}
+
+		item->Fill();
+
+		std::lock_guard<std::mutex> lock(sQueueLock);
+
+		item->mBusy = false;
+	}
+
+	return( B_OK );
+}
@@ -0,0 +1,117 @@
+#ifndef __fp_readahead__
+#define __fp_readahead__
+
+#include "fp_storage.h"
+#include "afp_os.h"
+
+#include <memory>
+#include <mutex>
+
+class fp_iosched;
+
+//
+//The prefetch window starts out small and doubles every time the
+//client keeps reading where it left off, up to the max. The max is
+//also the size of the per-fork buffer.
+//
+#define READAHEAD_MIN_WINDOW		(64 * 1024)
+#define READAHEAD_MAX_WINDOW		(256 * 1024)
+
+//
+//Number of back to back sequential reads we need to see before we
+//start reading ahead for a fork.
+//
+#define READAHEAD_SEQUENTIAL_HITS	2
+
+//
+//How long (in microseconds) we'll trust prefetched data. Bounds how
+//stale we can be when a local app writes to the file behind our back.
+//
+#define READAHEAD_MAX_AGE			2000000
+
+//
+//Reads we make ourselves that come back faster than this (bytes per
+//microsecond, about 1GB/s) are being served out of memory, the page
+//cache or the block cache. There's no disk time for a prefetch to
+//hide then, only the extra copies, so we don't start one.
+//
+#define READAHEAD_SLOW_RATE			1024
+
+
+class fp_readahead
+{
+public:
+						fp_readahead(fp_storage_node* file, fp_iosched* ioSched, const node_ref* cacheRef=NULL);
+	virtual				~fp_readahead();
+
+	virtual ssize_t		Read(off_t offset, void* buffer, size_t count);
+	virtual void		Invalidate();
+
+	virtual int32		GetWindowSize();
+	virtual int64		GetHits()		{ return mHits;		}
+	virtual int64		GetMisses()		{ return mMisses;	}
+	virtual int32		GetHitRate();
+
+private:
+
+	ssize_t				ReadFile(off_t offset, void* buffer, size_t count);
+	bool				IsSlow();
+	void				Schedule();
+	void				Fill();
+
+	static status_t		WorkerThread(void* data);
+
+	fp_storage_node*	mFile;
+
+	//
+	//Prefetches wait their turn on the volume's I/O scheduler.
+	//
+	fp_iosched*			mIOSched;
+
+	//
+	//When set, reads that miss our buffer go through the shared
+	//block cache for this node.
+	//
+	bool				mUseBlockCache;
+	node_ref			mNodeRef;
+
+	//
+	//Prefetched data for the range [mStart, mStart + mLength). The
+	//worker reads into mFillBuffer without holding mMutex and then
+	//merges it into mData.
+	//
+	std::mutex			mMutex;
+	std::unique_ptr<int8[]>	mData;
+	std::unique_ptr<int8[]>	mFillBuffer;
+	off_t				mStart;
+	size_t				mLength;
+	bool				mEOF;
+	bigtime_t			mFilledAt;
+
+	//
+	//Sequential detection. Anything that doesn't start where the
+	//last read ended resets the window.
+	//
+	off_t				mNextOffset;
+	int32				mSequential;
+	size_t				mWindow;
+	uint32				mGeneration;
+
+	//
+	//What the reads we had to make ourselves cost since the client
+	//started reading sequentially.
+	//
+	int64				mDirectBytes;
+	bigtime_t			mDirectTime;
+
+	//
+	//These two are protected by the worker's queue lock.
+	//
+	bool				mQueued;
+	bool				mBusy;
+
+	int64				mHits;
+	int64				mMisses;
+};
+
+#endif //__fp_readahead__
@@ -0,0 +1,430 @@
+#ifndef __fp_storage__
+#define __fp_storage__
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#ifdef __HAIKU__
+#include <SupportDefs.h>
+#include <Directory.h>
+#include <Entry.h>
+#include <File.h>
+#include <Node.h>
+#else
+#include <dirent.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string>
+#endif
+
+//
+//The storage layer is what the AFP engine uses to get at files,
+//directories and their attributes. On Haiku it's the Storage Kit, on
+//anything else plain POSIX (openat and extended attributes), so the
+//protocol code can be built and measured off Haiku. Which one is
+//used is decided when building, fp_storage_haiku.cpp and
+//fp_storage_posix.cpp each only compile on their own platform.
+//
+
+#ifndef __HAIKU__
+
+//
+//Off Haiku there is no SupportDefs.h. These are the types and codes
+//the engine uses from it, with the values Haiku gives them so status
+//codes mean the same on either platform and never collide with
+//errno values.
+//
+typedef int8_t				int8;
+typedef uint8_t				uint8;
+typedef int16_t				int16;
+typedef uint16_t			uint16;
+typedef int32_t				int32;
+typedef uint32_t			uint32;
+typedef int64_t				int64;
+typedef uint64_t			uint64;
+
+typedef unsigned char		uchar;
+
+typedef int32				status_t;
+typedef int64				bigtime_t;
+typedef uint32				type_code;
+
+#ifndef TRUE
+#define TRUE					1
+#define FALSE					0
+#endif
+
+#define B_GENERAL_ERROR_BASE	INT32_MIN
+#define B_OS_ERROR_BASE			(B_GENERAL_ERROR_BASE + 0x1000)
+#define B_STORAGE_ERROR_BASE	(B_GENERAL_ERROR_BASE + 0x6000)
+
+enum
+{
+	B_NO_MEMORY				= B_GENERAL_ERROR_BASE + 0,
+	B_IO_ERROR,
+	B_PERMISSION_DENIED,
+	B_BAD_INDEX,
+	B_BAD_TYPE,
+	B_BAD_VALUE,
+	B_MISMATCHED_VALUES,
+	B_NAME_NOT_FOUND,
+	B_NAME_IN_USE,
+	B_TIMED_OUT,
+	B_INTERRUPTED,
+	B_WOULD_BLOCK,
+	B_CANCELED,
+	B_NO_INIT,
+	B_BUSY,
+	B_NOT_ALLOWED,
+	B_BAD_DATA,
+
+	B_ERROR					= -1,
+	B_OK					= 0,
+	B_NO_ERROR				= 0
+};
+
+enum
+{
+	B_BAD_SEM_ID			= B_OS_ERROR_BASE + 0,
+	B_NO_MORE_SEMS,
+
+	B_BAD_THREAD_ID			= B_OS_ERROR_BASE + 0x100,
+	B_NO_MORE_THREADS,
+	B_BAD_THREAD_STATE,
+
+	B_BAD_TEAM_ID			= B_OS_ERROR_BASE + 0x200,
+	B_BAD_PORT_ID			= B_OS_ERROR_BASE + 0x300
+};
+
+enum
+{
+	B_FILE_ERROR			= B_STORAGE_ERROR_BASE + 0,
+	B_FILE_NOT_FOUND,
+	B_FILE_EXISTS,
+	B_ENTRY_NOT_FOUND,
+	B_NAME_TOO_LONG,
+	B_NOT_A_DIRECTORY,
+	B_DIRECTORY_NOT_EMPTY,
+	B_DEVICE_FULL,
+	B_READ_ONLY_DEVICE,
+	B_IS_A_DIRECTORY,
+	B_NO_MORE_FDS,
+	B_CROSS_DEVICE_LINK,
+	B_LINK_LIMIT,
+	B_BUSTED_PIPE,
+	B_UNSUPPORTED,
+	B_PARTITION_TOO_SMALL
+};
+
+#define B_FILE_NAME_LENGTH		256
+#define B_PATH_NAME_LENGTH		1024
+#define B_ATTR_NAME_LENGTH		256
+#define B_OS_NAME_LENGTH		32
+
+#define B_RAW_TYPE				'RAWT'
+#define B_STRING_TYPE			'CSTR'
+#define B_INT16_TYPE			'SHRT'
+#define B_INT32_TYPE			'LONG'
+
+#define min_c(a,b)				((a)>(b)?(b):(a))
+#define max_c(a,b)				((a)>(b)?(a):(b))
+
+//
+//A node on a device, what Haiku calls a node_ref.
+//
+struct node_ref
+{
+						node_ref() : device(-1), node(-1) {}
+						node_ref(dev_t dev, ino_t ino) : device(dev), node(ino) {}
+
+	bool				operator==(const node_ref& other) const
+							{ return( (device == other.device) && (node == other.node) ); }
+	bool				operator!=(const node_ref& other) const
+							{ return( !(*this == other) ); }
+	bool				operator<(const node_ref& other) const
+							{ return( (device < other.device) || ((device == other.device) && (node < other.node)) ); }
+
+	dev_t				device;
+	ino_t				node;
+};
+
+//
+//A name in a directory, what Haiku calls an entry_ref. The name is
+//owned by the ref.
+//
+struct entry_ref
+{
+						entry_ref();
+						entry_ref(dev_t dev, ino_t dir, const char* name);
+						entry_ref(const entry_ref& other);
+						~entry_ref();
+
+	entry_ref&			operator=(const entry_ref& other);
+	bool				operator==(const entry_ref& other) const;
+	bool				operator!=(const entry_ref& other) const
+							{ return( !(*this == other) ); }
+
+	status_t			set_name(const char* name);
+
+	dev_t				device;
+	ino_t				directory;
+	char*				name;
+};
+
+#endif //!__HAIKU__
+
+//
+//How a node is opened. With neither read nor write only attributes
+//can be used, which also works for directories.
+//
+#define FP_STORAGE_READ			0x01
+#define FP_STORAGE_WRITE		0x02
+#define FP_STORAGE_CREATE		0x04
+#define FP_STORAGE_NOFOLLOW		0x08
+#define FP_STORAGE_EXCLUSIVE	0x10	//With create, fail if it's already there
+#define FP_STORAGE_TRUNCATE		0x20
+
+//
+//Longest attribute name either backend will hand back.
+//
+#define FP_STORAGE_ATTR_NAME_LENGTH		256
+
+//
+//What fp_storage_watch_node() can be asked to report. Without a node
+//monitor (anything but Haiku) watching fails and only changes made
+//through AFP are noticed.
+//
+#define FP_STORAGE_WATCH_STOP			0x00
+#define FP_STORAGE_WATCH_DIRECTORY		0x01	//Entries added, removed or changed
+#define FP_STORAGE_WATCH_SHARE			0x02	//The node itself moved or removed
+
+typedef struct
+{
+	dev_t		device;
+	ino_t		node;
+	off_t		size;
+	time_t		created;
+	time_t		modified;
+	bigtime_t	modifiedUsecs;	//For telling apart writes within a second
+	mode_t		mode;
+	bool		isDirectory;
+}FP_STORAGE_STAT;
+
+typedef struct
+{
+	type_code	type;
+	off_t		size;
+}FP_STORAGE_ATTR_INFO;
+
+typedef struct
+{
+	off_t		freeBytes;
+	off_t		capacity;
+	bool		readOnly;
+}FP_STORAGE_VOLUME_INFO;
+
+class fp_storage_dir;
+class fp_storage_node;
+
+
+class fp_storage_entry
+{
+public:
+							fp_storage_entry();
+							fp_storage_entry(const char* path, bool traverse=false);
+							fp_storage_entry(const fp_storage_dir* dir, const char* name, bool traverse=false);
+							fp_storage_entry(const entry_ref* ref, bool traverse=false);
+							fp_storage_entry(const fp_storage_entry& entry);
+	virtual					~fp_storage_entry();
+
+	fp_storage_entry&		operator=(const fp_storage_entry& entry);
+	bool					operator==(const fp_storage_entry& entry) const;
+	bool					operator!=(const fp_storage_entry& entry) const	{ return( !(*this == entry) ); }
+
+	virtual status_t		SetTo(const char* path, bool traverse=false);
+	virtual status_t		SetTo(const fp_storage_dir* dir, const char* name, bool traverse=false);
+	virtual status_t		SetTo(const entry_ref* ref, bool traverse=false);
+	virtual status_t		InitCheck() const	{ return( mStatus ); }
+	virtual void			Unset();
+
+	virtual bool			Exists() const;
+	virtual bool			IsDirectory() const;
+	virtual bool			IsFile() const;
+	virtual bool			IsSymLink() const;
+
+	//
+	//name must hold B_FILE_NAME_LENGTH bytes.
+	//
+	virtual const char*		Name() const;
+	virtual status_t		GetName(char* name) const;
+	virtual status_t		GetPath(char* path, size_t size) const;
+	virtual status_t		GetParent(fp_storage_entry* parent) const;
+	virtual status_t		GetParent(fp_storage_dir* parent) const;
+	virtual status_t		GetRef(entry_ref* ref) const;
+	virtual status_t		GetNodeRef(node_ref* ref) const;
+	virtual status_t		GetStat(FP_STORAGE_STAT* stat) const;
+
+	virtual status_t		Rename(const char* name, bool clobber=false);
+	virtual status_t		MoveTo(fp_storage_dir* dir, const char* name=NULL, bool clobber=false);
+	virtual status_t		Remove();
+
+	virtual status_t		SetPermissions(mode_t perms);
+	virtual status_t		SetCreationTime(time_t time);
+	virtual status_t		SetModificationTime(time_t time);
+
+private:
+
+	friend class fp_storage_dir;
+	friend class fp_storage_node;
+
+	status_t				mStatus;
+
+#ifdef __HAIKU__
+	BEntry					mEntry;
+#else
+	std::string				mPath;
+#endif
+};
+
+
+class fp_storage_dir
+{
+public:
+							fp_storage_dir();
+							fp_storage_dir(const char* path);
+							fp_storage_dir(const node_ref* ref);
+							fp_storage_dir(const fp_storage_entry* entry);
+	virtual					~fp_storage_dir();
+
+	virtual status_t		SetTo(const char* path);
+	virtual status_t		SetTo(const node_ref* ref);
+	virtual status_t		SetTo(const fp_storage_entry* entry);
+	virtual status_t		InitCheck() const	{ return( mStatus ); }
+	virtual void			Unset();
+
+	virtual status_t		GetEntry(fp_storage_entry* entry) const;
+	virtual status_t		GetNodeRef(node_ref* ref) const;
+	virtual status_t		GetStat(FP_STORAGE_STAT* stat) const;
+	virtual status_t		GetVolumeInfo(FP_STORAGE_VOLUME_INFO* info) const;
+
+	virtual status_t		GetNextEntry(char* name, size_t nameSize);
+	virtual status_t		GetNextEntry(fp_storage_entry* entry, bool traverse=false);
+	virtual status_t		Rewind();
+	virtual int32			CountEntries();
+
+	virtual status_t		FindEntry(const char* name, fp_storage_entry* entry, bool traverse=false) const;
+	virtual status_t		StatEntry(const char* name, FP_STORAGE_STAT* stat);
+	virtual status_t		CreateDirectory(const char* name, fp_storage_dir* newDir=NULL);
+	virtual status_t		CreateFile(const char* name, fp_storage_node* file, bool failIfExists=false);
+	virtual status_t		RemoveEntry(const char* name);
+	virtual status_t		RenameEntry(const char* name, fp_storage_dir* toDir, const char* toName);
+
+private:
+
+							fp_storage_dir(const fp_storage_dir&) = delete;
+	fp_storage_dir&			operator=(const fp_storage_dir&) = delete;
+
+	friend class fp_storage_entry;
+	friend class fp_storage_node;
+
+	status_t				mStatus;
+
+#ifdef __HAIKU__
+	BDirectory				mDirectory;
+#else
+	status_t				Open(const char* path);
+
+	int						mFD;
+	DIR*					mIterator;
+	std::string				mPath;
+#endif
+};
+
+
+class fp_storage_node
+{
+public:
+							fp_storage_node();
+							fp_storage_node(const fp_storage_entry* entry, uint32 mode=0);
+	virtual					~fp_storage_node();
+
+	virtual status_t		SetTo(const char* path, uint32 mode);
+	virtual status_t		SetTo(fp_storage_dir* dir, const char* name, uint32 mode);
+	virtual status_t		SetTo(const fp_storage_entry* entry, uint32 mode);
+	virtual status_t		InitCheck() const	{ return( mStatus ); }
+	virtual void			Unset();
+
+	virtual status_t		GetNodeRef(node_ref* ref) const;
+	virtual status_t		GetStat(FP_STORAGE_STAT* stat) const;
+
+	//
+	//Keeps other openers of the node out while held.
+	//
+	virtual status_t		Lock();
+	virtual status_t		Unlock();
+
+	//
+	//Data
+	//
+	virtual bool			IsReadable() const;
+	virtual bool			IsWritable() const;
+	virtual ssize_t			ReadAt(off_t position, void* buffer, size_t size);
+	virtual ssize_t			WriteAt(off_t position, const void* buffer, size_t size);
+	virtual status_t		GetSize(off_t* size) const;
+	virtual status_t		SetSize(off_t size);
+	virtual status_t		Sync();
+
+	//
+	//Named attributes
+	//
+	virtual status_t		GetAttrInfo(const char* name, FP_STORAGE_ATTR_INFO* info);
+	virtual status_t		GetAttrSize(const char* name, off_t* size);
+	virtual ssize_t			ReadAttr(const char* name, off_t position, void* buffer, size_t size);
+	virtual ssize_t			WriteAttr(const char* name, type_code type, const void* buffer, size_t size);
+	virtual status_t		RemoveAttr(const char* name);
+	virtual status_t		GetNextAttrName(char* name);
+	virtual status_t		RewindAttrs();
+
+private:
+
+							fp_storage_node(const fp_storage_node&) = delete;
+	fp_storage_node&		operator=(const fp_storage_node&) = delete;
+
+	friend class fp_storage_dir;
+
+	status_t				mStatus;
+
+#ifdef __HAIKU__
+	BNode*					Node()				{ return( mIsFile ? (BNode*)&mFile : &mNode ); }
+	const BNode*			Node() const		{ return( mIsFile ? (const BNode*)&mFile : &mNode ); }
+
+	BNode					mNode;
+	BFile					mFile;
+	bool					mIsFile;
+#else
+	int						mFD;
+	uint32					mMode;
+	char*					mAttrNames;
+	ssize_t					mAttrNamesSize;
+	ssize_t					mAttrNamesPos;
+#endif
+};
+
+//
+//Where the server keeps its settings files.
+//
+status_t	fp_storage_settings_dir(char* path, size_t size);
+
+//
+//Where scratch files go.
+//
+status_t	fp_storage_temp_dir(char* path, size_t size);
+
+//
+//Put a node monitor on (or with FP_STORAGE_WATCH_STOP, take every one
+//of ours off) a node. Notifications go to the application.
+//
+status_t	fp_storage_watch_node(const node_ref* ref, uint32 flags);
+
+#endif //__fp_storage__
@@ -0,0 +1,1421 @@
+#ifdef __HAIKU__
+
+#include <Application.h>
+#include <FindDirectory.h>
+#include <NodeMonitor.h>
+#include <Path.h>
+#include <Volume.h>
+#include <fs_attr.h>
+#include <string.h>
+
+#include "fp_storage.h"
+
+/*
+ * OpenMode()
+ *
+ * Description:
+ *		Storage Kit open mode for a set of FP_STORAGE flags.
+ *
+ * Returns: uint32
+ */
+
+static uint32 OpenMode(uint32 mode)
+{
+	uint32	openMode = 0;
+
+	if ((mode & FP_STORAGE_READ) && (mode & FP_STORAGE_WRITE)) {
+		openMode = B_READ_WRITE;
+	}
+	else if (mode & FP_STORAGE_WRITE) {
+		openMode = B_WRITE_ONLY;
+	}
+	else {
+		openMode = B_READ_ONLY;
+	}
+
+	if (mode & FP_STORAGE_CREATE) {
+		openMode |= B_CREATE_FILE;
+	}
+
+	if (mode & FP_STORAGE_EXCLUSIVE) {
+		openMode |= B_FAIL_IF_EXISTS;
+	}
+
+	if (mode & FP_STORAGE_TRUNCATE) {
+		openMode |= B_ERASE_FILE;
+	}
+
+	return( openMode );
+}
+
+
+/*
+ * StatFromStat()
+ *
+ * Description:
+ *		Fill in an FP_STORAGE_STAT from what the Storage Kit returned.
+ *
+ * Returns: none
+ */
+
+static void StatFromStat(const struct stat& st, FP_STORAGE_STAT* stat)
+{
+	stat->device		= st.st_dev;
+	stat->node			= st.st_ino;
+	stat->size			= st.st_size;
+	stat->created		= st.st_crtime;
+	stat->modified		= st.st_mtime;
+	stat->modifiedUsecs	= ((bigtime_t)st.st_mtim.tv_sec * 1000000) + (st.st_mtim.tv_nsec / 1000);
+	stat->mode			= st.st_mode;
+	stat->isDirectory	= S_ISDIR(st.st_mode);
+}
+
+
+/*
+ * fp_storage_entry()
+ *
+ * Description:
+ *		A name in a directory on a Haiku volume, which is a BEntry.
+ *		The entry needn't exist.
+ *
+ * Returns:
+ */
+
+fp_storage_entry::fp_storage_entry()
+{
+	mStatus = B_NO_INIT;
+}
+
+
+/*
+ * fp_storage_entry()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_entry::fp_storage_entry(const char* path, bool traverse)
+{
+	SetTo(path, traverse);
+}
+
+
+/*
+ * fp_storage_entry()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_entry::fp_storage_entry(const fp_storage_dir* dir, const char* name, bool traverse)
+{
+	SetTo(dir, name, traverse);
+}
+
+
+/*
+ * fp_storage_entry()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_entry::fp_storage_entry(const entry_ref* ref, bool traverse)
+{
+	SetTo(ref, traverse);
+}
+
+
+/*
+ * fp_storage_entry()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_entry::fp_storage_entry(const fp_storage_entry& entry)
+{
+	mEntry	= entry.mEntry;
+	mStatus	= entry.mStatus;
+}
+
+
+/*
+ * ~fp_storage_entry()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_entry::~fp_storage_entry()
+{
+}
+
+
+/*
+ * operator=()
+ *
+ * Description:
+ *
+ * Returns: *this
+ */
+
+fp_storage_entry& fp_storage_entry::operator=(const fp_storage_entry& entry)
+{
+	if (this != &entry)
+	{
+		mEntry	= entry.mEntry;
+		mStatus	= entry.mStatus;
+	}
+
+	return( *this );
+}
+
+
+/*
+ * operator==()
+ *
+ * Description:
+ *
+ * Returns: true if both are the same entry
+ */
+
+bool fp_storage_entry::operator==(const fp_storage_entry& entry) const
+{
+	return( mEntry == entry.mEntry );
+}
+
+
+/*
+ * SetTo()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::SetTo(const char* path, bool traverse)
+{
+	mStatus = mEntry.SetTo(path, traverse);
+
+	return( mStatus );
+}
+
+
+/*
+ * SetTo()
+ *
+ * Description:
+ *		name in dir. name may also be a relative path.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::SetTo(const fp_storage_dir* dir, const char* name, bool traverse)
+{
+	mStatus = mEntry.SetTo(&dir->mDirectory, name, traverse);
+
+	return( mStatus );
+}
+
+
+/*
+ * SetTo()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::SetTo(const entry_ref* ref, bool traverse)
+{
+	mStatus = mEntry.SetTo(ref, traverse);
+
+	return( mStatus );
+}
+
+
+/*
+ * Unset()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+void fp_storage_entry::Unset()
+{
+	mEntry.Unset();
+	mStatus = B_NO_INIT;
+}
+
+
+/*
+ * Exists()
+ *
+ * Description:
+ *
+ * Returns: true or false
+ */
+
+bool fp_storage_entry::Exists() const
+{
+	return( mEntry.Exists() );
+}
+
+
+/*
+ * IsDirectory()
+ *
+ * Description:
+ *
+ * Returns: true or false
+ */
+
+bool fp_storage_entry::IsDirectory() const
+{
+	return( mEntry.IsDirectory() );
+}
+
+
+/*
+ * IsFile()
+ *
+ * Description:
+ *
+ * Returns: true or false
+ */
+
+bool fp_storage_entry::IsFile() const
+{
+	return( mEntry.IsFile() );
+}
+
+
+/*
+ * IsSymLink()
+ *
+ * Description:
+ *
+ * Returns: true or false
+ */
+
+bool fp_storage_entry::IsSymLink() const
+{
+	return( mEntry.IsSymLink() );
+}
+
+
+/*
+ * Name()
+ *
+ * Description:
+ *		The leaf name, good until the entry changes.
+ *
+ * Returns: const char* or NULL
+ */
+
+const char* fp_storage_entry::Name() const
+{
+	return( mEntry.Name() );
+}
+
+
+/*
+ * GetName()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::GetName(char* name) const
+{
+	return( mEntry.GetName(name) );
+}
+
+
+/*
+ * GetPath()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::GetPath(char* path, size_t size) const
+{
+	BPath		entryPath;
+	status_t	status = mEntry.GetPath(&entryPath);
+
+	if (status == B_OK)
+	{
+		if (strlcpy(path, entryPath.Path(), size) >= size) {
+			status = B_NAME_TOO_LONG;
+		}
+	}
+
+	return( status );
+}
+
+
+/*
+ * GetParent()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::GetParent(fp_storage_entry* parent) const
+{
+	parent->mStatus = mEntry.GetParent(&parent->mEntry);
+
+	return( parent->mStatus );
+}
+
+
+/*
+ * GetParent()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::GetParent(fp_storage_dir* parent) const
+{
+	parent->mStatus = mEntry.GetParent(&parent->mDirectory);
+
+	return( parent->mStatus );
+}
+
+
+/*
+ * GetRef()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::GetRef(entry_ref* ref) const
+{
+	return( mEntry.GetRef(ref) );
+}
+
+
+/*
+ * GetNodeRef()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::GetNodeRef(node_ref* ref) const
+{
+	return( mEntry.GetNodeRef(ref) );
+}
+
+
+/*
+ * GetStat()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::GetStat(FP_STORAGE_STAT* stat) const
+{
+	struct stat	st;
+	status_t	status = mEntry.GetStat(&st);
+
+	if (status == B_OK) {
+		StatFromStat(st, stat);
+	}
+
+	return( status );
+}
+
+
+/*
+ * Rename()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::Rename(const char* name, bool clobber)
+{
+	return( mEntry.Rename(name, clobber) );
+}
+
+
+/*
+ * MoveTo()
+ *
+ * Description:
+ *		Move into dir, keeping the name unless given a new one.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::MoveTo(fp_storage_dir* dir, const char* name, bool clobber)
+{
+	return( mEntry.MoveTo(&dir->mDirectory, name, clobber) );
+}
+
+
+/*
+ * Remove()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::Remove()
+{
+	return( mEntry.Remove() );
+}
+
+
+/*
+ * SetPermissions()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::SetPermissions(mode_t perms)
+{
+	return( mEntry.SetPermissions(perms) );
+}
+
+
+/*
+ * SetCreationTime()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::SetCreationTime(time_t time)
+{
+	return( mEntry.SetCreationTime(time) );
+}
+
+
+/*
+ * SetModificationTime()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::SetModificationTime(time_t time)
+{
+	return( mEntry.SetModificationTime(time) );
+}
+
+
+/*
+ * fp_storage_dir()
+ *
+ * Description:
+ *		A directory on a Haiku volume.
+ *
+ * Returns:
+ */
+
+fp_storage_dir::fp_storage_dir()
+{
+	mStatus = B_NO_INIT;
+}
+
+
+/*
+ * fp_storage_dir()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_dir::fp_storage_dir(const char* path)
+{
+	SetTo(path);
+}
+
+
+/*
+ * fp_storage_dir()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_dir::fp_storage_dir(const node_ref* ref)
+{
+	SetTo(ref);
+}
+
+
+/*
+ * fp_storage_dir()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_dir::fp_storage_dir(const fp_storage_entry* entry)
+{
+	SetTo(entry);
+}
+
+
+/*
+ * ~fp_storage_dir()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_dir::~fp_storage_dir()
+{
+}
+
+
+/*
+ * SetTo()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::SetTo(const char* path)
+{
+	mStatus = mDirectory.SetTo(path);
+
+	return( mStatus );
+}
+
+
+/*
+ * SetTo()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::SetTo(const node_ref* ref)
+{
+	mStatus = mDirectory.SetTo(ref);
+
+	return( mStatus );
+}
+
+
+/*
+ * SetTo()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::SetTo(const fp_storage_entry* entry)
+{
+	mStatus = mDirectory.SetTo(&entry->mEntry);
+
+	return( mStatus );
+}
+
+
+/*
+ * Unset()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+void fp_storage_dir::Unset()
+{
+	mDirectory.Unset();
+	mStatus = B_NO_INIT;
+}
+
+
+/*
+ * GetEntry()
+ *
+ * Description:
+ *		The directory's own entry.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::GetEntry(fp_storage_entry* entry) const
+{
+	entry->mStatus = mDirectory.GetEntry(&entry->mEntry);
+
+	return( entry->mStatus );
+}
+
+
+/*
+ * GetNodeRef()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::GetNodeRef(node_ref* ref) const
+{
+	return( mDirectory.GetNodeRef(ref) );
+}
+
+
+/*
+ * GetStat()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::GetStat(FP_STORAGE_STAT* stat) const
+{
+	struct stat	st;
+	status_t	status = mDirectory.GetStat(&st);
+
+	if (status == B_OK) {
+		StatFromStat(st, stat);
+	}
+
+	return( status );
+}
+
+
+/*
+ * GetVolumeInfo()
+ *
+ * Description:
+ *		Space and writability of the volume the directory is on.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::GetVolumeInfo(FP_STORAGE_VOLUME_INFO* info) const
+{
+	node_ref	ref;
+	status_t	status = mDirectory.GetNodeRef(&ref);
+
+	if (status != B_OK) {
+		return( status );
+	}
+
+	BVolume	volume(ref.device);
+
+	status = volume.InitCheck();
+
+	if (status == B_OK)
+	{
+		info->freeBytes	= volume.FreeBytes();
+		info->capacity	= volume.Capacity();
+		info->readOnly	= volume.IsReadOnly();
+	}
+
+	return( status );
+}
+
+
+/*
+ * GetNextEntry()
+ *
+ * Description:
+ *		The name of the next entry in the directory.
+ *
+ * Returns: B_OK or B_ENTRY_NOT_FOUND at the end
+ */
+
+status_t fp_storage_dir::GetNextEntry(char* name, size_t nameSize)
+{
+	BEntry		entry;
+	status_t	status = mDirectory.GetNextEntry(&entry);
+
+	if (status == B_OK)
+	{
+		char	leaf[B_FILE_NAME_LENGTH];
+
+		status = entry.GetName(leaf);
+
+		if (status == B_OK) {
+			strlcpy(name, leaf, nameSize);
+		}
+	}
+
+	return( status );
+}
+
+
+/*
+ * GetNextEntry()
+ *
+ * Description:
+ *		The next entry in the directory.
+ *
+ * Returns: B_OK or B_ENTRY_NOT_FOUND at the end
+ */
+
+status_t fp_storage_dir::GetNextEntry(fp_storage_entry* entry, bool traverse)
+{
+	entry->mStatus = mDirectory.GetNextEntry(&entry->mEntry, traverse);
+
+	return( entry->mStatus );
+}
+
+
+/*
+ * Rewind()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::Rewind()
+{
+	return( mDirectory.Rewind() );
+}
+
+
+/*
+ * CountEntries()
+ *
+ * Description:
+ *		Rewinds the directory.
+ *
+ * Returns: number of entries
+ */
+
+int32 fp_storage_dir::CountEntries()
+{
+	return( mDirectory.CountEntries() );
+}
+
+
+/*
+ * FindEntry()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::FindEntry(const char* name, fp_storage_entry* entry, bool traverse) const
+{
+	entry->mStatus = mDirectory.FindEntry(name, &entry->mEntry, traverse);
+
+	return( entry->mStatus );
+}
+
+
+/*
+ * StatEntry()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::StatEntry(const char* name, FP_STORAGE_STAT* stat)
+{
+	BEntry		entry(&mDirectory, name);
+	struct stat	st;
+	status_t	status = entry.GetStat(&st);
+
+	if (status == B_OK) {
+		StatFromStat(st, stat);
+	}
+
+	return( status );
+}
+
+
+/*
+ * CreateDirectory()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::CreateDirectory(const char* name, fp_storage_dir* newDir)
+{
+	if (newDir == NULL) {
+		return( mDirectory.CreateDirectory(name, NULL) );
+	}
+
+	newDir->mStatus = mDirectory.CreateDirectory(name, &newDir->mDirectory);
+
+	return( newDir->mStatus );
+}
+
+
+/*
+ * CreateFile()
+ *
+ * Description:
+ *		Create (or with failIfExists false, open and empty) a file and
+ *		open it for reading and writing. file may be NULL if all that's
+ *		wanted is the file.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::CreateFile(const char* name, fp_storage_node* file, bool failIfExists)
+{
+	if (file == NULL) {
+		return( mDirectory.CreateFile(name, NULL, failIfExists) );
+	}
+
+	file->Unset();
+
+	file->mIsFile = true;
+	file->mStatus = mDirectory.CreateFile(name, &file->mFile, failIfExists);
+
+	return( file->mStatus );
+}
+
+
+/*
+ * RemoveEntry()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::RemoveEntry(const char* name)
+{
+	BEntry	entry(&mDirectory, name);
+
+	return( entry.Remove() );
+}
+
+
+/*
+ * RenameEntry()
+ *
+ * Description:
+ *		Move an entry, possibly into another directory. An existing
+ *		entry with the new name is not replaced.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::RenameEntry(const char* name, fp_storage_dir* toDir, const char* toName)
+{
+	BEntry	entry(&mDirectory, name);
+
+	return( entry.MoveTo(&toDir->mDirectory, toName, false) );
+}
+
+
+/*
+ * fp_storage_node()
+ *
+ * Description:
+ *		A file or directory on a Haiku volume. Opened for reading or
+ *		writing it's a BFile, for attributes only it's a BNode.
+ *
+ * Returns:
+ */
+
+fp_storage_node::fp_storage_node()
+{
+	mStatus	= B_NO_INIT;
+	mIsFile	= false;
+}
+
+
+/*
+ * fp_storage_node()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_node::fp_storage_node(const fp_storage_entry* entry, uint32 mode)
+{
+	mStatus	= B_NO_INIT;
+	mIsFile	= false;
+
+	SetTo(entry, mode);
+}
+
+
+/*
+ * ~fp_storage_node()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_node::~fp_storage_node()
+{
+}
+
+
+/*
+ * SetTo()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::SetTo(const char* path, uint32 mode)
+{
+	fp_storage_entry	entry(path, (mode & FP_STORAGE_NOFOLLOW) ? false : true);
+
+	return( SetTo(&entry, mode) );
+}
+
+
+/*
+ * SetTo()
+ *
+ * Description:
+ *		Open name in dir.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::SetTo(fp_storage_dir* dir, const char* name, uint32 mode)
+{
+	fp_storage_entry	entry(dir, name, (mode & FP_STORAGE_NOFOLLOW) ? false : true);
+
+	return( SetTo(&entry, mode) );
+}
+
+
+/*
+ * SetTo()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::SetTo(const fp_storage_entry* entry, uint32 mode)
+{
+	Unset();
+
+	mIsFile = ((mode & (FP_STORAGE_READ | FP_STORAGE_WRITE)) != 0);
+
+	if (mIsFile) {
+		mStatus = mFile.SetTo(&entry->mEntry, OpenMode(mode));
+	}
+	else {
+		mStatus = mNode.SetTo(&entry->mEntry);
+	}
+
+	return( mStatus );
+}
+
+
+/*
+ * Unset()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+void fp_storage_node::Unset()
+{
+	mNode.Unset();
+	mFile.Unset();
+
+	mStatus	= B_NO_INIT;
+	mIsFile	= false;
+}
+
+
+/*
+ * GetNodeRef()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::GetNodeRef(node_ref* ref) const
+{
+	return( Node()->GetNodeRef(ref) );
+}
+
+
+/*
+ * GetStat()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::GetStat(FP_STORAGE_STAT* stat) const
+{
+	struct stat	st;
+	status_t	status = Node()->GetStat(&st);
+
+	if (status == B_OK) {
+		StatFromStat(st, stat);
+	}
+
+	return( status );
+}
+
+
+/*
+ * Lock()
+ *
+ * Description:
+ *		The Storage Kit's node lock.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::Lock()
+{
+	return( Node()->Lock() );
+}
+
+
+/*
+ * Unlock()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::Unlock()
+{
+	return( Node()->Unlock() );
+}
+
+
+/*
+ * IsReadable()
+ *
+ * Description:
+ *		Only if it was opened for reading.
+ *
+ * Returns: true or false
+ */
+
+bool fp_storage_node::IsReadable() const
+{
+	return( mIsFile && (mStatus == B_OK) && mFile.IsReadable() );
+}
+
+
+/*
+ * IsWritable()
+ *
+ * Description:
+ *
+ * Returns: true or false
+ */
+
+bool fp_storage_node::IsWritable() const
+{
+	return( mIsFile && (mStatus == B_OK) && mFile.IsWritable() );
+}
+
+
+/*
+ * ReadAt()
+ *
+ * Description:
+ *
+ * Returns: bytes read or an error
+ */
+
+ssize_t fp_storage_node::ReadAt(off_t position, void* buffer, size_t size)
+{
+	return( mFile.ReadAt(position, buffer, size) );
+}
+
+
+/*
+ * WriteAt()
+ *
+ * Description:
+ *
+ * Returns: bytes written or an error
+ */
+
+ssize_t fp_storage_node::WriteAt(off_t position, const void* buffer, size_t size)
+{
+	return( mFile.WriteAt(position, buffer, size) );
+}
+
+
+/*
+ * GetSize()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::GetSize(off_t* size) const
+{
+	return( mFile.GetSize(size) );
+}
+
+
+/*
+ * SetSize()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::SetSize(off_t size)
+{
+	return( mFile.SetSize(size) );
+}
+
+
+/*
+ * Sync()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::Sync()
+{
+	return( Node()->Sync() );
+}
+
+
+/*
+ * GetAttrInfo()
+ *
+ * Description:
+ *
+ * Returns: B_OK or B_ENTRY_NOT_FOUND if there is no such attribute
+ */
+
+status_t fp_storage_node::GetAttrInfo(const char* name, FP_STORAGE_ATTR_INFO* info)
+{
+	attr_info	attrInfo;
+	status_t	status = Node()->GetAttrInfo(name, &attrInfo);
+
+	if (status == B_OK)
+	{
+		info->type = attrInfo.type;
+		info->size = attrInfo.size;
+	}
+
+	return( status );
+}
+
+
+/*
+ * GetAttrSize()
+ *
+ * Description:
+ *
+ * Returns: B_OK or B_ENTRY_NOT_FOUND if there is no such attribute
+ */
+
+status_t fp_storage_node::GetAttrSize(const char* name, off_t* size)
+{
+	FP_STORAGE_ATTR_INFO	info;
+	status_t				status = GetAttrInfo(name, &info);
+
+	if (status == B_OK) {
+		*size = info.size;
+	}
+
+	return( status );
+}
+
+
+/*
+ * ReadAttr()
+ *
+ * Description:
+ *
+ * Returns: bytes read or an error
+ */
+
+ssize_t fp_storage_node::ReadAttr(const char* name, off_t position, void* buffer, size_t size)
+{
+	return( Node()->ReadAttr(name, B_RAW_TYPE, position, buffer, size) );
+}
+
+
+/*
+ * WriteAttr()
+ *
+ * Description:
+ *		Replace an attribute's contents.
+ *
+ * Returns: bytes written or an error
+ */
+
+ssize_t fp_storage_node::WriteAttr(const char* name, type_code type, const void* buffer, size_t size)
+{
+	return( Node()->WriteAttr(name, type, 0, buffer, size) );
+}
+
+
+/*
+ * RemoveAttr()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::RemoveAttr(const char* name)
+{
+	return( Node()->RemoveAttr(name) );
+}
+
+
+/*
+ * GetNextAttrName()
+ *
+ * Description:
+ *		name must hold FP_STORAGE_ATTR_NAME_LENGTH bytes.
+ *
+ * Returns: B_OK or B_ENTRY_NOT_FOUND at the end
+ */
+
+status_t fp_storage_node::GetNextAttrName(char* name)
+{
+	return( Node()->GetNextAttrName(name) );
+}
+
+
+/*
+ * RewindAttrs()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::RewindAttrs()
+{
+	return( Node()->RewindAttrs() );
+}
+
+
+/*
+ * fp_storage_settings_dir()
+ *
+ * Description:
+ *		The user settings directory.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_settings_dir(char* path, size_t size)
+{
+	BPath		settings;
+	status_t	status = find_directory(B_USER_SETTINGS_DIRECTORY, &settings);
+
+	if (status == B_OK)
+	{
+		if (strlcpy(path, settings.Path(), size) >= size) {
+			status = B_NAME_TOO_LONG;
+		}
+	}
+
+	return( status );
+}
+
+
+/*
+ * fp_storage_temp_dir()
+ *
+ * Description:
+ *		The system temp directory.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_temp_dir(char* path, size_t size)
+{
+	BPath		temp;
+	status_t	status = find_directory(B_SYSTEM_TEMP_DIRECTORY, &temp);
+
+	if (status == B_OK)
+	{
+		if (strlcpy(path, temp.Path(), size) >= size) {
+			status = B_NAME_TOO_LONG;
+		}
+	}
+
+	return( status );
+}
+
+
+/*
+ * fp_storage_watch_node()
+ *
+ * Description:
+ *		Node monitor messages go to the application, which hands them
+ *		on to the volume list and fp_dirwatch.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_watch_node(const node_ref* ref, uint32 flags)
+{
+	uint32	watchFlags = B_STOP_WATCHING;
+
+	if (flags & FP_STORAGE_WATCH_DIRECTORY) {
+		watchFlags |= B_WATCH_DIRECTORY;
+	}
+
+	if (flags & FP_STORAGE_WATCH_SHARE) {
+		watchFlags |= B_ENTRY_REMOVED | B_ENTRY_MOVED | B_WATCH_NAME;
+	}
+
+	return( watch_node(ref, watchFlags, be_app_messenger) );
+}
+
+#endif //__HAIKU__
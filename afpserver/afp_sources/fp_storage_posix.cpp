@@ -0,0 +1,2576 @@
+#ifndef __HAIKU__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+
+#include "fp_storage.h"
+
+//
+//Extended attributes that ordinary users may set live in the user
+//namespace. The prefix is hidden from the AFP code, so the names it
+//sees are the same as on Haiku.
+//
+#define XATTR_USER_PREFIX		"user."
+#define XATTR_USER_PREFIX_LEN	(sizeof(XATTR_USER_PREFIX) - 1)
+
+//
+//AFP names directories by node, which POSIX has no way to open. Every
+//directory we open or hand out is remembered by its node_ref so it
+//can be found again. A path that no longer leads to the same node
+//(something was moved behind our back) is forgotten, and the shares
+//we were asked to open by path are searched for it instead.
+//
+static std::mutex							sRegistryLock;
+static std::map<node_ref, std::string>		sDirPaths;
+static std::set<std::string>				sSearchRoots;
+
+/*
+ * StatusFromErrno()
+ *
+ * Description:
+ *		The Haiku error for a POSIX one, so callers can keep checking
+ *		for the same codes on either platform.
+ *
+ * Returns: status_t
+ */
+
+static status_t StatusFromErrno(int error)
+{
+	switch(error)
+	{
+		case 0:				return( B_OK );
+		case ENOENT:		return( B_ENTRY_NOT_FOUND );
+		case ENODATA:		return( B_ENTRY_NOT_FOUND );
+		case EEXIST:		return( B_FILE_EXISTS );
+		case EACCES:		return( B_PERMISSION_DENIED );
+		case EPERM:			return( B_NOT_ALLOWED );
+		case ENOSPC:		return( B_DEVICE_FULL );
+		case EROFS:			return( B_READ_ONLY_DEVICE );
+		case ENOTDIR:		return( B_NOT_A_DIRECTORY );
+		case EISDIR:		return( B_IS_A_DIRECTORY );
+		case ENOTEMPTY:		return( B_DIRECTORY_NOT_EMPTY );
+		case ENAMETOOLONG:	return( B_NAME_TOO_LONG );
+		case ENOMEM:		return( B_NO_MEMORY );
+		case EXDEV:			return( B_CROSS_DEVICE_LINK );
+		case ENOTSUP:		return( B_UNSUPPORTED );
+		case ELOOP:			return( B_LINK_LIMIT );
+		case EMFILE:		return( B_NO_MORE_FDS );
+		case EBUSY:			return( B_BUSY );
+		case EINVAL:		return( B_BAD_VALUE );
+		case EIO:			return( B_IO_ERROR );
+
+		default:
+			break;
+	}
+
+	return( B_ERROR );
+}
+
+
+/*
+ * XattrName()
+ *
+ * Description:
+ *		The name an attribute is stored under.
+ *
+ * Returns: false if it's too long
+ */
+
+static bool XattrName(const char* name, char* xattrName, size_t size)
+{
+	return( snprintf(xattrName, size, "%s%s", XATTR_USER_PREFIX, name) < (int)size );
+}
+
+
+/*
+ * OpenFlags()
+ *
+ * Description:
+ *		open() flags for a set of FP_STORAGE flags.
+ *
+ * Returns: int
+ */
+
+static int OpenFlags(uint32 mode)
+{
+	int		flags = O_CLOEXEC;
+
+	if ((mode & FP_STORAGE_READ) && (mode & FP_STORAGE_WRITE)) {
+		flags |= O_RDWR;
+	}
+	else if (mode & FP_STORAGE_WRITE) {
+		flags |= O_WRONLY;
+	}
+	else {
+		flags |= O_RDONLY;
+	}
+
+	if (mode & FP_STORAGE_CREATE) {
+		flags |= O_CREAT;
+	}
+
+	if (mode & FP_STORAGE_EXCLUSIVE) {
+		flags |= O_EXCL;
+	}
+
+	if (mode & FP_STORAGE_TRUNCATE) {
+		flags |= O_TRUNC;
+	}
+
+	if (mode & FP_STORAGE_NOFOLLOW) {
+		flags |= O_NOFOLLOW;
+	}
+
+	return( flags );
+}
+
+
+/*
+ * StatFromStat()
+ *
+ * Description:
+ *		POSIX has no creation time, the last status change is the
+ *		closest there is.
+ *
+ * Returns: none
+ */
+
+static void StatFromStat(const struct stat& st, FP_STORAGE_STAT* stat)
+{
+	stat->device		= st.st_dev;
+	stat->node			= st.st_ino;
+	stat->size			= st.st_size;
+	stat->created		= st.st_ctime;
+	stat->modified		= st.st_mtime;
+	stat->modifiedUsecs	= ((bigtime_t)st.st_mtim.tv_sec * 1000000) + (st.st_mtim.tv_nsec / 1000);
+	stat->mode			= st.st_mode;
+	stat->isDirectory	= S_ISDIR(st.st_mode);
+}
+
+
+/*
+ * JoinPath()
+ *
+ * Description:
+ *		name in the directory at dirPath.
+ *
+ * Returns: std::string
+ */
+
+static std::string JoinPath(const std::string& dirPath, const char* name)
+{
+	std::string	path(dirPath);
+
+	if (path.empty() || (path[path.size() - 1] != '/')) {
+		path += '/';
+	}
+
+	path += name;
+
+	return( path );
+}
+
+
+/*
+ * ParentPath()
+ *
+ * Description:
+ *
+ * Returns: false for the root, which has no parent
+ */
+
+static bool ParentPath(const std::string& path, std::string& parent)
+{
+	size_t	slash = path.rfind('/');
+
+	if ((path == "/") || (slash == std::string::npos)) {
+		return( false );
+	}
+
+	parent = (slash == 0) ? std::string("/") : path.substr(0, slash);
+
+	return( true );
+}
+
+
+/*
+ * LeafName()
+ *
+ * Description:
+ *
+ * Returns: pointer into path
+ */
+
+static const char* LeafName(const std::string& path)
+{
+	size_t	slash = path.rfind('/');
+
+	if ((path == "/") || (slash == std::string::npos)) {
+		return( path.c_str() );
+	}
+
+	return( path.c_str() + slash + 1 );
+}
+
+
+/*
+ * CanonicalPath()
+ *
+ * Description:
+ *		An absolute path without symlinks, "." or ".." for everything
+ *		but the last component, which is only resolved with traverse.
+ *		That's what keeps two entries for the same name comparable.
+ *		The parent has to exist, the entry itself needn't.
+ *
+ * Returns: B_OK or an error
+ */
+
+static status_t CanonicalPath(const char* path, bool traverse, std::string& canonical)
+{
+	char			resolved[PATH_MAX];
+	std::string		whole(path);
+
+	while((whole.size() > 1) && (whole[whole.size() - 1] == '/')) {
+		whole.erase(whole.size() - 1);
+	}
+
+	if (whole.empty()) {
+		return( B_BAD_VALUE );
+	}
+
+	std::string		leaf(LeafName(whole));
+	std::string		parent;
+
+	if (traverse || (leaf == ".") || (leaf == "..") || (whole == "/"))
+	{
+		if (realpath(whole.c_str(), resolved) != NULL)
+		{
+			canonical = resolved;
+			return( B_OK );
+		}
+
+		if (errno != ENOENT) {
+			return( StatusFromErrno(errno) );
+		}
+	}
+
+	if (!ParentPath(whole, parent)) {
+		parent = ".";
+	}
+
+	if (realpath(parent.c_str(), resolved) == NULL) {
+		return( StatusFromErrno(errno) );
+	}
+
+	canonical = JoinPath(resolved, leaf.c_str());
+
+	return( B_OK );
+}
+
+
+/*
+ * RegisterDirectory()
+ *
+ * Description:
+ *		Remember where a directory is.
+ *
+ * Returns: none
+ */
+
+static void RegisterDirectory(dev_t device, ino_t node, const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(sRegistryLock);
+
+	sDirPaths[node_ref(device, node)] = path;
+}
+
+
+/*
+ * SearchRoot()
+ *
+ * Description:
+ *		Walk the tree under root for ref, remembering every directory
+ *		on the way. A match that isn't a directory is reported as such
+ *		so callers can tell a file ID from a missing directory.
+ *
+ * Returns: B_OK, B_NOT_A_DIRECTORY or B_ENTRY_NOT_FOUND
+ */
+
+static status_t SearchRoot(const std::string& root, const node_ref& ref, std::string& path)
+{
+	std::deque<std::string>	pending;
+	struct stat				st;
+
+	if ((stat(root.c_str(), &st) < 0) || (st.st_dev != ref.device)) {
+		return( B_ENTRY_NOT_FOUND );
+	}
+
+	if (st.st_ino == ref.node)
+	{
+		path = root;
+		return( B_OK );
+	}
+
+	pending.push_back(root);
+
+	while(!pending.empty())
+	{
+		std::string		dirPath = pending.front();
+		DIR*			dir		= opendir(dirPath.c_str());
+		struct dirent*	entry;
+
+		pending.pop_front();
+
+		if (dir == NULL) {
+			continue;
+		}
+
+		while((entry = readdir(dir)) != NULL)
+		{
+			if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0)) {
+				continue;
+			}
+
+			if ((entry->d_type != DT_DIR) && (entry->d_type != DT_UNKNOWN))
+			{
+				if (entry->d_ino == ref.node)
+				{
+					closedir(dir);
+					return( B_NOT_A_DIRECTORY );
+				}
+
+				continue;
+			}
+
+			if ((fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0) ||
+				(st.st_dev != ref.device)) {
+				continue;
+			}
+
+			if (!S_ISDIR(st.st_mode))
+			{
+				if (st.st_ino == ref.node)
+				{
+					closedir(dir);
+					return( B_NOT_A_DIRECTORY );
+				}
+
+				continue;
+			}
+
+			std::string	childPath = JoinPath(dirPath, entry->d_name);
+
+			RegisterDirectory(st.st_dev, st.st_ino, childPath);
+
+			if (st.st_ino == ref.node)
+			{
+				closedir(dir);
+				path = childPath;
+				return( B_OK );
+			}
+
+			pending.push_back(childPath);
+		}
+
+		closedir(dir);
+	}
+
+	return( B_ENTRY_NOT_FOUND );
+}
+
+
+/*
+ * FindDirectory()
+ *
+ * Description:
+ *		The path of the directory ref names.
+ *
+ * Returns: B_OK, B_NOT_A_DIRECTORY or B_ENTRY_NOT_FOUND
+ */
+
+static status_t FindDirectory(const node_ref& ref, std::string& path)
+{
+	std::set<std::string>	roots;
+	struct stat				st;
+
+	{
+		std::lock_guard<std::mutex> lock(sRegistryLock);
+
+		std::map<node_ref, std::string>::iterator	known = sDirPaths.find(ref);
+
+		if (known != sDirPaths.end()) {
+			path = known->second;
+		}
+
+		roots = sSearchRoots;
+	}
+
+	if (!path.empty())
+	{
+		if ((stat(path.c_str(), &st) == 0) && (st.st_dev == ref.device) &&
+			(st.st_ino == ref.node) && S_ISDIR(st.st_mode)) {
+			return( B_OK );
+		}
+
+		std::lock_guard<std::mutex> lock(sRegistryLock);
+
+		sDirPaths.erase(ref);
+		path.clear();
+	}
+
+	for (std::set<std::string>::iterator root = roots.begin(); root != roots.end(); root++) {
+
+		status_t	status = SearchRoot(*root, ref, path);
+
+		if (status != B_ENTRY_NOT_FOUND) {
+			return( status );
+		}
+	}
+
+	return( B_ENTRY_NOT_FOUND );
+}
+
+
+/*
+ * entry_ref()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+entry_ref::entry_ref()
+{
+	device		= -1;
+	directory	= -1;
+	name		= NULL;
+}
+
+
+/*
+ * entry_ref()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+entry_ref::entry_ref(dev_t dev, ino_t dir, const char* leaf)
+{
+	device		= dev;
+	directory	= dir;
+	name		= NULL;
+
+	set_name(leaf);
+}
+
+
+/*
+ * entry_ref()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+entry_ref::entry_ref(const entry_ref& other)
+{
+	device		= other.device;
+	directory	= other.directory;
+	name		= NULL;
+
+	set_name(other.name);
+}
+
+
+/*
+ * ~entry_ref()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+entry_ref::~entry_ref()
+{
+	free(name);
+}
+
+
+/*
+ * operator=()
+ *
+ * Description:
+ *
+ * Returns: *this
+ */
+
+entry_ref& entry_ref::operator=(const entry_ref& other)
+{
+	if (this != &other)
+	{
+		device		= other.device;
+		directory	= other.directory;
+
+		set_name(other.name);
+	}
+
+	return( *this );
+}
+
+
+/*
+ * operator==()
+ *
+ * Description:
+ *
+ * Returns: true if both name the same entry
+ */
+
+bool entry_ref::operator==(const entry_ref& other) const
+{
+	if ((device != other.device) || (directory != other.directory)) {
+		return( false );
+	}
+
+	if ((name == NULL) || (other.name == NULL)) {
+		return( name == other.name );
+	}
+
+	return( strcmp(name, other.name) == 0 );
+}
+
+
+/*
+ * set_name()
+ *
+ * Description:
+ *
+ * Returns: B_OK or B_NO_MEMORY
+ */
+
+status_t entry_ref::set_name(const char* leaf)
+{
+	free(name);
+	name = NULL;
+
+	if (leaf != NULL)
+	{
+		name = strdup(leaf);
+
+		if (name == NULL) {
+			return( B_NO_MEMORY );
+		}
+	}
+
+	return( B_OK );
+}
+
+
+/*
+ * fp_storage_entry()
+ *
+ * Description:
+ *		A name in a directory, kept as its path. The entry needn't
+ *		exist, only the directory it's in.
+ *
+ * Returns:
+ */
+
+fp_storage_entry::fp_storage_entry()
+{
+	mStatus = B_NO_INIT;
+}
+
+
+/*
+ * fp_storage_entry()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_entry::fp_storage_entry(const char* path, bool traverse)
+{
+	SetTo(path, traverse);
+}
+
+
+/*
+ * fp_storage_entry()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_entry::fp_storage_entry(const fp_storage_dir* dir, const char* name, bool traverse)
+{
+	SetTo(dir, name, traverse);
+}
+
+
+/*
+ * fp_storage_entry()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_entry::fp_storage_entry(const entry_ref* ref, bool traverse)
+{
+	SetTo(ref, traverse);
+}
+
+
+/*
+ * fp_storage_entry()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_entry::fp_storage_entry(const fp_storage_entry& entry)
+{
+	mPath	= entry.mPath;
+	mStatus	= entry.mStatus;
+}
+
+
+/*
+ * ~fp_storage_entry()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_entry::~fp_storage_entry()
+{
+}
+
+
+/*
+ * operator=()
+ *
+ * Description:
+ *
+ * Returns: *this
+ */
+
+fp_storage_entry& fp_storage_entry::operator=(const fp_storage_entry& entry)
+{
+	if (this != &entry)
+	{
+		mPath	= entry.mPath;
+		mStatus	= entry.mStatus;
+	}
+
+	return( *this );
+}
+
+
+/*
+ * operator==()
+ *
+ * Description:
+ *		Paths are kept canonical, so the same entry has the same path.
+ *
+ * Returns: true if both are the same entry
+ */
+
+bool fp_storage_entry::operator==(const fp_storage_entry& entry) const
+{
+	if ((mStatus != B_OK) || (entry.mStatus != B_OK)) {
+		return( mStatus == entry.mStatus );
+	}
+
+	return( mPath == entry.mPath );
+}
+
+
+/*
+ * SetTo()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::SetTo(const char* path, bool traverse)
+{
+	mStatus = CanonicalPath(path, traverse, mPath);
+
+	if (mStatus != B_OK) {
+		mPath.clear();
+	}
+
+	return( mStatus );
+}
+
+
+/*
+ * SetTo()
+ *
+ * Description:
+ *		name in dir. name may also be a relative path. The directory's
+ *		path is already canonical, so a plain name is just appended.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::SetTo(const fp_storage_dir* dir, const char* name, bool traverse)
+{
+	if (dir->InitCheck() != B_OK)
+	{
+		Unset();
+		mStatus = dir->InitCheck();
+		return( mStatus );
+	}
+
+	if ((strchr(name, '/') != NULL) || (strcmp(name, ".") == 0) || (strcmp(name, "..") == 0)) {
+		return( SetTo(JoinPath(dir->mPath, name).c_str(), traverse) );
+	}
+
+	mPath	= JoinPath(dir->mPath, name);
+	mStatus	= B_OK;
+
+	if (traverse && IsSymLink()) {
+		return( SetTo(mPath.c_str(), true) );
+	}
+
+	return( mStatus );
+}
+
+
+/*
+ * SetTo()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::SetTo(const entry_ref* ref, bool traverse)
+{
+	std::string	dirPath;
+
+	if (ref->name == NULL)
+	{
+		Unset();
+		mStatus = B_BAD_VALUE;
+		return( mStatus );
+	}
+
+	mStatus = FindDirectory(node_ref(ref->device, ref->directory), dirPath);
+
+	if (mStatus != B_OK)
+	{
+		mPath.clear();
+		return( mStatus );
+	}
+
+	mPath	= JoinPath(dirPath, ref->name);
+	mStatus	= B_OK;
+
+	if (traverse && IsSymLink()) {
+		return( SetTo(mPath.c_str(), true) );
+	}
+
+	return( mStatus );
+}
+
+
+/*
+ * Unset()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+void fp_storage_entry::Unset()
+{
+	mPath.clear();
+	mStatus = B_NO_INIT;
+}
+
+
+/*
+ * Exists()
+ *
+ * Description:
+ *
+ * Returns: true or false
+ */
+
+bool fp_storage_entry::Exists() const
+{
+	struct stat	st;
+
+	return( (mStatus == B_OK) && (lstat(mPath.c_str(), &st) == 0) );
+}
+
+
+/*
+ * IsDirectory()
+ *
+ * Description:
+ *
+ * Returns: true or false
+ */
+
+bool fp_storage_entry::IsDirectory() const
+{
+	struct stat	st;
+
+	return( (mStatus == B_OK) && (lstat(mPath.c_str(), &st) == 0) && S_ISDIR(st.st_mode) );
+}
+
+
+/*
+ * IsFile()
+ *
+ * Description:
+ *
+ * Returns: true or false
+ */
+
+bool fp_storage_entry::IsFile() const
+{
+	struct stat	st;
+
+	return( (mStatus == B_OK) && (lstat(mPath.c_str(), &st) == 0) && S_ISREG(st.st_mode) );
+}
+
+
+/*
+ * IsSymLink()
+ *
+ * Description:
+ *
+ * Returns: true or false
+ */
+
+bool fp_storage_entry::IsSymLink() const
+{
+	struct stat	st;
+
+	return( (mStatus == B_OK) && (lstat(mPath.c_str(), &st) == 0) && S_ISLNK(st.st_mode) );
+}
+
+
+/*
+ * Name()
+ *
+ * Description:
+ *		The leaf name, good until the entry changes.
+ *
+ * Returns: const char* or NULL
+ */
+
+const char* fp_storage_entry::Name() const
+{
+	if (mStatus != B_OK) {
+		return( NULL );
+	}
+
+	return( LeafName(mPath) );
+}
+
+
+/*
+ * GetName()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::GetName(char* name) const
+{
+	if (mStatus != B_OK) {
+		return( mStatus );
+	}
+
+	strncpy(name, LeafName(mPath), B_FILE_NAME_LENGTH);
+	name[B_FILE_NAME_LENGTH - 1] = '\0';
+
+	return( B_OK );
+}
+
+
+/*
+ * GetPath()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::GetPath(char* path, size_t size) const
+{
+	if (mStatus != B_OK) {
+		return( mStatus );
+	}
+
+	if (mPath.size() >= size) {
+		return( B_NAME_TOO_LONG );
+	}
+
+	memcpy(path, mPath.c_str(), mPath.size() + 1);
+
+	return( B_OK );
+}
+
+
+/*
+ * GetParent()
+ *
+ * Description:
+ *
+ * Returns: B_OK or B_ENTRY_NOT_FOUND for the root
+ */
+
+status_t fp_storage_entry::GetParent(fp_storage_entry* parent) const
+{
+	std::string	parentPath;
+
+	if (mStatus != B_OK) {
+		return( mStatus );
+	}
+
+	if (!ParentPath(mPath, parentPath))
+	{
+		parent->Unset();
+		return( B_ENTRY_NOT_FOUND );
+	}
+
+	parent->mPath	= parentPath;
+	parent->mStatus	= B_OK;
+
+	return( B_OK );
+}
+
+
+/*
+ * GetParent()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::GetParent(fp_storage_dir* parent) const
+{
+	std::string	parentPath;
+
+	if (mStatus != B_OK) {
+		return( mStatus );
+	}
+
+	if (!ParentPath(mPath, parentPath))
+	{
+		parent->Unset();
+		return( B_ENTRY_NOT_FOUND );
+	}
+
+	return( parent->Open(parentPath.c_str()) );
+}
+
+
+/*
+ * GetRef()
+ *
+ * Description:
+ *		The parent is remembered so the ref can be turned back into
+ *		an entry.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::GetRef(entry_ref* ref) const
+{
+	std::string	parentPath;
+	struct stat	st;
+
+	if (mStatus != B_OK) {
+		return( mStatus );
+	}
+
+	if (!ParentPath(mPath, parentPath)) {
+		return( B_ENTRY_NOT_FOUND );
+	}
+
+	if (stat(parentPath.c_str(), &st) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	RegisterDirectory(st.st_dev, st.st_ino, parentPath);
+
+	ref->device		= st.st_dev;
+	ref->directory	= st.st_ino;
+
+	return( ref->set_name(LeafName(mPath)) );
+}
+
+
+/*
+ * GetNodeRef()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::GetNodeRef(node_ref* ref) const
+{
+	struct stat	st;
+
+	if (mStatus != B_OK) {
+		return( mStatus );
+	}
+
+	if (lstat(mPath.c_str(), &st) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	if (S_ISDIR(st.st_mode)) {
+		RegisterDirectory(st.st_dev, st.st_ino, mPath);
+	}
+
+	ref->device	= st.st_dev;
+	ref->node	= st.st_ino;
+
+	return( B_OK );
+}
+
+
+/*
+ * GetStat()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::GetStat(FP_STORAGE_STAT* stat) const
+{
+	struct stat	st;
+
+	if (mStatus != B_OK) {
+		return( mStatus );
+	}
+
+	if (lstat(mPath.c_str(), &st) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	StatFromStat(st, stat);
+
+	return( B_OK );
+}
+
+
+/*
+ * Rename()
+ *
+ * Description:
+ *		New name, same directory.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::Rename(const char* name, bool clobber)
+{
+	std::string	parentPath;
+
+	if (mStatus != B_OK) {
+		return( mStatus );
+	}
+
+	if (!ParentPath(mPath, parentPath)) {
+		return( B_NOT_ALLOWED );
+	}
+
+	fp_storage_dir	parent(parentPath.c_str());
+
+	return( MoveTo(&parent, name, clobber) );
+}
+
+
+/*
+ * MoveTo()
+ *
+ * Description:
+ *		Move into dir, keeping the name unless given a new one. As
+ *		with the Storage Kit an existing entry is only replaced with
+ *		clobber.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::MoveTo(fp_storage_dir* dir, const char* name, bool clobber)
+{
+	struct stat	st;
+
+	if (mStatus != B_OK) {
+		return( mStatus );
+	}
+
+	if (dir->InitCheck() != B_OK) {
+		return( dir->InitCheck() );
+	}
+
+	std::string	newPath = JoinPath(dir->mPath, (name != NULL) ? name : LeafName(mPath));
+
+	if (newPath == mPath) {
+		return( B_OK );
+	}
+
+	if ((!clobber) && (lstat(newPath.c_str(), &st) == 0)) {
+		return( B_FILE_EXISTS );
+	}
+
+	if (rename(mPath.c_str(), newPath.c_str()) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	mPath = newPath;
+
+	if ((lstat(mPath.c_str(), &st) == 0) && S_ISDIR(st.st_mode)) {
+		RegisterDirectory(st.st_dev, st.st_ino, mPath);
+	}
+
+	return( B_OK );
+}
+
+
+/*
+ * Remove()
+ *
+ * Description:
+ *		Files and empty directories alike. The entry stays set to the
+ *		name, which no longer exists.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::Remove()
+{
+	if (mStatus != B_OK) {
+		return( mStatus );
+	}
+
+	if (unlink(mPath.c_str()) == 0) {
+		return( B_OK );
+	}
+
+	if ((errno == EISDIR) || (errno == EPERM))
+	{
+		if (rmdir(mPath.c_str()) == 0) {
+			return( B_OK );
+		}
+	}
+
+	return( StatusFromErrno(errno) );
+}
+
+
+/*
+ * SetPermissions()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::SetPermissions(mode_t perms)
+{
+	if (mStatus != B_OK) {
+		return( mStatus );
+	}
+
+	if (chmod(mPath.c_str(), perms & 07777) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	return( B_OK );
+}
+
+
+/*
+ * SetCreationTime()
+ *
+ * Description:
+ *		There's no creation time to set. The change time that stands
+ *		in for it moves on its own.
+ *
+ * Returns: B_OK
+ */
+
+status_t fp_storage_entry::SetCreationTime(time_t /*time*/)
+{
+	return( mStatus );
+}
+
+
+/*
+ * SetModificationTime()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_entry::SetModificationTime(time_t time)
+{
+	struct timespec	times[2];
+
+	if (mStatus != B_OK) {
+		return( mStatus );
+	}
+
+	times[0].tv_sec		= 0;
+	times[0].tv_nsec	= UTIME_OMIT;
+	times[1].tv_sec		= time;
+	times[1].tv_nsec	= 0;
+
+	if (utimensat(AT_FDCWD, mPath.c_str(), times, AT_SYMLINK_NOFOLLOW) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	return( B_OK );
+}
+
+
+/*
+ * fp_storage_dir()
+ *
+ * Description:
+ *		A directory, held open so everything in it is reached with
+ *		the *at() calls and never by walking a path again.
+ *
+ * Returns:
+ */
+
+fp_storage_dir::fp_storage_dir()
+{
+	mStatus		= B_NO_INIT;
+	mFD			= -1;
+	mIterator	= NULL;
+}
+
+
+/*
+ * fp_storage_dir()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_dir::fp_storage_dir(const char* path)
+{
+	mStatus		= B_NO_INIT;
+	mFD			= -1;
+	mIterator	= NULL;
+
+	SetTo(path);
+}
+
+
+/*
+ * fp_storage_dir()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_dir::fp_storage_dir(const node_ref* ref)
+{
+	mStatus		= B_NO_INIT;
+	mFD			= -1;
+	mIterator	= NULL;
+
+	SetTo(ref);
+}
+
+
+/*
+ * fp_storage_dir()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_dir::fp_storage_dir(const fp_storage_entry* entry)
+{
+	mStatus		= B_NO_INIT;
+	mFD			= -1;
+	mIterator	= NULL;
+
+	SetTo(entry);
+}
+
+
+/*
+ * ~fp_storage_dir()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_dir::~fp_storage_dir()
+{
+	Unset();
+}
+
+
+/*
+ * Open()
+ *
+ * Description:
+ *		Open the directory at a canonical path and remember where it
+ *		is.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::Open(const char* path)
+{
+	struct stat	st;
+
+	Unset();
+
+	mFD = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (mFD < 0)
+	{
+		mStatus = StatusFromErrno(errno);
+		return( mStatus );
+	}
+
+	if (fstat(mFD, &st) < 0)
+	{
+		mStatus = StatusFromErrno(errno);
+		Unset();
+		return( mStatus );
+	}
+
+	mPath	= path;
+	mStatus	= B_OK;
+
+	RegisterDirectory(st.st_dev, st.st_ino, mPath);
+
+	return( mStatus );
+}
+
+
+/*
+ * SetTo()
+ *
+ * Description:
+ *		Anything below a directory opened by path can later be found
+ *		by node_ref.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::SetTo(const char* path)
+{
+	std::string	canonical;
+
+	Unset();
+
+	mStatus = CanonicalPath(path, true, canonical);
+
+	if (mStatus != B_OK) {
+		return( mStatus );
+	}
+
+	if (Open(canonical.c_str()) == B_OK)
+	{
+		std::lock_guard<std::mutex> lock(sRegistryLock);
+
+		sSearchRoots.insert(mPath);
+	}
+
+	return( mStatus );
+}
+
+
+/*
+ * SetTo()
+ *
+ * Description:
+ *
+ * Returns: B_OK, B_NOT_A_DIRECTORY if ref is a file or B_ENTRY_NOT_FOUND
+ */
+
+status_t fp_storage_dir::SetTo(const node_ref* ref)
+{
+	std::string	path;
+
+	Unset();
+
+	mStatus = FindDirectory(*ref, path);
+
+	if (mStatus != B_OK) {
+		return( mStatus );
+	}
+
+	return( Open(path.c_str()) );
+}
+
+
+/*
+ * SetTo()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::SetTo(const fp_storage_entry* entry)
+{
+	if (entry->InitCheck() != B_OK)
+	{
+		Unset();
+		mStatus = entry->InitCheck();
+		return( mStatus );
+	}
+
+	return( Open(entry->mPath.c_str()) );
+}
+
+
+/*
+ * Unset()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+void fp_storage_dir::Unset()
+{
+	if (mIterator != NULL)
+	{
+		//
+		//closedir() closes the descriptor the iterator was given,
+		//which is our own reopening of the directory.
+		//
+		closedir(mIterator);
+		mIterator = NULL;
+	}
+
+	if (mFD >= 0)
+	{
+		close(mFD);
+		mFD = -1;
+	}
+
+	mPath.clear();
+	mStatus = B_NO_INIT;
+}
+
+
+/*
+ * GetEntry()
+ *
+ * Description:
+ *		The directory's own entry.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::GetEntry(fp_storage_entry* entry) const
+{
+	if (mStatus != B_OK)
+	{
+		entry->Unset();
+		return( mStatus );
+	}
+
+	entry->mPath	= mPath;
+	entry->mStatus	= B_OK;
+
+	return( B_OK );
+}
+
+
+/*
+ * GetNodeRef()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::GetNodeRef(node_ref* ref) const
+{
+	struct stat	st;
+
+	if (mStatus != B_OK) {
+		return( mStatus );
+	}
+
+	if (fstat(mFD, &st) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	ref->device	= st.st_dev;
+	ref->node	= st.st_ino;
+
+	return( B_OK );
+}
+
+
+/*
+ * GetStat()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::GetStat(FP_STORAGE_STAT* stat) const
+{
+	struct stat	st;
+
+	if (mStatus != B_OK) {
+		return( mStatus );
+	}
+
+	if (fstat(mFD, &st) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	StatFromStat(st, stat);
+
+	return( B_OK );
+}
+
+
+/*
+ * GetVolumeInfo()
+ *
+ * Description:
+ *		Space and writability of the file system the directory is on.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::GetVolumeInfo(FP_STORAGE_VOLUME_INFO* info) const
+{
+	struct statvfs	st;
+
+	if (mStatus != B_OK) {
+		return( mStatus );
+	}
+
+	if (fstatvfs(mFD, &st) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	info->freeBytes	= (off_t)st.f_bavail * st.f_frsize;
+	info->capacity	= (off_t)st.f_blocks * st.f_frsize;
+	info->readOnly	= ((st.f_flag & ST_RDONLY) != 0);
+
+	return( B_OK );
+}
+
+
+/*
+ * GetNextEntry()
+ *
+ * Description:
+ *		The name of the next entry in the directory, skipping "." and
+ *		"..", which the Storage Kit never returns. The directory is
+ *		opened again for this, a dup would share (and move) the offset
+ *		of our own descriptor.
+ *
+ * Returns: B_OK or B_ENTRY_NOT_FOUND at the end
+ */
+
+status_t fp_storage_dir::GetNextEntry(char* name, size_t nameSize)
+{
+	struct dirent*	entry;
+
+	if (mStatus != B_OK) {
+		return( mStatus );
+	}
+
+	if (mIterator == NULL)
+	{
+		int		iterFD = openat(mFD, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+		if (iterFD < 0) {
+			return( StatusFromErrno(errno) );
+		}
+
+		mIterator = fdopendir(iterFD);
+
+		if (mIterator == NULL)
+		{
+			close(iterFD);
+			return( StatusFromErrno(errno) );
+		}
+	}
+
+	while((entry = readdir(mIterator)) != NULL)
+	{
+		if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0)) {
+			continue;
+		}
+
+		strncpy(name, entry->d_name, nameSize);
+		name[nameSize - 1] = '\0';
+
+		return( B_OK );
+	}
+
+	return( B_ENTRY_NOT_FOUND );
+}
+
+
+/*
+ * GetNextEntry()
+ *
+ * Description:
+ *		The next entry in the directory.
+ *
+ * Returns: B_OK or B_ENTRY_NOT_FOUND at the end
+ */
+
+status_t fp_storage_dir::GetNextEntry(fp_storage_entry* entry, bool traverse)
+{
+	char		name[B_FILE_NAME_LENGTH];
+	status_t	status = GetNextEntry(name, sizeof(name));
+
+	if (status != B_OK)
+	{
+		entry->Unset();
+		return( status );
+	}
+
+	return( entry->SetTo(this, name, traverse) );
+}
+
+
+/*
+ * Rewind()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::Rewind()
+{
+	if (mIterator != NULL) {
+		rewinddir(mIterator);
+	}
+
+	return( mStatus );
+}
+
+
+/*
+ * CountEntries()
+ *
+ * Description:
+ *		Counted on a descriptor of its own, so it doesn't disturb an
+ *		iteration in progress.
+ *
+ * Returns: number of entries
+ */
+
+int32 fp_storage_dir::CountEntries()
+{
+	struct dirent*	entry;
+	DIR*			counter;
+	int32			count	= 0;
+	int				countFD;
+
+	if (mStatus != B_OK) {
+		return( 0 );
+	}
+
+	countFD = openat(mFD, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (countFD < 0) {
+		return( 0 );
+	}
+
+	counter = fdopendir(countFD);
+
+	if (counter == NULL)
+	{
+		close(countFD);
+		return( 0 );
+	}
+
+	while((entry = readdir(counter)) != NULL)
+	{
+		if ((strcmp(entry->d_name, ".") != 0) && (strcmp(entry->d_name, "..") != 0)) {
+			count++;
+		}
+	}
+
+	closedir(counter);
+
+	return( count );
+}
+
+
+/*
+ * FindEntry()
+ *
+ * Description:
+ *
+ * Returns: B_OK or B_ENTRY_NOT_FOUND
+ */
+
+status_t fp_storage_dir::FindEntry(const char* name, fp_storage_entry* entry, bool traverse) const
+{
+	status_t	status = entry->SetTo(this, name, traverse);
+
+	if ((status == B_OK) && (!entry->Exists()))
+	{
+		entry->Unset();
+		status = B_ENTRY_NOT_FOUND;
+	}
+
+	return( status );
+}
+
+
+/*
+ * StatEntry()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::StatEntry(const char* name, FP_STORAGE_STAT* stat)
+{
+	struct stat	st;
+
+	if (fstatat(mFD, name, &st, 0) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	StatFromStat(st, stat);
+
+	return( B_OK );
+}
+
+
+/*
+ * CreateDirectory()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::CreateDirectory(const char* name, fp_storage_dir* newDir)
+{
+	if (mkdirat(mFD, name, 0755) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	if (newDir != NULL) {
+		return( newDir->Open(JoinPath(mPath, name).c_str()) );
+	}
+
+	return( B_OK );
+}
+
+
+/*
+ * CreateFile()
+ *
+ * Description:
+ *		Create (or with failIfExists false, open and empty) a file and
+ *		open it for reading and writing. file may be NULL if all that's
+ *		wanted is the file.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::CreateFile(const char* name, fp_storage_node* file, bool failIfExists)
+{
+	uint32	mode = FP_STORAGE_READ | FP_STORAGE_WRITE | FP_STORAGE_CREATE;
+
+	mode |= failIfExists ? FP_STORAGE_EXCLUSIVE : FP_STORAGE_TRUNCATE;
+
+	if (file == NULL)
+	{
+		fp_storage_node	created;
+
+		return( created.SetTo(this, name, mode) );
+	}
+
+	return( file->SetTo(this, name, mode) );
+}
+
+
+/*
+ * RemoveEntry()
+ *
+ * Description:
+ *		Files and empty directories alike, as BEntry::Remove() does.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::RemoveEntry(const char* name)
+{
+	if (unlinkat(mFD, name, 0) == 0) {
+		return( B_OK );
+	}
+
+	if ((errno == EISDIR) || (errno == EPERM))
+	{
+		if (unlinkat(mFD, name, AT_REMOVEDIR) == 0) {
+			return( B_OK );
+		}
+	}
+
+	return( StatusFromErrno(errno) );
+}
+
+
+/*
+ * RenameEntry()
+ *
+ * Description:
+ *		Move an entry, possibly into another directory. An existing
+ *		entry with the new name is not replaced, the same as
+ *		BEntry::MoveTo() without clobber.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_dir::RenameEntry(const char* name, fp_storage_dir* toDir, const char* toName)
+{
+	struct stat	st;
+
+	if (fstatat(toDir->mFD, toName, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+		return( B_FILE_EXISTS );
+	}
+
+	if (renameat(mFD, name, toDir->mFD, toName) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	return( B_OK );
+}
+
+
+/*
+ * fp_storage_node()
+ *
+ * Description:
+ *		A file or directory held by a descriptor. Named attributes are
+ *		kept as extended attributes.
+ *
+ * Returns:
+ */
+
+fp_storage_node::fp_storage_node()
+{
+	mStatus			= B_NO_INIT;
+	mFD				= -1;
+	mMode			= 0;
+	mAttrNames		= NULL;
+	mAttrNamesSize	= 0;
+	mAttrNamesPos	= 0;
+}
+
+
+/*
+ * fp_storage_node()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_node::fp_storage_node(const fp_storage_entry* entry, uint32 mode)
+{
+	mStatus			= B_NO_INIT;
+	mFD				= -1;
+	mMode			= 0;
+	mAttrNames		= NULL;
+	mAttrNamesSize	= 0;
+	mAttrNamesPos	= 0;
+
+	SetTo(entry, mode);
+}
+
+
+/*
+ * ~fp_storage_node()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_storage_node::~fp_storage_node()
+{
+	Unset();
+}
+
+
+/*
+ * SetTo()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::SetTo(const char* path, uint32 mode)
+{
+	Unset();
+
+	mFD = open(path, OpenFlags(mode), 0644);
+
+	mStatus = (mFD < 0) ? StatusFromErrno(errno) : B_OK;
+	mMode	= mode;
+
+	return( mStatus );
+}
+
+
+/*
+ * SetTo()
+ *
+ * Description:
+ *		Open name in dir.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::SetTo(fp_storage_dir* dir, const char* name, uint32 mode)
+{
+	Unset();
+
+	mFD = openat(dir->mFD, name, OpenFlags(mode), 0644);
+
+	mStatus = (mFD < 0) ? StatusFromErrno(errno) : B_OK;
+	mMode	= mode;
+
+	return( mStatus );
+}
+
+
+/*
+ * SetTo()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::SetTo(const fp_storage_entry* entry, uint32 mode)
+{
+	if (entry->InitCheck() != B_OK)
+	{
+		Unset();
+		mStatus = entry->InitCheck();
+		return( mStatus );
+	}
+
+	return( SetTo(entry->mPath.c_str(), mode) );
+}
+
+
+/*
+ * Unset()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+void fp_storage_node::Unset()
+{
+	if (mFD >= 0)
+	{
+		close(mFD);
+		mFD = -1;
+	}
+
+	free(mAttrNames);
+
+	mAttrNames		= NULL;
+	mAttrNamesSize	= 0;
+	mAttrNamesPos	= 0;
+	mMode			= 0;
+	mStatus			= B_NO_INIT;
+}
+
+
+/*
+ * GetNodeRef()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::GetNodeRef(node_ref* ref) const
+{
+	struct stat	st;
+
+	if (fstat(mFD, &st) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	ref->device	= st.st_dev;
+	ref->node	= st.st_ino;
+
+	return( B_OK );
+}
+
+
+/*
+ * GetStat()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::GetStat(FP_STORAGE_STAT* stat) const
+{
+	struct stat	st;
+
+	if (fstat(mFD, &st) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	StatFromStat(st, stat);
+
+	return( B_OK );
+}
+
+
+/*
+ * Lock()
+ *
+ * Description:
+ *		An advisory lock, so it only keeps out others who ask for
+ *		it too, which is everyone going through here.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::Lock()
+{
+	if (flock(mFD, LOCK_EX) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	return( B_OK );
+}
+
+
+/*
+ * Unlock()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::Unlock()
+{
+	if (flock(mFD, LOCK_UN) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	return( B_OK );
+}
+
+
+/*
+ * IsReadable()
+ *
+ * Description:
+ *		Only if it was opened for reading.
+ *
+ * Returns: true or false
+ */
+
+bool fp_storage_node::IsReadable() const
+{
+	return( (mStatus == B_OK) && ((mMode & FP_STORAGE_READ) != 0) );
+}
+
+
+/*
+ * IsWritable()
+ *
+ * Description:
+ *
+ * Returns: true or false
+ */
+
+bool fp_storage_node::IsWritable() const
+{
+	return( (mStatus == B_OK) && ((mMode & FP_STORAGE_WRITE) != 0) );
+}
+
+
+/*
+ * ReadAt()
+ *
+ * Description:
+ *
+ * Returns: bytes read or an error
+ */
+
+ssize_t fp_storage_node::ReadAt(off_t position, void* buffer, size_t size)
+{
+	ssize_t	result = pread(mFD, buffer, size, position);
+
+	return( (result < 0) ? StatusFromErrno(errno) : result );
+}
+
+
+/*
+ * WriteAt()
+ *
+ * Description:
+ *
+ * Returns: bytes written or an error
+ */
+
+ssize_t fp_storage_node::WriteAt(off_t position, const void* buffer, size_t size)
+{
+	ssize_t	result = pwrite(mFD, buffer, size, position);
+
+	return( (result < 0) ? StatusFromErrno(errno) : result );
+}
+
+
+/*
+ * GetSize()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::GetSize(off_t* size) const
+{
+	struct stat	st;
+
+	if (fstat(mFD, &st) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	*size = st.st_size;
+
+	return( B_OK );
+}
+
+
+/*
+ * SetSize()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::SetSize(off_t size)
+{
+	if (ftruncate(mFD, size) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	return( B_OK );
+}
+
+
+/*
+ * Sync()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::Sync()
+{
+	if (fsync(mFD) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	return( B_OK );
+}
+
+
+/*
+ * GetAttrInfo()
+ *
+ * Description:
+ *		Extended attributes have no type, they all read back as raw
+ *		data.
+ *
+ * Returns: B_OK or B_ENTRY_NOT_FOUND if there is no such attribute
+ */
+
+status_t fp_storage_node::GetAttrInfo(const char* name, FP_STORAGE_ATTR_INFO* info)
+{
+	char	xattrName[FP_STORAGE_ATTR_NAME_LENGTH + XATTR_USER_PREFIX_LEN];
+	ssize_t	result;
+
+	if (!XattrName(name, xattrName, sizeof(xattrName))) {
+		return( B_NAME_TOO_LONG );
+	}
+
+	result = fgetxattr(mFD, xattrName, NULL, 0);
+
+	if (result < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	info->type = B_RAW_TYPE;
+	info->size = result;
+
+	return( B_OK );
+}
+
+
+/*
+ * GetAttrSize()
+ *
+ * Description:
+ *
+ * Returns: B_OK or B_ENTRY_NOT_FOUND if there is no such attribute
+ */
+
+status_t fp_storage_node::GetAttrSize(const char* name, off_t* size)
+{
+	FP_STORAGE_ATTR_INFO	info;
+	status_t				status = GetAttrInfo(name, &info);
+
+	if (status == B_OK) {
+		*size = info.size;
+	}
+
+	return( status );
+}
+
+
+/*
+ * ReadAttr()
+ *
+ * Description:
+ *		Extended attributes can only be read whole, so reading from
+ *		part way in reads it all and copies out the part asked for.
+ *
+ * Returns: bytes read or an error
+ */
+
+ssize_t fp_storage_node::ReadAttr(const char* name, off_t position, void* buffer, size_t size)
+{
+	char	xattrName[FP_STORAGE_ATTR_NAME_LENGTH + XATTR_USER_PREFIX_LEN];
+	ssize_t	result;
+
+	if (!XattrName(name, xattrName, sizeof(xattrName))) {
+		return( B_NAME_TOO_LONG );
+	}
+
+	if (size == 0) {
+		return( 0 );
+	}
+
+	if (position == 0)
+	{
+		result = fgetxattr(mFD, xattrName, buffer, size);
+
+		if ((result < 0) && (errno == ERANGE))
+		{
+			//
+			//The buffer is smaller than the attribute, fall through
+			//and return as much as fits.
+			//
+		}
+		else
+		{
+			return( (result < 0) ? StatusFromErrno(errno) : result );
+		}
+	}
+
+	result = fgetxattr(mFD, xattrName, NULL, 0);
+
+	if (result < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	char*	whole = (char*)malloc(result + 1);
+
+	if (whole == NULL) {
+		return( B_NO_MEMORY );
+	}
+
+	result = fgetxattr(mFD, xattrName, whole, result);
+
+	if (result >= 0)
+	{
+		size_t	available = (position < result) ? (size_t)(result - position) : 0;
+
+		result = (ssize_t)((size < available) ? size : available);
+
+		memcpy(buffer, whole + position, result);
+	}
+	else
+	{
+		result = StatusFromErrno(errno);
+	}
+
+	free(whole);
+
+	return( result );
+}
+
+
+/*
+ * WriteAttr()
+ *
+ * Description:
+ *		Replace an attribute's contents. Extended attributes have no
+ *		type, it's dropped.
+ *
+ * Returns: bytes written or an error
+ */
+
+ssize_t fp_storage_node::WriteAttr(const char* name, type_code /*type*/, const void* buffer, size_t size)
+{
+	char	xattrName[FP_STORAGE_ATTR_NAME_LENGTH + XATTR_USER_PREFIX_LEN];
+
+	if (!XattrName(name, xattrName, sizeof(xattrName))) {
+		return( B_NAME_TOO_LONG );
+	}
+
+	if (fsetxattr(mFD, xattrName, buffer, size, 0) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	return( size );
+}
+
+
+/*
+ * RemoveAttr()
+ *
+ * Description:
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_node::RemoveAttr(const char* name)
+{
+	char	xattrName[FP_STORAGE_ATTR_NAME_LENGTH + XATTR_USER_PREFIX_LEN];
+
+	if (!XattrName(name, xattrName, sizeof(xattrName))) {
+		return( B_NAME_TOO_LONG );
+	}
+
+	if (fremovexattr(mFD, xattrName) < 0) {
+		return( StatusFromErrno(errno) );
+	}
+
+	return( B_OK );
+}
+
+
+/*
+ * GetNextAttrName()
+ *
+ * Description:
+ *		The whole name list is fetched on the first call and handed out
+ *		one at a time. Attributes outside the user namespace are not
+ *		ours and are skipped. name must hold FP_STORAGE_ATTR_NAME_LENGTH
+ *		bytes.
+ *
+ * Returns: B_OK or B_ENTRY_NOT_FOUND at the end
+ */
+
+status_t fp_storage_node::GetNextAttrName(char* name)
+{
+	if (mAttrNames == NULL)
+	{
+		ssize_t	size = flistxattr(mFD, NULL, 0);
+
+		if (size < 0) {
+			return( StatusFromErrno(errno) );
+		}
+
+		mAttrNames = (char*)malloc(size + 1);
+
+		if (mAttrNames == NULL) {
+			return( B_NO_MEMORY );
+		}
+
+		mAttrNamesSize	= flistxattr(mFD, mAttrNames, size);
+		mAttrNamesPos	= 0;
+
+		if (mAttrNamesSize < 0)
+		{
+			RewindAttrs();
+			return( StatusFromErrno(errno) );
+		}
+	}
+
+	while(mAttrNamesPos < mAttrNamesSize)
+	{
+		const char*	next = &mAttrNames[mAttrNamesPos];
+
+		mAttrNamesPos += strlen(next) + 1;
+
+		if (strncmp(next, XATTR_USER_PREFIX, XATTR_USER_PREFIX_LEN) == 0)
+		{
+			strncpy(name, next + XATTR_USER_PREFIX_LEN, FP_STORAGE_ATTR_NAME_LENGTH);
+			name[FP_STORAGE_ATTR_NAME_LENGTH - 1] = '\0';
+
+			return( B_OK );
+		}
+	}
+
+	return( B_ENTRY_NOT_FOUND );
+}
+
+
+/*
+ * RewindAttrs()
+ *
+ * Description:
+ *
+ * Returns: B_OK
+ */
+
+status_t fp_storage_node::RewindAttrs()
+{
+	free(mAttrNames);
+
+	mAttrNames		= NULL;
+	mAttrNamesSize	= 0;
+	mAttrNamesPos	= 0;
+
+	return( B_OK );
+}
+
+
+/*
+ * fp_storage_settings_dir()
+ *
+ * Description:
+ *		$XDG_CONFIG_HOME, or ~/.config without it. Created if it isn't
+ *		there yet.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_settings_dir(char* path, size_t size)
+{
+	const char*	config	= getenv("XDG_CONFIG_HOME");
+	const char*	home	= getenv("HOME");
+	int			length;
+
+	if ((config != NULL) && (config[0] == '/')) {
+		length = snprintf(path, size, "%s", config);
+	}
+	else if (home != NULL) {
+		length = snprintf(path, size, "%s/.config", home);
+	}
+	else {
+		return( B_ENTRY_NOT_FOUND );
+	}
+
+	if ((length < 0) || ((size_t)length >= size)) {
+		return( B_NAME_TOO_LONG );
+	}
+
+	if ((mkdir(path, 0700) < 0) && (errno != EEXIST)) {
+		return( StatusFromErrno(errno) );
+	}
+
+	return( B_OK );
+}
+
+
+/*
+ * fp_storage_temp_dir()
+ *
+ * Description:
+ *		$TMPDIR, or /tmp without it.
+ *
+ * Returns: B_OK or an error
+ */
+
+status_t fp_storage_temp_dir(char* path, size_t size)
+{
+	const char*	temp	= getenv("TMPDIR");
+	int			length;
+
+	if ((temp == NULL) || (temp[0] != '/')) {
+		temp = "/tmp";
+	}
+
+	length = snprintf(path, size, "%s", temp);
+
+	if ((length < 0) || ((size_t)length >= size)) {
+		return( B_NAME_TOO_LONG );
+	}
+
+	return( B_OK );
+}
+
+
+/*
+ * fp_storage_watch_node()
+ *
+ * Description:
+ *		There is no node monitor here. Callers carry on without one
+ *		and only see changes made through AFP.
+ *
+ * Returns: B_UNSUPPORTED
+ */
+
+status_t fp_storage_watch_node(const node_ref* /*ref*/, uint32 /*flags*/)
+{
+	return( B_UNSUPPORTED );
+}
+
+#endif //__HAIKU__
@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <chrono>
+
+#include "debug.h"
+#include "fp_volume.h"
+#include "fp_volspace.h"
+
+fp_volspace		gAFPVolSpace;
+
+
+/*
+ * fp_volspace()
+ *
+ * Description:
+ *		The sampler thread is started by the first volume added.
+ *
+ * Returns:
+ */
+
+fp_volspace::fp_volspace()
+{
+	mThread		= -1;
+	mQuit		= false;
+	mSampling	= NULL;
+}
+
+
+/*
+ * ~fp_volspace()
+ *
+ * Description:
+ *
+ * Returns:
+ */
+
+fp_volspace::~fp_volspace()
+{
+	if (mThread >= 0)
+	{
+		status_t	result;
+
+		{
+			std::lock_guard<std::mutex> guard(mMutex);
+
+			mQuit = true;
+		}
+
+		mWake.notify_one();
+		wait_for_thread(mThread, &result);
+	}
+}
+
+
+/*
+ * Add()
+ *
+ * Description:
+ *		Start sampling a volume. It should already have been sampled
+ *		once so it has something to report.
+ *
+ * Returns: None
+ */
+
+void fp_volspace::Add(fp_volume* volume)
+{
+	std::lock_guard<std::mutex> guard(mMutex);
+
+	mVolumes.push_back(volume);
+
+	if (mThread < 0)
+	{
+		//
+		//Sampling is never more urgent than serving requests.
+		//
+		mThread = spawn_thread(
+					fp_volspace::SamplerThread,
+					"afp_volspace",
+					B_LOW_PRIORITY,
+					this
+					);
+
+		resume_thread(mThread);
+	}
+}
+
+
+/*
+ * Remove()
+ *
+ * Description:
+ *		Stop sampling a volume. Once it's off the lists the sampler
+ *		won't start on it again, but it may be in the middle of a
+ *		sample, which we wait out.
+ *
+ * Returns: None
+ */
+
+void fp_volspace::Remove(fp_volume* volume)
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+
+	mVolumes.erase(std::remove(mVolumes.begin(), mVolumes.end(), volume), mVolumes.end());
+	mDirty.erase(std::remove(mDirty.begin(), mDirty.end(), volume), mDirty.end());
+
+	mSampled.wait(lock, [this, volume]() { return( mSampling != volume ); });
+}
+
+
+/*
+ * Wake()
+ *
+ * Description:
+ *
+ * Returns: None
+ */
+
+void fp_volspace::Wake(fp_volume* volume)
+{
+	{
+		std::lock_guard<std::mutex> guard(mMutex);
+
+		if (std::find(mDirty.begin(), mDirty.end(), volume) == mDirty.end()) {
+			mDirty.push_back(volume);
+		}
+	}
+
+	mWake.notify_one();
+}
+
+
+/*
+ * SamplerThread() [STATIC]
+ *
+ * Description:
+ *		Samples every volume once per TTL, and a volume that was
+ *		woken right away. The volumes due are copied under mMutex and
+ *		sampled one at a time without it, so Wake() and Add() never
+ *		wait behind the disk.
+ *
+ * Returns: B_OK
+ */
+
+int32 fp_volspace::SamplerThread(void* data)
+{
+	fp_volspace*			sampler		= (fp_volspace*)data;
+	bigtime_t				lastSweep	= system_time();
+	std::vector<fp_volume*>	volumes;
+
+	std::unique_lock<std::mutex> lock(sampler->mMutex);
+
+	while(!sampler->mQuit)
+	{
+		bigtime_t	wait = std::max(lastSweep + VOLSPACE_TTL - system_time(), (bigtime_t)0);
+		bool		sweep;
+
+		sampler->mWake.wait_for(lock, std::chrono::microseconds(wait), [sampler]() {
+			return( (sampler->mQuit) || (!sampler->mDirty.empty()) );
+		});
+
+		if (sampler->mQuit) {
+			break;
+		}
+
+		sweep	= (system_time() - lastSweep >= VOLSPACE_TTL);
+		volumes	= sweep ? sampler->mVolumes : sampler->mDirty;
+
+		sampler->mDirty.clear();
+
+		for (fp_volume* volume : volumes)
+		{
+			//
+			//It may have been removed while we were sampling another.
+			//
+			if (std::find(sampler->mVolumes.begin(), sampler->mVolumes.end(), volume) == sampler->mVolumes.end()) {
+				continue;
+			}
+
+			sampler->mSampling = volume;
+
+			lock.unlock();
+			volume->SampleSpace();
+			lock.lock();
+
+			sampler->mSampling = NULL;
+			sampler->mSampled.notify_all();
+		}
+
+		if (sweep) {
+			lastSweep = system_time();
+		}
+	}
+
+	return( B_OK );
+}
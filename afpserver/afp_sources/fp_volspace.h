@@ -0,0 +1,60 @@
+#ifndef __fp_volspace__
+#define __fp_volspace__
+
+#include "afp_os.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+class fp_volume;
+
+//
+//How old (in microseconds) the free space FPGetVolParms reports is
+//allowed to get.
+//
+#define VOLSPACE_TTL				2000000
+
+//
+//Writes to a volume add up until this many bytes, then its free space
+//is sampled again without waiting for the TTL.
+//
+#define VOLSPACE_REFRESH_BYTES		(8 * 1024 * 1024)
+
+
+class fp_volspace
+{
+public:
+						fp_volspace();
+	virtual				~fp_volspace();
+
+	virtual void		Add(fp_volume* volume);
+	virtual void		Remove(fp_volume* volume);
+
+	//
+	//Sample the volume as soon as possible.
+	//
+	virtual void		Wake(fp_volume* volume);
+
+private:
+
+	static int32		SamplerThread(void* data);
+
+	std::mutex					mMutex;
+	std::condition_variable		mWake;
+	std::vector<fp_volume*>		mVolumes;
+	std::vector<fp_volume*>		mDirty;
+
+	//
+	//Volumes are sampled without mMutex held. Remove() waits on
+	//mSampled while the volume it's removing is the one in mSampling.
+	//
+	fp_volume*					mSampling;
+	std::condition_variable		mSampled;
+	thread_id					mThread;
+	bool						mQuit;
+};
+
+extern fp_volspace		gAFPVolSpace;
+
+#endif //__fp_volspace__
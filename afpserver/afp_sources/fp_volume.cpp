@@ -1,13 +1,16 @@
-#include <Entry.h>
-#include <Volume.h>
-#include <Directory.h>
+#include "fp_storage.h"
 #include <netinet/in.h>
 
+#include <algorithm>
+#include <vector>
+
 #include "debug.h"
 #include "afp.h"
 #include "fp_volume.h"
-
-int16 gNextVolumeID = 1;
+#include "fp_readahead.h"
+#include "fp_blockcache.h"
+#include "fp_writebehind.h"
+#include "fp_volspace.h"
 
 /*
  * fp_volume()
@@ -17,17 +20,34 @@ int16 gNextVolumeID = 1;
  * Returns:
  */
 
-fp_volume::fp_volume(BPath* path, uint32 srvrVolFlags)
+fp_volume::fp_volume(const char* path, int16 volumeID, uint32 srvrVolFlags)
 {
-	BDirectory		dir;
+	size_t	length;
+
+	strlcpy(mPath, path, sizeof(mPath));
+
+	length = strlen(mPath);
+
+	while((length > 1) && (mPath[length - 1] == '/')) {
+		mPath[--length] = '\0';
+	}
+
+	mLeaf = strrchr(mPath, '/');
+	mLeaf = ((mLeaf == NULL) || (mLeaf[1] == '\0')) ? mPath : mLeaf + 1;
 
-	mVolumeID 		= gNextVolumeID++;
+	mVolumeID 		= volumeID;
 	mVolumeFlags	= srvrVolFlags;
-	mPath			= path;
 	mRootDirID		= 0;
 	mParentOfRootID	= 0;
-	mDirectory 		= new BDirectory(path->Path());
-	mIsDirty		= false;
+	mDirectory 		= new fp_storage_dir(mPath);
+	mCatalog		= NULL;
+	mDevice			= (dev_t)-1;
+	mDeviceReadOnly	= false;
+	mCreateDate		= 0;
+	mModDate		= 0;
+	mFreeBytes		= 0;
+	mCapacity		= 0;
+	mBytesSinceSample	= 0;
 
 	//
 	//Get the root and parent of root node id's so we can
@@ -35,13 +55,31 @@ fp_volume::fp_volume(BPath* path, uint32 srvrVolFlags)
 	//
 	if (mDirectory->InitCheck() == B_OK)
 	{
-		BEntry		parentOfRoot;
-		BEntry		root;
-		node_ref	nodeRef;
+		fp_storage_entry		parentOfRoot;
+		fp_storage_entry		root;
+		node_ref				nodeRef;
+		FP_STORAGE_STAT			st;
+		FP_STORAGE_VOLUME_INFO	info;
 
 		mDirectory->GetNodeRef(&nodeRef);
 
-		mRootDirID = nodeRef.node;
+		mRootDirID	= nodeRef.node;
+		mRootRef	= nodeRef;
+		mDevice		= nodeRef.device;
+
+		if (mDirectory->GetVolumeInfo(&info) == B_OK) {
+			mDeviceReadOnly = info.readOnly;
+		}
+
+		if (mDirectory->GetStat(&st) == B_OK) {
+			mCreateDate = TO_AFP_TIME(st.created);
+		}
+
+		//
+		//Start indexing the volume in the background for FPCatSearch.
+		//
+		mCatalog = new fp_catalog(nodeRef);
+		mCatalog->StartBuilding();
 
 		mDirectory->GetEntry(&root);
 		root.GetParent(&parentOfRoot);
@@ -53,7 +91,13 @@ fp_volume::fp_volume(BPath* path, uint32 srvrVolFlags)
 		}
 	}
 
-	mOpenFiles = new BList();
+	mOpenFiles 			= new BList();
+	mWriteBehindForks	= 0;
+	mReferences			= 0;
+	mIOSched			= new fp_iosched();
+
+	SampleSpace();
+	gAFPVolSpace.Add(this);
 }
 
 
@@ -67,7 +111,10 @@ fp_volume::fp_volume(BPath* path, uint32 srvrVolFlags)
 
 fp_volume::~fp_volume()
 {
-	delete mPath;
+	gAFPVolSpace.Remove(this);
+
+	delete mCatalog;
+	delete mIOSched;
 	delete mDirectory;
 	delete mOpenFiles;
 }
@@ -87,6 +134,10 @@ void fp_volume::AddOpenFile(OPEN_FORK_ITEM* forkitem)
 
 	mOpenFiles->AddItem(forkitem);
 
+	if (forkitem->writeBehind != NULL) {
+		mWriteBehindForks++;
+	}
+
 	mLock.Unlock();
 }
 
@@ -99,7 +150,7 @@ void fp_volume::AddOpenFile(OPEN_FORK_ITEM* forkitem)
  * Returns:
  */
 
-bool fp_volume::IsFileOpen(BEntry* entry, int8 fork, uint16* ref)
+bool fp_volume::IsFileOpen(fp_storage_entry* entry, int8 fork, uint16* ref)
 {
 	OPEN_FORK_ITEM* forkitem	= NULL;
 	int32			i			= 0;
@@ -138,9 +189,211 @@ void fp_volume::RemoveOpenFile(OPEN_FORK_ITEM* forkitem)
 {
 	mLock.Lock();
 
-	mOpenFiles->RemoveItem(forkitem);
+	if ((mOpenFiles->RemoveItem(forkitem)) && (forkitem->writeBehind != NULL)) {
+		mWriteBehindForks--;
+	}
+
+	mLock.Unlock();
+}
+
+
+/*
+ * InvalidateCachedData()
+ *
+ * Description:
+ *		The data fork of this file changed. Its blocks go out of the
+ *		shared block cache and every open fork of it, in any session,
+ *		has to drop what it read ahead.
+ *
+ * Returns: none
+ */
+
+void fp_volume::InvalidateCachedData(fp_storage_entry* entry)
+{
+	OPEN_FORK_ITEM* forkitem	= NULL;
+	int32			i			= 0;
+	node_ref		nodeRef;
+
+	if (entry->GetNodeRef(&nodeRef) == B_OK) {
+		gAFPBlockCache.InvalidateNode(nodeRef);
+	}
+
+	mLock.Lock();
+
+	while((forkitem = (OPEN_FORK_ITEM*)mOpenFiles->ItemAt(i++)) != NULL)
+	{
+		if ((forkitem->readAhead != NULL) && (*(forkitem->entry) == *entry))
+		{
+			forkitem->readAhead->Invalidate();
+		}
+	}
+
+	mLock.Unlock();
+}
+
+
+/*
+ * FlushWriteBehind()
+ *
+ * Description:
+ *		Someone is about to look at the data fork of this file (read,
+ *		lock or resize it). Push out anything any session is holding
+ *		in a write behind buffer for it first. Errors go back to the
+ *		fork that did the writing.
+ *
+ *		The forks are only looked up under mLock, the writes happen
+ *		after it's released so other sessions can keep opening and
+ *		closing files on the volume.
+ *
+ * Returns: none
+ */
+
+void fp_volume::FlushWriteBehind(fp_storage_entry* entry)
+{
+	OPEN_FORK_ITEM* 				forkitem	= NULL;
+	int32							i			= 0;
+	std::vector<fp_writebehind*>	forks;
+
+	if (mWriteBehindForks == 0) {
+		return;
+	}
+
+	mLock.Lock();
+
+	while((forkitem = (OPEN_FORK_ITEM*)mOpenFiles->ItemAt(i++)) != NULL)
+	{
+		if ((forkitem->writeBehind != NULL) && (*(forkitem->entry) == *entry))
+		{
+			forkitem->writeBehind->AcquireReference();
+			forks.push_back(forkitem->writeBehind);
+		}
+	}
 
 	mLock.Unlock();
+
+	for (fp_writebehind* fork : forks)
+	{
+		fork->Flush(true);
+		fork->ReleaseReference();
+	}
+}
+
+
+/*
+ * CatalogUpdate()
+ *
+ * Description:
+ *		Tell the catalog an object on this volume was created or changed.
+ *
+ * Returns: none
+ */
+
+void fp_volume::CatalogUpdate(fp_storage_entry* entry)
+{
+	if (mCatalog != NULL) {
+
+		mCatalog->UpdateEntry(entry);
+	}
+}
+
+
+/*
+ * CatalogRemove()
+ *
+ * Description:
+ *		Tell the catalog an object on this volume was deleted.
+ *
+ * Returns: none
+ */
+
+void fp_volume::CatalogRemove(const node_ref& nodeRef, ino_t parent)
+{
+	if (mCatalog != NULL) {
+
+		mCatalog->RemoveEntry(nodeRef, parent);
+	}
+}
+
+
+/*
+ * CatalogDirectoryChanged()
+ *
+ * Description:
+ *		Tell the catalog the node monitor saw a directory on this
+ *		volume change.
+ *
+ * Returns: none
+ */
+
+void fp_volume::CatalogDirectoryChanged(ino_t directory)
+{
+	if (mCatalog != NULL) {
+
+		mCatalog->DirectoryChanged(directory);
+	}
+}
+
+
+/*
+ * SampleSpace()
+ *
+ * Description:
+ *		Read the free space and size of the disk the volume is on,
+ *		and the modification date of its root.
+ *
+ * Returns: none
+ */
+
+void fp_volume::SampleSpace()
+{
+	FP_STORAGE_VOLUME_INFO	info;
+	FP_STORAGE_STAT			st;
+
+	mBytesSinceSample = 0;
+
+	if (mDirectory->GetVolumeInfo(&info) == B_OK)
+	{
+		mFreeBytes	= info.freeBytes;
+		mCapacity	= info.capacity;
+	}
+
+	if (mDirectory->GetStat(&st) == B_OK) {
+		mModDate = TO_AFP_TIME(st.modified);
+	}
+}
+
+
+/*
+ * SpaceChanged()
+ *
+ * Description:
+ *		bytes were written to the volume. Once enough have been the
+ *		free space we report is too far off to wait for the TTL.
+ *
+ * Returns: none
+ */
+
+void fp_volume::SpaceChanged(off_t bytes)
+{
+	if ((mBytesSinceSample += bytes) >= VOLSPACE_REFRESH_BYTES) {
+		RefreshSpace();
+	}
+}
+
+
+/*
+ * RefreshSpace()
+ *
+ * Description:
+ *
+ * Returns: none
+ */
+
+void fp_volume::RefreshSpace()
+{
+	mBytesSinceSample = 0;
+
+	gAFPVolSpace.Wake(this);
 }
 
 
@@ -149,17 +402,17 @@ void fp_volume::RemoveOpenFile(OPEN_FORK_ITEM* forkitem)
  *
  * Description:
  *		Get the volume parameters as returned in FPOpenVol and
- *		FPGetVolParms.
+ *		FPGetVolParms. Nothing here touches the disk, it is all
+ *		cached or sampled in the background.
  *
  * Returns: AFPERROR
  */
 
 AFPERROR fp_volume::fp_GetVolParms(int16 volBitmap, afp_buffer& afpBuffer)
 {
-	BEntry		entry(mPath->Path());
-	entry_ref	afpVolumeRef;
-	time_t		ctime;
 	int8*		volNamePtr	= NULL;
+	off_t		freeBytes	= mFreeBytes;
+	off_t		capacity	= mCapacity;
 
 	DBGWRITE(dbg_level_trace, "Enter\n");
 
@@ -168,21 +421,9 @@ AFPERROR fp_volume::fp_GetVolParms(int16 volBitmap, afp_buffer& afpBuffer)
 	//
 	afpBuffer.push_num(volBitmap);
 
-	//
-	//Obtain the entry_ref for the Be Volume we're sitting on
-	//so we can obtain information about it.
-	//
-	if (entry.GetRef(&afpVolumeRef) != B_OK)
-	{
-		DBGWRITE(dbg_level_error, "Failed to get ref for afp volume\n");
-		return( afpParmErr );
-	}
-
-	BVolume	volume(afpVolumeRef.device);
-
-	if (volume.InitCheck() != B_OK)
+	if (mDevice == (dev_t)-1)
 	{
-		DBGWRITE(dbg_level_error, "InitCheck() failed for BVolume\n");
+		DBGWRITE(dbg_level_error, "No device for afp volume\n");
 		return( afpParmErr );
 	}
 
@@ -190,6 +431,7 @@ AFPERROR fp_volume::fp_GetVolParms(int16 volBitmap, afp_buffer& afpBuffer)
 	{
 		uint16	volAttributes = (	kFPVolSupportsFileIDs		|
 									kFPVolSupportsUnicodeNames	|
+									kFPVolSupportsCatSearch		|
 									kDefaultPrivsFromParent		|
 									kNoExchangeFiles 			|
 									kSupportsExtAttrs			|
@@ -199,7 +441,7 @@ AFPERROR fp_volume::fp_GetVolParms(int16 volBitmap, afp_buffer& afpBuffer)
 
 		DBGWRITE(dbg_level_trace, "Getting vol kFPVolAttributeBit\n");
 
-		if ((volume.IsReadOnly()) || (mVolumeFlags & kAFPReadOnly)) {
+		if ((mDeviceReadOnly) || (mVolumeFlags & kAFPReadOnly)) {
 
 			volAttributes |= kFPVolReadOnly;
 		}
@@ -214,14 +456,12 @@ AFPERROR fp_volume::fp_GetVolParms(int16 volBitmap, afp_buffer& afpBuffer)
 
 	if (volBitmap & kFPVolCreateDateBit)
 	{
-		entry.GetCreationTime(&ctime);
-		afpBuffer.push_num<uint32>(TO_AFP_TIME(ctime));
+		afpBuffer.push_num<uint32>(mCreateDate);
 	}
 
 	if (volBitmap & kFPVolModDateBit)
 	{
-		entry.GetModificationTime(&ctime);
-		afpBuffer.push_num<uint32>(TO_AFP_TIME(ctime));
+		afpBuffer.push_num<uint32>(mModDate);
 	}
 
 	if (volBitmap & kFPVolBackupDateBit)
@@ -234,24 +474,15 @@ AFPERROR fp_volume::fp_GetVolParms(int16 volBitmap, afp_buffer& afpBuffer)
 		afpBuffer.push_num(mVolumeID);
 	}
 
-	off_t freeBytes = volume.FreeBytes();
-	off_t capacity 	= volume.Capacity();
-
 	if (volBitmap & kFPVolBytesFreeBit)
 	{
 		//
 		//For AFP 2.1 and older clients, we cannot report volume
 		//sizes larger than 4GB.
 		//
-
-		if (freeBytes >= UINT32_MAX)
-		{
-			freeBytes = UINT32_MAX;
-		}
-
 		DBGWRITE(dbg_level_info, "Disk bytes free: %llu\n", freeBytes);
 
-		afpBuffer.push_num<uint32>(freeBytes);
+		afpBuffer.push_num<uint32>(std::min(freeBytes, (off_t)UINT32_MAX));
 	}
 
 	if (volBitmap & kFPVolBytesTotalBit)
@@ -259,16 +490,9 @@ AFPERROR fp_volume::fp_GetVolParms(int16 volBitmap, afp_buffer& afpBuffer)
 		//
 		//The total number of bytes (free + used) on the AFP volume as a uint32.
 		//
-		off_t bytesTotal = freeBytes + (capacity - freeBytes);
-
-		if (bytesTotal > UINT32_MAX)
-		{
-			bytesTotal = UINT32_MAX;
-		}
-
-		DBGWRITE(dbg_level_info, "Disk bytes total: %llu\n", bytesTotal);
+		DBGWRITE(dbg_level_info, "Disk bytes total: %llu\n", capacity);
 
-		afpBuffer.push_num<uint32>(bytesTotal);
+		afpBuffer.push_num<uint32>(std::min(capacity, (off_t)UINT32_MAX));
 	}
 
 	if (volBitmap & kFPVolNameBit)
@@ -305,7 +529,7 @@ AFPERROR fp_volume::fp_GetVolParms(int16 volBitmap, afp_buffer& afpBuffer)
 	{
 		char name[MAX_AFP_NAME];
 
-		strcpy(name, mPath->Leaf());
+		strlcpy(name, mLeaf, sizeof(name));
 
 		*((int16*)volNamePtr) = htons(afpBuffer.GetDataLength()-sizeof(int16));
 		afpBuffer.AddCStringAsPascal(name);
@@ -1,26 +1,30 @@
 #ifndef __fp_volume__
 #define __fp_volume__
 
-#include <Path.h>
-#include <Directory.h>
-#include <BlockCache.h>
+#include "fp_storage.h"
+
+#include <atomic>
 
 #include "afpGlobals.h"
 #include "afp_session.h"
 #include "afp_buffer.h"
+#include "fp_catalog.h"
+#include "fp_iosched.h"
 
 //
 //Server specific flags to keep track of volume options.
 //
 enum
 {
-	kAFPReadOnly	= 0x02
+	kAFPReadOnly	= 0x02,
+	kAFPWriteBehind	= 0x04,		//Coalesce small writes to open data forks
+	kAFPNoBlockCache= 0x08		//Keep this volume out of the shared block cache
 };
 
 class fp_volume
 {
 public:
-						fp_volume(BPath* path, uint32 srvrVolFlags=0);
+						fp_volume(const char* path, int16 volumeID, uint32 srvrVolFlags=0);
 	virtual				~fp_volume();
 		
 	//
@@ -29,28 +33,58 @@ public:
 	//bits in the file's attributes.
 	//
 	virtual void		AddOpenFile(OPEN_FORK_ITEM* forkitem);
-	virtual bool		IsFileOpen(BEntry* entry, int8 fork, uint16* ref=NULL);
+	virtual bool		IsFileOpen(fp_storage_entry* entry, int8 fork, uint16* ref=NULL);
 	virtual void		RemoveOpenFile(OPEN_FORK_ITEM* forkitem);
+	virtual void		InvalidateCachedData(fp_storage_entry* entry);
+	virtual void		FlushWriteBehind(fp_storage_entry* entry);
 	
-	virtual const char*	GetVolumeName() 				{ return(mPath->Leaf()); }
+	virtual const char*	GetVolumeName() 				{ return(mLeaf); }
 	virtual int8		GetVolumeFlags()				{ return(mVolumeFlags); }
 	virtual void		SetVolumeFlags(uint32 flags)	{ mVolumeFlags = flags; }
 	virtual int16		GetVolumeID()					{ return(mVolumeID); }
-	virtual BPath*		GetPath()						{ return(mPath); }
-	virtual BDirectory*	GetDirectory()					{ return(mDirectory); }
+	virtual const char*	GetPath()						{ return(mPath); }
+	virtual fp_storage_dir*	GetDirectory()					{ return(mDirectory); }
 	virtual uint32		GetRootDirID()					{ return(mRootDirID); }
 	virtual uint32		GetParentOfRootID()				{ return(mParentOfRootID); }
-	virtual bool		IsDirty()						{ return(mIsDirty); }
-	virtual void		MakeDirty()			{ mLock.Lock(); mIsDirty = true; mLock.Unlock();}
-	virtual void		MakeClean()			{ mLock.Lock(); mIsDirty = false; mLock.Unlock();}
+	virtual node_ref	GetRootNodeRef()				{ return(mRootRef); }
+	virtual int32		CountOpenFiles()				{ return(mOpenFiles->CountItems()); }
+	
+	//
+	//Forks hold a reference from when they are opened until they and
+	//everything working on them are gone. A volume that is no longer
+	//shared is only freed once the last one is released.
+	//
+	virtual void		AcquireReference()				{ mReferences++; }
+	virtual void		ReleaseReference()				{ mReferences--; }
+	virtual int32		CountReferences()				{ return(mReferences); }
+
+	virtual fp_catalog*	GetCatalog()					{ return(mCatalog); }
+	virtual fp_iosched*	GetIOScheduler()				{ return(mIOSched); }
+	
+	//
+	//Keep the FPCatSearch catalog in step with changes made through AFP.
+	//
+	virtual void		CatalogUpdate(fp_storage_entry* entry);
+	virtual void		CatalogRemove(const node_ref& nodeRef, ino_t parent);
+	virtual void		CatalogDirectoryChanged(ino_t directory);
+	
+	//
+	//Free space comes from fp_volspace, which samples it in the
+	//background. Writes report how much they wrote, anything that
+	//may free a lot of space at once asks for a new sample.
+	//
+	virtual void		SampleSpace();
+	virtual void		SpaceChanged(off_t bytes);
+	virtual void		RefreshSpace();
 	
 	virtual AFPERROR	fp_GetVolParms(int16 volBitmap, afp_buffer& afpBuffer);
 	virtual AFPERROR 	fp_OpenVolume(afp_session* session);
 	virtual AFPERROR	fp_CloseVolume(afp_session* session);
 	
 private:
-		BPath*			mPath;
-		BDirectory*		mDirectory;
+		char			mPath[B_PATH_NAME_LENGTH];
+		const char*		mLeaf;
+		fp_storage_dir*	mDirectory;
 		char			mVolumeName[MAX_VOLNAME_LEN+1];
 		int16			mOpenedRefCount;
 		int16			mVolumeID;
@@ -58,11 +92,28 @@ private:
 		
 		uint32			mRootDirID;
 		uint32			mParentOfRootID;
-		
-		bool			mIsDirty;
+		node_ref		mRootRef;
 		
 		BList*			mOpenFiles;
 		BLocker			mLock;
+		int32			mWriteBehindForks;
+		std::atomic<int32>	mReferences;
+		
+		fp_catalog*		mCatalog;
+		fp_iosched*		mIOSched;
+		
+		//
+		//FPGetVolParms is answered from here. The attributes and
+		//creation date don't change while the volume is shared.
+		//
+		dev_t			mDevice;
+		bool			mDeviceReadOnly;
+		uint32			mCreateDate;
+		
+		std::atomic<uint32>	mModDate;
+		std::atomic<int64>	mFreeBytes;
+		std::atomic<int64>	mCapacity;
+		std::atomic<int64>	mBytesSinceSample;
 };
 
 #endif //__fp_volume__
@@ -0,0 +1,491 @@
+#include <string.h>
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#include "debug.h"
+#include "fp_volume.h"
+#include "fp_writebehind.h"
+
+//
+//Every fork with write behind enabled is on this list so the flusher
+//thread can put data that has been sitting too long on disk.
+//
+static std::mutex					sListLock;
+static std::vector<fp_writebehind*>	sForks;
+static thread_id					sFlusher	= -1;
+
+/*
+ * fp_writebehind()
+ *
+ * Description:
+ *		Coalesces the small sequential writes older clients make into
+ *		large writes to the filesystem. The buffer isn't allocated
+ *		until the first write.
+ *
+ * Returns:
+ */
+
+fp_writebehind::fp_writebehind(fp_storage_node* file, fp_volume* volume, fp_storage_entry* entry)
+{
+	mFile		= file;
+	mVolume		= volume;
+	mEntry		= entry;
+	mStart		= 0;
+	mLength		= 0;
+	mDirtySince	= 0;
+	mError		= AFP_OK;
+	mWrites		= 0;
+	mFlushes	= 0;
+	mFlushing	= false;
+	mReferences	= 0;
+
+	std::lock_guard<std::mutex> lock(sListLock);
+
+	sForks.push_back(this);
+
+	if (sFlusher < 0)
+	{
+		sFlusher = spawn_thread(
+					FlusherThread,
+					"afp_writebehind",
+					B_LOW_PRIORITY,
+					NULL
+					);
+
+		if (sFlusher >= 0) {
+
+			resume_thread(sFlusher);
+		}
+		else {
+
+			DBGWRITE(dbg_level_error, "Failed to spawn write behind thread!\n");
+		}
+	}
+}
+
+
+/*
+ * ~fp_writebehind()
+ *
+ * Description:
+ *		The owner should have called Flush() to get any error, this
+ *		is just so nothing is ever lost. Waits for anyone still
+ *		flushing us on a reader's behalf.
+ *
+ * Returns:
+ */
+
+fp_writebehind::~fp_writebehind()
+{
+	{
+		std::lock_guard<std::mutex> lock(sListLock);
+
+		sForks.erase(std::remove(sForks.begin(), sForks.end(), this), sForks.end());
+	}
+
+	std::unique_lock<std::mutex> lock(mMutex);
+
+	mIdle.wait(lock, [this]() { return( (mReferences == 0) && (!mFlushing) ); });
+
+	if (mLength > 0) {
+		WriteOut(mLength);
+	}
+}
+
+
+/*
+ * Write()
+ *
+ * Description:
+ *		Add count bytes at offset to the buffer. A write that doesn't
+ *		continue where the buffered data ends pushes what we have out
+ *		first. When the buffer fills we write up to the last aligned
+ *		boundary and keep the rest.
+ *
+ *		An error from an earlier background flush is returned here
+ *		and the write isn't done.
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR fp_writebehind::Write(off_t offset, const void* data, size_t count)
+{
+	const int8*		src			= (const int8*)data;
+	AFPERROR		afpError	= AFP_OK;
+	bool			flushed		= false;
+
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+
+		WaitForFlush(lock);
+
+		if (mError != AFP_OK)
+		{
+			afpError	= mError;
+			mError		= AFP_OK;
+
+			return( afpError );
+		}
+
+		if (mBuffer == nullptr)
+		{
+			mBuffer.reset(new (std::nothrow) int8[WRITEBEHIND_BUFFER_SIZE]);
+
+			if (mBuffer == nullptr)
+			{
+				ssize_t	result = mFile->WriteAt(offset, data, count);
+
+				return( (result == (ssize_t)count) ? AFP_OK :
+						(result == B_DEVICE_FULL) ? afpDiskFull : afpMiscErr );
+			}
+		}
+
+		if ((mLength > 0) && (offset != mStart + (off_t)mLength))
+		{
+			afpError	= WriteOut(mLength);
+			flushed		= true;
+		}
+
+		if (mLength == 0)
+		{
+			mStart		= offset;
+			mDirtySince	= system_time();
+		}
+
+		while((AFP_SUCCESS(afpError)) && (count > 0))
+		{
+			if (mLength == WRITEBEHIND_BUFFER_SIZE)
+			{
+				off_t	end		= (mStart + mLength) & ~((off_t)WRITEBEHIND_ALIGN - 1);
+				size_t	length	= (end > mStart) ? (size_t)(end - mStart) : mLength;
+
+				afpError	= WriteOut(length);
+				flushed		= true;
+
+				if (mLength == 0)
+				{
+					mStart		= offset + (src - (const int8*)data);
+					mDirtySince	= system_time();
+				}
+
+				continue;
+			}
+
+			size_t	n = std::min(count, (size_t)WRITEBEHIND_BUFFER_SIZE - mLength);
+
+			memcpy(mBuffer.get() + mLength, src, n);
+
+			mLength	+= n;
+			src		+= n;
+			count	-= n;
+		}
+
+		mWrites++;
+	}
+
+	if (flushed) {
+		mVolume->InvalidateCachedData(mEntry);
+	}
+
+	return( afpError );
+}
+
+
+/*
+ * Flush()
+ *
+ * Description:
+ *		Put everything that's buffered on disk. If deferError is set
+ *		we're flushing on someone else's behalf (a reader, a lock) and
+ *		an error is saved for the next call on this fork instead. In
+ *		that case the buffer is swapped out and written without mMutex
+ *		held, so the owner isn't held up by the write.
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR fp_writebehind::Flush(bool deferError)
+{
+	AFPERROR	afpError	= AFP_OK;
+	bool		flushed		= false;
+
+	if (deferError)
+	{
+		std::unique_ptr<int8[]>	data;
+		off_t					start	= 0;
+		size_t					length	= 0;
+
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+
+			WaitForFlush(lock);
+
+			if (mLength == 0) {
+				return( AFP_OK );
+			}
+
+			data		= std::move(mBuffer);
+			start		= mStart;
+			length		= mLength;
+			mLength		= 0;
+			mFlushing	= true;
+			mFlushes++;
+		}
+
+		afpError = WriteAt(start, data.get(), length);
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+
+			if ((AFP_FAILURE(afpError)) && (mError == AFP_OK)) {
+				mError = afpError;
+			}
+
+			if (mBuffer == nullptr) {
+				mBuffer = std::move(data);
+			}
+
+			//
+			//Notified with mMutex held, once it's dropped the
+			//destructor may already be done with us.
+			//
+			mFlushing = false;
+			mIdle.notify_all();
+		}
+
+		mVolume->InvalidateCachedData(mEntry);
+
+		return( AFP_OK );
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+
+		WaitForFlush(lock);
+
+		if (mLength > 0)
+		{
+			afpError	= WriteOut(mLength);
+			flushed		= true;
+		}
+
+		if (mError != AFP_OK)
+		{
+			afpError	= mError;
+			mError		= AFP_OK;
+		}
+	}
+
+	if (flushed) {
+		mVolume->InvalidateCachedData(mEntry);
+	}
+
+	return( afpError );
+}
+
+
+/*
+ * AcquireReference()/ReleaseReference()
+ *
+ * Description:
+ *		Keep the fork from being destroyed until the reference is
+ *		released.
+ *
+ * Returns: none
+ */
+
+void fp_writebehind::AcquireReference()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	mReferences++;
+}
+
+
+void fp_writebehind::ReleaseReference()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	mReferences--;
+	mIdle.notify_all();
+}
+
+
+/*
+ * WriteAt()
+ *
+ * Description:
+ *		Write length bytes of data to the file at offset.
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR fp_writebehind::WriteAt(off_t offset, const int8* data, size_t length)
+{
+	ssize_t		result = mFile->WriteAt(offset, data, length);
+
+	if (result != (ssize_t)length)
+	{
+		DBGWRITE(dbg_level_error, "Write behind failed at %lld (%ld)\n", offset, result);
+
+		return( ((result >= 0) || (result == B_DEVICE_FULL)) ? afpDiskFull : afpMiscErr );
+	}
+
+	return( AFP_OK );
+}
+
+
+/*
+ * WriteOut()
+ *
+ * Description:
+ *		Write the first length bytes of the buffer to the file and
+ *		slide the rest down. On failure the buffered data is dropped
+ *		so we don't keep retrying it. mMutex must be held and no
+ *		swapped out flush may be in progress.
+ *
+ * Returns: AFPERROR
+ */
+
+AFPERROR fp_writebehind::WriteOut(size_t length)
+{
+	AFPERROR	afpError = WriteAt(mStart, mBuffer.get(), length);
+
+	mFlushes++;
+
+	if (AFP_FAILURE(afpError))
+	{
+		mLength = 0;
+
+		return( afpError );
+	}
+
+	memmove(mBuffer.get(), mBuffer.get() + length, mLength - length);
+
+	mStart	+= length;
+	mLength	-= length;
+
+	return( AFP_OK );
+}
+
+
+/*
+ * WaitForFlush()
+ *
+ * Description:
+ *		Wait for a flush done on someone else's behalf to finish, so
+ *		what we write next can't land on disk before it. lock must
+ *		hold mMutex.
+ *
+ * Returns: none
+ */
+
+void fp_writebehind::WaitForFlush(std::unique_lock<std::mutex>& lock)
+{
+	mIdle.wait(lock, [this]() { return( !mFlushing ); });
+}
+
+
+/*
+ * FlushIfOld()
+ *
+ * Description:
+ *		Called by the flusher thread. Writes out the buffer if it has
+ *		been holding data longer than WRITEBEHIND_MAX_AGE. We wait our
+ *		turn on the volume's I/O scheduler like a client would, without
+ *		mMutex held so the owner isn't stuck behind the wait. The write
+ *		itself is done under mMutex.
+ *
+ * Returns: true if anything was written
+ */
+
+bool fp_writebehind::FlushIfOld(bigtime_t now)
+{
+	fp_iosched*	ioSched	= mVolume->GetIOScheduler();
+	size_t		length	= 0;
+	bool		flushed	= false;
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+
+		if ((mLength == 0) || (now - mDirtySince < WRITEBEHIND_MAX_AGE)) {
+			return( false );
+		}
+
+		length = mLength;
+	}
+
+	ioSched->Begin(NULL, length);
+
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+
+		WaitForFlush(lock);
+
+		//
+		//The owner may have written it out while we waited.
+		//
+		if ((mLength > 0) && (now - mDirtySince >= WRITEBEHIND_MAX_AGE))
+		{
+			AFPERROR	afpError = WriteOut(mLength);
+
+			if ((AFP_FAILURE(afpError)) && (mError == AFP_OK)) {
+				mError = afpError;
+			}
+
+			flushed = true;
+		}
+	}
+
+	ioSched->End();
+
+	return( flushed );
+}
+
+
+/*
+ * FlusherThread()
+ *
+ * Description:
+ *		Makes sure nothing sits in a write behind buffer for long.
+ *		The forks are referenced under sListLock and flushed after
+ *		it's dropped, so opening and closing forks doesn't wait on
+ *		the disk.
+ *
+ * Returns: B_OK
+ */
+
+status_t fp_writebehind::FlusherThread(void*)
+{
+	std::vector<fp_writebehind*>	forks;
+
+	for (;;)
+	{
+		snooze(WRITEBEHIND_MAX_AGE / 4);
+
+		{
+			std::lock_guard<std::mutex> lock(sListLock);
+
+			forks = sForks;
+
+			for (fp_writebehind* fork : forks) {
+				fork->AcquireReference();
+			}
+		}
+
+		bigtime_t	now = system_time();
+
+		for (fp_writebehind* fork : forks)
+		{
+			if (fork->FlushIfOld(now)) {
+				fork->mVolume->InvalidateCachedData(fork->mEntry);
+			}
+
+			fork->ReleaseReference();
+		}
+	}
+
+	return( B_OK );
+}
@@ -0,0 +1,90 @@
+#ifndef __fp_writebehind__
+#define __fp_writebehind__
+
+#include "fp_storage.h"
+#include "afp_os.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+#include "afp.h"
+
+class fp_volume;
+
+//
+//Size of the per-fork buffer. When it fills, everything up to the
+//last WRITEBEHIND_ALIGN boundary goes to disk in one write.
+//
+#define WRITEBEHIND_BUFFER_SIZE		(256 * 1024)
+#define WRITEBEHIND_ALIGN			(64 * 1024)
+
+//
+//How long (in microseconds) written data may sit in the buffer
+//before the flusher thread puts it on disk.
+//
+#define WRITEBEHIND_MAX_AGE			1000000
+
+
+class fp_writebehind
+{
+public:
+						fp_writebehind(fp_storage_node* file, fp_volume* volume, fp_storage_entry* entry);
+	virtual				~fp_writebehind();
+
+	virtual AFPERROR	Write(off_t offset, const void* data, size_t count);
+	virtual AFPERROR	Flush(bool deferError=false);
+
+	//
+	//fp_volume::FlushWriteBehind() finds forks under the volume's lock
+	//and flushes them after dropping it. It holds a reference in
+	//between so the fork can't be closed under it.
+	//
+	virtual void		AcquireReference();
+	virtual void		ReleaseReference();
+
+	virtual int64		GetWrites()		{ return mWrites;	}
+	virtual int64		GetFlushes()	{ return mFlushes;	}
+
+private:
+
+	AFPERROR			WriteAt(off_t offset, const int8* data, size_t length);
+	AFPERROR			WriteOut(size_t length);
+	void				WaitForFlush(std::unique_lock<std::mutex>& lock);
+	bool				FlushIfOld(bigtime_t now);
+
+	static status_t		FlusherThread(void* data);
+
+	fp_storage_node*	mFile;
+	fp_volume*			mVolume;
+	fp_storage_entry*	mEntry;
+
+	//
+	//Buffered data for [mStart, mStart + mLength), not yet on disk.
+	//
+	std::mutex			mMutex;
+	std::unique_ptr<int8[]>	mBuffer;
+	off_t				mStart;
+	size_t				mLength;
+	bigtime_t			mDirtySince;
+
+	//
+	//A flush on someone else's behalf swaps the buffer out and writes
+	//it without mMutex, so the owner can keep buffering. Anything that
+	//would write or drop data waits on mIdle for it to finish first.
+	//
+	std::condition_variable	mIdle;
+	bool				mFlushing;
+	int32				mReferences;
+
+	//
+	//A flush done by the flusher thread has nobody to report to. The
+	//error is held here and returned by the next call on this fork.
+	//
+	AFPERROR			mError;
+
+	int64				mWrites;
+	int64				mFlushes;
+};
+
+#endif //__fp_writebehind__
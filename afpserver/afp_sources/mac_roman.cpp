@@ -0,0 +1,449 @@
+#include <string.h>
+
+#include <algorithm>
+
+#include "mac_roman.h"
+
+//
+//Unicode code points for the upper half of the Mac Roman character
+//set (Apple's ROMAN.TXT). The lower half is plain ASCII.
+//
+static const uint16 kMacRomanToUnicode[128] =
+{
+	0x00C4, 0x00C5, 0x00C7, 0x00C9, 0x00D1, 0x00D6, 0x00DC, 0x00E1,	//0x80
+	0x00E0, 0x00E2, 0x00E4, 0x00E3, 0x00E5, 0x00E7, 0x00E9, 0x00E8,	//0x88
+	0x00EA, 0x00EB, 0x00ED, 0x00EC, 0x00EE, 0x00EF, 0x00F1, 0x00F3,	//0x90
+	0x00F2, 0x00F4, 0x00F6, 0x00F5, 0x00FA, 0x00F9, 0x00FB, 0x00FC,	//0x98
+	0x2020, 0x00B0, 0x00A2, 0x00A3, 0x00A7, 0x2022, 0x00B6, 0x00DF,	//0xA0
+	0x00AE, 0x00A9, 0x2122, 0x00B4, 0x00A8, 0x2260, 0x00C6, 0x00D8,	//0xA8
+	0x221E, 0x00B1, 0x2264, 0x2265, 0x00A5, 0x00B5, 0x2202, 0x2211,	//0xB0
+	0x220F, 0x03C0, 0x222B, 0x00AA, 0x00BA, 0x03A9, 0x00E6, 0x00F8,	//0xB8
+	0x00BF, 0x00A1, 0x00AC, 0x221A, 0x0192, 0x2248, 0x2206, 0x00AB,	//0xC0
+	0x00BB, 0x2026, 0x00A0, 0x00C0, 0x00C3, 0x00D5, 0x0152, 0x0153,	//0xC8
+	0x2013, 0x2014, 0x201C, 0x201D, 0x2018, 0x2019, 0x00F7, 0x25CA,	//0xD0
+	0x00FF, 0x0178, 0x2044, 0x20AC, 0x2039, 0x203A, 0xFB01, 0xFB02,	//0xD8
+	0x2021, 0x00B7, 0x201A, 0x201E, 0x2030, 0x00C2, 0x00CA, 0x00C1,	//0xE0
+	0x00CB, 0x00C8, 0x00CD, 0x00CE, 0x00CF, 0x00CC, 0x00D3, 0x00D4,	//0xE8
+	0xF8FF, 0x00D2, 0x00DA, 0x00DB, 0x00D9, 0x0131, 0x02C6, 0x02DC,	//0xF0
+	0x00AF, 0x02D8, 0x02D9, 0x02DA, 0x00B8, 0x02DD, 0x02DB, 0x02C7	//0xF8
+};
+
+//
+//What a character with no Mac Roman equivalent becomes, as it did when
+//we converted with convert_from_utf8().
+//
+static const uchar kSubstituteChar = '?';
+
+//
+//Mac OS X sends names decomposed, an accented letter is the letter
+//followed by a combining mark. These are the pairs that make up a
+//precomposed character Mac Roman has.
+//
+typedef struct
+{
+	uint16	base;
+	uint16	mark;
+	uint16	composed;
+}UNICODE_COMPOSITION;
+
+static const UNICODE_COMPOSITION kCompositions[] =
+{
+	{ 'A', 0x0300, 0x00C0 }, { 'A', 0x0301, 0x00C1 }, { 'A', 0x0302, 0x00C2 },
+	{ 'A', 0x0303, 0x00C3 }, { 'A', 0x0308, 0x00C4 }, { 'A', 0x030A, 0x00C5 },
+	{ 'C', 0x0327, 0x00C7 },
+	{ 'E', 0x0300, 0x00C8 }, { 'E', 0x0301, 0x00C9 }, { 'E', 0x0302, 0x00CA },
+	{ 'E', 0x0308, 0x00CB },
+	{ 'I', 0x0300, 0x00CC }, { 'I', 0x0301, 0x00CD }, { 'I', 0x0302, 0x00CE },
+	{ 'I', 0x0308, 0x00CF },
+	{ 'N', 0x0303, 0x00D1 },
+	{ 'O', 0x0300, 0x00D2 }, { 'O', 0x0301, 0x00D3 }, { 'O', 0x0302, 0x00D4 },
+	{ 'O', 0x0303, 0x00D5 }, { 'O', 0x0308, 0x00D6 },
+	{ 'U', 0x0300, 0x00D9 }, { 'U', 0x0301, 0x00DA }, { 'U', 0x0302, 0x00DB },
+	{ 'U', 0x0308, 0x00DC },
+	{ 'Y', 0x0308, 0x0178 },
+	{ 'a', 0x0300, 0x00E0 }, { 'a', 0x0301, 0x00E1 }, { 'a', 0x0302, 0x00E2 },
+	{ 'a', 0x0303, 0x00E3 }, { 'a', 0x0308, 0x00E4 }, { 'a', 0x030A, 0x00E5 },
+	{ 'c', 0x0327, 0x00E7 },
+	{ 'e', 0x0300, 0x00E8 }, { 'e', 0x0301, 0x00E9 }, { 'e', 0x0302, 0x00EA },
+	{ 'e', 0x0308, 0x00EB },
+	{ 'i', 0x0300, 0x00EC }, { 'i', 0x0301, 0x00ED }, { 'i', 0x0302, 0x00EE },
+	{ 'i', 0x0308, 0x00EF },
+	{ 'n', 0x0303, 0x00F1 },
+	{ 'o', 0x0300, 0x00F2 }, { 'o', 0x0301, 0x00F3 }, { 'o', 0x0302, 0x00F4 },
+	{ 'o', 0x0303, 0x00F5 }, { 'o', 0x0308, 0x00F6 },
+	{ 'u', 0x0300, 0x00F9 }, { 'u', 0x0301, 0x00FA }, { 'u', 0x0302, 0x00FB },
+	{ 'u', 0x0308, 0x00FC },
+	{ 'y', 0x0308, 0x00FF }
+};
+
+static inline bool IsCombiningMark(uint32 unicode)
+{
+	return( (unicode >= 0x0300) && (unicode <= 0x036F) );
+}
+
+typedef struct
+{
+	uint8	length;
+	char	bytes[3];
+}MAC_ROMAN_UTF8;
+
+typedef struct
+{
+	uint16	unicode;
+	uchar	macRoman;
+}UNICODE_MAC_ROMAN;
+
+//
+//The tables we actually convert with are derived once from the one
+//above: the UTF-8 byte sequence for each high Mac Roman character,
+//and the reverse mapping sorted by code point for a binary search.
+//
+class mac_roman_tables
+{
+public:
+	mac_roman_tables()
+	{
+		for (int32 i = 0; i < 128; i++)
+		{
+			uint16	unicode = kMacRomanToUnicode[i];
+
+			if (unicode < 0x800)
+			{
+				toUTF8[i].length	= 2;
+				toUTF8[i].bytes[0]	= (char)(0xC0 | (unicode >> 6));
+				toUTF8[i].bytes[1]	= (char)(0x80 | (unicode & 0x3F));
+			}
+			else
+			{
+				toUTF8[i].length	= 3;
+				toUTF8[i].bytes[0]	= (char)(0xE0 | (unicode >> 12));
+				toUTF8[i].bytes[1]	= (char)(0x80 | ((unicode >> 6) & 0x3F));
+				toUTF8[i].bytes[2]	= (char)(0x80 | (unicode & 0x3F));
+			}
+
+			fromUnicode[i].unicode	= unicode;
+			fromUnicode[i].macRoman	= (uchar)(0x80 + i);
+		}
+
+		std::sort(
+			fromUnicode,
+			fromUnicode + 128,
+			[](const UNICODE_MAC_ROMAN& a, const UNICODE_MAC_ROMAN& b)
+			{
+				return( a.unicode < b.unicode );
+			});
+	}
+
+	bool Lookup(uint32 unicode, uchar* macRoman) const
+	{
+		const UNICODE_MAC_ROMAN*	found;
+
+		found = std::lower_bound(
+					fromUnicode,
+					fromUnicode + 128,
+					unicode,
+					[](const UNICODE_MAC_ROMAN& a, uint32 b)
+					{
+						return( a.unicode < b );
+					});
+
+		if ((found != fromUnicode + 128) && (found->unicode == unicode))
+		{
+			*macRoman = found->macRoman;
+			return( true );
+		}
+
+		return( false );
+	}
+
+	MAC_ROMAN_UTF8		toUTF8[128];
+	UNICODE_MAC_ROMAN	fromUnicode[128];
+};
+
+static const mac_roman_tables& Tables()
+{
+	static const mac_roman_tables	tables;
+
+	return( tables );
+}
+
+//
+//Word at a time helpers for the ASCII fast path. ZeroByteIn() is
+//non-zero if any of the 8 bytes in the word is zero.
+//
+static const uint64 kLowBits	= 0x0101010101010101ULL;
+static const uint64 kHighBits	= 0x8080808080808080ULL;
+
+static inline uint64 ZeroByteIn(uint64 word)
+{
+	return( (word - kLowBits) & ~word & kHighBits );
+}
+
+static inline bool NeedsSlowPath(uint64 word, bool isPath)
+{
+	if (word & kHighBits) {
+		return( true );
+	}
+
+	if (isPath)
+	{
+		return(
+			ZeroByteIn(word ^ (kLowBits * '/')) ||
+			ZeroByteIn(word ^ (kLowBits * ':'))
+			);
+	}
+
+	return( false );
+}
+
+
+/*
+ * MacRomanToUTF8()
+ *
+ * Description:
+ *		Convert a Mac Roman string to UTF-8. Runs of plain ASCII are
+ *		copied 8 bytes at a time, everything else comes out of the
+ *		precomputed UTF-8 table.
+ *
+ *		If isPath is set, REPLACE_SLASH_CHAR goes back to a '/'.
+ *
+ * Returns: B_OK or B_NAME_TOO_LONG if dest is too small
+ */
+
+status_t MacRomanToUTF8(
+	const char*		src,
+	int32			srcLen,
+	char*			dest,
+	int32*			destLen,
+	bool			isPath
+	)
+{
+	const mac_roman_tables&	tables	= Tables();
+	const uchar*			s		= (const uchar*)src;
+	const uchar*			sEnd	= s + srcLen;
+	char*					d		= dest;
+	char*					dEnd	= dest + *destLen;
+
+	while (s < sEnd)
+	{
+		//
+		//Fast path: copy whole words while they're pure ASCII. There
+		//is nothing to substitute in ASCII going this direction.
+		//
+		while ((sEnd - s >= 8) && (dEnd - d >= 8))
+		{
+			uint64	word;
+
+			memcpy(&word, s, sizeof(word));
+
+			if (word & kHighBits) {
+				break;
+			}
+
+			memcpy(d, &word, sizeof(word));
+			s += 8;
+			d += 8;
+		}
+
+		if (s >= sEnd) {
+			break;
+		}
+
+		uchar	c = *s++;
+
+		if (c < 0x80)
+		{
+			if (d >= dEnd) {
+				return( B_NAME_TOO_LONG );
+			}
+
+			*d++ = (char)c;
+		}
+		else if ((isPath) && (c == REPLACE_SLASH_CHAR))
+		{
+			if (d >= dEnd) {
+				return( B_NAME_TOO_LONG );
+			}
+
+			*d++ = '/';
+		}
+		else
+		{
+			const MAC_ROMAN_UTF8&	utf8 = tables.toUTF8[c - 0x80];
+
+			if (dEnd - d < utf8.length) {
+				return( B_NAME_TOO_LONG );
+			}
+
+			memcpy(d, utf8.bytes, utf8.length);
+			d += utf8.length;
+		}
+	}
+
+	*destLen = d - dest;
+
+	return( B_OK );
+}
+
+
+/*
+ * UTF8ToMacRoman()
+ *
+ * Description:
+ *		Convert a UTF-8 string to Mac Roman. As above, ASCII runs are
+ *		copied a word at a time; other characters are decoded and
+ *		looked up in the sorted reverse table.
+ *
+ *		A combining mark is folded into the character before it when
+ *		Mac Roman has the pair precomposed (e + U+0301 is 0x8E). Any
+ *		character still without a Mac Roman equivalent, including
+ *		everything outside the BMP, becomes kSubstituteChar.
+ *
+ *		If isPath is set, a '/' becomes REPLACE_SLASH_CHAR and the Mac
+ *		':' separator becomes a '/'.
+ *
+ * Returns: B_OK, B_NAME_TOO_LONG if dest is too small or B_BAD_VALUE
+ *			if the string isn't well formed UTF-8.
+ */
+
+status_t UTF8ToMacRoman(
+	const char*		src,
+	int32			srcLen,
+	char*			dest,
+	int32*			destLen,
+	bool			isPath
+	)
+{
+	const mac_roman_tables&	tables	= Tables();
+	const uchar*			s		= (const uchar*)src;
+	const uchar*			sEnd	= s + srcLen;
+	char*					d		= dest;
+	char*					dEnd	= dest + *destLen;
+
+	while (s < sEnd)
+	{
+		while ((sEnd - s >= 8) && (dEnd - d >= 8))
+		{
+			uint64	word;
+
+			memcpy(&word, s, sizeof(word));
+
+			if (NeedsSlowPath(word, isPath)) {
+				break;
+			}
+
+			memcpy(d, &word, sizeof(word));
+			s += 8;
+			d += 8;
+		}
+
+		if (s >= sEnd) {
+			break;
+		}
+
+		uchar	c = *s++;
+
+		if (c < 0x80)
+		{
+			if (d >= dEnd) {
+				return( B_NAME_TOO_LONG );
+			}
+
+			if (isPath)
+			{
+				switch(c)
+				{
+					case '/': c = REPLACE_SLASH_CHAR; break;
+					case ':': c = '/'; break;
+
+					default:
+						break;
+				}
+			}
+
+			*d++ = (char)c;
+			continue;
+		}
+
+		//
+		//Decode the multibyte sequence.
+		//
+		uint32	unicode;
+		int32	extra;
+
+		if ((c & 0xE0) == 0xC0)
+		{
+			unicode	= c & 0x1F;
+			extra	= 1;
+		}
+		else if ((c & 0xF0) == 0xE0)
+		{
+			unicode	= c & 0x0F;
+			extra	= 2;
+		}
+		else if ((c & 0xF8) == 0xF0)
+		{
+			unicode	= c & 0x07;
+			extra	= 3;
+		}
+		else
+		{
+			return( B_BAD_VALUE );
+		}
+
+		if (sEnd - s < extra) {
+			return( B_BAD_VALUE );
+		}
+
+		for (int32 i = 0; i < extra; i++)
+		{
+			if ((s[i] & 0xC0) != 0x80) {
+				return( B_BAD_VALUE );
+			}
+
+			unicode = (unicode << 6) | (s[i] & 0x3F);
+		}
+
+		s += extra;
+
+		//
+		//A mark replaces the character it follows if the two make one
+		//Mac Roman has, the letter may have come through the fast path.
+		//
+		if ((IsCombiningMark(unicode)) && (d > dest))
+		{
+			uchar	previous	= (uchar)d[-1];
+			uint32	base		= (previous < 0x80) ? previous : kMacRomanToUnicode[previous - 0x80];
+			bool	composed	= false;
+
+			for (const UNICODE_COMPOSITION& pair : kCompositions)
+			{
+				if ((pair.base == base) && (pair.mark == unicode))
+				{
+					composed = tables.Lookup(pair.composed, &c);
+					break;
+				}
+			}
+
+			if (composed)
+			{
+				d[-1] = (char)c;
+				continue;
+			}
+		}
+
+		if (d >= dEnd) {
+			return( B_NAME_TOO_LONG );
+		}
+
+		if (!tables.Lookup(unicode, &c)) {
+			c = kSubstituteChar;
+		}
+
+		*d++ = (char)c;
+	}
+
+	*destLen = d - dest;
+
+	return( B_OK );
+}
@@ -0,0 +1,37 @@
+#ifndef __mac_roman__
+#define __mac_roman__
+
+#include "afp_os.h"
+
+//
+//On disk, a '/' in a Mac filename is stored as this character since
+//it is the path separator in Be land.
+//
+constexpr uchar REPLACE_SLASH_CHAR = 0xb6; //'∂';
+
+//
+//Table driven conversion between the Mac Roman names we keep on disk
+//and the UTF-8 names AFP 3.x clients send over the wire. Both calls
+//take the size of dest in destLen and return the number of bytes
+//written there. No null terminator is added.
+//
+//When isPath is true the '/' <-> REPLACE_SLASH_CHAR and ':' -> '/'
+//path substitutions are done as part of the same pass.
+//
+status_t MacRomanToUTF8(
+				const char*		src,
+				int32			srcLen,
+				char*			dest,
+				int32*			destLen,
+				bool			isPath
+				);
+
+status_t UTF8ToMacRoman(
+				const char*		src,
+				int32			srcLen,
+				char*			dest,
+				int32*			destLen,
+				bool			isPath
+				);
+
+#endif //__mac_roman__